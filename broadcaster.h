@@ -0,0 +1,205 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Building blocks for pushing seat changes to
+// subscribed clients. seatChangeLog collects the
+// seats sold since the last broadcast tick, so many
+// purchases of one tick go out as one message.
+// outQueue holds bytes a client socket could not
+// take yet, so no thread ever blocks on a slow client.
+// ==============================
+
+#ifndef BROADCASTER_H
+#define BROADCASTER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "bufpool.h"
+
+// Seats changed since the last tick. A seat appears in the
+// list at most once per tick no matter how often it changes.
+typedef struct seatChangeLog_
+{
+    int cols;
+    int numSeats;
+    unsigned char* dirty; // 1 if the seat is already in changed
+    int* changed;         // Seat indexes (row * cols + col)
+    int numChanged;
+    pthread_mutex_t mutex;
+} seatChangeLog;
+
+// Allocates a change log for a rows x cols seat map. Returns 0 on success.
+int initSeatChangeLog(seatChangeLog* log, int rows, int cols)
+{
+    log->cols = cols;
+    log->numSeats = rows * cols;
+    log->dirty = calloc(log->numSeats, 1);
+    log->changed = malloc(sizeof(int) * log->numSeats);
+    log->numChanged = 0;
+    pthread_mutex_init(&(log->mutex), NULL);
+
+    return (log->dirty == NULL || log->changed == NULL);
+}
+
+// Frees the change log's arrays
+void freeSeatChangeLog(seatChangeLog* log)
+{
+    free(log->dirty);
+    free(log->changed);
+    log->dirty = NULL;
+    log->changed = NULL;
+    pthread_mutex_destroy(&(log->mutex));
+}
+
+// Records that a seat changed. O(1), never blocks on I/O.
+void recordSeatChange(seatChangeLog* log, int row, int col)
+{
+    int seat = row * log->cols + col;
+    if (seat < 0 || seat >= log->numSeats) return;
+
+    pthread_mutex_lock(&(log->mutex));
+    if (!log->dirty[seat])
+    {
+        log->dirty[seat] = 1;
+        log->changed[log->numChanged++] = seat;
+    }
+    pthread_mutex_unlock(&(log->mutex));
+}
+
+// Moves up to maxSeats changed seats into seats and clears them from
+// the log. Returns the number of seats copied.
+int takeSeatChanges(seatChangeLog* log, int* seats, int maxSeats)
+{
+    pthread_mutex_lock(&(log->mutex));
+
+    int count = (log->numChanged < maxSeats) ? log->numChanged : maxSeats;
+    for (int i = 0; i < count; i++)
+    {
+        seats[i] = log->changed[log->numChanged - 1 - i];
+        log->dirty[seats[i]] = 0;
+    }
+    log->numChanged -= count;
+
+    pthread_mutex_unlock(&(log->mutex));
+    return count;
+}
+
+// Bytes waiting to be written to one client socket. The first buffer
+// is borrowed from pool and the memory goes back once the queue is
+// empty, so idle clients hold none.
+typedef struct outQueue_
+{
+    char* data;
+    int length;
+    int capacity;
+    bufPool* pool; // NULL = always malloc
+    int pooled;    // data was borrowed from pool
+} outQueue;
+
+// Gives the queue's memory back once everything has been sent
+void releaseIdleOutQueue(outQueue* queue)
+{
+    if (queue->length > 0 || queue->data == NULL) return;
+
+    if (queue->pooled) bufPoolPut(queue->pool, queue->data);
+    else free(queue->data);
+
+    queue->data = NULL;
+    queue->capacity = 0;
+    queue->pooled = 0;
+}
+
+// Appends bytes to the queue, refusing to grow past maxLength.
+// Returns 0 on success, or 1 if the queue is full.
+int appendOutQueue(outQueue* queue, const char* data, int length, int maxLength)
+{
+    if (queue->length + length > maxLength) return 1;
+
+    if (queue->data == NULL && queue->pool != NULL && length <= queue->pool->bufSize)
+    {
+        queue->data = bufPoolGet(queue->pool);
+        queue->capacity = (queue->data != NULL) ? queue->pool->bufSize : 0;
+        queue->pooled = (queue->data != NULL);
+    }
+
+    if (queue->length + length > queue->capacity)
+    {
+        int capacity = queue->capacity ? queue->capacity * 2 : 1024;
+        while (capacity < queue->length + length) capacity *= 2;
+
+        // Pooled buffers have a fixed size, move out of them to grow
+        char* grown = queue->pooled ? malloc(capacity) : realloc(queue->data, capacity);
+        if (grown == NULL) return 1;
+        if (queue->pooled)
+        {
+            memcpy(grown, queue->data, queue->length);
+            bufPoolPut(queue->pool, queue->data);
+            queue->pooled = 0;
+        }
+        queue->data = grown;
+        queue->capacity = capacity;
+    }
+
+    memcpy(queue->data + queue->length, data, length);
+    queue->length += length;
+    return 0;
+}
+
+// Writes as much of data as the socket accepts without blocking.
+// Returns the bytes sent, or -1 if the socket failed.
+int sendWithoutBlocking(int socket, const char* data, int length)
+{
+    int sent = 0;
+    while (sent < length)
+    {
+        ssize_t n = send(socket, data + sent, length - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return -1;
+        sent += n;
+    }
+
+    return sent;
+}
+
+// Removes the first count bytes, after they were written
+void consumeOutQueue(outQueue* queue, int count)
+{
+    queue->length -= count;
+    if (queue->length > 0) memmove(queue->data, queue->data + count, queue->length);
+    releaseIdleOutQueue(queue);
+}
+
+// Writes as much of the queue as the socket accepts without blocking.
+// Returns 0, or -1 if the socket failed.
+int flushOutQueue(outQueue* queue, int socket)
+{
+    int sent = sendWithoutBlocking(socket, queue->data, queue->length);
+    if (sent < 0)
+    {
+        queue->length = 0;
+        releaseIdleOutQueue(queue);
+        return -1;
+    }
+
+    consumeOutQueue(queue, sent);
+    return 0;
+}
+
+// Frees the queue's memory
+void freeOutQueue(outQueue* queue)
+{
+    queue->length = 0;
+    releaseIdleOutQueue(queue);
+}
+
+#endif
@@ -0,0 +1,139 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Pool of fixed size buffers carved out of larger
+// slabs. Connections borrow a buffer only while
+// they have bytes waiting and give it back once
+// it is empty, so idle connections hold none.
+// Slabs are added when the free list runs dry and
+// kept until the pool is freed.
+// ==============================
+
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#define BUF_POOL_SLAB_BUFFERS 64 // Buffers allocated at once when the pool runs out
+
+// Free buffers are linked through their first bytes
+typedef struct bufPoolFree_
+{
+    struct bufPoolFree_* next;
+} bufPoolFree;
+
+typedef struct bufPool_
+{
+    bufPoolFree* freeList;
+    char** slabs;
+    int numSlabs;
+    int slabCapacity;
+    int bufSize;
+    int inUse;     // Buffers lent out right now
+    int peakInUse; // Most buffers lent out at once
+    pthread_mutex_t mutex;
+} bufPool;
+
+// Sets up an empty pool of bufSize byte buffers
+void initBufPool(bufPool* pool, int bufSize)
+{
+    pool->freeList = NULL;
+    pool->slabs = NULL;
+    pool->numSlabs = 0;
+    pool->slabCapacity = 0;
+    pool->bufSize = (bufSize < (int)sizeof(bufPoolFree)) ? (int)sizeof(bufPoolFree) : bufSize;
+    pool->inUse = 0;
+    pool->peakInUse = 0;
+    pthread_mutex_init(&(pool->mutex), NULL);
+}
+
+// Allocates another slab and puts its buffers on the free list.
+// Caller must hold the pool's mutex. Returns 0 on success.
+int _bufPoolGrow(bufPool* pool)
+{
+    if (pool->numSlabs == pool->slabCapacity)
+    {
+        int capacity = pool->slabCapacity ? pool->slabCapacity * 2 : 16;
+        char** grown = realloc(pool->slabs, sizeof(char*) * capacity);
+        if (grown == NULL) return 1;
+        pool->slabs = grown;
+        pool->slabCapacity = capacity;
+    }
+
+    char* slab = malloc((size_t)pool->bufSize * BUF_POOL_SLAB_BUFFERS);
+    if (slab == NULL) return 1;
+    pool->slabs[pool->numSlabs++] = slab;
+
+    for (int i = BUF_POOL_SLAB_BUFFERS - 1; i >= 0; i--)
+    {
+        bufPoolFree* buf = (bufPoolFree*)(slab + (size_t)i * pool->bufSize);
+        buf->next = pool->freeList;
+        pool->freeList = buf;
+    }
+
+    return 0;
+}
+
+// Borrows a buffer of pool->bufSize bytes, or returns NULL if
+// memory ran out. Is thread safe.
+char* bufPoolGet(bufPool* pool)
+{
+    pthread_mutex_lock(&(pool->mutex));
+
+    if (pool->freeList == NULL && _bufPoolGrow(pool))
+    {
+        pthread_mutex_unlock(&(pool->mutex));
+        return NULL;
+    }
+
+    bufPoolFree* buf = pool->freeList;
+    pool->freeList = buf->next;
+    if (++pool->inUse > pool->peakInUse) pool->peakInUse = pool->inUse;
+
+    pthread_mutex_unlock(&(pool->mutex));
+    return (char*)buf;
+}
+
+// Gives back a buffer from bufPoolGet(). Is thread safe.
+void bufPoolPut(bufPool* pool, char* data)
+{
+    bufPoolFree* buf = (bufPoolFree*)data;
+
+    pthread_mutex_lock(&(pool->mutex));
+    buf->next = pool->freeList;
+    pool->freeList = buf;
+    pool->inUse--;
+    pthread_mutex_unlock(&(pool->mutex));
+}
+
+// Returns the bytes held by the pool's slabs
+size_t bufPoolBytes(bufPool* pool)
+{
+    pthread_mutex_lock(&(pool->mutex));
+    size_t bytes = (size_t)pool->numSlabs * BUF_POOL_SLAB_BUFFERS * pool->bufSize;
+    pthread_mutex_unlock(&(pool->mutex));
+    return bytes;
+}
+
+// Frees every slab. Buffers still lent out become invalid.
+void freeBufPool(bufPool* pool)
+{
+    for (int i = 0; i < pool->numSlabs; i++)
+        free(pool->slabs[i]);
+
+    free(pool->slabs);
+    pool->slabs = NULL;
+    pool->numSlabs = 0;
+    pool->slabCapacity = 0;
+    pool->freeList = NULL;
+    pool->inUse = 0;
+}
+
+#endif
@@ -0,0 +1,94 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Hands out connection slot numbers from a free
+// list, so claiming and releasing a slot costs the
+// same with 10 or 100000 slots. Each slot counts
+// how many times it has been released. Code that
+// remembers a slot across an unlock, like a timer,
+// keeps the generation too and can tell whether the
+// slot now belongs to a newer connection.
+// Not thread safe, callers provide the locking.
+// ==============================
+
+#ifndef CONNTABLE_H
+#define CONNTABLE_H
+
+#include <stdlib.h>
+
+typedef struct connTable_
+{
+    int* nextFree;            // Next slot on the free list, -1 ends it
+    unsigned int* generation; // Bumped each time the slot is released
+    int freeHead;             // -1 when every slot is in use
+    int capacity;
+    int numUsed;
+} connTable;
+
+// Allocates a table of capacity free slots, handed out lowest first.
+// Returns 0 on success.
+int initConnTable(connTable* table, int capacity)
+{
+    table->nextFree = malloc(sizeof(int) * capacity);
+    table->generation = calloc(capacity, sizeof(unsigned int));
+    if (table->nextFree == NULL || table->generation == NULL)
+    {
+        free(table->nextFree);
+        free(table->generation);
+        return 1;
+    }
+
+    for (int i = 0; i < capacity; i++)
+        table->nextFree[i] = (i + 1 < capacity) ? i + 1 : -1;
+
+    table->freeHead = (capacity > 0) ? 0 : -1;
+    table->capacity = capacity;
+    table->numUsed = 0;
+    return 0;
+}
+
+// Takes a free slot. Returns its index, or -1 if the table is full.
+int claimConnSlot(connTable* table)
+{
+    int slot = table->freeHead;
+    if (slot < 0) return -1;
+
+    table->freeHead = table->nextFree[slot];
+    table->nextFree[slot] = -1;
+    table->numUsed++;
+    return slot;
+}
+
+// Puts a slot back on the free list. The most recently released
+// slot is reused first, while its memory is still in cache.
+void releaseConnSlot(connTable* table, int slot)
+{
+    table->generation[slot]++;
+    table->nextFree[slot] = table->freeHead;
+    table->freeHead = slot;
+    table->numUsed--;
+}
+
+// Returns 1 if slot still holds the connection it held at generation
+int connSlotCurrent(const connTable* table, int slot, unsigned int generation)
+{
+    return table->generation[slot] == generation;
+}
+
+// Frees the table's arrays
+void freeConnTable(connTable* table)
+{
+    free(table->nextFree);
+    free(table->generation);
+    table->nextFree = NULL;
+    table->generation = NULL;
+    table->capacity = 0;
+}
+
+#endif
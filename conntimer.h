@@ -0,0 +1,241 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Deadline timers for client connections. Every
+// connection slot owns at most one timer, stored in
+// a binary min-heap ordered by deadline. A single
+// timer thread sleeps until the earliest deadline
+// and fires a callback for each expired slot.
+// ==============================
+
+#ifndef CONNTIMER_H
+#define CONNTIMER_H
+
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+// Called from the timer thread with the expired slot id and the
+// generation it was set with. The timer lock is not held while the
+// callback runs, so the slot may have been reused by then.
+typedef void (*timerCallback)(int id, unsigned int generation);
+
+typedef struct timerEntry_
+{
+    long long deadlineMs;
+    int id;
+    unsigned int generation;
+} timerEntry;
+
+// Min-heap of deadlines plus the thread that services it.
+// heapPos maps a slot id to its heap index, or -1 if unset.
+typedef struct timerService_
+{
+    timerEntry* heap;
+    int* heapPos;
+    int size;
+    int capacity;
+
+    int running;
+    timerCallback callback;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} timerService;
+
+// Returns the current CLOCK_MONOTONIC time in milliseconds
+long long timerNowMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Swaps two heap entries and keeps heapPos in sync
+void _timerSwap(timerService* timers, int a, int b)
+{
+    timerEntry tmp = timers->heap[a];
+    timers->heap[a] = timers->heap[b];
+    timers->heap[b] = tmp;
+
+    timers->heapPos[timers->heap[a].id] = a;
+    timers->heapPos[timers->heap[b].id] = b;
+}
+
+// Moves the entry at index i up or down until the heap is ordered
+void _timerFix(timerService* timers, int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (timers->heap[parent].deadlineMs <= timers->heap[i].deadlineMs) break;
+        _timerSwap(timers, parent, i);
+        i = parent;
+    }
+
+    for (;;)
+    {
+        int left = i * 2 + 1;
+        int right = left + 1;
+        int smallest = i;
+
+        if (left < timers->size && timers->heap[left].deadlineMs < timers->heap[smallest].deadlineMs)
+            smallest = left;
+        if (right < timers->size && timers->heap[right].deadlineMs < timers->heap[smallest].deadlineMs)
+            smallest = right;
+        if (smallest == i) break;
+
+        _timerSwap(timers, smallest, i);
+        i = smallest;
+    }
+}
+
+// Removes the entry at heap index i. Not thread safe.
+void _timerRemoveAt(timerService* timers, int i)
+{
+    int last = timers->size - 1;
+    timers->heapPos[timers->heap[i].id] = -1;
+
+    if (i != last)
+    {
+        timers->heap[i] = timers->heap[last];
+        timers->heapPos[timers->heap[i].id] = i;
+        timers->size--;
+        _timerFix(timers, i);
+    }
+    else
+    {
+        timers->size--;
+    }
+}
+
+// Sets or moves the deadline for slot id, delayMs from now, for the
+// slot's current generation. A delay of 0 or less cancels the timer.
+// Is thread safe.
+void setTimer(timerService* timers, int id, unsigned int generation, long long delayMs)
+{
+    pthread_mutex_lock(&(timers->mutex));
+
+    int pos = timers->heapPos[id];
+
+    if (delayMs <= 0)
+    {
+        if (pos >= 0) _timerRemoveAt(timers, pos);
+        pthread_mutex_unlock(&(timers->mutex));
+        return;
+    }
+
+    if (pos < 0)
+    {
+        pos = timers->size++;
+        timers->heap[pos].id = id;
+        timers->heapPos[id] = pos;
+    }
+
+    timers->heap[pos].deadlineMs = timerNowMs() + delayMs;
+    timers->heap[pos].generation = generation;
+    _timerFix(timers, pos);
+
+    // Wake the timer thread if this is the new earliest deadline
+    if (timers->heapPos[id] == 0)
+        pthread_cond_signal(&(timers->cond));
+
+    pthread_mutex_unlock(&(timers->mutex));
+}
+
+// Cancels the timer for slot id if one is set. Is thread safe.
+void cancelTimer(timerService* timers, int id)
+{
+    setTimer(timers, id, 0, 0);
+}
+
+// Timer thread, fires expired timers until stopTimerService() is called
+void* _runTimerService(void* _timers)
+{
+    timerService* timers = (timerService*)_timers;
+
+    pthread_mutex_lock(&(timers->mutex));
+
+    while (timers->running)
+    {
+        if (timers->size == 0)
+        {
+            pthread_cond_wait(&(timers->cond), &(timers->mutex));
+            continue;
+        }
+
+        long long deadline = timers->heap[0].deadlineMs;
+        if (deadline > timerNowMs())
+        {
+            struct timespec wakeAt;
+            wakeAt.tv_sec = deadline / 1000;
+            wakeAt.tv_nsec = (deadline % 1000) * 1000000;
+            pthread_cond_timedwait(&(timers->cond), &(timers->mutex), &wakeAt);
+            continue;
+        }
+
+        int id = timers->heap[0].id;
+        unsigned int generation = timers->heap[0].generation;
+        _timerRemoveAt(timers, 0);
+
+        // Run the callback unlocked so it can set timers itself
+        pthread_mutex_unlock(&(timers->mutex));
+        timers->callback(id, generation);
+        pthread_mutex_lock(&(timers->mutex));
+    }
+
+    pthread_mutex_unlock(&(timers->mutex));
+    return NULL;
+}
+
+// Allocates the heap for capacity slot ids and starts the timer
+// thread. Returns 0 on success, non-zero on failure.
+int startTimerService(timerService* timers, int capacity, timerCallback callback)
+{
+    timers->heap = malloc(sizeof(timerEntry) * capacity);
+    timers->heapPos = malloc(sizeof(int) * capacity);
+    if (timers->heap == NULL || timers->heapPos == NULL) return 1;
+
+    for (int i = 0; i < capacity; i++)
+        timers->heapPos[i] = -1;
+
+    timers->size = 0;
+    timers->capacity = capacity;
+    timers->callback = callback;
+    timers->running = 1;
+
+    // Deadlines use CLOCK_MONOTONIC, so the condition must too
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(timers->cond), &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    pthread_mutex_init(&(timers->mutex), NULL);
+
+    return pthread_create(&(timers->thread), NULL, _runTimerService, timers);
+}
+
+// Stops the timer thread and frees the heap
+void stopTimerService(timerService* timers)
+{
+    pthread_mutex_lock(&(timers->mutex));
+    timers->running = 0;
+    pthread_cond_signal(&(timers->cond));
+    pthread_mutex_unlock(&(timers->mutex));
+
+    pthread_join(timers->thread, NULL);
+
+    free(timers->heap);
+    free(timers->heapPos);
+    timers->heap = NULL;
+    timers->heapPos = NULL;
+}
+
+#endif
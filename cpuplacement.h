@@ -0,0 +1,214 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Pins threads to configured CPUs and keeps the
+// memory they allocate on the NUMA node of those
+// CPUs. CPU lists use the kernel's "0-3,8,10-11"
+// format. Nodes are read from sysfs and memory
+// policy is set with the raw system calls, so
+// libnuma is not needed. Without NUMA support
+// every CPU is on node 0 and only pinning applies.
+// Needs _GNU_SOURCE.
+// ==============================
+
+#ifndef CPUPLACEMENT_H
+#define CPUPLACEMENT_H
+
+#include <sched.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_DEFAULT 0
+#define MPOL_PREFERRED 1
+#endif
+
+#define MAX_NUMA_NODES 64 // Nodes past this are treated as unknown
+
+// CPUs in the order they were listed
+typedef struct cpuList_
+{
+    int cpus[CPU_SETSIZE];
+    int numCpus; // 0 = not pinned
+} cpuList;
+
+// CPUs the process could use before any thread was pinned. New
+// threads inherit their creator's CPUs and memory policy, so threads
+// with no list of their own are reset to these.
+cpu_set_t _processCpus;
+int _processCpusSaved = 0;
+
+// Remembers the CPUs the process may use, call before pinning anything
+void rememberProcessCpus()
+{
+    _processCpusSaved = (sched_getaffinity(0, sizeof(_processCpus), &_processCpus) == 0);
+}
+
+// Parses a list such as "0-3,8" into list. An empty string gives an
+// empty list. Returns 0 on success, 1 if the text is not a valid list.
+int parseCpuList(const char* text, cpuList* list)
+{
+    list->numCpus = 0;
+
+    while (*text != '\0')
+    {
+        char* end;
+        if (!isdigit((unsigned char)*text)) return 1;
+        long first = strtol(text, &end, 10);
+        long last = first;
+
+        if (*end == '-')
+        {
+            if (!isdigit((unsigned char)end[1])) return 1;
+            last = strtol(end + 1, &end, 10);
+        }
+
+        if (last < first || last >= CPU_SETSIZE) return 1;
+        if (list->numCpus + (last - first + 1) > CPU_SETSIZE) return 1;
+
+        for (long cpu = first; cpu <= last; cpu++)
+            list->cpus[list->numCpus++] = (int)cpu;
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return 1;
+        text = end;
+    }
+
+    return 0;
+}
+
+// Returns 1 if both lists hold the same CPUs in the same order
+int cpuListsEqual(const cpuList* a, const cpuList* b)
+{
+    if (a->numCpus != b->numCpus) return 0;
+    for (int i = 0; i < a->numCpus; i++)
+        if (a->cpus[i] != b->cpus[i]) return 0;
+    return 1;
+}
+
+// Returns the first CPU in list this process may not run on, or -1
+// if all of them are available
+int unavailableCpu(const cpuList* list)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return -1;
+
+    for (int i = 0; i < list->numCpus; i++)
+        if (!CPU_ISSET(list->cpus[i], &allowed)) return list->cpus[i];
+    return -1;
+}
+
+// Fills set with every CPU in list
+void cpuListToSet(const cpuList* list, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+    for (int i = 0; i < list->numCpus; i++)
+        CPU_SET(list->cpus[i], set);
+}
+
+// Returns the NUMA node of cpu, or 0 if the system does not report one
+int cpuNode(int cpu)
+{
+    char path[96];
+
+    for (int node = 0; node < MAX_NUMA_NODES; node++)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (access(path, F_OK) == 0) return node;
+    }
+
+    return 0;
+}
+
+// Returns the number of distinct NUMA nodes the CPUs in list are on
+int cpuListNodes(const cpuList* list)
+{
+    unsigned long long seen = 0;
+    int numNodes = 0;
+
+    for (int i = 0; i < list->numCpus; i++)
+    {
+        unsigned long long bit = 1ULL << cpuNode(list->cpus[i]);
+        if (!(seen & bit)) numNodes++;
+        seen |= bit;
+    }
+
+    return numNodes;
+}
+
+// Makes pages the calling thread touches for the first time come
+// from node, falling back to other nodes when it is full. A negative
+// node goes back to the system default. Returns 0 on success.
+int preferNode(int node)
+{
+    if (node < 0) return syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0) != 0;
+
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) != 0;
+}
+
+// Places the pages of a mapping on node, also the ones another
+// process touches first through a shared mapping. addr must be
+// page aligned. Returns 0 on success.
+int preferNodeForRange(void* addr, size_t length, int node)
+{
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) != 0;
+}
+
+// Restricts thread to the CPUs in list, or to every CPU of the
+// process for an empty list. Returns 0 on success.
+int pinThread(pthread_t thread, const cpuList* list)
+{
+    cpu_set_t set;
+    if (list->numCpus > 0) cpuListToSet(list, &set);
+    else if (_processCpusSaved) set = _processCpus;
+    else return 0;
+
+    return pthread_setaffinity_np(thread, sizeof(set), &set) != 0;
+}
+
+// Restricts the calling thread to the CPUs in list and places its
+// new memory on the node of the first one. An empty list undoes
+// what the thread inherited. Returns 0 on success.
+int pinCurrentThread(const cpuList* list)
+{
+    if (list->numCpus == 0 && !_processCpusSaved) return 0;
+    if (pinThread(pthread_self(), list)) return 1;
+
+    // Only fails without NUMA support, where placement does not matter
+    preferNode((list->numCpus > 0) ? cpuNode(list->cpus[0]) : -1);
+    return 0;
+}
+
+// Sets attr so a new thread starts on the index'th CPU of list,
+// wrapping around. Starting there, instead of moving once running,
+// means the thread's stack is first touched on the right node.
+// An empty list gives every CPU of the process.
+// Returns the CPU, or -1 if the list is empty or attr rejects it.
+int pinThreadAttr(pthread_attr_t* attr, const cpuList* list, int index)
+{
+    if (list->numCpus == 0)
+    {
+        if (_processCpusSaved) pthread_attr_setaffinity_np(attr, sizeof(_processCpus), &_processCpus);
+        return -1;
+    }
+
+    cpu_set_t set;
+    int cpu = list->cpus[index % list->numCpus];
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return (pthread_attr_setaffinity_np(attr, sizeof(set), &set) == 0) ? cpu : -1;
+}
+
+#endif
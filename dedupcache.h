@@ -0,0 +1,218 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Remembers the reply sent for recent requests that
+// carried a client chosen request id, so a retried
+// purchase gets the original outcome instead of
+// being run again. Keys are split over stripes by
+// hash, each with its own mutex, fixed size entry
+// array and hash chains. When a stripe is full its
+// oldest entry is replaced, so memory stays bounded.
+// ==============================
+
+#ifndef DEDUPCACHE_H
+#define DEDUPCACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define DEDUP_STRIPES 16       // Independent locks, must be a power of 2
+#define DEDUP_KEY_SIZE 48      // Longest request id + 1
+#define DEDUP_REQUEST_SIZE 32  // Arguments the reply was for
+#define DEDUP_REPLY_SIZE 64    // Reply text without tag or terminator
+
+#define DEDUP_MISS 0     // Not seen, the stripe stays locked for dedupFinish()
+#define DEDUP_HIT 1      // Seen with the same arguments, reply filled in
+#define DEDUP_MISMATCH 2 // Seen with different arguments
+
+typedef struct dedupEntry_
+{
+    char key[DEDUP_KEY_SIZE];
+    char request[DEDUP_REQUEST_SIZE];
+    char reply[DEDUP_REPLY_SIZE];
+    unsigned int hash;
+    int next; // Next entry in the same hash chain, -1 ends it
+    int used;
+} dedupEntry;
+
+typedef struct dedupStripe_
+{
+    pthread_mutex_t mutex;
+    dedupEntry* entries;
+    int* buckets;    // First entry of each hash chain, -1 if empty
+    int numEntries;
+    int numBuckets;
+    int nextReplace; // Oldest entry, replaced by the next insert
+    unsigned long hits;
+} dedupStripe;
+
+typedef struct dedupCache_
+{
+    dedupStripe stripes[DEDUP_STRIPES];
+    int capacity; // Entries over all stripes, 0 = disabled
+} dedupCache;
+
+// Holds a looked up key between dedupBegin() and dedupFinish()
+typedef struct dedupTicket_
+{
+    dedupStripe* stripe;
+    unsigned int hash;
+} dedupTicket;
+
+// FNV-1a hash of a request id
+unsigned int _dedupHash(const char* key)
+{
+    unsigned int hash = 2166136261u;
+    for (; *key != '\0'; key++)
+        hash = (hash ^ (unsigned char)*key) * 16777619u;
+    return hash;
+}
+
+// Sets up a cache of about capacity entries. A capacity of 0 gives a
+// disabled cache. Returns 0 on success.
+int initDedupCache(dedupCache* cache, int capacity)
+{
+    int perStripe = (capacity + DEDUP_STRIPES - 1) / DEDUP_STRIPES;
+    cache->capacity = perStripe * DEDUP_STRIPES;
+
+    for (int s = 0; s < DEDUP_STRIPES; s++)
+    {
+        dedupStripe* stripe = &(cache->stripes[s]);
+        pthread_mutex_init(&(stripe->mutex), NULL);
+        stripe->numEntries = perStripe;
+        stripe->numBuckets = perStripe * 2;
+        stripe->nextReplace = 0;
+        stripe->hits = 0;
+        stripe->entries = NULL;
+        stripe->buckets = NULL;
+        if (perStripe == 0) continue;
+
+        stripe->entries = calloc(perStripe, sizeof(dedupEntry));
+        stripe->buckets = malloc(sizeof(int) * stripe->numBuckets);
+        if (stripe->entries == NULL || stripe->buckets == NULL) return 1;
+        for (int b = 0; b < stripe->numBuckets; b++) stripe->buckets[b] = -1;
+    }
+
+    return 0;
+}
+
+// Returns the index of key's entry in stripe, or -1
+int _dedupFind(dedupStripe* stripe, const char* key, unsigned int hash)
+{
+    int index = stripe->buckets[(hash / DEDUP_STRIPES) % stripe->numBuckets];
+    while (index >= 0)
+    {
+        dedupEntry* entry = &(stripe->entries[index]);
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) return index;
+        index = entry->next;
+    }
+    return -1;
+}
+
+// Takes entry index off its hash chain
+void _dedupUnlink(dedupStripe* stripe, int index)
+{
+    int* link = &(stripe->buckets[(stripe->entries[index].hash / DEDUP_STRIPES) % stripe->numBuckets]);
+    while (*link != index) link = &(stripe->entries[*link].next);
+    *link = stripe->entries[index].next;
+}
+
+// Looks up key, which must be shorter than DEDUP_KEY_SIZE. request
+// describes the arguments, so a key reused for a different request is
+// caught. On DEDUP_HIT the original reply is copied into reply. On
+// DEDUP_MISS the key's stripe is left locked: run the request, then
+// call dedupFinish() with its reply, so a retry that races the first
+// attempt waits for it instead of running twice.
+int dedupBegin(dedupCache* cache, const char* key, const char* request,
+    char* reply, dedupTicket* ticket)
+{
+    unsigned int hash = _dedupHash(key);
+    dedupStripe* stripe = &(cache->stripes[hash & (DEDUP_STRIPES - 1)]);
+
+    pthread_mutex_lock(&(stripe->mutex));
+
+    int index = (stripe->numEntries > 0) ? _dedupFind(stripe, key, hash) : -1;
+    if (index >= 0)
+    {
+        dedupEntry* entry = &(stripe->entries[index]);
+        int result = DEDUP_MISMATCH;
+        if (strcmp(entry->request, request) == 0)
+        {
+            strcpy(reply, entry->reply);
+            stripe->hits++;
+            result = DEDUP_HIT;
+        }
+        pthread_mutex_unlock(&(stripe->mutex));
+        return result;
+    }
+
+    ticket->stripe = stripe;
+    ticket->hash = hash;
+    return DEDUP_MISS;
+}
+
+// Stores the reply for a key from dedupBegin() and unlocks its
+// stripe. A NULL reply stores nothing, for requests that changed
+// nothing and are safe to run again.
+void dedupFinish(dedupTicket* ticket, const char* key, const char* request, const char* reply)
+{
+    dedupStripe* stripe = ticket->stripe;
+
+    if (reply != NULL && stripe->numEntries > 0)
+    {
+        int index = stripe->nextReplace;
+        dedupEntry* entry = &(stripe->entries[index]);
+        if (entry->used) _dedupUnlink(stripe, index);
+
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+        snprintf(entry->request, sizeof(entry->request), "%s", request);
+        snprintf(entry->reply, sizeof(entry->reply), "%s", reply);
+        entry->hash = ticket->hash;
+        entry->used = 1;
+
+        int* bucket = &(stripe->buckets[(ticket->hash / DEDUP_STRIPES) % stripe->numBuckets]);
+        entry->next = *bucket;
+        *bucket = index;
+
+        stripe->nextReplace = (index + 1) % stripe->numEntries;
+    }
+
+    pthread_mutex_unlock(&(stripe->mutex));
+}
+
+// Returns how many retries were answered from the cache
+unsigned long dedupHits(dedupCache* cache)
+{
+    unsigned long hits = 0;
+    for (int s = 0; s < DEDUP_STRIPES; s++)
+    {
+        pthread_mutex_lock(&(cache->stripes[s].mutex));
+        hits += cache->stripes[s].hits;
+        pthread_mutex_unlock(&(cache->stripes[s].mutex));
+    }
+    return hits;
+}
+
+// Frees every stripe's arrays
+void freeDedupCache(dedupCache* cache)
+{
+    for (int s = 0; s < DEDUP_STRIPES; s++)
+    {
+        free(cache->stripes[s].entries);
+        free(cache->stripes[s].buckets);
+        cache->stripes[s].entries = NULL;
+        cache->stripes[s].buckets = NULL;
+        pthread_mutex_destroy(&(cache->stripes[s].mutex));
+    }
+    cache->capacity = 0;
+}
+
+#endif
@@ -0,0 +1,177 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Epoch based reclamation of objects that readers
+// use without a lock. A reader enters the current
+// epoch before loading a shared pointer and leaves
+// it when done. A writer that replaces an object
+// retires the old one, which is freed once the
+// epoch has moved on twice: the epoch only moves
+// on when no reader is left in the one before it,
+// so by then no reader can still hold the object.
+//
+// Readers count themselves in one of two counters,
+// one per epoch parity, on one of several stripes
+// picked per thread, so readers on different
+// threads rarely touch the same cache line.
+// ==============================
+
+#ifndef EPOCHRECLAIM_H
+#define EPOCHRECLAIM_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#define EPOCH_READER_STRIPES 16
+
+// Put first in a retired object, so it can be cast back
+typedef struct epochNode_
+{
+    struct epochNode_* next;
+    unsigned long epoch; // When it was retired
+} epochNode;
+
+// Readers in the even and odd epochs
+typedef struct epochStripe_
+{
+    unsigned long readers[2];
+} __attribute__((aligned(64))) epochStripe;
+
+typedef struct epochDomain_
+{
+    epochStripe stripes[EPOCH_READER_STRIPES];
+    unsigned long epoch;
+    pthread_mutex_t mutex;      // Guards the retired list
+    epochNode* retired;         // Newest first
+    unsigned long numRetired;   // Read without the mutex to skip reclaiming
+    unsigned long numFreed;
+    void (*freeObject)(epochNode* node);
+} epochDomain;
+
+__thread int _epochStripe = -1;
+int _nextEpochStripe = 0;
+
+// Sets up a domain whose retired objects are freed with freeObject
+void initEpochDomain(epochDomain* domain, void (*freeObject)(epochNode* node))
+{
+    for (int s = 0; s < EPOCH_READER_STRIPES; s++)
+    {
+        domain->stripes[s].readers[0] = 0;
+        domain->stripes[s].readers[1] = 0;
+    }
+    domain->epoch = 1;
+    pthread_mutex_init(&(domain->mutex), NULL);
+    domain->retired = NULL;
+    domain->numRetired = 0;
+    domain->numFreed = 0;
+    domain->freeObject = freeObject;
+}
+
+// Enters the current epoch. Objects loaded from now on stay valid
+// until leaveEpoch() is called with the returned token.
+int enterEpoch(epochDomain* domain)
+{
+    if (_epochStripe < 0)
+        _epochStripe = __atomic_fetch_add(&_nextEpochStripe, 1, __ATOMIC_RELAXED) % EPOCH_READER_STRIPES;
+
+    epochStripe* stripe = &(domain->stripes[_epochStripe]);
+    for (;;)
+    {
+        unsigned long epoch = __atomic_load_n(&(domain->epoch), __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&(stripe->readers[epoch & 1]), 1, __ATOMIC_SEQ_CST);
+
+        // Counted too late if the epoch moved on meanwhile
+        if (__atomic_load_n(&(domain->epoch), __ATOMIC_SEQ_CST) == epoch)
+            return _epochStripe * 2 + (int)(epoch & 1);
+
+        __atomic_sub_fetch(&(stripe->readers[epoch & 1]), 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// Returns the number of readers left in the epochs with this parity
+unsigned long _epochReaders(epochDomain* domain, int parity)
+{
+    unsigned long readers = 0;
+    for (int s = 0; s < EPOCH_READER_STRIPES; s++)
+        readers += __atomic_load_n(&(domain->stripes[s].readers[parity]), __ATOMIC_SEQ_CST);
+    return readers;
+}
+
+// Moves the epoch on as far as readers allow and frees the retired
+// objects no reader can hold. Skipped if another thread is already
+// at it. Returns the number of objects freed.
+int reclaimEpochObjects(epochDomain* domain)
+{
+    if (pthread_mutex_trylock(&(domain->mutex)) != 0) return 0;
+
+    // At most twice, after that nothing more becomes free
+    unsigned long epoch = __atomic_load_n(&(domain->epoch), __ATOMIC_SEQ_CST);
+    for (int step = 0; step < 2 && _epochReaders(domain, (epoch + 1) & 1) == 0; step++)
+        __atomic_store_n(&(domain->epoch), ++epoch, __ATOMIC_SEQ_CST);
+
+    int freed = 0;
+    epochNode** link = &(domain->retired);
+    while (*link != NULL)
+    {
+        epochNode* node = *link;
+        if (node->epoch + 2 > epoch)
+        {
+            link = &(node->next);
+            continue;
+        }
+
+        *link = node->next;
+        domain->freeObject(node);
+        freed++;
+    }
+
+    __atomic_sub_fetch(&(domain->numRetired), freed, __ATOMIC_RELAXED);
+    domain->numFreed += freed;
+    pthread_mutex_unlock(&(domain->mutex));
+    return freed;
+}
+
+// Leaves the epoch entered with token, and frees retired objects
+// if there are any
+void leaveEpoch(epochDomain* domain, int token)
+{
+    __atomic_sub_fetch(&(domain->stripes[token / 2].readers[token & 1]), 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&(domain->numRetired), __ATOMIC_RELAXED) > 0)
+        reclaimEpochObjects(domain);
+}
+
+// Frees node once no reader can hold it. It must already be
+// unreachable for new readers.
+void retireEpochObject(epochDomain* domain, epochNode* node)
+{
+    pthread_mutex_lock(&(domain->mutex));
+    node->epoch = __atomic_load_n(&(domain->epoch), __ATOMIC_SEQ_CST);
+    node->next = domain->retired;
+    domain->retired = node;
+    __atomic_add_fetch(&(domain->numRetired), 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&(domain->mutex));
+
+    reclaimEpochObjects(domain);
+}
+
+// Frees every retired object, no reader may be left
+void freeEpochDomain(epochDomain* domain)
+{
+    while (domain->retired != NULL)
+    {
+        epochNode* node = domain->retired;
+        domain->retired = node->next;
+        domain->freeObject(node);
+    }
+    domain->numRetired = 0;
+    pthread_mutex_destroy(&(domain->mutex));
+}
+
+#endif
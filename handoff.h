@@ -0,0 +1,200 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Helpers for passing open sockets and server state
+// from a running server to its replacement over a
+// UNIX domain socket. File descriptors are sent as
+// SCM_RIGHTS ancillary data.
+// ==============================
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Handoff message types, sent in this order by the old server
+#define HANDOFF_SEATMAP 1   // Payload: seat map snapshot
+#define HANDOFF_LISTENER 2  // Fd: listening socket, payload: listener kind chosen by the server
+#define HANDOFF_CLIENT 3    // Fd: client socket, payload: client state chosen by the server
+#define HANDOFF_DONE 4      // No more state follows
+#define HANDOFF_ACK 5       // Sent back by the new server once it is serving
+#define HANDOFF_CLIENT_SHM 6 // Fd: shared memory channel fd of the last client, payload: which fd
+
+// Header that starts every handoff message
+typedef struct handoffHeader_
+{
+    int type;
+    int length; // Payload bytes following the header
+} handoffHeader;
+
+// Fills a sockaddr_un for the given path. Returns non-zero if
+// the path does not fit.
+int _handoffAddr(const char* path, struct sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return 1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// Creates the UNIX socket a replacement server connects to.
+// Removes a stale socket file first. Returns the fd or -1.
+int listenForHandoff(const char* path)
+{
+    struct sockaddr_un addr;
+    if (_handoffAddr(path, &addr)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Connects to a running server's handoff socket. Returns the fd or -1.
+int connectForHandoff(const char* path)
+{
+    struct sockaddr_un addr;
+    if (_handoffAddr(path, &addr)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Sends one handoff message. passFd is attached with SCM_RIGHTS
+// unless it is negative. Returns 0 on success.
+int sendHandoffMsg(int sock, int type, const void* payload, int length, int passFd)
+{
+    handoffHeader header = { type, length };
+    struct iovec iov[2];
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(int))];
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = length;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (length > 0) ? 2 : 1;
+
+    if (passFd >= 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &passFd, sizeof(int));
+    }
+
+    // The first sendmsg carries the fd, the rest is plain data
+    ssize_t total = sizeof(header) + length;
+    ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (sent < 0) return 1;
+
+    while (sent < total)
+    {
+        ssize_t offset = sent - sizeof(header);
+        ssize_t n = (offset < 0) ?
+            send(sock, (char*)&header + sent, sizeof(header) - sent, MSG_NOSIGNAL) :
+            send(sock, (const char*)payload + offset, length - offset, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        sent += n;
+    }
+
+    return 0;
+}
+
+// Receives one handoff message into payload (at most maxLength bytes).
+// Sets *recvFd to a passed fd, or -1 if none was sent.
+// Returns 0 on success.
+int recvHandoffMsg(int sock, int* type, void* payload, int maxLength, int* length, int* recvFd)
+{
+    handoffHeader header;
+    struct iovec iov;
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(int))];
+
+    *recvFd = -1;
+
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t got;
+    do {
+        got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) return 1;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(recvFd, CMSG_DATA(cmsg), sizeof(int));
+
+    // Finish reading the header if it arrived in pieces
+    while (got < sizeof(header))
+    {
+        ssize_t n = recv(sock, (char*)&header + got, sizeof(header) - got, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) goto failed;
+        got += n;
+    }
+
+    if (header.length < 0 || header.length > maxLength) goto failed;
+
+    int received = 0;
+    while (received < header.length)
+    {
+        ssize_t n = recv(sock, (char*)payload + received, header.length - received, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) goto failed;
+        received += n;
+    }
+
+    *type = header.type;
+    *length = header.length;
+    return 0;
+
+failed:
+    if (*recvFd >= 0) close(*recvFd);
+    *recvFd = -1;
+    return 1;
+}
+
+#endif
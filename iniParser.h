@@ -4,10 +4,12 @@
 // Instructor: Dr. Szilárd VAJDA
 // Student: Andrew Dunn
 // Assignment: Lab 3
-// Description: Example program demonstrating 
+// Description: Example program demonstrating
 // multi theading and sockets from the client side
 // ==============================
-// Very simple ini file reader
+// Simple ini file reader. The file is read once
+// into a table sorted by key, lookups are a binary
+// search with an exact key match.
 // ==============================
 #ifndef INIPARSER_H
 #define INIPARSER_H
@@ -15,52 +17,179 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 
-// Finds the given ini key in the file and places the value in resultBuffer
-// if the key is found and returns 0. Otherwise returns a non-zero error code.
-int getIniValue(FILE* fp, char* key, char* resultBuffer, int bufferLen)
+// One key=value pair
+typedef struct iniEntry_
 {
-    if (fp == NULL) return 2;
+    char* key;
+    char* value;
+} iniEntry;
 
-    // Seek to the start of the file
-    fseek(fp, 0, SEEK_SET);
+// Every key of an ini file, sorted by key
+typedef struct iniFile_
+{
+    iniEntry* entries;
+    int numEntries;
+    int capacity;
+    int badLine; // First line that is not key=value, 0 if none
+} iniFile;
+
+// Sets up an empty table
+void initIniFile(iniFile* ini)
+{
+    ini->entries = NULL;
+    ini->numEntries = 0;
+    ini->capacity = 0;
+    ini->badLine = 0;
+}
+
+// Frees every key and value in the table
+void freeIniFile(iniFile* ini)
+{
+    for (int i = 0; i < ini->numEntries; i++)
+    {
+        free(ini->entries[i].key);
+        free(ini->entries[i].value);
+    }
+
+    free(ini->entries);
+    initIniFile(ini);
+}
+
+// Finds the index of key, or the index it would be inserted at.
+// Sets *found to 1 if the key exists.
+int _iniSearch(const iniFile* ini, const char* key, int* found)
+{
+    int low = 0;
+    int high = ini->numEntries;
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        int cmp = strcmp(ini->entries[mid].key, key);
+        if (cmp == 0)
+        {
+            *found = 1;
+            return mid;
+        }
+
+        if (cmp < 0) low = mid + 1;
+        else high = mid;
+    }
+
+    *found = 0;
+    return low;
+}
+
+// Adds a key or replaces its value. Returns 0 on success.
+int setIniValue(iniFile* ini, const char* key, const char* value)
+{
+    int found;
+    int pos = _iniSearch(ini, key, &found);
+
+    char* valueCopy = strdup(value);
+    if (valueCopy == NULL) return 1;
+
+    if (found)
+    {
+        free(ini->entries[pos].value);
+        ini->entries[pos].value = valueCopy;
+        return 0;
+    }
+
+    if (ini->numEntries == ini->capacity)
+    {
+        int capacity = ini->capacity ? ini->capacity * 2 : 16;
+        iniEntry* grown = realloc(ini->entries, sizeof(iniEntry) * capacity);
+        if (grown == NULL) { free(valueCopy); return 1; }
+        ini->entries = grown;
+        ini->capacity = capacity;
+    }
+
+    char* keyCopy = strdup(key);
+    if (keyCopy == NULL) { free(valueCopy); return 1; }
+
+    memmove(&(ini->entries[pos + 1]), &(ini->entries[pos]), sizeof(iniEntry) * (ini->numEntries - pos));
+    ini->entries[pos].key = keyCopy;
+    ini->entries[pos].value = valueCopy;
+    ini->numEntries++;
+    return 0;
+}
+
+// Strips leading and trailing whitespace in place
+char* _iniTrim(char* str)
+{
+    while (isspace((unsigned char)*str)) str++;
+
+    char* end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+
+    return str;
+}
+
+// Reads every key=value line of the file at path into ini, which must be
+// initialized. Blank lines and lines starting with # or ; are skipped, a
+// key that appears twice keeps its last value. Returns 0 on success, or
+// 1 if the file could not be read.
+int loadIniFile(const char* path, iniFile* ini)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) return 1;
 
-    const char delim[2] = "=";
-    char* token;
     char* lineBuffer = NULL;
     size_t lineBufferSize = 0;
-    ssize_t bytesRead;
+    int lineNumber = 0;
+    int err = 0;
 
-    // Read the file line by line looking for the key
-    while ((bytesRead = getline(&lineBuffer, &lineBufferSize, fp)) != -1) 
+    while (!err && getline(&lineBuffer, &lineBufferSize, fp) != -1)
     {
-        if (strstr(lineBuffer, key) != NULL)
+        lineNumber++;
+
+        char* line = _iniTrim(lineBuffer);
+        if (*line == '\0' || *line == '#' || *line == ';') continue;
+
+        char* equals = strchr(line, '=');
+        if (equals == NULL || equals == line)
         {
-            // Split line around '=' character
-            token = strtok(lineBuffer, delim);
-            if (token == NULL) { free(lineBuffer); return 1; }
-
-            // Get token on right side of '=' character
-            token = strtok(NULL, delim);
-            if (token == NULL) { free(lineBuffer); return 1; }
-            
-            // Replace new line char with null char
-            int tokLen = strlen(token);
-            if (token[tokLen - 1] == '\n') token[tokLen - 1] = '\0';
-
-            // If token is longer than our buffer, return with error
-            if (tokLen > bufferLen) { free(lineBuffer); return 3; }
-
-            // Copy value into return buffer and return
-            strcpy(resultBuffer, token);
-
-            free(lineBuffer); 
-            return 0;
+            if (ini->badLine == 0) ini->badLine = lineNumber;
+            continue;
         }
+
+        *equals = '\0';
+        err = setIniValue(ini, _iniTrim(line), _iniTrim(equals + 1));
     }
 
     free(lineBuffer);
-    return 1;
+    fclose(fp);
+    return err;
+}
+
+// Returns the value for key, or NULL if the key is not in the table
+const char* getIniString(const iniFile* ini, const char* key)
+{
+    int found;
+    int pos = _iniSearch(ini, key, &found);
+    return found ? ini->entries[pos].value : NULL;
+}
+
+// Reads a non-negative integer value. Returns 0 on success, 1 if the
+// key is missing, or 2 if the value is not a number that fits.
+int getIniUInt(const iniFile* ini, const char* key, unsigned int* result)
+{
+    const char* value = getIniString(ini, key);
+    if (value == NULL) return 1;
+    if (!isdigit((unsigned char)*value)) return 2;
+
+    char* end;
+    errno = 0;
+    unsigned long parsed = strtoul(value, &end, 10);
+    if (errno != 0 || *end != '\0' || parsed > 0xffffffffUL) return 2;
+
+    *result = (unsigned int)parsed;
+    return 0;
 }
 
-#endif
\ No newline at end of file
+#endif
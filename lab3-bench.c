@@ -0,0 +1,272 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the client side
+// ==============================
+//
+// Build and Run instructions:
+//
+// To build, open a terminal and execute:
+// gcc -O2 -o bench lab3-bench.c -pthread
+//
+// Start a server with a unix socket listener and quiet logging:
+// ./server -unixsock /tmp/ticketserver.sock -loglevel warn
+//
+// Then run:
+// ./bench [-ip addr] [-port n] [-unix path]
+//         [-requests n] [-window n]
+//
+// ==============================
+//
+// Usage:
+//
+// Compares the client transports against a running server:
+// TCP loopback, the unix socket and shared memory (the last
+// two only with -unix). Each transport gets its own
+// connection and is measured two ways with availability
+// requests, which do not change the seat map:
+//
+// Round trip latency: one request at a time, reporting the
+// average, median and 99th percentile.
+//
+// Throughput: -window requests kept in flight (default 32,
+// at most TICKET_MAX_PENDING), reporting messages per second.
+//
+// ==============================
+
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "networkmsg.h"
+#include "ticketclient.h"
+
+#define DEFAULT_IP "127.0.0.1"
+#define DEFAULT_PORT 5432
+#define DEFAULT_REQUESTS 20000
+#define DEFAULT_WINDOW 32
+#define WARMUP_REQUESTS 1000
+#define REQUEST_TIMEOUT_MS 5000
+
+// Requests kept in flight by the throughput test
+typedef struct pipelineState_ {
+    ticketSession* session;
+    int toSend;
+    int inFlight;
+    int failed;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} pipelineState;
+
+ticketClient* netClient = NULL;
+
+// Returns the current time in nanoseconds
+long long nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int compareLongLong(const void* a, const void* b)
+{
+    long long diff = *(const long long*)a - *(const long long*)b;
+    return (diff > 0) - (diff < 0);
+}
+
+// Sends one request and waits for its reply. Returns 0 on success.
+int roundTrip(ticketSession* session)
+{
+    ticketFuture future;
+    if (ticketRequest(session, &future, CLIENT_TICKET_REQUESTAVAILABILITY, 0)) return 1;
+    return ticketFutureWait(&future, REQUEST_TIMEOUT_MS) != TICKET_WAIT_OK;
+}
+
+// Called on the network thread with each reply, sends the next request
+void onPipelineReply(ticketSession* session, const ticketResponse* response, void* _state)
+{
+    pipelineState* state = (pipelineState*)_state;
+    int sendNext = 0;
+
+    pthread_mutex_lock(&(state->mutex));
+    state->inFlight--;
+    if (response == NULL) state->failed = 1;
+    if (!state->failed && state->toSend > 0)
+    {
+        state->toSend--;
+        state->inFlight++;
+        sendNext = 1;
+    }
+    pthread_mutex_unlock(&(state->mutex));
+
+    if (sendNext && ticketRequestAsync(session, onPipelineReply, state, CLIENT_TICKET_REQUESTAVAILABILITY, 0) < 0)
+    {
+        pthread_mutex_lock(&(state->mutex));
+        state->inFlight--;
+        state->failed = 1;
+        pthread_mutex_unlock(&(state->mutex));
+    }
+
+    pthread_mutex_lock(&(state->mutex));
+    if (state->inFlight == 0) pthread_cond_signal(&(state->cond));
+    pthread_mutex_unlock(&(state->mutex));
+}
+
+// Runs numRequests requests with window of them in flight at once.
+// Returns the messages per second, or -1 on failure.
+double measureThroughput(ticketSession* session, int numRequests, int window)
+{
+    pipelineState state;
+    state.session = session;
+    state.toSend = numRequests - window;
+    state.inFlight = window;
+    state.failed = 0;
+    pthread_mutex_init(&(state.mutex), NULL);
+    pthread_cond_init(&(state.cond), NULL);
+
+    long long start = nowNs();
+
+    for (int i = 0; i < window; i++)
+    {
+        if (ticketRequestAsync(session, onPipelineReply, &state, CLIENT_TICKET_REQUESTAVAILABILITY, 0) < 0)
+        {
+            pthread_mutex_lock(&(state.mutex));
+            state.inFlight -= window - i;
+            state.failed = 1;
+            pthread_mutex_unlock(&(state.mutex));
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&(state.mutex));
+    while (state.inFlight > 0)
+        pthread_cond_wait(&(state.cond), &(state.mutex));
+    pthread_mutex_unlock(&(state.mutex));
+
+    long long elapsed = nowNs() - start;
+
+    pthread_mutex_destroy(&(state.mutex));
+    pthread_cond_destroy(&(state.cond));
+    return state.failed ? -1 : numRequests * 1e9 / elapsed;
+}
+
+// Measures one connected session and prints its results
+void runBenchmark(const char* name, ticketSession* session, int numRequests, int window)
+{
+    long long* samples = malloc(sizeof(long long) * numRequests);
+    long long total = 0;
+
+    if (session == NULL || samples == NULL)
+    {
+        printf("%-14s unable to connect\n", name);
+        free(samples);
+        return;
+    }
+
+    for (int i = 0; i < WARMUP_REQUESTS; i++)
+    {
+        if (roundTrip(session))
+        {
+            printf("%-14s request failed\n", name);
+            free(samples);
+            return;
+        }
+    }
+
+    for (int i = 0; i < numRequests; i++)
+    {
+        long long start = nowNs();
+        if (roundTrip(session))
+        {
+            printf("%-14s request failed\n", name);
+            free(samples);
+            return;
+        }
+        samples[i] = nowNs() - start;
+        total += samples[i];
+    }
+
+    qsort(samples, numRequests, sizeof(long long), compareLongLong);
+    double msgsPerSec = measureThroughput(session, numRequests, window);
+
+    printf("%-14s %9.1f %9.1f %9.1f %12.0f\n", name, total / 1000.0 / numRequests,
+        samples[numRequests / 2] / 1000.0, samples[(int)(numRequests * 0.99)] / 1000.0, msgsPerSec);
+
+    free(samples);
+}
+
+// Program entry point
+int main(int argc, char const *argv[])
+{
+    const char* ip = DEFAULT_IP;
+    const char* unixPath = NULL;
+    unsigned int port = DEFAULT_PORT;
+    int numRequests = DEFAULT_REQUESTS;
+    int window = DEFAULT_WINDOW;
+
+    // Process command line arguments
+    for (int curArg = 1; curArg < argc; curArg++)
+    {
+        const char* value = (curArg + 1 < argc) ? argv[curArg + 1] : NULL;
+
+        if (strcmp(argv[curArg], "-ip") == 0 && value != NULL)
+            ip = argv[++curArg];
+        else if (strcmp(argv[curArg], "-port") == 0 && value != NULL)
+            port = atoi(argv[++curArg]);
+        else if (strcmp(argv[curArg], "-unix") == 0 && value != NULL)
+            unixPath = argv[++curArg];
+        else if (strcmp(argv[curArg], "-requests") == 0 && value != NULL)
+            numRequests = atoi(argv[++curArg]);
+        else if (strcmp(argv[curArg], "-window") == 0 && value != NULL)
+            window = atoi(argv[++curArg]);
+        else
+        {
+            fprintf(stderr, "Correct usage: %s [-ip addr] [-port n] [-unix path] [-requests n] [-window n]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (numRequests < 100) numRequests = 100;
+    if (window < 1) window = 1;
+    if (window > TICKET_MAX_PENDING) window = TICKET_MAX_PENDING;
+    if (window > numRequests) window = numRequests;
+
+    netClient = ticketClientCreate();
+    if (netClient == NULL)
+    {
+        perror("Unable to start network thread");
+        return EXIT_FAILURE;
+    }
+
+    printf("%d requests per test, window of %d for throughput\n\n", numRequests, window);
+    printf("%-14s %9s %9s %9s %12s\n", "transport", "avg us", "p50 us", "p99 us", "msgs/s");
+
+    ticketSession* session = ticketConnect(netClient, ip, port, 0, NULL, NULL);
+    runBenchmark("tcp loopback", session, numRequests, window);
+    if (session != NULL) ticketReleaseSession(session);
+
+    if (unixPath != NULL)
+    {
+        session = ticketConnectUnix(netClient, unixPath, 0, NULL, NULL);
+        runBenchmark("unix socket", session, numRequests, window);
+        if (session != NULL) ticketReleaseSession(session);
+
+        session = ticketConnectUnix(netClient, unixPath, 0, NULL, NULL);
+        if (session != NULL && ticketUseSharedMemory(session, REQUEST_TIMEOUT_MS))
+        {
+            ticketReleaseSession(session);
+            session = NULL;
+        }
+        runBenchmark("shared memory", session, numRequests, window);
+        if (session != NULL) ticketReleaseSession(session);
+    }
+
+    ticketClientDestroy(netClient);
+    return 0;
+}
@@ -20,305 +20,573 @@
 //
 // Optional command line parameters:
 // ./client [settings_file] [-manual | -automatic]
+//          [-sessions n] [-interval ms]
 //
 // ==============================
 //
 // Usage:
 //
 // -manual mode will privide a simple menu allowing
-// you to select and purchase seats.
+// you to select and purchase seats, to buy the next
+// free seat of a price tier, to count the free seats
+// in a section of the map, to see how many seats are
+// left in every row and section, or to return a ticket
+// bought during this session for a refund.
 //
 // -automatic mode will put the client into an automatic
 // loop where it tries to randomly buy seats until the
-// server tells us to disconnect.
+// server tells us to disconnect. -sessions runs several
+// buyers at once, each with its own server connection.
+// -interval sets the pause between purchase attempts
+// (default 500 ms, 0 buys as fast as the server answers).
+// Each buyer downloads the seat map first and remembers
+// every seat it learns is sold, so it only tries seats
+// that may still be free and stops once none are left.
+// Buyers subscribe to the server's seat change pushes to
+// keep that list current instead of asking again.
+//
+// The settings file holds the server's ip, port and the
+// connect timeout in seconds. Setting unix_path instead
+// connects through the server's unix socket listener
+// (see -unixsock on the server), which avoids the TCP
+// stack when both run on the same machine. With
+// shared_memory=1 as well, each connection then moves onto
+// a shared memory channel, and requests and replies are
+// passed without system calls while both sides are busy.
+//
+// If the server is busy it replies with a retry hint. The
+// client then waits that long, plus a little random jitter,
+// and reconnects (up to MAX_BUSY_RETRYS times).
+//
+// All networking goes through ticketclient.h, which waits
+// on every connection from one thread and wakes each
+// caller as soon as its own response arrives.
 //
 // ==============================
 
 #include <unistd.h>
 #include <time.h>
 #include <stdio.h> 
-#include <sys/socket.h> 
 #include <stdlib.h> 
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include <string.h>
 #include <pthread.h>
 #include "networkmsg.h"
 #include "threadsafeprint.h"
 #include "iniParser.h"
+#include "ticketclient.h"
+#include "seatcache.h"
 
 // Default server information
 #define DEFAULT_IP "127.0.0.1"
 #define DEFAULT_PORT 5432
 #define DEFAULT_TIMEOUT 5
 
-// Size of network messages buffer
-#define MSG_BUFFER_SIZE 1024
+// Reconnect attempts after the server asks us to retry later
+#define MAX_BUSY_RETRYS 10
+
+#define SHM_ATTACH_TIMEOUT_MS 5000
+
+// Purchases carry a request id and are sent again with the same id
+// when no reply arrives in time, the server never sells twice for it
+#define PURCHASE_TIMEOUT_MS 2000
+#define PURCHASE_ATTEMPTS 3
+
+// Automatic mode defaults
+#define DEFAULT_SESSIONS 1
+#define MAX_SESSIONS 64
+#define DEFAULT_INTERVAL_MS 500
+#define MAP_REFRESH_FAILURES 3 // Refresh the seat map after this many failed purchases in a row
+
+#define MAX_OWNED_TICKETS 64 // Tickets a manual mode buyer remembers for refunds
+
+// A seat we bought and the receipt that proves it
+typedef struct ownedTicket_ {
+    int row;
+    int col;
+    char receipt[24];
+} ownedTicket;
+
+// State of one buyer's connection to the server
+typedef struct buyerInfo_ {
+    int id;
+    ticketSession* session;
+    unsigned int retryAfterMs; // Set when the server asks us to come back later
+    int seatRows;
+    int seatCols;
+    int seatsAvailable;
+    seatCache cache;  // Seats known to be sold, automatic mode only
+    pthread_mutex_t cacheLock; // Pushes update the cache from the network thread
+    int mapNextRow;   // Next row to request when a map reply is partial
+    int subscribed;   // Server pushes seat changes to us
+    unsigned int purchasesSent; // Numbers this buyer's purchase request ids
+    ownedTicket tickets[MAX_OWNED_TICKETS]; // Bought this session, oldest first
+    int numTickets;
+    pthread_t thread;
+} buyerInfo;
 
 // Global variables because this is just an example program:
-char receiveBuffer[MSG_BUFFER_SIZE];
-char sendBuffer[MSG_BUFFER_SIZE];
-int socketHandle = 0;
-int socketStatus = 0;
+ticketClient* netClient = NULL;
+char ipAddress[64] = DEFAULT_IP;
+char unixPath[108] = ""; // Connect through this unix socket instead of TCP when set
+unsigned int sharedMemory = 0; // Move unix socket connections onto shared memory
+unsigned int port = DEFAULT_PORT;
+unsigned int timeoutRetrys = DEFAULT_TIMEOUT;
 int manualMode = 1;
-int seatRows = 0;
-int seatCols = 0;
-
-// Client thread handle and mutex lock
-pthread_t clientThread;
-pthread_mutex_t socketLock;
+unsigned int numSessions = DEFAULT_SESSIONS;
+unsigned int intervalMs = DEFAULT_INTERVAL_MS;
 
 // Linebuffer for user terminal input
 char* linebuffer = NULL;
 size_t lineSize = 0;
 ssize_t lineLen = 0;
 
-// Disconnects from the server and closes the socket connection
-void disconnectFromServer()
+// Returns argument i of a server message as text, or "" if it is missing
+const char* msgArgText(const netMsg* msg, int i, char* buffer, int bufferLen)
 {
-    if (!socketStatus)
-    {
-        pthread_mutex_unlock(&socketLock);
-        return;
-    }
+    if (i >= msg->numArgs) return "";
 
-    safePrintLine("Disconnecting from server ...");
-    shutdown(socketHandle, SHUT_RDWR);
-    socketStatus = 0;
+    int len = (msg->argLen[i] < bufferLen - 1) ? msg->argLen[i] : bufferLen - 1;
+    memcpy(buffer, msg->argStr[i], len);
+    buffer[len] = '\0';
+    return buffer;
 }
 
-// Takes a c-string message from the server and processes it accordingly
-void processServerMsg(char* msg)
+// Prints a message from the server and records anything the buyer
+// needs to know, such as the seat map size or a retry hint. session is
+// the connection the message came from, pushes can arrive after the
+// buyer has already let go of it.
+void processServerMsg(buyerInfo* buyer, ticketSession* session, const netMsg* msg)
 {
-    printFromThread(clientThread, "Processing server message. Data: '%s'", msg);
-
-    char *saveptr;
-    char* msgArgument;
-    char* sRow;
-    char* sCol;
-    char* sAvail;
-    char* reqIdStr = strtok_r(msg, NETWORK_MSG_DELIM, &saveptr); // strtok_r is threadsafe
-    int reqId = atoi(reqIdStr);
+    char argText[TICKET_MSG_BUFFER_SIZE];
     int avail;
 
     // Every server message starts with an integer request id
-    switch (reqId)
+    switch (msg->id)
     {
         case SERVER_DISCONNECT:
-            msgArgument = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            printFromThread(clientThread, "Server requested us to disconnect. Reason: %s", msgArgument);
-            disconnectFromServer();
+            printFromClient(buyer->id, "Server requested us to disconnect. Reason: %s",
+                msgArgText(msg, 0, argText, sizeof(argText)));
+            ticketDisconnect(session);
             if (manualMode) safePrintLine("~~~ PRESS ENTER TO EXIT FROM MAIN MENU ~~~");
             break;
+        case SERVER_RETRY_LATER:
+            buyer->retryAfterMs = (msg->numArgs > 0 && msg->argIsInt[0] && msg->args[0] > 0) ?
+                msg->args[0] : 1000;
+            printFromClient(buyer->id, "Server is busy, retry in %u ms. Reason: %s",
+                buyer->retryAfterMs, msgArgText(msg, 1, argText, sizeof(argText)));
+            ticketDisconnect(session);
+            if (manualMode) safePrintLine("~~~ PRESS ENTER TO RETRY ~~~");
+            break;
         case SERVER_MSG_INVALID:
-            msgArgument = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            printFromThread(clientThread, "Server says we sent an invalid message. Reason: %s", msgArgument);
+            printFromClient(buyer->id, "Server says we sent an invalid message. Reason: %s",
+                msgArgText(msg, 0, argText, sizeof(argText)));
             break;
         case SERVER_TICKET_RANGE:
-            printFromThread(clientThread, "Server is telling us the range of available tickets.");
+            printFromClient(buyer->id, "Server is telling us the range of available tickets.");
 
-            sRow = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            if (sRow == NULL)
+            if (msg->numArgs < 3)
             {
-                printFromThread(clientThread, "Server response is missing row argument.");
+                printFromClient(buyer->id, "Server response is missing arguments.");
                 break;
             }
 
-            sCol = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            if (sCol == NULL)
-            {
-                printFromThread(clientThread, "Server response is missing column argument.");
-                break;
-            }
-
-            sAvail = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            if (sAvail == NULL)
-            {
-                printFromThread(clientThread, "Server response is missing # available argument.");
-                break;
-            }
-
-            seatRows = atoi(sRow);
-            seatCols = atoi(sCol);
-            avail = atoi(sAvail);
+            buyer->seatRows = msg->args[0];
+            buyer->seatCols = msg->args[1];
+            avail = msg->args[2];
+            buyer->seatsAvailable = avail;
 
             safePrintLine("=========================\n"
                           "|   Available Seating   |\n"
                           "| Rows:    %2d           |\n"
                           "| Columns: %2d           |\n"
                           "| # Available: %2d       |\n"
-                          "=========================", seatRows, seatCols, avail);
+                          "=========================", buyer->seatRows, buyer->seatCols, avail);
             break;
         case SERVER_TICKET_INVALID:
-            msgArgument = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            printFromThread(clientThread, "Server says we referenced an invalid ticket. Reason: %s", msgArgument);
+            printFromClient(buyer->id, "Server says we referenced an invalid ticket. Reason: %s",
+                msgArgText(msg, 0, argText, sizeof(argText)));
             break;
         case SERVER_TICKET_AVAILABLE:
-            printFromThread(clientThread, "Server says that ticket is available for us to purchase.");
+            printFromClient(buyer->id, "Server says that ticket is available for us to purchase.");
             break;
         case SERVER_TICKET_NOT_AVAILABLE:
-            printFromThread(clientThread, "Server says that ticket is not available for us to purchase.");
+            printFromClient(buyer->id, "Server says that ticket is not available for us to purchase.");
             break;
         case SERVER_TICKET_TRANSACTION_FAILED:
-            msgArgument = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            printFromThread(clientThread, "Server says our transaction failed. Reason: %s", msgArgument);
+            printFromClient(buyer->id, "Server says our transaction failed. Reason: %s",
+                msgArgText(msg, 0, argText, sizeof(argText)));
             break;
         case SERVER_TICKET_TRANSACTION_SUCCESS:
-            msgArgument = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            printFromThread(clientThread, "Server says our transaction was a success: %s", msgArgument);
+            printFromClient(buyer->id, "Server says our transaction was a success: %s",
+                msgArgText(msg, 0, argText, sizeof(argText)));
+            break;
+        case SERVER_TICKET_MAP:
+            pthread_mutex_lock(&(buyer->cacheLock));
+            if (msg->numArgs < 4 || buyer->cache.candidates == NULL ||
+                msg->args[2] != buyer->cache.cols ||
+                applySeatBitmap(&(buyer->cache), msg->args[0], msg->args[1], msg->argStr[3], msg->argLen[3]))
+            {
+                pthread_mutex_unlock(&(buyer->cacheLock));
+                printFromClient(buyer->id, "Ignoring seat map that does not match our cache.");
+                buyer->mapNextRow = -1;
+                break;
+            }
+
+            buyer->mapNextRow = msg->args[0] + msg->args[1];
+            avail = buyer->cache.numCandidates;
+            pthread_mutex_unlock(&(buyer->cacheLock));
+
+            printFromClient(buyer->id, "Seat map rows %d-%d received, %d seats may be free.",
+                msg->args[0], buyer->mapNextRow - 1, avail);
+            break;
+        case SERVER_TICKET_TIERS:
+            if (msg->numArgs < 2)
+            {
+                printFromClient(buyer->id, "Server response is missing arguments.");
+                break;
+            }
+
+            printFromClient(buyer->id, "Server is telling us the price tiers.");
+            {
+                const char* tierList = msgArgText(msg, 1, argText, sizeof(argText));
+                unsigned int price, tierAvail, tierTotal;
+                int tier = 0;
+                int used;
+
+                // Each tier is "price:available:total", separated by commas
+                while (sscanf(tierList, "%u:%u:%u%n", &price, &tierAvail, &tierTotal, &used) == 3)
+                {
+                    safePrintLine("| Tier %d: price %u, %u of %u seats available", tier++, price, tierAvail, tierTotal);
+                    tierList += used;
+                    if (*tierList == ',') tierList++;
+                }
+            }
+            safePrintLine("| Cheapest tier with seats left: %d", msg->args[0]);
+            break;
+        case SERVER_TICKET_SEAT_ASSIGNED:
+            if (msg->numArgs < 4)
+            {
+                printFromClient(buyer->id, "Server response is missing arguments.");
+                break;
+            }
+
+            printFromClient(buyer->id, "Server sold us Row: %2d, Col: %2d in tier %d for %d.",
+                msg->args[0], msg->args[1], msg->args[2], msg->args[3]);
+            break;
+        case SERVER_TICKET_REGION:
+            if (msg->numArgs < 3)
+            {
+                printFromClient(buyer->id, "Server response is missing arguments.");
+                break;
+            }
+
+            if (msg->args[0] > 0)
+                printFromClient(buyer->id, "Server says %d seats are available there, the first at Row: %2d, Col: %2d.",
+                    msg->args[0], msg->args[1], msg->args[2]);
+            else
+                printFromClient(buyer->id, "Server says no seats are available there.");
+            break;
+        case SERVER_TICKET_SUMMARY:
+            if (msg->numArgs < 5 || msg->args[2] < 1)
+            {
+                printFromClient(buyer->id, "Server response is missing arguments.");
+                break;
+            }
+
+            printFromClient(buyer->id, "Server is telling us the available seats by row and section.");
+            {
+                const char* counts = msgArgText(msg, 3, argText, sizeof(argText));
+                char* end;
+                for (int y = 0; y < msg->args[0] && *counts != '\0'; y++)
+                {
+                    safePrintLine("| Row %2d: %2ld available", y, strtol(counts, &end, 10));
+                    counts = (*end == ',') ? end + 1 : end;
+                }
+
+                // One line per row of sections, front sections first
+                int sectionCols = (msg->args[1] + msg->args[2] - 1) / msg->args[2];
+                counts = msgArgText(msg, 4, argText, sizeof(argText));
+                for (int sectionRow = 0; *counts != '\0'; sectionRow++)
+                {
+                    char line[256];
+                    int length = snprintf(line, sizeof(line), "| Sections in rows %2d+:", sectionRow * msg->args[2]);
+                    for (int x = 0; x < sectionCols && *counts != '\0'; x++)
+                    {
+                        long available = strtol(counts, &end, 10);
+                        counts = (*end == ',') ? end + 1 : end;
+                        if (length < sizeof(line))
+                            length += snprintf(line + length, sizeof(line) - length, " %3ld", available);
+                    }
+                    safePrintLine("%s", line);
+                }
+            }
+            break;
+        case SERVER_WAITING:
+            if (msg->numArgs < 2)
+            {
+                printFromClient(buyer->id, "Server response is missing arguments.");
+                break;
+            }
+
+            if (msg->args[1] >= 0)
+                printFromClient(buyer->id, "Server is full, we are number %d in line, about %d s to go.",
+                    msg->args[0], (msg->args[1] + 999) / 1000);
+            else
+                printFromClient(buyer->id, "Server is full, we are number %d in line.", msg->args[0]);
+            break;
+        case SERVER_SUBSCRIBED:
+            buyer->subscribed = (msg->numArgs > 0 && msg->argIsInt[0] && msg->args[0]);
+            printFromClient(buyer->id, "Server %s seat changes.",
+                buyer->subscribed ? "will push" : "stopped pushing");
+            break;
+        case SERVER_SEATS_CHANGED:
+            if (msg->numArgs < 2) break;
+
+            pthread_mutex_lock(&(buyer->cacheLock));
+            avail = (buyer->cache.candidates == NULL) ? 0 :
+                applySeatList(&(buyer->cache), msg->argStr[1], msg->argLen[1], 1);
+            if (msg->numArgs > 2 && buyer->cache.candidates != NULL)
+                applySeatList(&(buyer->cache), msg->argStr[2], msg->argLen[2], 0);
+            pthread_mutex_unlock(&(buyer->cacheLock));
+
+            printFromClient(buyer->id, "Server says %d seats were sold, %d left.", avail, msg->args[0]);
+            break;
+        case SERVER_TICKET_REFUNDED:
+            if (msg->numArgs < 2)
+            {
+                printFromClient(buyer->id, "Server response is missing arguments.");
+                break;
+            }
+
+            printFromClient(buyer->id, "Server refunded our ticket for Row: %2d, Col: %2d.",
+                msg->args[0], msg->args[1]);
+            break;
+        case SERVER_SALES_CHANGED:
+            if (msg->numArgs > 0 && msg->args[0])
+                printFromClient(buyer->id, "Server says seats were returned and are for sale again.");
+            else
+                printFromClient(buyer->id, "Server says every seat is sold, tickets can still be returned.");
             break;
         default:
-            printFromThread(clientThread, "Server sent an unknown request id: %d", reqId);
+            printFromClient(buyer->id, "Server sent an unknown request id: %d", msg->id);
             break;
     }
 }
 
-// Runs the client server message recieve loop which is executed in a separate thread
-void* runClient(void *unused)
+// Receives messages the server sends on its own, called on the network thread
+void onServerPush(ticketSession* session, const ticketResponse* response, void* _buyer)
 {
-    int bytesRead = 0;
-    printFromThread(clientThread, "Client thread is now running and ready to process network messages.");
+    buyerInfo* buyer = (buyerInfo*)_buyer;
 
-    // Request available seating info from server
-    char intStr[20];
-    sprintf(sendBuffer, "%d", CLIENT_TICKET_REQUESTAVAILABILITY);
-    send(socketHandle, sendBuffer, strlen(sendBuffer), 0);
-
-    // Continue until we are disconnected
-    while (socketStatus)
+    if (response == NULL)
     {
-        // Block until the next server message is received
-        bytesRead = read(socketHandle , receiveBuffer, MSG_BUFFER_SIZE); 
-        if (bytesRead > 0)
-        {
-            // Make sure message is null terminated
-            receiveBuffer[bytesRead] = '\0';
-
-            pthread_mutex_lock(&socketLock);
-            processServerMsg(receiveBuffer);
-            pthread_mutex_unlock(&socketLock);
-        }
+        printFromClient(buyer->id, "Disconnected from server.");
+        return;
     }
 
-    shutdown(socketHandle, SHUT_RDWR);
-    close(socketHandle);
+    processServerMsg(buyer, session, &(response->msg));
+}
 
-    printFromThread(clientThread, "Client thread is exiting ....");
+// Waits out a SERVER_RETRY_LATER reply, sent when we are over the
+// server's request rate. Returns 1 if the request should be sent
+// again, or 0 if the reply was anything else.
+int waitIfThrottled(buyerInfo* buyer, const netMsg* msg)
+{
+    if (msg->id != SERVER_RETRY_LATER) return 0;
+
+    unsigned int waitMs = (msg->numArgs > 0 && msg->argIsInt[0] && msg->args[0] > 0) ? msg->args[0] : 1000;
+    printFromClient(buyer->id, "Server is rate limiting us, retrying in %u ms.", waitMs);
+    usleep(waitMs * 1000);
+    return 1;
 }
 
-// Creates the client socket, attempts to connect to the server, and then
-// spins up a new thread for the network msg receive loop. Returns a non-zero
-// value on failure.
-int startClient(char* ip, unsigned int port, unsigned int timeoutRetrys)
+// Sends a request and blocks until its response arrives.
+// Prints the response and returns its message id, or -1
+// if the connection closed first.
+int requestAndWait(buyerInfo* buyer, int msgId, int numArgs, int row, int col)
 {
-    struct sockaddr_in address;
-    struct sockaddr_in serv_addr;
+    ticketFuture future;
 
-    safePrintLine("Attempting to connect to server %s:%d, %d retrys", ip, port, timeoutRetrys);
-    safePrintLine("Creating socket file descriptor ...");
+    do
+    {
+        if (ticketRequest(buyer->session, &future, msgId, numArgs, row, col))
+            return -1;
 
-    if ((socketHandle = socket(AF_INET, SOCK_STREAM, 0)) < 0) 
-    { 
-        perror("Socket failed");
+        if (ticketFutureWait(&future, 0) != TICKET_WAIT_OK)
+            return -1;
+    } while (waitIfThrottled(buyer, &(future.msg)));
 
-        pthread_mutex_lock(&socketLock);
-        socketStatus = -1;
-        pthread_mutex_unlock(&socketLock);
+    processServerMsg(buyer, buyer->session, &(future.msg));
+    return future.msg.id;
+}
 
-        return EXIT_FAILURE;
-    } 
+// Asks for the available seats in a rectangle of the map and blocks
+// until the response arrives. Returns its message id, or -1 if the
+// connection closed first.
+int requestRegionAndWait(buyerInfo* buyer, int row, int col, int numRows, int numCols)
+{
+    ticketFuture future;
 
-    safePrintLine("Setting socket info ...");
+    do
+    {
+        if (ticketRequest(buyer->session, &future, CLIENT_TICKET_REQUESTREGION, 4, row, col, numRows, numCols))
+            return -1;
 
-    memset(&serv_addr, '0', sizeof(serv_addr)); 
-   
-    serv_addr.sin_family = AF_INET; 
-    serv_addr.sin_port = htons(port); 
-       
-    // Convert IPv4 and IPv6 addresses from text to binary form 
-    if(inet_pton(AF_INET, ip, &serv_addr.sin_addr)<=0)  
-    { 
-        perror("Invalid address or address not supported");
+        if (ticketFutureWait(&future, 0) != TICKET_WAIT_OK)
+            return -1;
+    } while (waitIfThrottled(buyer, &(future.msg)));
 
-        pthread_mutex_lock(&socketLock);
-        socketStatus = -1;
-        pthread_mutex_unlock(&socketLock);
+    processServerMsg(buyer, buyer->session, &(future.msg));
+    return future.msg.id;
+}
 
-        return EXIT_FAILURE;
+// Keeps the seat and receipt of a successful purchase, which the
+// server asks for when the ticket is returned. Only manual mode
+// returns them.
+void rememberTicket(buyerInfo* buyer, int msgId, int arg0, int arg1, const netMsg* reply)
+{
+    if (!manualMode || buyer->numTickets >= MAX_OWNED_TICKETS) return;
+
+    ownedTicket* ticket = &(buyer->tickets[buyer->numTickets]);
+    if (msgId == CLIENT_TICKET_REQUESTPURCHASE && reply->id == SERVER_TICKET_TRANSACTION_SUCCESS &&
+        reply->numArgs >= 2)
+    {
+        ticket->row = arg0;
+        ticket->col = arg1;
+        msgArgText(reply, 1, ticket->receipt, sizeof(ticket->receipt));
     }
+    else if (reply->id == SERVER_TICKET_SEAT_ASSIGNED && reply->numArgs >= 5)
+    {
+        ticket->row = reply->args[0];
+        ticket->col = reply->args[1];
+        msgArgText(reply, 4, ticket->receipt, sizeof(ticket->receipt));
+    }
+    else return;
+
+    buyer->numTickets++;
+}
 
-    safePrintLine("Connecting to server ...");
+// Asks the server to refund ticket number index of the buyer's tickets
+// and blocks until the response arrives. The ticket is forgotten once
+// the server no longer holds a seat for it. Returns the response id,
+// or -1 if the connection closed first.
+int refundAndWait(buyerInfo* buyer, int index)
+{
+    ticketFuture future;
 
-    int cResult = connect(socketHandle, (struct sockaddr *)&serv_addr, sizeof(serv_addr));;
-    while (timeoutRetrys > 0 && cResult < 0)
-    {  
-        // Keep trying to connect until we run out of timout retrys
-        safePrintLine("Connection attempt failed. Retry in 1 second.");
-        sleep(1);
-        timeoutRetrys--;
-        cResult = connect(socketHandle, (struct sockaddr *)&serv_addr, sizeof(serv_addr)); 
+    if (index < 0 || index >= buyer->numTickets)
+    {
+        safePrintLine("Error: Invalid ticket.");
+        return 0;
     }
 
-    if (cResult < 0) 
-    { 
-        perror("Connection Failed");
+    do
+    {
+        ownedTicket* ticket = &(buyer->tickets[index]);
+        if (ticketRequestWithId(buyer->session, &future, ticket->receipt,
+                CLIENT_TICKET_REQUESTREFUND, 2, ticket->row, ticket->col))
+            return -1;
 
-        pthread_mutex_lock(&socketLock);
-        socketStatus = -1;
-        pthread_mutex_unlock(&socketLock);
+        if (ticketFutureWait(&future, 0) != TICKET_WAIT_OK)
+            return -1;
+    } while (waitIfThrottled(buyer, &(future.msg)));
 
-        return EXIT_FAILURE;
+    processServerMsg(buyer, buyer->session, &(future.msg));
+
+    if (future.msg.id == SERVER_TICKET_REFUNDED || future.msg.id == SERVER_TICKET_INVALID)
+    {
+        buyer->tickets[index] = buyer->tickets[--buyer->numTickets];
     }
+    return future.msg.id;
+}
 
-    pthread_mutex_lock(&socketLock);
-    socketStatus = 1;
-    pthread_mutex_unlock(&socketLock);
+// Sends a purchase with a request id unique to this buyer and purchase,
+// and sends it again with the same id if the reply takes longer than
+// PURCHASE_TIMEOUT_MS. Returns the response id, or -1 on failure.
+int purchaseAndWait(buyerInfo* buyer, int msgId, int numArgs, int arg0, int arg1)
+{
+    char requestId[48];
+    ticketFuture future;
+
+    snprintf(requestId, sizeof(requestId), "%d-%ld-%d-%u", (int)getpid(), (long)time(NULL),
+        buyer->id, buyer->purchasesSent++);
 
-    // Spin up client network handling thread
-    safePrintLine("Starting client thread ...");
-    int err = pthread_create(&clientThread, NULL, runClient, NULL);
-    if (err)
+    for (int attempt = 1; attempt <= PURCHASE_ATTEMPTS; attempt++)
     {
-        perror("Unable to create client thread");
+        if (ticketRequestWithId(buyer->session, &future, requestId, msgId, numArgs, arg0, arg1))
+            return -1;
+
+        int waited = ticketFutureWait(&future, PURCHASE_TIMEOUT_MS);
+        if (waited == TICKET_WAIT_OK && waitIfThrottled(buyer, &(future.msg)))
+        {
+            attempt--; // Turned away before it was run, does not count
+            continue;
+        }
+        if (waited == TICKET_WAIT_OK)
+        {
+            processServerMsg(buyer, buyer->session, &(future.msg));
+            rememberTicket(buyer, msgId, arg0, arg1, &(future.msg));
+            return future.msg.id;
+        }
+        if (waited == TICKET_WAIT_CLOSED) return -1;
 
-        pthread_mutex_lock(&socketLock);
-        socketStatus = -1;
-        pthread_mutex_unlock(&socketLock);
+        printFromClient(buyer->id, "No reply to purchase %s, sending it again.", requestId);
+    }
 
-        return EXIT_FAILURE;
+    return -1;
+}
+
+// Downloads the whole seat map into the buyer's cache, one
+// message worth of rows at a time. Returns 0 on success.
+int refreshSeatCache(buyerInfo* buyer)
+{
+    buyer->mapNextRow = 0;
+
+    while (buyer->mapNextRow >= 0 && buyer->mapNextRow < buyer->seatRows)
+    {
+        if (requestAndWait(buyer, CLIENT_TICKET_REQUESTMAP, 1, buyer->mapNextRow, 0) != SERVER_TICKET_MAP)
+            return 1;
     }
 
-    return 0;
+    return buyer->mapNextRow < 0;
 }
 
 // Handles the main menu display and input while in manual mode
-void showMainMenu()
+void showMainMenu(buyerInfo* buyer)
 {
     safePrint("\n_____________________\n"
                 "===== Main Menu =====\n"
                 "1. Get seating information\n"
                 "2. Check ticket availability\n"
                 "3. Purchase a ticket\n"
-                "4. Disconnect and exit\n\n"
+                "4. Show price tiers\n"
+                "5. Purchase a ticket by price tier\n"
+                "6. Count available seats in a section\n"
+                "7. Show available seats by row and section\n"
+                "8. Return a ticket\n"
+                "9. Disconnect and exit\n\n"
                 "Selection: ");
 
     lineLen = getline(&linebuffer, &lineSize, stdin);
-
-    pthread_mutex_lock(&socketLock);
+    if (lineLen <= 0)
+    {
+        // stdin closed, nothing more to do
+        ticketDisconnect(buyer->session);
+        return;
+    }
 
     // Strip new-line char at end of string
     if (linebuffer[lineLen - 1] == '\n')
         linebuffer[lineLen - 1] = '\0';
 
-    if (strlen(linebuffer) <= 0 || !socketStatus){
-        pthread_mutex_unlock(&socketLock);
+    if (strlen(linebuffer) <= 0 || !ticketConnected(buyer->session))
         return;
-    }
 
     int selection = atoi(linebuffer);
     int row = -1;
     int col = -1;
-    char intStr[20];
+    int numRows = 0;
+    int numCols = 0;
 
     // Process user selection
     switch (selection)
@@ -326,146 +594,272 @@ void showMainMenu()
         case 1:
             // Request available seating info from server
             safePrintLine("Sending server request ...");
-            sprintf(sendBuffer, "%d", CLIENT_TICKET_REQUESTAVAILABILITY);
-            send(socketHandle, sendBuffer, strlen(sendBuffer), 0);
+            requestAndWait(buyer, CLIENT_TICKET_REQUESTAVAILABILITY, 0, 0, 0);
             break;
         case 2:
             safePrint("Enter the row and column of the seat you wish to check: ");
-            scanf("%d %d", &row, &col);
+            if (scanf("%d %d", &row, &col) != 2) { }
 
             // flush stdin
             while ((selection = getchar()) != '\n' && selection != EOF) { }
 
             safePrintLine("Sending server request ...");
-            sprintf(sendBuffer, "%d", CLIENT_TICKET_REQUESTSTATUS);
-
-            strcat(sendBuffer, NETWORK_MSG_DELIM);
-            sprintf(intStr, "%d", row);
-            strcat(sendBuffer, intStr);
-
-            strcat(sendBuffer, NETWORK_MSG_DELIM);
-            sprintf(intStr, "%d", col);
-            strcat(sendBuffer, intStr);
-            send(socketHandle, sendBuffer, strlen(sendBuffer), 0);
+            requestAndWait(buyer, CLIENT_TICKET_REQUESTSTATUS, 2, row, col);
             break;
         case 3:
             safePrint("Enter the row and column of the seat you wish to purchase: ");
-            scanf("%d %d", &row, &col);
+            if (scanf("%d %d", &row, &col) != 2) { }
 
             // flush stdin
             while ((selection = getchar()) != '\n' && selection != EOF) { }
 
             safePrintLine("Sending server request ...");
-            sprintf(sendBuffer, "%d", CLIENT_TICKET_REQUESTPURCHASE);
+            purchaseAndWait(buyer, CLIENT_TICKET_REQUESTPURCHASE, 2, row, col);
+            break;
+        case 4:
+            safePrintLine("Sending server request ...");
+            requestAndWait(buyer, CLIENT_TICKET_REQUESTTIERS, 0, 0, 0);
+            break;
+        case 5:
+            safePrint("Enter the tier to purchase from (-1 for the cheapest): ");
+            if (scanf("%d", &row) != 1) { }
 
-            strcat(sendBuffer, NETWORK_MSG_DELIM);
-            sprintf(intStr, "%d", row);
-            strcat(sendBuffer, intStr);
+            // flush stdin
+            while ((selection = getchar()) != '\n' && selection != EOF) { }
 
-            strcat(sendBuffer, NETWORK_MSG_DELIM);
-            sprintf(intStr, "%d", col);
-            strcat(sendBuffer, intStr);
-            send(socketHandle, sendBuffer, strlen(sendBuffer), 0);
+            safePrintLine("Sending server request ...");
+            purchaseAndWait(buyer, CLIENT_TICKET_REQUESTTIERPURCHASE, 1, row, 0);
             break;
-        case 4:
+        case 6:
+            safePrint("Enter the first row and column, and the number of rows and columns: ");
+            if (scanf("%d %d %d %d", &row, &col, &numRows, &numCols) != 4) { }
+
+            // flush stdin
+            while ((selection = getchar()) != '\n' && selection != EOF) { }
+
             safePrintLine("Sending server request ...");
-            sprintf(sendBuffer, "%d", CLIENT_DISCONNECT);
-            send(socketHandle, sendBuffer, strlen(sendBuffer), 0);
-            disconnectFromServer();
+            requestRegionAndWait(buyer, row, col, numRows, numCols);
+            break;
+        case 7:
+            safePrintLine("Sending server request ...");
+            requestAndWait(buyer, CLIENT_TICKET_REQUESTSUMMARY, 0, 0, 0);
+            break;
+        case 8:
+            if (buyer->numTickets == 0)
+            {
+                safePrintLine("We have no tickets to return.");
+                break;
+            }
+
+            for (int i = 0; i < buyer->numTickets; i++)
+                safePrintLine("%d. Row: %2d, Col: %2d", i + 1, buyer->tickets[i].row, buyer->tickets[i].col);
+            safePrint("Enter the number of the ticket to return: ");
+            if (scanf("%d", &row) != 1) { }
+
+            // flush stdin
+            while ((selection = getchar()) != '\n' && selection != EOF) { }
+
+            safePrintLine("Sending server request ...");
+            refundAndWait(buyer, row - 1);
+            break;
+        case 9:
+            safePrintLine("Sending server request ...");
+            ticketSend(buyer->session, CLIENT_DISCONNECT);
+            ticketDisconnect(buyer->session);
             break;
         default:
             safePrintLine("Error: Invalid selection.");
             break;
     }
-
-    pthread_mutex_unlock(&socketLock);
 }
 
 // Executes the manual mode ticket purchasing loop, which
 // displays the main menu to the user
-void runManualLoop()
+void runManualLoop(buyerInfo* buyer)
 {
-    struct timespec tim, tim2;
-    tim.tv_sec  = 0;
-    tim.tv_nsec = 500000000L;
+    // Request available seating info from server
+    requestAndWait(buyer, CLIENT_TICKET_REQUESTAVAILABILITY, 0, 0, 0);
 
-    // Give client thread enough time to spin up (0.5 secs)
-    nanosleep(&tim , &tim2);
+    while (ticketConnected(buyer->session))
+        showMainMenu(buyer);
+}
+
+// Called in automatic mode. Attempts to buy a random seat that is not
+// known to be sold. Returns 1 if we bought it, 0 if we did not, or
+// -1 if the connection closed or no seat may be free.
+int buyRandomTicket(buyerInfo* buyer)
+{
+    int row, col;
 
-    while (socketStatus)
+    pthread_mutex_lock(&(buyer->cacheLock));
+    int picked = pickCachedSeat(&(buyer->cache), &row, &col);
+    pthread_mutex_unlock(&(buyer->cacheLock));
+    if (!picked) return -1;
+
+    printFromClient(buyer->id, "Buying random ticket. Row: %2d, Col: %2d", row, col);
+    int response = purchaseAndWait(buyer, CLIENT_TICKET_REQUESTPURCHASE, 2, row, col);
+
+    // Whatever the reason, this seat is no longer worth trying
+    if (response == SERVER_TICKET_TRANSACTION_SUCCESS ||
+        response == SERVER_TICKET_TRANSACTION_FAILED ||
+        response == SERVER_TICKET_INVALID)
     {
-        showMainMenu();
-        nanosleep(&tim , &tim2); // Give server enough time to respond (0.5 secs)
+        pthread_mutex_lock(&(buyer->cacheLock));
+        markSeatSold(&(buyer->cache), row, col);
+        pthread_mutex_unlock(&(buyer->cacheLock));
     }
+
+    if (response < 0) return -1;
+    return response == SERVER_TICKET_TRANSACTION_SUCCESS;
 }
 
-// Called in automatic mode. Attempts to buy a random seat ticket from the server
-void buyRandomTicket()
+// Executed in automatic mode, runs a loop that calls buyRandomTicket()
+// until the server disconnects us or the venue is full, pausing
+// intervalMs between attempts
+void runAutomaticLoop(buyerInfo* buyer)
 {
-    pthread_mutex_lock(&socketLock);
+    struct timespec tim;
+    tim.tv_sec = intervalMs / 1000;
+    tim.tv_nsec = (intervalMs % 1000) * 1000000L;
+    int failures = 0;
+
+    // We need the seat map size before we can pick seats
+    if (requestAndWait(buyer, CLIENT_TICKET_REQUESTAVAILABILITY, 0, 0, 0) != SERVER_TICKET_RANGE ||
+        buyer->seatRows <= 0 || buyer->seatCols <= 0)
+        return;
 
-    char intStr[20];
-    int row = rand() % seatRows;
-    int col = rand() % seatCols;
+    if (buyer->seatsAvailable == 0)
+    {
+        printFromClient(buyer->id, "Every seat is sold, no purchase attempts.");
+        return;
+    }
+
+    pthread_mutex_lock(&(buyer->cacheLock));
+    int err = initSeatCache(&(buyer->cache), buyer->seatRows, buyer->seatCols);
+    pthread_mutex_unlock(&(buyer->cacheLock));
+    if (err) return;
 
-    safePrintLine("\nBuying random ticket. Row: %2d, Col: %2d", row, col);
+    // Subscribe before downloading the map so no sale is missed
+    buyer->subscribed = 0;
+    requestAndWait(buyer, CLIENT_SUBSCRIBE, 1, 1, 0);
+    refreshSeatCache(buyer);
 
-    sprintf(sendBuffer, "%d", CLIENT_TICKET_REQUESTPURCHASE);
-    strcat(sendBuffer, NETWORK_MSG_DELIM);
+    while (ticketConnected(buyer->session))
+    {
+        pthread_mutex_lock(&(buyer->cacheLock));
+        int candidates = buyer->cache.numCandidates;
+        pthread_mutex_unlock(&(buyer->cacheLock));
 
-    sprintf(intStr, "%d", row);
-    strcat(sendBuffer, intStr);
-    strcat(sendBuffer, NETWORK_MSG_DELIM);
+        if (candidates == 0)
+        {
+            printFromClient(buyer->id, "Every seat is sold, no more purchase attempts.");
+            ticketSend(buyer->session, CLIENT_DISCONNECT);
+            break;
+        }
+
+        int bought = buyRandomTicket(buyer);
+        if (bought < 0) break;
+
+        // Others are buying too, catch up once our guesses keep missing.
+        // Subscribed buyers are kept up to date by the server instead.
+        failures = bought ? 0 : failures + 1;
+        if (failures >= MAP_REFRESH_FAILURES && !buyer->subscribed)
+        {
+            refreshSeatCache(buyer);
+            failures = 0;
+        }
 
-    sprintf(intStr, "%d", col);
-    strcat(sendBuffer, intStr);
-    send(socketHandle, sendBuffer, strlen(sendBuffer), 0);
+        if (intervalMs > 0) nanosleep(&tim, NULL);
+    }
 
-    pthread_mutex_unlock(&socketLock);
+    pthread_mutex_lock(&(buyer->cacheLock));
+    freeSeatCache(&(buyer->cache));
+    pthread_mutex_unlock(&(buyer->cacheLock));
 }
 
-// Executed in automatic mode, runs a loop that calls buyRandomTicket()
-// every half a second
-void runAutomaticLoop()
+// Connects a buyer to the server and runs the selected mode, reconnecting
+// when the server asks us to retry later. Returns non-zero if we could
+// not connect. Executed in it's own thread in automatic mode.
+void* runBuyer(void* _buyer)
 {
-    srand(time(NULL));
+    buyerInfo* buyer = (buyerInfo*)_buyer;
 
-    struct timespec tim, tim2;
-    tim.tv_sec  = 0;
-    tim.tv_nsec = 500000000L; // 0.5 seconds
+    for (int busyRetrys = 0; ; busyRetrys++)
+    {
+        buyer->retryAfterMs = 0;
 
-    // Give client thread enough time to spin up (0.5 secs)
-    nanosleep(&tim , &tim2);
+        if (unixPath[0] != '\0')
+        {
+            safePrintLine("Attempting to connect to server unix:%s, %d retrys", unixPath, timeoutRetrys);
+            buyer->session = ticketConnectUnix(netClient, unixPath, timeoutRetrys, onServerPush, buyer);
 
-    while (socketStatus)
-    {
-        buyRandomTicket();
-        nanosleep(&tim , &tim2); // Wait 0.5 seconds between purchase attempts
+            if (buyer->session != NULL && sharedMemory)
+            {
+                if (ticketUseSharedMemory(buyer->session, SHM_ATTACH_TIMEOUT_MS) == 0)
+                    printFromClient(buyer->id, "Using shared memory.");
+                else
+                    printFromClient(buyer->id, "Shared memory unavailable, using the unix socket.");
+            }
+        }
+        else
+        {
+            safePrintLine("Attempting to connect to server %s:%d, %d retrys", ipAddress, port, timeoutRetrys);
+            buyer->session = ticketConnect(netClient, ipAddress, port, timeoutRetrys, onServerPush, buyer);
+        }
+        if (buyer->session == NULL)
+        {
+            perror("Connection Failed");
+            return (void*)1;
+        }
+
+        printFromClient(buyer->id, "Successfully connected to the server.");
+
+        // Run in either manual or automatic mode
+        if (manualMode)
+            runManualLoop(buyer);
+        else
+            runAutomaticLoop(buyer);
+
+        ticketReleaseSession(buyer->session);
+        buyer->session = NULL;
+
+        if (buyer->retryAfterMs == 0 || busyRetrys >= MAX_BUSY_RETRYS) break;
+
+        // Add up to 50% random jitter so turned away clients
+        // do not all reconnect at the same moment
+        unsigned int waitMs = buyer->retryAfterMs + rand() % (buyer->retryAfterMs / 2 + 1);
+        printFromClient(buyer->id, "Reconnecting in %u ms ...", waitMs);
+
+        struct timespec tim;
+        tim.tv_sec = waitMs / 1000;
+        tim.tv_nsec = (waitMs % 1000) * 1000000L;
+        nanosleep(&tim, NULL);
     }
+
+    return NULL;
 }
 
-// Attempts to read the ip, port, and timeout settings from the given ini file path
-int readIniSettings(const char* filePath, char* ip, unsigned int* port, unsigned int* timeout)
+// Attempts to read the ip, port, timeout, unix_path and shared_memory settings from the given ini file path
+int readIniSettings(const char* filePath, char* ip, unsigned int* port, unsigned int* timeout,
+    char* unixSock, unsigned int* shm)
 {
     safePrintLine("Reading settings from: %s", filePath);
-    
-    // Open file
-    FILE* fp;
-    fp = fopen(filePath, "r");
-    if (fp == NULL)
+
+    // Read the whole file once
+    iniFile ini;
+    initIniFile(&ini);
+    if (loadIniFile(filePath, &ini))
     {
         safePrintLine("Error opening file. Using default settings.");
         return 1;
     }
 
-    char resultBuffer[64];
-
     // Read ip value
-    int ret = getIniValue(fp, "ip", resultBuffer, 64);
-    if (ret == 0)
+    const char* value = getIniString(&ini, "ip");
+    if (value != NULL && strlen(value) < 64)
     {
-        safePrintLine("Using ip from ini file: '%s'", resultBuffer);
-        ip = strcpy(ip, resultBuffer);
+        safePrintLine("Using ip from ini file: '%s'", value);
+        strcpy(ip, value);
     }
     else
     {
@@ -473,41 +867,41 @@ int readIniSettings(const char* filePath, char* ip, unsigned int* port, unsigned
     }
 
     // Read port value
-    ret = getIniValue(fp, "port", resultBuffer, 64);
-    if (ret == 0)
-    {
-        unsigned int p = atoi(resultBuffer);
-        safePrintLine("Using port # from ini file: '%d'", p);
-        *port = p;
-    }
+    if (getIniUInt(&ini, "port", port) == 0)
+        safePrintLine("Using port # from ini file: '%d'", *port);
     else
-    {
         safePrintLine("Error reading port # from ini file. Using default.");
-    }
-    
+
     // Read timout value
-    ret = getIniValue(fp, "timeout", resultBuffer, 64);
-    if (ret == 0)
+    if (getIniUInt(&ini, "timeout", timeout) == 0)
+        safePrintLine("Using timeout # from ini file: '%d'", *timeout);
+    else
+        safePrintLine("Error reading timeout # from ini file. Using default.");
+
+    // Read the optional unix socket path, which replaces ip and port
+    value = getIniString(&ini, "unix_path");
+    if (value != NULL && value[0] != '\0' && strlen(value) < 108)
     {
-        unsigned int t = atoi(resultBuffer);
-        safePrintLine("Using timeout # from ini file: '%d'", t);
-        *timeout = t;
+        safePrintLine("Using unix socket from ini file: '%s'", value);
+        strcpy(unixSock, value);
     }
-    else
+    else if (value != NULL)
     {
-        safePrintLine("Error reading timeout # from ini file. Using default.");
+        safePrintLine("Error reading unix_path from ini file. Using TCP.");
     }
 
-    fclose(fp);
+    // Read the optional shared memory switch, which needs unix_path
+    if (getIniUInt(&ini, "shared_memory", shm) == 0)
+        safePrintLine("Using shared_memory from ini file: '%u'", *shm);
+
+    freeIniFile(&ini);
     return 0;
 }
 
 // Program entry point
 int main(int argc, char const *argv[]) 
 { 
-    char ipAddress[64] = DEFAULT_IP;
-    unsigned int port = DEFAULT_PORT;
-    unsigned int timeoutRetrys = DEFAULT_TIMEOUT;
+    buyerInfo buyers[MAX_SESSIONS];
 
     // Process command line arguments
     int curArg = 1;
@@ -517,37 +911,70 @@ int main(int argc, char const *argv[])
             manualMode = 1;
         else if (strstr(argv[curArg], "-automatic") != NULL)
             manualMode = 0;
+        else if (strcmp(argv[curArg], "-sessions") == 0 && curArg + 1 < argc)
+        {
+            numSessions = atoi(argv[++curArg]);
+            if (numSessions == 0) numSessions = DEFAULT_SESSIONS;
+            if (numSessions > MAX_SESSIONS) numSessions = MAX_SESSIONS;
+        }
+        else if (strcmp(argv[curArg], "-interval") == 0 && curArg + 1 < argc)
+            intervalMs = atoi(argv[++curArg]);
         else
         {
-            if (readIniSettings(argv[curArg], ipAddress, &port, &timeoutRetrys) > 0)
+            if (readIniSettings(argv[curArg], ipAddress, &port, &timeoutRetrys, unixPath, &sharedMemory) > 0)
             {
                 safePrintLine("Unknown or invalid command line arguments.");
-                safePrintLine("Correct usage: %s [settings_file] [-manual | -automatic]", argv[0]);
+                safePrintLine("Correct usage: %s [settings_file] [-manual | -automatic] [-sessions n] [-interval ms]", argv[0]);
             }
         }
         curArg++;
     }
 
-    // Connect to server and spin up client thread
-    int err = startClient(ipAddress, port, timeoutRetrys);
-    if (err) return err;
+    srand(time(NULL) ^ getpid());
+
+    netClient = ticketClientCreate();
+    if (netClient == NULL)
+    {
+        perror("Unable to start network thread");
+        return EXIT_FAILURE;
+    }
+
+    // Manual mode has a single buyer driven by the menu
+    if (manualMode) numSessions = 1;
 
-    safePrintLine("Successfully connected to the server.");
+    memset(buyers, 0, sizeof(buyers));
+    for (int i = 0; i < numSessions; i++)
+    {
+        buyers[i].id = i;
+        pthread_mutex_init(&(buyers[i].cacheLock), NULL);
+        if (numSessions == 1)
+            continue;
 
-    // Run in either manual or automatic mode
-    if (manualMode)
-        runManualLoop();
+        if (pthread_create(&(buyers[i].thread), NULL, runBuyer, &(buyers[i])))
+        {
+            perror("Unable to create buyer thread");
+            numSessions = i;
+            break;
+        }
+    }
+
+    int err = 0;
+    if (numSessions == 1)
+    {
+        err = (runBuyer(&(buyers[0])) != NULL);
+    }
     else
-        runAutomaticLoop();
-    
-    pthread_mutex_lock(&socketLock);
-    disconnectFromServer();
-    pthread_mutex_unlock(&socketLock);
+    {
+        for (int i = 0; i < numSessions; i++)
+            pthread_join(buyers[i].thread, NULL);
+    }
+
+    ticketClientDestroy(netClient);
 
     free(linebuffer);
     linebuffer = NULL;
 
     safePrintLine("Exiting main thread ...");
 
-    return 0; 
+    return err ? EXIT_FAILURE : 0; 
 }
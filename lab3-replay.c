@@ -0,0 +1,530 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the client side
+// ==============================
+//
+// Build and Run instructions:
+//
+// To build, open a terminal and execute:
+// gcc -O2 -o replay lab3-replay.c -pthread
+//
+// Capture traffic with the server's -capture option:
+// ./server -capture /tmp/traffic.trace
+//
+// Then replay it against a fresh server:
+// ./replay /tmp/traffic.trace [-ip addr] [-port n]
+//          [-unix path] [-speed x]
+//
+// ==============================
+//
+// Usage:
+//
+// Sends the messages of a capture to a server again, each on
+// its own connection as in the capture, in the same order and,
+// by default, with the same timing. -speed 2 plays it twice as
+// fast, -speed 0 as fast as the server takes it. Connections
+// are opened and closed where the capture recorded it, or
+// before their first message for connections that were already
+// open when the capture started.
+//
+// Replies are read as they arrive. Tagged replies are matched
+// to their request to report latency. A connection is only
+// closed once its requests were answered, so the server serves
+// every captured request even when it falls behind. The report
+// also shows how far sending fell behind the capture's timing,
+// which tells whether the server kept up at the speed asked for.
+//
+// Requests to move onto shared memory are skipped, the replay
+// keeps every connection on its socket.
+//
+// ==============================
+
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "networkmsg.h"
+#include "tracefile.h"
+
+#define DEFAULT_IP "127.0.0.1"
+#define DEFAULT_PORT 5432
+#define REPLY_BUFFER_SIZE 4096
+#define MAX_PENDING_TAGS 256  // Tagged requests tracked per connection
+#define DRAIN_EVERY 32        // Messages sent between reads at full speed
+#define DRAIN_TIMEOUT_MS 2000 // Time allowed for the last replies
+
+// One connection from the capture
+typedef struct replayConn_ {
+    unsigned int traceId;
+    int socket;          // -1 once closed
+    char in[REPLY_BUFFER_SIZE];
+    int inLen;
+    int tags[MAX_PENDING_TAGS];
+    long long sentNs[MAX_PENDING_TAGS];
+    int pendingHead;
+    int pendingCount;
+} replayConn;
+
+// Connections, and an open addressing table from trace id to index
+typedef struct replayState_ {
+    replayConn* conns;
+    int numConns;
+    int maxConns;
+    int* table;  // -1 = empty
+    int tableSize;
+    int epollFd;
+    const char* ip;
+    const char* unixPath;
+    unsigned int port;
+    long long* latencies;
+    int numLatencies;
+    int maxLatencies;
+    unsigned long sent;
+    unsigned long skipped;
+    unsigned long replies;
+    unsigned long connectFailures;
+    unsigned long serverClosed;
+    long long maxLagNs;
+} replayState;
+
+// Returns the current time in nanoseconds
+long long nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int compareLongLong(const void* a, const void* b)
+{
+    long long diff = *(const long long*)a - *(const long long*)b;
+    return (diff > 0) - (diff < 0);
+}
+
+// Doubles the size of the trace id table and reinserts every connection
+int growConnTable(replayState* state)
+{
+    int size = state->tableSize ? state->tableSize * 2 : 1024;
+    int* table = malloc(sizeof(int) * size);
+    if (table == NULL) return 1;
+
+    for (int i = 0; i < size; i++) table[i] = -1;
+    for (int c = 0; c < state->numConns; c++)
+    {
+        unsigned int slot = state->conns[c].traceId * 2654435761u & (size - 1);
+        while (table[slot] >= 0) slot = (slot + 1) & (size - 1);
+        table[slot] = c;
+    }
+
+    free(state->table);
+    state->table = table;
+    state->tableSize = size;
+    return 0;
+}
+
+// Returns the connection with traceId, adding a closed one if it is
+// new. Returns NULL if out of memory.
+replayConn* findConn(replayState* state, unsigned int traceId)
+{
+    if (state->numConns * 2 >= state->tableSize && growConnTable(state)) return NULL;
+
+    unsigned int slot = traceId * 2654435761u & (state->tableSize - 1);
+    while (state->table[slot] >= 0)
+    {
+        replayConn* conn = &(state->conns[state->table[slot]]);
+        if (conn->traceId == traceId) return conn;
+        slot = (slot + 1) & (state->tableSize - 1);
+    }
+
+    if (state->numConns == state->maxConns)
+    {
+        int maxConns = state->maxConns ? state->maxConns * 2 : 256;
+        replayConn* conns = realloc(state->conns, sizeof(replayConn) * maxConns);
+        if (conns == NULL) return NULL;
+        state->conns = conns;
+        state->maxConns = maxConns;
+    }
+
+    replayConn* conn = &(state->conns[state->numConns]);
+    conn->traceId = traceId;
+    conn->socket = -1;
+    conn->inLen = 0;
+    conn->pendingHead = 0;
+    conn->pendingCount = 0;
+    state->table[slot] = state->numConns++;
+    return conn;
+}
+
+// Connects to the server over the unix socket if one was given, else
+// over TCP. Returns the socket, or -1.
+int connectToServer(replayState* state)
+{
+    int sock;
+
+    if (state->unixPath != NULL)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, state->unixPath, sizeof(addr.sun_path) - 1);
+
+        if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) return -1;
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0) return sock;
+    }
+    else
+    {
+        struct sockaddr_in addr;
+        int noDelay = 1;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(state->port);
+        if (inet_pton(AF_INET, state->ip, &addr.sin_addr) <= 0) return -1;
+
+        if ((sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) return -1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0) return sock;
+    }
+
+    close(sock);
+    return -1;
+}
+
+// Opens conn's socket. Returns 0 on success.
+int openConn(replayState* state, replayConn* conn)
+{
+    conn->socket = connectToServer(state);
+    if (conn->socket < 0)
+    {
+        state->connectFailures++;
+        return 1;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = conn - state->conns; // conns may move as it grows
+    epoll_ctl(state->epollFd, EPOLL_CTL_ADD, conn->socket, &event);
+    conn->inLen = 0;
+    conn->pendingCount = 0;
+    return 0;
+}
+
+void closeConn(replayConn* conn)
+{
+    if (conn->socket < 0) return;
+    close(conn->socket); // Also takes it out of the epoll set
+    conn->socket = -1;
+}
+
+// Keeps how long a reply took to arrive
+void addLatency(replayState* state, long long latencyNs)
+{
+    if (state->numLatencies == state->maxLatencies)
+    {
+        int maxLatencies = state->maxLatencies ? state->maxLatencies * 2 : 4096;
+        long long* latencies = realloc(state->latencies, sizeof(long long) * maxLatencies);
+        if (latencies == NULL) return;
+        state->latencies = latencies;
+        state->maxLatencies = maxLatencies;
+    }
+    state->latencies[state->numLatencies++] = latencyNs;
+}
+
+// Matches a reply's tag to the oldest request sent with it
+void matchReply(replayState* state, replayConn* conn, const char* line, long long now)
+{
+    state->replies++;
+    if (line[0] != NETWORK_MSG_TAG) return;
+
+    int tag = atoi(line + 1);
+    for (int i = 0; i < conn->pendingCount; i++)
+    {
+        int index = (conn->pendingHead + i) % MAX_PENDING_TAGS;
+        if (conn->tags[index] != tag) continue;
+
+        addLatency(state, now - conn->sentNs[index]);
+
+        // Close the gap, older requests still waiting keep their order
+        for (int j = i; j > 0; j--)
+        {
+            int to = (conn->pendingHead + j) % MAX_PENDING_TAGS;
+            int from = (conn->pendingHead + j - 1) % MAX_PENDING_TAGS;
+            conn->tags[to] = conn->tags[from];
+            conn->sentNs[to] = conn->sentNs[from];
+        }
+        conn->pendingHead = (conn->pendingHead + 1) % MAX_PENDING_TAGS;
+        conn->pendingCount--;
+        return;
+    }
+}
+
+// Reads whatever conn's socket has and handles every complete reply
+void readReplies(replayState* state, replayConn* conn)
+{
+    ssize_t bytesRead = recv(conn->socket, conn->in + conn->inLen, sizeof(conn->in) - conn->inLen - 1, MSG_DONTWAIT);
+    if (bytesRead < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (bytesRead <= 0)
+    {
+        state->serverClosed++;
+        closeConn(conn);
+        return;
+    }
+
+    long long now = nowNs();
+    conn->inLen += bytesRead;
+    conn->in[conn->inLen] = '\0';
+
+    char* line = conn->in;
+    char* end;
+    while ((end = memchr(line, NETWORK_MSG_END[0], conn->inLen - (line - conn->in))) != NULL)
+    {
+        *end = '\0';
+        matchReply(state, conn, line, now);
+        line = end + 1;
+    }
+
+    // A reply longer than the buffer is dropped rather than stalling
+    conn->inLen -= line - conn->in;
+    if (conn->inLen == sizeof(conn->in) - 1) conn->inLen = 0;
+    memmove(conn->in, line, conn->inLen);
+}
+
+// Handles replies for up to timeoutMs, returning early once one batch
+// has been read. A timeout of 0 only reads what already arrived.
+void pollReplies(replayState* state, int timeoutMs)
+{
+    struct epoll_event events[64];
+    int numEvents = epoll_wait(state->epollFd, events, 64, timeoutMs);
+
+    for (int i = 0; i < numEvents; i++)
+        readReplies(state, &(state->conns[events[i].data.u32]));
+}
+
+// Returns 1 if msg asks to move the connection onto shared memory
+int isShmAttach(const char* msg, int length)
+{
+    const char* id = msg;
+    if (length > 0 && msg[0] == NETWORK_MSG_TAG)
+    {
+        id = memchr(msg, NETWORK_MSG_DELIM[0], length);
+        if (id == NULL) return 0;
+        id++;
+    }
+    return atoi(id) == CLIENT_SHM_ATTACH;
+}
+
+// Sends one captured message with its terminator
+void sendMessage(replayState* state, replayConn* conn, char* msg, int length)
+{
+    if (isShmAttach(msg, length))
+    {
+        state->skipped++;
+        return;
+    }
+
+    if (conn->socket < 0 && openConn(state, conn)) return;
+
+    msg[length] = NETWORK_MSG_END[0];
+    const char* data = msg;
+    int left = length + 1;
+    while (left > 0)
+    {
+        ssize_t written = send(conn->socket, data, left, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0)
+        {
+            state->serverClosed++;
+            closeConn(conn);
+            return;
+        }
+        data += written;
+        left -= written;
+    }
+
+    state->sent++;
+
+    if (msg[0] == NETWORK_MSG_TAG)
+    {
+        // Forget the oldest request if too many are waiting
+        if (conn->pendingCount == MAX_PENDING_TAGS)
+        {
+            conn->pendingHead = (conn->pendingHead + 1) % MAX_PENDING_TAGS;
+            conn->pendingCount--;
+        }
+        int index = (conn->pendingHead + conn->pendingCount++) % MAX_PENDING_TAGS;
+        conn->tags[index] = atoi(msg + 1);
+        conn->sentNs[index] = nowNs();
+    }
+}
+
+// Closes conn once the replies to its requests arrived, as the captured
+// client did before it disconnected. Closing sooner would make the
+// server drop requests it has not read yet when the replay runs ahead
+// of it.
+void finishConn(replayState* state, replayConn* conn)
+{
+    long long deadline = nowNs() + DRAIN_TIMEOUT_MS * 1000000LL;
+    while (conn->socket >= 0 && conn->pendingCount > 0 && nowNs() < deadline)
+        pollReplies(state, 10);
+    closeConn(conn);
+}
+
+// Returns the number of tagged requests still waiting for a reply
+int pendingReplies(replayState* state)
+{
+    int pending = 0;
+    for (int c = 0; c < state->numConns; c++)
+        if (state->conns[c].socket >= 0) pending += state->conns[c].pendingCount;
+    return pending;
+}
+
+// Program entry point
+int main(int argc, char const *argv[])
+{
+    const char* tracePath = NULL;
+    double speed = 1;
+    int invalidArgs = 0;
+    replayState state;
+    memset(&state, 0, sizeof(state));
+    state.ip = DEFAULT_IP;
+    state.port = DEFAULT_PORT;
+
+    // Process command line arguments
+    for (int curArg = 1; curArg < argc; curArg++)
+    {
+        const char* value = (curArg + 1 < argc) ? argv[curArg + 1] : NULL;
+
+        if (strcmp(argv[curArg], "-ip") == 0 && value != NULL)
+            state.ip = argv[++curArg];
+        else if (strcmp(argv[curArg], "-port") == 0 && value != NULL)
+            state.port = atoi(argv[++curArg]);
+        else if (strcmp(argv[curArg], "-unix") == 0 && value != NULL)
+            state.unixPath = argv[++curArg];
+        else if (strcmp(argv[curArg], "-speed") == 0 && value != NULL)
+            speed = atof(argv[++curArg]);
+        else if (argv[curArg][0] != '-' && tracePath == NULL)
+            tracePath = argv[curArg];
+        else
+            invalidArgs = 1;
+    }
+
+    if (invalidArgs || tracePath == NULL || speed < 0)
+    {
+        fprintf(stderr, "Correct usage: %s trace [-ip addr] [-port n] [-unix path] [-speed x, 0 = max]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    traceReader reader;
+    if (openTrace(&reader, tracePath))
+    {
+        perror("Unable to open trace");
+        return EXIT_FAILURE;
+    }
+
+    state.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (state.epollFd < 0)
+    {
+        perror("Unable to create epoll instance");
+        return EXIT_FAILURE;
+    }
+
+    // One extra byte for the terminator added when sending
+    char* msg = malloc(TRACE_MAX_MESSAGE + 1);
+    if (msg == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    traceRecord record;
+    int result;
+    long long traceUs = 0;
+    long long start = nowNs();
+
+    while ((result = readTraceRecord(&reader, &record, msg)) > 0)
+    {
+        replayConn* conn = findConn(&state, record.connId);
+        if (conn == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+        traceUs = record.timeUs;
+
+        // Wait for the record's time, reading replies meanwhile
+        if (speed > 0)
+        {
+            long long due = start + (long long)(record.timeUs * 1000 / speed);
+            long long now;
+            while ((now = nowNs()) < due)
+                pollReplies(&state, (int)((due - now + 999999) / 1000000));
+            if (now - due > state.maxLagNs) state.maxLagNs = now - due;
+        }
+        else if (state.sent % DRAIN_EVERY == 0)
+            pollReplies(&state, 0);
+
+        if (record.kind == TRACE_CONNECT)
+        {
+            closeConn(conn);
+            openConn(&state, conn);
+        }
+        else if (record.kind == TRACE_DISCONNECT)
+            finishConn(&state, conn);
+        else
+            sendMessage(&state, conn, msg, record.length);
+    }
+
+    if (result < 0) printf("Trace is damaged or cut short, replayed the records before the damage.\n");
+    long long sendNs = nowNs() - start;
+
+    // Give the last requests time to be answered
+    long long drainEnd = nowNs() + DRAIN_TIMEOUT_MS * 1000000LL;
+    while (pendingReplies(&state) > 0 && nowNs() < drainEnd)
+        pollReplies(&state, 10);
+    for (int c = 0; c < state.numConns; c++)
+        closeConn(&(state.conns[c]));
+
+    time_t captured = reader.startEpochNs / 1000000000LL;
+    printf("Trace %s, captured %s", tracePath, ctime(&captured));
+    printf("%d connections, %lu messages over %.3f s of capture\n", state.numConns,
+        state.sent + state.skipped, traceUs / 1e6);
+    printf("Sent %lu messages in %.3f s (%.0f msgs/s) at ", state.sent, sendNs / 1e9, state.sent * 1e9 / sendNs);
+    if (speed > 0) printf("%gx speed, at most %.1f ms behind the capture\n", speed, state.maxLagNs / 1e6);
+    else printf("full speed\n");
+    if (state.skipped > 0)
+        printf("Skipped %lu shared memory requests\n", state.skipped);
+    if (state.connectFailures > 0 || state.serverClosed > 0)
+        printf("%lu connections failed to open, %lu were closed by the server\n",
+            state.connectFailures, state.serverClosed);
+
+    printf("%lu replies, %d matched to tagged requests", state.replies, state.numLatencies);
+    if (state.numLatencies > 0)
+    {
+        long long total = 0;
+        for (int i = 0; i < state.numLatencies; i++) total += state.latencies[i];
+        qsort(state.latencies, state.numLatencies, sizeof(long long), compareLongLong);
+        printf(": avg %.1f us, p50 %.1f us, p99 %.1f us", total / 1000.0 / state.numLatencies,
+            state.latencies[state.numLatencies / 2] / 1000.0,
+            state.latencies[(int)(state.numLatencies * 0.99)] / 1000.0);
+    }
+    printf("\n");
+
+    closeTrace(&reader);
+    close(state.epollFd);
+    free(msg);
+    free(state.conns);
+    free(state.table);
+    free(state.latencies);
+    return 0;
+}
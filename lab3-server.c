@@ -17,368 +17,3898 @@
 // To build, open a terminal and execute:
 // gcc -o server lab3-server.c -pthread
 //
+// To include the io_uring engine (Linux 6.0 or newer):
+// gcc -DUSE_IO_URING -o server lab3-server.c -pthread
+//
+// To profile lock contention (see lockprofile.h):
+// gcc -DLOCK_PROFILE -o server lab3-server.c -pthread
+//
 // To run, open a terminal and execute:
 // ./server
 //
 // Optional command line parameters:
-// ./server [seat map rows] [seat map columns]
+// ./server [seat map rows] [seat map columns] [-maxconn n]
+//          [-backlog n] [-acceptrate n] [-retryafter ms]
+//          [-idletimeout ms] [-readtimeout ms]
+//          [-upgradesock path] [-takeover path]
+//          [-broadcasttick ms] [-maxoutqueue bytes]
+//          [-port n] [-loglevel level] [-config path]
+//          [-engine threads|uring|tasks] [-unixsock path]
+//          [-workers n] [-iocpus list] [-workercpus list]
+//          [-backgroundcpus list] [-dedupentries n]
+//          [-ratelimit n] [-iprate n]
+//          [-waitingroom n] [-admitrate n]
+//          [-capture path] [-exitsoldout 0|1]
 //
 // ==============================
 //
 // Usage:
 //
+// Every setting can also be read from a config file given
+// with -config, see server-settings.ini for the keys. Command
+// line values take precedence over the file. Send the server
+// SIGHUP to reread the file: timeouts, rate limits, the listen
+// backlog, buffer sizes, thread stack size and the log level
+// change right away. The port and connection limit need a
+// restart.
+//
+// Online resize:
+// A reload that changes rows or cols resizes the seat map
+// without stopping sales, such as to open a held back row or
+// add a section. Seats keep their state and added seats are
+// for sale. A size that would cut off sold seats is refused
+// with a warning and the map keeps its size. The new layout is
+// built while buyers keep using the old one, and buyers only
+// wait while the seats they changed meanwhile are copied over
+// and the new layout is swapped in. Clients learn the new size
+// from CLIENT_TICKET_REQUESTAVAILABILITY. Sizes given on the
+// command line override the file and so cannot be reloaded.
+// After a takeover the map keeps the old server's size until a
+// reload changes rows or cols in the file.
+//
+// I/O engines:
+// By default every client is served by its own thread using
+// blocking reads. -engine uring serves every client from one
+// io_uring event loop instead: connections are accepted and
+// read with multishot requests into a shared pool of kernel
+// provided buffers, and the replies produced by a batch of
+// completions are submitted together with one system call.
+// -engine tasks serves clients from a fixed set of worker
+// threads (-workers, by default one per worker CPU). A client
+// with data to read becomes a task on a worker's queue, and
+// workers with nothing to do steal tasks from busy ones, so a
+// few busy clients can use every core and idle clients hold
+// no thread at all. A client that keeps sending gives up its
+// worker after each full read so others get a turn.
+// The uring and tasks engines do not support -upgradesock or
+// -takeover.
+//
 // If you want to specify a specific seat map size,
 // provide the number of rows and columns as command
 // line arguemnts. Default size is 5x5.
 //
 // By default the server will not accept more than 5
-// simultaneous client connections. You can change this
-// value to whatever by editing MAX_CONNECTIONS below.
+// simultaneous client connections. Use -maxconn to change
+// the limit and -backlog to change the listen() backlog.
+// -acceptrate limits how many new connections are admitted
+// per second (0 = no limit).
+//
+// Connections over either limit are closed right away with
+// a SERVER_RETRY_LATER message that tells the client how
+// many milliseconds to wait (-retryafter) before reconnecting.
+//
+// Waiting room:
+// With -waitingroom n, up to n connections that find every slot
+// taken wait in line instead of being turned away, and are only
+// turned away once the line is full. A waiting connection is just
+// its socket, it has no thread, slot or buffer. Clients are
+// admitted first come first served as slots free up, at most
+// -admitrate per second (0 = as fast as slots free up). Every
+// waiting_update_ms each waiting client is pushed SERVER_WAITING
+// with its place in line and an estimated wait based on recent
+// admissions, and clients that hung up leave the line. Requests
+// sent while waiting are answered once the client is admitted.
+// When the server sells out the line is sent SERVER_DISCONNECT,
+// and after a takeover SERVER_RETRY_LATER.
+//
+// Price tiers:
+// tier_prices in the config file splits the seats into tiers
+// by row, front rows first, and tier_rows gives the number of
+// rows in every tier but the last, which takes the rest. For
+// example tier_prices=120,80,40 and tier_rows=2,3. Clients ask
+// for each tier's price and free seats with
+// CLIENT_TICKET_REQUESTTIERS, and buy the next seat of a tier,
+// or of the cheapest tier with seats left, with
+// CLIENT_TICKET_REQUESTTIERPURCHASE. Both are answered from
+// per-tier counters and free lists without scanning the map.
+//
+// Safe purchase retries:
+// Both purchase requests take an optional request id after
+// their other arguments, any text of up to 47 bytes the client
+// picks, such as a UUID. The server remembers the reply it sent
+// for the last -dedupentries ids (0 turns this off) and sends the
+// same reply again when an id comes back, even on another
+// connection, instead of buying again. A retry that arrives while
+// the first attempt is still running waits for it. An id reused
+// for a different seat or tier is refused. The ids are not passed
+// on by a takeover.
+//
+// Refunds:
+// Every purchase reply ends with a random receipt that the server
+// keeps with the seat, also across a takeover. CLIENT_TICKET_REQUESTREFUND
+// with the seat's row, column and receipt returns the seat, so only
+// its buyer can, and a retried purchase of a refunded seat is told
+// so. The seat's counts and free lists are updated in O(1)
+// and it is the next one sold from its tier. By default the server
+// disconnects everyone and exits once every seat is sold. With
+// -exitsoldout 0 it pushes SERVER_SALES_CHANGED to every client
+// instead, keeps serving them and turns new connections away with
+// SERVER_RETRY_LATER until a seat is returned, when it pushes
+// SERVER_SALES_CHANGED again and accepts clients as before.
+//
+// Connection slots come from a free list and cost a couple
+// hundred bytes each (logged at startup), so -engine uring can
+// hold 100000 or more connections within the open file limit.
+// Buffers are lent from a shared pool only while a connection
+// has output or a partial message waiting. With -engine threads
+// each connection also costs a thread and its stack.
+//
+// Request rate limits:
+// -ratelimit caps the requests per second each connection is
+// served and -iprate the requests per second from each client IP
+// address over all its connections (0 = no limit for either).
+// rate_burst and ip_rate_burst in the config file set how many
+// requests may arrive at once, one second's worth by default.
+// Both are token buckets checked before a request is parsed. A
+// request over either limit only has its tag read and gets a
+// SERVER_RETRY_LATER reply with the milliseconds until it would
+// be served. Each connection's bucket is only used by the thread
+// serving it. The address buckets are spread over 64 separately
+// locked stripes. Unix socket and shared memory clients have no
+// address and only the per connection limit applies to them.
+//
+// Clients that send nothing for -idletimeout ms, or that
+// leave a message half sent for -readtimeout ms, are
+// disconnected. A value of 0 disables the timeout.
+//
+// Unix socket listener:
+// -unixsock /tmp/ticketserver.sock also accepts clients on a
+// unix stream socket, next to the TCP port. Clients on the same
+// machine skip the TCP/IP stack, set unix_path in the client's
+// settings file to use it. Both listeners share every limit and
+// are served the same way. The socket file is removed when the
+// server exits, and handed to the new server on a takeover.
+//
+// Shared memory transport:
+// A client on the unix socket can send CLIENT_SHM_ATTACH to move
+// its connection onto a pair of ring buffers in a memfd shared
+// with the server. The reply SERVER_SHM_READY carries the memfd
+// and two eventfds, after which every request and reply goes
+// through the rings and the socket only tells each side when the
+// other hangs up. A side only signals the eventfd when the other
+// says it is about to sleep, and first spins for up to
+// shm_spin_us microseconds (skipped on a single CPU). Only the
+// threads engine supports it.
+//
+// CPU placement:
+// Threads float across every CPU by default. -iocpus pins the
+// accept loop (or the io_uring event loop), -workercpus the
+// client threads and -backgroundcpus the broadcaster, timer,
+// config reload and upgrade threads. Lists look like 0-3,8.
+// Client threads each get one CPU of their list, in turn by
+// client slot. Each pinned thread allocates its memory on its
+// CPU's NUMA node: client threads their buffers and shared
+// memory rings, the I/O thread the seat map and client pool.
+//
+// Zero downtime restarts:
+// Start the server with -upgradesock /tmp/ticket.sock. To
+// deploy a new build, run it with -takeover /tmp/ticket.sock.
+// The running server pauses, passes its listening socket,
+// every client socket and the seat map to the new server,
+// and exits once the new server confirms it is serving.
+// No client connections are dropped. The new server then
+// listens on the same path for the next upgrade.
+//
+// Seat change pushes:
+// Clients that send CLIENT_SUBSCRIBE receive SERVER_SEATS_CHANGED
+// messages listing the seats sold, and any returned, since the
+// last push. Changes are collected and sent once every
+// -broadcasttick ms by a broadcaster thread. Replies and pushes
+// are written without blocking, bytes a client cannot take yet
+// wait in a per-client queue. Clients whose queue grows past
+// -maxoutqueue bytes are disconnected instead of slowing anyone
+// else down.
+//
+// Traffic capture:
+// -capture /tmp/traffic.trace records every message clients
+// send, with the time and the connection it came on, plus each
+// connect and disconnect, in the binary format of tracefile.h.
+// Records are copied into a memory buffer that a separate thread
+// writes out, so serving never waits on the disk, and are dropped
+// if the disk falls a whole buffer behind. Setting capture_path
+// and sending SIGHUP starts, moves or (set empty) stops a capture
+// while running. Buffers reach the disk at least once a second,
+// a server that is killed loses at most that last second. Play a
+// capture back with lab3-replay.c.
+//
+// Lock profiling:
+// A build with -DLOCK_PROFILE times every acquisition of the
+// seat map lock, socketLock and the print lock. Send SIGUSR1 for
+// a report, one is also printed when the server exits. Each line
+// is one place in the code that takes a lock: how often, how
+// often it had to wait, and the total, 99th percentile and
+// longest wait and hold times.
 // ==============================
 
+#define _GNU_SOURCE // For pipe2() and CPU affinity
+
 #include <unistd.h> 
 #include <stdio.h> 
 #include <sys/socket.h> 
 #include <stdlib.h> 
 #include <stdarg.h>
 #include <netinet/in.h> 
+#include <sys/resource.h>
+#include <time.h>
 #include <pthread.h>
 #include <string.h> 
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/random.h>
 #include "seatmap.h"
 #include "networkmsg.h"
+#include "msgparser.h"
 #include "threadsafeprint.h"
+#include "conntimer.h"
+#include "handoff.h"
+#include "broadcaster.h"
+#include "iniParser.h"
+#include "shmring.h"
+#include "cpuplacement.h"
+#include "conntable.h"
+#include "dedupcache.h"
+#include "ratelimit.h"
+#include "waitroom.h"
+#include "tracefile.h"
+#include "taskpool.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#ifdef USE_IO_URING
+#include "uringengine.h"
+#endif
+
+#define DEFAULT_SEATS_ROWS 5 // Default size of seat map rows
+#define DEFAULT_SEATS_COLS 5 // Default size of seat map columns
+#define MAX_SEATS_ROWS 25    // Max allowed size of seat map rows
+#define MAX_SEATS_COLS 25    // Max allowed size of seat map columns
+
+#define DEFAULT_PORT 5432    // Listening port for server
+#define MAX_UNIX_PATH 108    // Size of sockaddr_un.sun_path
+#define MAX_CAPTURE_PATH 256
+#define MSG_BUFFER_SIZE 1024 // Size of network messages buffer
+
+#define DEFAULT_MAX_CONNECTIONS 5   // Max number of allowed connected clients
+#define DEFAULT_LISTEN_BACKLOG 16   // Pending connection queue size for listen()
+#define DEFAULT_ACCEPT_RATE 0       // Max new connections admitted per second, 0 = no limit
+#define DEFAULT_RETRY_AFTER_MS 1000 // Retry hint sent to clients that are turned away
+#define RESERVED_FDS 16             // File descriptors kept free for the server itself
+#define DEFAULT_IDLE_TIMEOUT_MS 60000 // Disconnect clients that send nothing for this long
+#define DEFAULT_READ_TIMEOUT_MS 5000  // Max time to finish sending a partial message
+#define DEFAULT_BROADCAST_TICK_MS 100 // Seat changes are pushed to subscribers this often
+#define DEFAULT_MAX_OUT_QUEUE_BYTES (64 * 1024) // Unsent bytes allowed per client before it is dropped
+#define DEFAULT_SHM_SPIN_US 20 // Time a shared memory client's thread polls for requests before sleeping
+#define DEFAULT_DEDUP_ENTRIES 4096 // Purchase replies remembered for retries with the same request id
+#define IP_RATE_SLOTS 16384 // Addresses tracked by the per address rate limit
+#define DEFAULT_WAITING_UPDATE_MS 1000 // Waiting clients are told their place in line this often
+#define WAITING_ROOM_TICK_MS 100       // Longest time between admission checks
+#define MAX_OUT_QUEUE_LIMIT (1024 * 1024)       // Largest allowed -maxoutqueue
+#define BROADCAST_SEATS_PER_MSG 128   // "rr:cc," is at most 6 bytes, keeps pushes under MSG_BUFFER_SIZE
+
+// Enums for different client connection status.
+// NONE -> ACTIVE <-> READING -> DISCONNECT -> NONE
+#define CLIENT_STATUS_NONE 0       // Slot is free
+#define CLIENT_STATUS_ACTIVE 1     // Connected, waiting for the next message
+#define CLIENT_STATUS_DISCONNECT 2 // Closing, slot is reclaimed by the client thread
+#define CLIENT_STATUS_READING 3    // Part of a message has been received
+
+// Reasons a client connection was closed
+#define CLOSE_REASON_NONE 0
+#define CLOSE_REASON_REQUESTED 1
+#define CLOSE_REASON_EOF 2
+#define CLOSE_REASON_ERROR 3
+#define CLOSE_REASON_IDLE_TIMEOUT 4
+#define CLOSE_REASON_READ_TIMEOUT 5
+#define CLOSE_REASON_PROTOCOL 6
+#define CLOSE_REASON_SHUTDOWN 7
+#define CLOSE_REASON_SLOW_CLIENT 8
+
+// Ways of doing client socket I/O
+#define IO_ENGINE_THREADS 0 // One thread per client, blocking reads
+#define IO_ENGINE_URING 1   // One io_uring event loop for every client
+#define IO_ENGINE_TASKS 2   // Worker threads run ready clients as tasks
+
+// Progress of a handoff to a replacement server
+#define HANDOFF_STATE_NONE 0
+#define HANDOFF_STATE_RUNNING 1 // Threads are parking, state is being sent
+#define HANDOFF_STATE_DONE 2    // New server took over, this process exits
+
+#define HANDOFF_ACK_TIMEOUT_SECS 5
+
+// Payload of a HANDOFF_LISTENER message, none means TCP
+#define LISTENER_KIND_TCP 0
+#define LISTENER_KIND_UNIX 1
+#define HANDOFF_MAX_PAYLOAD (MAX_SEATS_ROWS * MAX_SEATS_COLS * (1 + sizeof(unsigned long long)) + \
+    MSG_BUFFER_SIZE + MAX_OUT_QUEUE_LIMIT)
+
+// Stores information related to a single client
+typedef struct clientInfo_ {
+    pthread_t thread;
+    int status;
+    int socket;
+    int closeReason;
+    char* pending;  // Unprocessed bytes carried across a server handoff
+    int pendingLen;
+    int hasReplyTag; // Set while processing a tagged request
+    int replyTag;
+    int subscribed;  // Receives SERVER_SEATS_CHANGED pushes
+    outQueue out;    // Bytes the socket could not take yet
+    pthread_mutex_t sendLock; // Serializes writes from the client thread and the broadcaster
+    shmEndpoint shm; // Shared memory transport, channel is NULL for socket clients
+    int cpu;         // CPU the client thread is pinned to, -1 if not pinned
+    uint32_t peerAddr; // IPv4 address in host order, 0 for unix socket clients
+    tokenBucket requestBudget; // Only touched by the thread serving the client
+    unsigned int traceId; // Names the connection in captured traffic
+} clientInfo;
+
+// Sockets received from the server being replaced
+typedef struct takeoverClient_ {
+    int socket;
+    char* pending;
+    int pendingLen;
+    int subscribed;
+    outQueue out;
+    int shmFds[SHM_NUM_FDS]; // memfd, server and client eventfds, -1 if not on shared memory
+} takeoverClient;
+
+// Client state sent with each HANDOFF_CLIENT message,
+// followed by the pending bytes and then the queued output
+typedef struct handoffClientState_ {
+    int subscribed;
+    int pendingLen;
+    int outLen;
+} handoffClientState;
+
+// Handles one parsed client request, returns non-zero on error
+typedef int (*msgHandlerFunc)(int clientIndex, const netMsg* msg, char* sendBuffer);
+
+// Entry in the request id dispatch table
+typedef struct msgHandlerEntry_ {
+    msgHandlerFunc handler;
+    int numIntArgs;                  // Number of required integer arguments
+    const char* argNames[MSG_MAX_ARGS]; // Used in "Missing ..." replies
+} msgHandlerEntry;
+
+#define MSG_HANDLER_TABLE_SIZE 32 // Must be larger than the highest client request id
+
+// Runtime tunable server limits
+typedef struct serverSettings_ {
+    unsigned int port;
+    unsigned int seatRows;
+    unsigned int seatCols;
+    unsigned int maxConnections;
+    unsigned int listenBacklog;
+    unsigned int acceptRate;
+    unsigned int retryAfterMs;
+    unsigned int idleTimeoutMs;
+    unsigned int readTimeoutMs;
+    unsigned int broadcastTickMs;
+    unsigned int maxOutQueueBytes;
+    unsigned int socketSendBuffer; // SO_SNDBUF for client sockets, 0 = system default
+    unsigned int socketRecvBuffer; // SO_RCVBUF for client sockets, 0 = system default
+    unsigned int threadStackKb;    // Client thread stack size, 0 = system default
+    unsigned int shmSpinUs;
+    unsigned int dedupEntries;
+    unsigned int rateLimit;   // Requests per second per connection, 0 = no limit
+    unsigned int rateBurst;   // Requests a connection may send at once
+    unsigned int ipRateLimit; // Requests per second per IP address, 0 = no limit
+    unsigned int ipRateBurst;
+    unsigned int waitingRoomSize; // Connections that may wait for a slot, 0 = turn them away
+    unsigned int admitRate;       // Waiting clients admitted per second, 0 = as slots free up
+    unsigned int waitingUpdateMs;
+    unsigned int workerThreads; // Task engine workers, 0 = one per worker CPU
+    unsigned int sectionSize;   // Rows and columns of seats in a summary section
+    unsigned int exitWhenSoldOut; // 0 = stay open for refunds once every seat is sold
+    int logLevel;
+    int ioEngine;
+    char unixPath[MAX_UNIX_PATH]; // Unix socket listener, "" = TCP only
+    char capturePath[MAX_CAPTURE_PATH]; // Trace of client traffic, "" = not capturing
+    cpuList ioCpus;         // Accept loop or io_uring event loop
+    cpuList workerCpus;     // Client threads, one CPU each in turn
+    cpuList backgroundCpus; // Broadcaster, timer, reload and upgrade threads
+    unsigned int numTiers;
+    unsigned int tierPrices[MAX_SEAT_TIERS];
+    unsigned int tierRows[MAX_SEAT_TIERS]; // Rows in each tier but the last
+} serverSettings;
+
+// Describes one numeric server setting. Values come from the
+// default, then the config file, then the command line.
+typedef struct settingInfo_ {
+    const char* key;  // Name in the config file
+    const char* flag; // Command line flag, or NULL
+    unsigned int* value;
+    unsigned int defaultValue;
+    unsigned int minValue;
+    unsigned int maxValue;
+    int live;         // Applied when the config is reloaded
+} settingInfo;
+
+// Global variables because this is just an example program.
+seatMap* seatsMap = NULL;
+serverSettings settings; // Filled in by applyConfig()
+clientInfo* clientPool = NULL;
+connTable connSlots;  // Free clientPool slots, protected by socketLock
+bufPool connBuffers;  // Receive and output buffers lent to connections
+dedupCache purchaseReplies; // Replies to purchases sent with a request id
+unsigned int configRows = 0; // Seat map size the config last asked for, the
+unsigned int configCols = 0; // map can differ after a takeover
+ipRateLimiter ipLimits;     // Request budget of each client IP address
+unsigned long throttledRequests = 0; // Updated atomically
+traceWriter capture; // Records client traffic while capture_path is set
+unsigned int nextTraceId = 0; // Protected by socketLock
+
+// Waiting room state. admitBudget is only used by whichever thread
+// admits clients: the waiting room thread, or the io_uring loop.
+waitingRoom lobby;
+pthread_t doormanThread;
+int doormanRunning = 0; // Protected by lobby.mutex
+tokenBucket admitBudget;
+double admitRateEstimate = 0; // Clients admitted per second lately
+unsigned int numConnections = 0;
+unsigned int serverRunning = 0;
+int server_fd = 0;
+int unix_fd = -1; // Unix socket listener, -1 if not enabled
+
+pthread_mutex_t socketLock;
+timerService connTimers;
+
+// Handoff state, protected by socketLock. quiescePipe becomes
+// readable while a handoff is running to wake blocked threads.
+const char* upgradePath = NULL;
+int quiescePipe[2] = { -1, -1 };
+int handoffState = HANDOFF_STATE_NONE;
+int parkedThreads = 0;
+int acceptLoopParked = 0;
+pthread_cond_t handoffCond = PTHREAD_COND_INITIALIZER;
+
+// Broadcaster state. broadcastLock is held for a whole broadcaster
+// pass and by a handoff, and is always taken before socketLock.
+// Lock order: broadcastLock -> socketLock -> clientInfo.sendLock
+seatChangeLog seatChanges;
+pthread_mutex_t broadcastLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t broadcasterThread;
+int broadcastPipe[2] = { -1, -1 }; // Readable when the broadcaster should wake early
+int broadcasterRunning = 0;
+int soldOutPending = 0; // Set once the last seat is sold, cleared by the broadcaster
+int salesChangePending = 0; // Set when sales may have closed or reopened, cleared by the broadcaster
+int salesOpen = 1; // Last sales state pushed to clients, when the server stays open once sold out
+
+// Config file and the command line values that override it
+const char* configPath = NULL;
+iniFile configOverrides;
+
+settingInfo settingInfos[] = {
+    { "port", "-port", &settings.port, DEFAULT_PORT, 1, 65535, 0 },
+    { "rows", NULL, &settings.seatRows, DEFAULT_SEATS_ROWS, 1, MAX_SEATS_ROWS, 1 },
+    { "cols", NULL, &settings.seatCols, DEFAULT_SEATS_COLS, 1, MAX_SEATS_COLS, 1 },
+    { "max_connections", "-maxconn", &settings.maxConnections, DEFAULT_MAX_CONNECTIONS, 1, INT_MAX, 0 },
+    { "listen_backlog", "-backlog", &settings.listenBacklog, DEFAULT_LISTEN_BACKLOG, 1, INT_MAX, 1 },
+    { "accept_rate", "-acceptrate", &settings.acceptRate, DEFAULT_ACCEPT_RATE, 0, UINT_MAX, 1 },
+    { "retry_after_ms", "-retryafter", &settings.retryAfterMs, DEFAULT_RETRY_AFTER_MS, 0, UINT_MAX, 1 },
+    { "idle_timeout_ms", "-idletimeout", &settings.idleTimeoutMs, DEFAULT_IDLE_TIMEOUT_MS, 0, UINT_MAX, 1 },
+    { "read_timeout_ms", "-readtimeout", &settings.readTimeoutMs, DEFAULT_READ_TIMEOUT_MS, 0, UINT_MAX, 1 },
+    { "broadcast_tick_ms", "-broadcasttick", &settings.broadcastTickMs, DEFAULT_BROADCAST_TICK_MS, 1, INT_MAX, 1 },
+    { "max_out_queue_bytes", "-maxoutqueue", &settings.maxOutQueueBytes,
+        DEFAULT_MAX_OUT_QUEUE_BYTES, MSG_BUFFER_SIZE, MAX_OUT_QUEUE_LIMIT, 1 },
+    { "socket_send_buffer", NULL, &settings.socketSendBuffer, 0, 0, INT_MAX, 1 },
+    { "socket_recv_buffer", NULL, &settings.socketRecvBuffer, 0, 0, INT_MAX, 1 },
+    { "thread_stack_kb", NULL, &settings.threadStackKb, 0, 0, 1024 * 1024, 1 },
+    { "shm_spin_us", NULL, &settings.shmSpinUs, DEFAULT_SHM_SPIN_US, 0, 1000000, 1 },
+    { "dedup_entries", "-dedupentries", &settings.dedupEntries, DEFAULT_DEDUP_ENTRIES, 0, 16 * 1024 * 1024, 0 },
+    { "rate_limit", "-ratelimit", &settings.rateLimit, 0, 0, UINT_MAX, 1 },
+    { "rate_burst", NULL, &settings.rateBurst, 0, 0, UINT_MAX, 1 },
+    { "ip_rate_limit", "-iprate", &settings.ipRateLimit, 0, 0, UINT_MAX, 1 },
+    { "ip_rate_burst", NULL, &settings.ipRateBurst, 0, 0, UINT_MAX, 1 },
+    { "waiting_room", "-waitingroom", &settings.waitingRoomSize, 0, 0, 16 * 1024 * 1024, 0 },
+    { "admit_rate", "-admitrate", &settings.admitRate, 0, 0, UINT_MAX, 1 },
+    { "waiting_update_ms", NULL, &settings.waitingUpdateMs, DEFAULT_WAITING_UPDATE_MS, 100, INT_MAX, 1 },
+    { "worker_threads", "-workers", &settings.workerThreads, 0, 0, 1024, 0 },
+    { "section_size", NULL, &settings.sectionSize, DEFAULT_SECTION_SIZE, 2, MAX_SEATS_ROWS, 0 },
+    { "exit_when_sold_out", "-exitsoldout", &settings.exitWhenSoldOut, 1, 0, 1, 1 },
+};
+
+#define NUM_SETTINGS (sizeof(settingInfos) / sizeof(settingInfo))
+#define DEFAULT_LOG_LEVEL LOG_LEVEL_DEBUG
+#define DEFAULT_IO_ENGINE IO_ENGINE_THREADS
+
+// Defined with the io_uring engine further down
+void uringWake();
+void uringRequestFlush(int clientIndex);
+
+// Defined with the task engine further down
+int startTaskConn(int socket);
+
+// Helper function that will automatically exit the server
+// if returnVal is non-zero
+int exitOnError(int returnVal, char* errMsg) {
+    if (returnVal != 0) 
+    { 
+        serverRunning = 0;
+        perror(errMsg); 
+        exit(1);
+    }
+
+    return returnVal; 
+}
+
+// Allocates and initializes the client connection pool
+void initclientPool()
+{
+    clientPool = malloc(sizeof(clientInfo) * settings.maxConnections);
+    if (clientPool == NULL || initConnTable(&connSlots, settings.maxConnections))
+        exitOnError(1, "Unable to allocate client pool");
+    initBufPool(&connBuffers, MSG_BUFFER_SIZE);
+    if (initDedupCache(&purchaseReplies, settings.dedupEntries))
+        exitOnError(1, "Unable to allocate purchase request id cache");
+    if (initIpRateLimiter(&ipLimits, IP_RATE_SLOTS))
+        exitOnError(1, "Unable to allocate rate limit table");
+
+    for (int i = 0; i < settings.maxConnections; i++)
+    {
+        clientPool[i].thread = 0;
+        clientPool[i].status = CLIENT_STATUS_NONE;
+        clientPool[i].socket = 0;
+        clientPool[i].closeReason = CLOSE_REASON_NONE;
+        clientPool[i].pending = NULL;
+        clientPool[i].pendingLen = 0;
+        clientPool[i].hasReplyTag = 0;
+        clientPool[i].subscribed = 0;
+        memset(&(clientPool[i].out), 0, sizeof(outQueue));
+        clientPool[i].out.pool = &connBuffers;
+        pthread_mutex_init(&(clientPool[i].sendLock), NULL);
+        clientPool[i].shm.channel = NULL;
+        clientPool[i].cpu = -1;
+        clientPool[i].peerAddr = 0;
+    }
+}
+
+// Returns a printable name for a close reason
+const char* closeReasonStr(int reason)
+{
+    switch (reason)
+    {
+        case CLOSE_REASON_REQUESTED: return "client requested disconnect";
+        case CLOSE_REASON_EOF: return "client closed the connection";
+        case CLOSE_REASON_ERROR: return "socket error";
+        case CLOSE_REASON_IDLE_TIMEOUT: return "idle timeout";
+        case CLOSE_REASON_READ_TIMEOUT: return "read timeout";
+        case CLOSE_REASON_PROTOCOL: return "protocol error";
+        case CLOSE_REASON_SHUTDOWN: return "server shutting down";
+        case CLOSE_REASON_SLOW_CLIENT: return "client not reading its messages";
+        default: return "unknown";
+    }
+}
+
+// Returns 1 if the client slot holds an open connection
+int clientConnected(clientInfo* cInfo)
+{
+    return cInfo->status == CLIENT_STATUS_ACTIVE || cInfo->status == CLIENT_STATUS_READING;
+}
+
+// Writes as much of data as the client's socket, or shared memory
+// channel, takes without blocking. Caller must hold the client's
+// sendLock. Returns the bytes written, or -1 if the connection failed.
+int _writeClient(clientInfo* cInfo, const char* data, int length)
+{
+    if (cInfo->shm.channel == NULL) return sendWithoutBlocking(cInfo->socket, data, length);
+
+    // Whatever does not fit waits until the client reads and wakes
+    // the client thread, which flushes again
+    shmRing* ring = &(cInfo->shm.channel->responses);
+    int sent = 0;
+    do
+    {
+        int count = shmRingWrite(ring, data + sent, length - sent, cInfo->shm.peerWakeFd);
+        if (count < 0) return -1;
+        sent += count;
+    } while (sent < length && shmRingWaitForRoom(ring));
+
+    return sent;
+}
+
+// Writes as much queued output as the connection takes without blocking.
+// Caller must hold the client's sendLock. Returns 0, or -1 if the
+// connection failed.
+int _flushClientOutput(clientInfo* cInfo)
+{
+    int sent = _writeClient(cInfo, cInfo->out.data, cInfo->out.length);
+    if (sent < 0)
+    {
+        freeOutQueue(&(cInfo->out));
+        return -1;
+    }
+
+    consumeOutQueue(&(cInfo->out), sent);
+    return 0;
+}
+
+// Moves a client into the DISCONNECT state and wakes its thread.
+// Only the first reason is kept. The client thread closes the
+// socket and frees the slot. Caller must hold socketLock, but not
+// the client's sendLock.
+void _beginDisconnect(clientInfo* cInfo, int reason)
+{
+    if (!clientConnected(cInfo)) return;
+
+    cInfo->status = CLIENT_STATUS_DISCONNECT;
+    cInfo->closeReason = reason;
+
+    // The ring may still be sending, it flushes and closes the
+    // socket itself once its receive ends
+    if (settings.ioEngine == IO_ENGINE_URING)
+    {
+        shutdown(cInfo->socket, SHUT_RD);
+        return;
+    }
+
+    // Last chance for queued replies, such as a disconnect notice
+    pthread_mutex_lock(&(cInfo->sendLock));
+    _flushClientOutput(cInfo);
+    pthread_mutex_unlock(&(cInfo->sendLock));
+
+    shutdown(cInfo->socket, SHUT_RDWR); // Unblocks the client thread's read()
+}
+
+// Wakes the broadcaster before its next tick
+void wakeBroadcaster()
+{
+    // The pipe is non-blocking, a full pipe already means a wake up is pending
+    if (write(broadcastPipe[1], "x", 1) < 0) { }
+}
+
+// Queues bytes for a client and writes as much as the socket takes
+// without blocking. The io_uring engine sends queued bytes itself.
+// Returns the bytes still queued, or -1 if the client's queue is full
+// or its socket failed.
+int _queueClientOutput(clientInfo* cInfo, const char* data, int length)
+{
+    pthread_mutex_lock(&(cInfo->sendLock));
+
+    // With nothing queued ahead, write straight from data and only
+    // queue what the connection does not take. Most replies then
+    // never need a buffer.
+    int sent = 0;
+    if (cInfo->out.length == 0 && settings.ioEngine != IO_ENGINE_URING)
+        sent = _writeClient(cInfo, data, length);
+
+    int result = -1;
+    if (sent >= 0 && appendOutQueue(&(cInfo->out), data + sent, length - sent, settings.maxOutQueueBytes) == 0)
+        result = cInfo->out.length;
+
+    pthread_mutex_unlock(&(cInfo->sendLock));
+    return result;
+}
+
+// Called from the timer thread when a client's idle or read deadline
+// passes. Ignored if the slot was released and reused since the timer
+// was set.
+void onClientTimeout(int clientIndex, unsigned int generation)
+{
+    profiledLock(&socketLock);
+
+    // Sockets being handed off must stay open
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    if (connSlotCurrent(&connSlots, clientIndex, generation) &&
+        clientConnected(cInfo) && handoffState == HANDOFF_STATE_NONE)
+    {
+        int reason = (cInfo->status == CLIENT_STATUS_READING) ?
+            CLOSE_REASON_READ_TIMEOUT : CLOSE_REASON_IDLE_TIMEOUT;
+        printFromClient(clientIndex, "Disconnecting client, %s.", closeReasonStr(reason));
+        _beginDisconnect(cInfo, reason);
+    }
+
+    profiledUnlock(&socketLock);
+}
+
+// Sets the client's state and restarts the matching idle or read timer
+void setClientState(int clientIndex, int status)
+{
+    profiledLock(&socketLock);
+
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    if (clientConnected(cInfo))
+    {
+        cInfo->status = status;
+
+        unsigned int timeoutMs = (status == CLIENT_STATUS_READING) ?
+            settings.readTimeoutMs : settings.idleTimeoutMs;
+        setTimer(&connTimers, clientIndex, connSlots.generation[clientIndex], timeoutMs);
+    }
+
+    profiledUnlock(&socketLock);
+}
+
+// Sends a message that is already formatted in sendBuffer,
+// adding the message terminator. Never blocks, whatever the socket
+// does not take is left for the broadcaster, or the io_uring engine,
+// to flush. Must not be called with socketLock held.
+void sendMsgBuffer(clientInfo* cInfo, char* sendBuffer)
+{
+    strcat(sendBuffer, NETWORK_MSG_END);
+
+    int queued = _queueClientOutput(cInfo, sendBuffer, strlen(sendBuffer));
+    if (queued > 0 && settings.ioEngine == IO_ENGINE_URING)
+    {
+        uringRequestFlush(cInfo - clientPool);
+    }
+    else if (queued > 0)
+    {
+        wakeBroadcaster();
+    }
+    else if (queued < 0)
+    {
+        profiledLock(&socketLock);
+        _beginDisconnect(cInfo, CLOSE_REASON_SLOW_CLIENT);
+        profiledUnlock(&socketLock);
+    }
+}
+
+// Helper function that sends a response id and resonse message to a client
+void sendMsgResponse(clientInfo* cInfo, int msgId, char* msgBody, char* sendBuffer)
+{
+    sprintf(sendBuffer, "%d", msgId);
+    strcat(sendBuffer, NETWORK_MSG_DELIM);
+    strcat(sendBuffer, msgBody);
+    sendMsgBuffer(cInfo, sendBuffer);
+}
+
+// Prefixes a reply in sendBuffer with the tag of the request
+// currently being processed for cInfo, if it had one
+void _addReplyTag(clientInfo* cInfo, char* sendBuffer)
+{
+    if (cInfo->hasReplyTag)
+    {
+        char tagStr[20];
+        int tagLen = sprintf(tagStr, "%c%d%s", NETWORK_MSG_TAG, cInfo->replyTag, NETWORK_MSG_DELIM);
+        memmove(sendBuffer + tagLen, sendBuffer, strlen(sendBuffer) + 1);
+        memcpy(sendBuffer, tagStr, tagLen);
+    }
+}
+
+// Sends a reply that is already formatted in sendBuffer to the request
+// currently being processed for cInfo, echoing the request's tag
+void sendReplyBuffer(clientInfo* cInfo, char* sendBuffer)
+{
+    _addReplyTag(cInfo, sendBuffer);
+    sendMsgBuffer(cInfo, sendBuffer);
+}
+
+// Sends a response id and response message as the reply to the
+// request currently being processed for cInfo
+void sendReply(clientInfo* cInfo, int msgId, char* msgBody, char* sendBuffer)
+{
+    sprintf(sendBuffer, "%d", msgId);
+    strcat(sendBuffer, NETWORK_MSG_DELIM);
+    strcat(sendBuffer, msgBody);
+    sendReplyBuffer(cInfo, sendBuffer);
+}
+
+// Turns away a connection the server has no room for. Never blocks,
+// the short reply always fits in the new socket's empty send buffer
+// and is dropped if it somehow does not.
+void shedConnection(int socket, unsigned int retryAfterMs, char* reason)
+{
+    char sendBuffer[128];
+
+    snprintf(sendBuffer, sizeof(sendBuffer), "%d%s%u%s%s%s", SERVER_RETRY_LATER,
+        NETWORK_MSG_DELIM, retryAfterMs, NETWORK_MSG_DELIM, reason, NETWORK_MSG_END);
+    send(socket, sendBuffer, strlen(sendBuffer), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(socket);
+}
+
+// Checks if all seats have been sold, and has the broadcaster
+// disconnect all clients if so. With exit_when_sold_out=0 the
+// clients are only told, and stay connected to return seats.
+void checkSeatsFull()
+{
+    if (getNumSeatsAvailable(seatsMap) <= 0 && settings.exitWhenSoldOut)
+    {
+        printFromHost("All seats have been sold. Disconnecting clients ...");
+
+        profiledLock(&socketLock);
+        soldOutPending = 1;
+        profiledUnlock(&socketLock);
+        wakeBroadcaster();
+    }
+    else if (getNumSeatsAvailable(seatsMap) <= 0)
+    {
+        printFromHost("All seats have been sold. Turning new clients away until a seat is returned.");
+
+        profiledLock(&socketLock);
+        salesChangePending = 1;
+        profiledUnlock(&socketLock);
+        wakeBroadcaster();
+    }
+}
+
+// Has the broadcaster tell clients sales are open again if they were
+// told every seat was sold. Called after a seat is returned.
+void checkSalesReopened()
+{
+    profiledLock(&socketLock);
+    int wasClosed = !salesOpen;
+    if (wasClosed) salesChangePending = 1;
+    profiledUnlock(&socketLock);
+
+    if (wasClosed) wakeBroadcaster();
+}
+
+// Turns away a new connection while every seat is sold and the server
+// stays open for refunds. Returns 1 if the connection was shed.
+int shedIfSoldOut(int socket)
+{
+    if (settings.exitWhenSoldOut || getNumSeatsAvailable(seatsMap) > 0) return 0;
+
+    printFromHost("Sold out, asking client to retry in %u ms.", settings.retryAfterMs);
+    shedConnection(socket, settings.retryAfterMs, "Sold out");
+    return 1;
+}
+
+// Replies to a client that asked to disconnect
+int handleDisconnect(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+
+    printFromClient(clientIndex, "Client requested disconnection.");
+    sendReply(cInfo, SERVER_DISCONNECT, "Client requested disconnection.", sendBuffer);
+
+    profiledLock(&socketLock);
+    _beginDisconnect(cInfo, CLOSE_REASON_REQUESTED);
+    profiledUnlock(&socketLock);
+    return 0;
+}
+
+// Sends the seat map size and number of available seats
+int handleRequestAvailability(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+
+    printFromClient(clientIndex, "Client requested ticket availability. Sending response.");
+
+    sprintf(sendBuffer, "%d%s%u%s%u%s%u", SERVER_TICKET_RANGE,
+        NETWORK_MSG_DELIM, getSeatRows(seatsMap),
+        NETWORK_MSG_DELIM, getSeatCols(seatsMap),
+        NETWORK_MSG_DELIM, getNumSeatsAvailable(seatsMap));
+    sendReplyBuffer(cInfo, sendBuffer);
+    return 0;
+}
+
+// Tells the client if the given row and column are available
+int handleRequestStatus(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    int row = msg->args[0];
+    int col = msg->args[1];
+
+    printFromClient(clientIndex, "Client requested ticket status.");
+
+    int taken = seatSold(seatsMap, row, col);
+    if (taken == -1)
+    {
+        printFromClient(clientIndex, "Ticket Row/Col is invalid. (row: %2d, col: %2d)", row, col);
+        sendReply(cInfo, SERVER_TICKET_INVALID, "Invalid row or column", sendBuffer);
+    }
+    else if (taken == 0)
+    {
+        printFromClient(clientIndex, "Sending response. Is Available (row: %2d, col: %2d)", row, col);
+        sprintf(sendBuffer, "%d", SERVER_TICKET_AVAILABLE);
+        sendReplyBuffer(cInfo, sendBuffer);
+    }
+    else
+    {
+        printFromClient(clientIndex, "Sending response. Not Available (row: %2d, col: %2d)", row, col);
+        sprintf(sendBuffer, "%d", SERVER_TICKET_NOT_AVAILABLE);
+        sendReplyBuffer(cInfo, sendBuffer);
+    }
+
+    return 0;
+}
+
+// Returns a random receipt for a sale, so no one can refund a seat
+// they did not buy by guessing it, or 0 if the system has no
+// randomness to give. 0 marks an unsold seat, so is never issued.
+unsigned long long newReceipt()
+{
+    unsigned long long receipt = 0;
+    while (receipt == 0)
+    {
+        ssize_t got = getrandom(&receipt, sizeof(receipt), 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got != sizeof(receipt)) return 0;
+    }
+    return receipt;
+}
+
+// Returns 1 if the purchase request made with a cached reply sold a
+// seat that has been refunded since. Seat purchases name the seat in
+// the request, tier purchases in the reply, and both end their reply
+// with the receipt.
+int saleRefunded(const char* request, const char* reply)
+{
+    int replyId = 0;
+    int row = -1;
+    int col = -1;
+    seatInfo info;
+
+    sscanf(reply, "%d", &replyId);
+    if (replyId == SERVER_TICKET_TRANSACTION_SUCCESS)
+        sscanf(request, "%*d|%d|%d", &row, &col);
+    else if (replyId == SERVER_TICKET_SEAT_ASSIGNED)
+        sscanf(reply, "%*d|%d|%d", &row, &col);
+    else
+        return 0;
+
+    const char* receipt = strrchr(reply, NETWORK_MSG_DELIM[0]);
+    if (receipt == NULL) return 0;
+
+    // Gone after a shrink, which only happens once it was refunded
+    if (getSeatInfo(seatsMap, row, col, &info) < 0) return 1;
+    return info.receipt != strtoull(receipt + 1, NULL, 16);
+}
+
+// Checks a purchase for the optional request id argument at argIndex.
+// Returns 0 to run a purchase without one, 1 to run it and pass its
+// reply to finishKeyedPurchase(), which must follow while the id's
+// cache stripe is locked, or -1 if the reply was already sent: the
+// original reply to a retry, or an error.
+int beginKeyedPurchase(int clientIndex, const netMsg* msg, int argIndex, const char* request,
+    char* key, dedupTicket* ticket, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+
+    if (msg->numArgs <= argIndex || purchaseReplies.capacity == 0) return 0;
+
+    int keyLen = msg->argLen[argIndex];
+    if (keyLen == 0 || keyLen >= DEDUP_KEY_SIZE)
+    {
+        printFromClient(clientIndex, "Client sent a request id of %d bytes.", keyLen);
+        sendReply(cInfo, SERVER_MSG_INVALID, "Invalid request id", sendBuffer);
+        return -1;
+    }
+    memcpy(key, msg->argStr[argIndex], keyLen);
+    key[keyLen] = '\0';
+
+    int found = dedupBegin(&purchaseReplies, key, request, sendBuffer, ticket);
+    if (found == DEDUP_MISS) return 1;
+
+    if (found == DEDUP_HIT && saleRefunded(request, sendBuffer))
+    {
+        printFromClient(clientIndex, "Client retried request id '%s' of a refunded sale.", key);
+        sprintf(sendBuffer, "%d%s%s", SERVER_TICKET_TRANSACTION_FAILED, NETWORK_MSG_DELIM, "Ticket was refunded");
+        sendReplyBuffer(cInfo, sendBuffer);
+    }
+    else if (found == DEDUP_HIT)
+    {
+        printFromClient(clientIndex, "Client retried request id '%s', sending the original reply.", key);
+        sendReplyBuffer(cInfo, sendBuffer);
+    }
+    else
+    {
+        printFromClient(clientIndex, "Client reused request id '%s' for a different purchase.", key);
+        sendReply(cInfo, SERVER_TICKET_INVALID, "Request id already used", sendBuffer);
+    }
+    return -1;
+}
+
+// Remembers the reply to a purchase begun with a request id and
+// unlocks its cache stripe. reply is NULL if nothing was bought or
+// refused, such as an invalid seat, so a retry is checked again.
+void finishKeyedPurchase(int keyed, dedupTicket* ticket, const char* key,
+    const char* request, const char* reply)
+{
+    if (keyed) dedupFinish(ticket, key, request, reply);
+}
+
+// Attempts to buy the given row and column for the client. A request
+// id after the column makes retries safe, see beginKeyedPurchase().
+int handleRequestPurchase(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    int row = msg->args[0];
+    int col = msg->args[1];
+    char key[DEDUP_KEY_SIZE];
+    char request[DEDUP_REQUEST_SIZE];
+    dedupTicket ticket;
+
+    printFromClient(clientIndex, "Client requested ticket purchase.");
+
+    snprintf(request, sizeof(request), "%d|%d|%d", msg->id, row, col);
+    int keyed = beginKeyedPurchase(clientIndex, msg, 2, request, key, &ticket, sendBuffer);
+    if (keyed < 0) return 0;
+
+    unsigned long long receipt = newReceipt();
+    if (receipt == 0)
+    {
+        finishKeyedPurchase(keyed, &ticket, key, request, NULL);
+        printWarning("Unable to issue a receipt: %s", strerror(errno));
+        sendReply(cInfo, SERVER_TICKET_TRANSACTION_FAILED, "Unable to issue a receipt", sendBuffer);
+        return 0;
+    }
+
+    int success = buySeat(seatsMap, row, col, receipt);
+    if (success == -1)
+    {
+        finishKeyedPurchase(keyed, &ticket, key, request, NULL);
+        printFromClient(clientIndex, "Ticket Row/Col is invalid. (row: %2d, col: %2d)", row, col);
+        sendReply(cInfo, SERVER_TICKET_INVALID, "Invalid row or column", sendBuffer);
+    }
+    else if (success == 0)
+    {
+        sprintf(sendBuffer, "%d%s%s", SERVER_TICKET_TRANSACTION_FAILED, NETWORK_MSG_DELIM, "Ticket already purchased");
+        finishKeyedPurchase(keyed, &ticket, key, request, sendBuffer);
+        printFromClient(clientIndex, "Ticket Row/Col is already taken. (row: %2d, col: %2d)", row, col);
+        sendReplyBuffer(cInfo, sendBuffer);
+    }
+    else
+    {
+        sprintf(sendBuffer, "%d%s%s%s%016llx", SERVER_TICKET_TRANSACTION_SUCCESS, NETWORK_MSG_DELIM,
+            "Ticket purchased", NETWORK_MSG_DELIM, receipt);
+        finishKeyedPurchase(keyed, &ticket, key, request, sendBuffer);
+        printFromClient(clientIndex, "Client successfully purchased a ticket. (row: %2d, col: %2d)", row, col);
+        sendReplyBuffer(cInfo, sendBuffer);
+        recordSeatChange(&seatChanges, row, col);
+        printSeatMap(seatsMap);
+        checkSeatsFull(); // Closes server if all seats are full
+    }
+
+    return 0;
+}
+
+// Sends every price tier's price, available and total seats, and the
+// cheapest tier that still has seats
+int handleRequestTiers(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    seatTier tiers[MAX_SEAT_TIERS];
+    int cheapest;
+
+    printFromClient(clientIndex, "Client requested the price tiers.");
+
+    int numTiers = getSeatTiers(seatsMap, tiers, &cheapest);
+    int length = sprintf(sendBuffer, "%d%s%d%s", SERVER_TICKET_TIERS,
+        NETWORK_MSG_DELIM, cheapest, NETWORK_MSG_DELIM);
+    for (int t = 0; t < numTiers; t++)
+        length += sprintf(sendBuffer + length, "%s%u:%u:%u", (t > 0) ? "," : "",
+            tiers[t].price, tiers[t].numFree, tiers[t].numSeats);
+
+    sendReplyBuffer(cInfo, sendBuffer);
+    return 0;
+}
+
+// Buys whichever seat is next in the requested tier, or in the
+// cheapest tier with seats left for tier -1, and tells the client
+// which seat it got. Takes an optional request id after the tier.
+int handleRequestTierPurchase(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    int tier = msg->args[0];
+    int row, col;
+    char key[DEDUP_KEY_SIZE];
+    char request[DEDUP_REQUEST_SIZE];
+    dedupTicket ticket;
+
+    printFromClient(clientIndex, "Client requested a ticket in tier %d.", tier);
+
+    snprintf(request, sizeof(request), "%d|%d", msg->id, tier);
+    int keyed = beginKeyedPurchase(clientIndex, msg, 1, request, key, &ticket, sendBuffer);
+    if (keyed < 0) return 0;
+
+    unsigned long long receipt = newReceipt();
+    if (receipt == 0)
+    {
+        finishKeyedPurchase(keyed, &ticket, key, request, NULL);
+        printWarning("Unable to issue a receipt: %s", strerror(errno));
+        sendReply(cInfo, SERVER_TICKET_TRANSACTION_FAILED, "Unable to issue a receipt", sendBuffer);
+        return 0;
+    }
+
+    int success = buyTierSeat(seatsMap, &tier, &row, &col, receipt);
+    if (success == -1)
+    {
+        finishKeyedPurchase(keyed, &ticket, key, request, NULL);
+        printFromClient(clientIndex, "Ticket tier is invalid. (tier: %d)", tier);
+        sendReply(cInfo, SERVER_TICKET_INVALID, "Invalid tier", sendBuffer);
+    }
+    else if (success == 0)
+    {
+        sprintf(sendBuffer, "%d%s%s", SERVER_TICKET_TRANSACTION_FAILED, NETWORK_MSG_DELIM, "No seats left in that tier");
+        finishKeyedPurchase(keyed, &ticket, key, request, sendBuffer);
+        printFromClient(clientIndex, "No tickets left in tier %d.", tier);
+        sendReplyBuffer(cInfo, sendBuffer);
+    }
+    else
+    {
+        sprintf(sendBuffer, "%d%s%d%s%d%s%d%s%u%s%016llx", SERVER_TICKET_SEAT_ASSIGNED,
+            NETWORK_MSG_DELIM, row, NETWORK_MSG_DELIM, col,
+            NETWORK_MSG_DELIM, tier, NETWORK_MSG_DELIM, getSeatTierPrice(seatsMap, tier),
+            NETWORK_MSG_DELIM, receipt);
+        finishKeyedPurchase(keyed, &ticket, key, request, sendBuffer);
+        printFromClient(clientIndex, "Client successfully purchased a tier %d ticket. (row: %2d, col: %2d)", tier, row, col);
+        sendReplyBuffer(cInfo, sendBuffer);
+        recordSeatChange(&seatChanges, row, col);
+        printSeatMap(seatsMap);
+        checkSeatsFull(); // Closes server if all seats are full
+    }
+
+    return 0;
+}
+
+// Returns the seat at the given row and column if the client shows
+// the receipt it was sold with. Receipts are kept with the seats
+// rather than in the dedup cache, so every sale stays refundable,
+// also after a takeover, and a seat sold again has a new receipt.
+int handleRequestRefund(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    int row = msg->args[0];
+    int col = msg->args[1];
+    char text[20];
+    char* end;
+
+    printFromClient(clientIndex, "Client requested a refund.");
+
+    if (msg->numArgs < 3 || msg->argLen[2] == 0 || msg->argLen[2] >= sizeof(text))
+    {
+        sendReply(cInfo, SERVER_MSG_INVALID, "Missing receipt", sendBuffer);
+        return 0;
+    }
+    memcpy(text, msg->argStr[2], msg->argLen[2]);
+    text[msg->argLen[2]] = '\0';
+    unsigned long long receipt = strtoull(text, &end, 16);
+
+    int success = (*end == '\0' && receipt != 0) ? refundSeat(seatsMap, row, col, receipt) : 0;
+    if (success == -1)
+    {
+        printFromClient(clientIndex, "Ticket Row/Col is invalid. (row: %2d, col: %2d)", row, col);
+        sendReply(cInfo, SERVER_TICKET_INVALID, "Invalid row or column", sendBuffer);
+        return 0;
+    }
+    if (success == 0)
+    {
+        printFromClient(clientIndex, "Receipt does not hold the seat. (row: %2d, col: %2d)", row, col);
+        sendReply(cInfo, SERVER_TICKET_INVALID, "Nothing to refund", sendBuffer);
+        return 0;
+    }
+
+    sprintf(sendBuffer, "%d%s%d%s%d", SERVER_TICKET_REFUNDED, NETWORK_MSG_DELIM, row, NETWORK_MSG_DELIM, col);
+    printFromClient(clientIndex, "Client returned a ticket. (row: %2d, col: %2d)", row, col);
+    sendReplyBuffer(cInfo, sendBuffer);
+    recordSeatChange(&seatChanges, row, col);
+    printSeatMap(seatsMap);
+    checkSalesReopened();
+
+    return 0;
+}
+
+// Counts the available seats in a rectangle of the map, such as a
+// section, and sends the count with the first available seat in it.
+// The number of rows and columns are optional and default to the rest
+// of the map, as it is when the seats are counted.
+int handleRequestRegion(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    int row = msg->args[0];
+    int col = msg->args[1];
+    int numRows = (msg->numArgs > 2 && msg->argIsInt[2]) ? msg->args[2] : -1;
+    int numCols = (msg->numArgs > 3 && msg->argIsInt[3]) ? msg->args[3] : -1;
+    int firstRow, firstCol;
+
+    // -1 from the client is out of range, not the rest of the map
+    if (numRows < 0 && msg->numArgs > 2 && msg->argIsInt[2]) numRows = 0;
+    if (numCols < 0 && msg->numArgs > 3 && msg->argIsInt[3]) numCols = 0;
+
+    printFromClient(clientIndex, "Client requested the seats available in %d rows by %d columns from (%d, %d).",
+        numRows, numCols, row, col);
+
+    int available = countSeatsAvailableIn(seatsMap, row, col, numRows, numCols, &firstRow, &firstCol);
+    if (available < 0)
+    {
+        sendReply(cInfo, SERVER_TICKET_INVALID, "Region is outside the seat map", sendBuffer);
+        return 0;
+    }
+
+    sprintf(sendBuffer, "%d%s%d%s%d%s%d", SERVER_TICKET_REGION, NETWORK_MSG_DELIM, available,
+        NETWORK_MSG_DELIM, firstRow, NETWORK_MSG_DELIM, firstCol);
+    sendReplyBuffer(cInfo, sendBuffer);
+    return 0;
+}
+
+// Sends the available seats of every row and of every section, from
+// counts the seat map keeps up to date, so it costs no scan
+int handleRequestSummary(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    unsigned int rowFree[MAX_SEATS_ROWS];
+    unsigned int sectionFree[MAX_SEATS_ROWS * MAX_SEATS_COLS];
+    int cols = 0;
+    int sectionSize = 0;
+    int sectionRows = 0;
+    int sectionCols = 0;
+
+    printFromClient(clientIndex, "Client requested the seat summaries.");
+
+    // Every count and size comes from one layout, even during a resize
+    int rows = getSeatSummaries(seatsMap, rowFree, MAX_SEATS_ROWS, sectionFree,
+        MAX_SEATS_ROWS * MAX_SEATS_COLS, &cols, &sectionSize, &sectionRows, &sectionCols);
+    int numSections = sectionRows * sectionCols;
+
+    // Leave room for the tag and terminator
+    int maxLength = MSG_BUFFER_SIZE - 32;
+    int length = snprintf(sendBuffer, maxLength, "%d%s%d%s%d%s%d%s", SERVER_TICKET_SUMMARY,
+        NETWORK_MSG_DELIM, rows, NETWORK_MSG_DELIM, cols,
+        NETWORK_MSG_DELIM, sectionSize, NETWORK_MSG_DELIM);
+    for (int y = 0; y < rows && length < maxLength; y++)
+        length += snprintf(sendBuffer + length, maxLength - length, "%s%u", (y > 0) ? "," : "", rowFree[y]);
+    if (length < maxLength)
+        length += snprintf(sendBuffer + length, maxLength - length, "%s", NETWORK_MSG_DELIM);
+    for (int i = 0; i < numSections && length < maxLength; i++)
+        length += snprintf(sendBuffer + length, maxLength - length, "%s%u", (i > 0) ? "," : "", sectionFree[i]);
+
+    if (rows == 0 || length >= maxLength)
+    {
+        sendReply(cInfo, SERVER_MSG_INVALID, "Seat summaries do not fit in a message", sendBuffer);
+        return 0;
+    }
+
+    sendReplyBuffer(cInfo, sendBuffer);
+    return 0;
+}
+
+// Sends the sold seats as a hex bitmap, 4 seats per digit, most
+// significant bit first. Starts at the optional first row argument and
+// includes as many whole rows as fit in one message. Clients ask again
+// from the next row if the reply does not reach the last row. Read
+// from a seat map snapshot, so buyers do not wait on the encoding.
+int handleRequestMap(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    static const char hexDigits[] = "0123456789abcdef";
+
+    printFromClient(clientIndex, "Client requested the seat map.");
+
+    int firstRow = (msg->numArgs > 0 && msg->argIsInt[0]) ? msg->args[0] : 0;
+    int token;
+    const seatSnapshot* snapshot = acquireSeatSnapshot(seatsMap, &token);
+    int rows = (snapshot != NULL) ? snapshot->rows : 0;
+    int cols = (snapshot != NULL) ? snapshot->cols : 0;
+
+    if (firstRow < 0 || firstRow >= rows)
+    {
+        if (snapshot != NULL) releaseSeatSnapshot(seatsMap, token);
+        sendReply(cInfo, SERVER_TICKET_INVALID, "Invalid row", sendBuffer);
+        return 1;
+    }
+
+    // Leave room for the header fields, tag and terminator
+    int maxDigits = MSG_BUFFER_SIZE - 96;
+    int numRows = (maxDigits * 4) / cols;
+    if (numRows > rows - firstRow) numRows = rows - firstRow;
+
+    int len = sprintf(sendBuffer, "%d%s%d%s%d%s%d%s", SERVER_TICKET_MAP,
+        NETWORK_MSG_DELIM, firstRow, NETWORK_MSG_DELIM, numRows,
+        NETWORK_MSG_DELIM, cols, NETWORK_MSG_DELIM);
+
+    const unsigned char* seat = snapshot->seatSold + firstRow * cols;
+    int chunkSeats = numRows * cols;
+    for (int i = 0; i < chunkSeats; i += 4)
+    {
+        int value = 0;
+        for (int bit = 0; bit < 4; bit++)
+            if (i + bit < chunkSeats && seat[i + bit]) value |= 8 >> bit;
+        sendBuffer[len++] = hexDigits[value];
+    }
+    sendBuffer[len] = '\0';
+    releaseSeatSnapshot(seatsMap, token);
+
+    sendReplyBuffer(cInfo, sendBuffer);
+    return 0;
+}
+
+// Turns seat change pushes on or off for the client. Clients should
+// fetch the seat map after subscribing, only later changes are pushed.
+int handleSubscribe(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    int subscribe = (msg->numArgs > 0 && msg->argIsInt[0]) ? (msg->args[0] != 0) : 1;
+
+    printFromClient(clientIndex, "Client %s seat changes.", subscribe ? "subscribed to" : "unsubscribed from");
+
+    profiledLock(&socketLock);
+    cInfo->subscribed = subscribe;
+    profiledUnlock(&socketLock);
+
+    sprintf(sendBuffer, "%d%s%d%s%u", SERVER_SUBSCRIBED,
+        NETWORK_MSG_DELIM, subscribe, NETWORK_MSG_DELIM, settings.broadcastTickMs);
+    sendReplyBuffer(cInfo, sendBuffer);
+    return 0;
+}
+
+// Moves the client onto a shared memory channel. The reply carries the
+// channel's file descriptors. From then on requests and replies go
+// through the channel, and the socket only reports a disconnect.
+int handleShmAttach(int clientIndex, const netMsg* msg, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    int domain = 0;
+    socklen_t domainLen = sizeof(domain);
+
+    if (settings.ioEngine != IO_ENGINE_THREADS || cInfo->shm.channel != NULL ||
+        getsockopt(cInfo->socket, SOL_SOCKET, SO_DOMAIN, &domain, &domainLen) < 0 || domain != AF_UNIX)
+    {
+        printFromClient(clientIndex, "Client asked for shared memory on an unsupported connection.");
+        sendReply(cInfo, SERVER_MSG_INVALID, "Shared memory needs a unix socket and -engine threads", sendBuffer);
+        return 1;
+    }
+
+    shmEndpoint endpoint;
+    int clientWakeFd;
+    if (shmCreate(&endpoint, &clientWakeFd))
+    {
+        printWarning("Unable to create a shared memory channel for Client #%d.", clientIndex);
+        sendReply(cInfo, SERVER_MSG_INVALID, "Unable to create shared memory", sendBuffer);
+        return 1;
+    }
+
+    sprintf(sendBuffer, "%d%s%d", SERVER_SHM_READY, NETWORK_MSG_DELIM, SHM_RING_SIZE);
+    _addReplyTag(cInfo, sendBuffer);
+    strcat(sendBuffer, NETWORK_MSG_END);
+
+    // The reply has to be the last bytes on the socket, so anything
+    // still queued must go out first
+    int fds[SHM_NUM_FDS] = { endpoint.memFd, clientWakeFd, endpoint.wakeFd };
+    pthread_mutex_lock(&(cInfo->sendLock));
+    int failed = flushOutQueue(&(cInfo->out), cInfo->socket) || cInfo->out.length > 0 ||
+                 shmSendFds(cInfo->socket, sendBuffer, strlen(sendBuffer), fds, SHM_NUM_FDS);
+    if (!failed) cInfo->shm = endpoint;
+    pthread_mutex_unlock(&(cInfo->sendLock));
+
+    // Keep the rings on this thread's node, the client touches
+    // most of the request ring first
+    if (!failed && cInfo->cpu >= 0)
+        preferNodeForRange(endpoint.channel, sizeof(shmChannel), cpuNode(cInfo->cpu));
+
+    if (failed)
+    {
+        shmClose(&endpoint);
+        sendReply(cInfo, SERVER_MSG_INVALID, "Unable to send shared memory", sendBuffer);
+        return 1;
+    }
+
+    printFromClient(clientIndex, "Client moved to shared memory.");
+    return 0;
+}
+
+// Maps each client request id to its handler. Integer arguments
+// listed in argNames are required and validated before the
+// handler is called.
+msgHandlerEntry msgHandlers[MSG_HANDLER_TABLE_SIZE] = {
+    [CLIENT_DISCONNECT] = { handleDisconnect, 0, { NULL } },
+    [CLIENT_TICKET_REQUESTAVAILABILITY] = { handleRequestAvailability, 0, { NULL } },
+    [CLIENT_TICKET_REQUESTSTATUS] = { handleRequestStatus, 2, { "row", "column" } },
+    [CLIENT_TICKET_REQUESTPURCHASE] = { handleRequestPurchase, 2, { "row", "column" } },
+    [CLIENT_TICKET_REQUESTMAP] = { handleRequestMap, 0, { NULL } },
+    [CLIENT_SUBSCRIBE] = { handleSubscribe, 0, { NULL } },
+    [CLIENT_SHM_ATTACH] = { handleShmAttach, 0, { NULL } },
+    [CLIENT_TICKET_REQUESTTIERS] = { handleRequestTiers, 0, { NULL } },
+    [CLIENT_TICKET_REQUESTTIERPURCHASE] = { handleRequestTierPurchase, 1, { "tier" } },
+    [CLIENT_TICKET_REQUESTREGION] = { handleRequestRegion, 2, { "row", "column" } },
+    [CLIENT_TICKET_REQUESTSUMMARY] = { handleRequestSummary, 0, { NULL } },
+    [CLIENT_TICKET_REQUESTREFUND] = { handleRequestRefund, 2, { "row", "column" } },
+};
+
+// Validates a parsed client message and runs its handler
+int dispatchClientMsg(int clientIndex, int parseErr, const netMsg* parsed, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    char reason[64];
+
+    if (parseErr)
+    {
+        printFromClient(clientIndex, "Message is malformed: %s", msgParseErrorStr(parseErr));
+        sendReply(cInfo, SERVER_MSG_INVALID, (char*)msgParseErrorStr(parseErr), sendBuffer);
+        return 1;
+    }
+
+    if (parsed->id < 0 || parsed->id >= MSG_HANDLER_TABLE_SIZE ||
+        msgHandlers[parsed->id].handler == NULL)
+    {
+        printFromClient(clientIndex, "Message contains an invalid request id: %d", parsed->id);
+        sendReply(cInfo, SERVER_MSG_INVALID, "Unknown request id", sendBuffer);
+        return 1;
+    }
+
+    const msgHandlerEntry* entry = &(msgHandlers[parsed->id]);
+    for (int i = 0; i < entry->numIntArgs; i++)
+    {
+        if (i >= parsed->numArgs)
+        {
+            printFromClient(clientIndex, "Client request is missing %s arg.", entry->argNames[i]);
+            snprintf(reason, sizeof(reason), "Missing %s argument", entry->argNames[i]);
+            sendReply(cInfo, SERVER_TICKET_INVALID, reason, sendBuffer);
+            return 1;
+        }
+
+        if (!parsed->argIsInt[i])
+        {
+            printFromClient(clientIndex, "Client request has a malformed %s arg.", entry->argNames[i]);
+            snprintf(reason, sizeof(reason), "Malformed %s argument", entry->argNames[i]);
+            sendReply(cInfo, SERVER_MSG_INVALID, reason, sendBuffer);
+            return 1;
+        }
+    }
+
+    return entry->handler(clientIndex, parsed, sendBuffer);
+}
+
+// Processes a message recieved from a client
+int processClientMsg(int clientIndex, const char* msg, int msgSize, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    netMsg parsed;
+
+    printFromClient(clientIndex, "Processing message. Data = '%.*s'", msgSize, msg);
+
+    // All network messages start with a reqest id, optionally
+    // preceded by a tag that is echoed back in the reply
+    int err = parseNetMsg(msg, msgSize, &parsed);
+    cInfo->hasReplyTag = parsed.hasTag;
+    cInfo->replyTag = parsed.tag;
+
+    err = dispatchClientMsg(clientIndex, err, &parsed, sendBuffer);
+
+    cInfo->hasReplyTag = 0;
+    return err;
+}
+
+// Takes a token from the client's request budget and from its IP
+// address's. Returns 0 if the request may be served, otherwise the
+// milliseconds until it could be.
+unsigned int requestBudgetWait(clientInfo* cInfo)
+{
+    unsigned int rate = settings.rateLimit;
+    unsigned int ipRate = settings.ipRateLimit;
+    if (rate == 0 && (ipRate == 0 || cInfo->peerAddr == 0)) return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long nowNs = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+    // A burst of 0 allows one second worth of requests at once
+    unsigned int waitMs = takeToken(&(cInfo->requestBudget), rate,
+        settings.rateBurst ? settings.rateBurst : rate, nowNs);
+    if (waitMs == 0 && cInfo->peerAddr != 0)
+        waitMs = takeIpToken(&ipLimits, cInfo->peerAddr, ipRate,
+            settings.ipRateBurst ? settings.ipRateBurst : ipRate, nowNs);
+    return waitMs;
+}
+
+// Turns away a request over the client's budget with SERVER_RETRY_LATER.
+// Only the request tag is read, so a flood costs no parsing or locking.
+void throttleClientMsg(int clientIndex, const char* msg, int msgSize, unsigned int waitMs, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+
+    if (msgSize > 1 && msg[0] == NETWORK_MSG_TAG)
+    {
+        const char* delim = memchr(msg, NETWORK_MSG_DELIM[0], msgSize);
+        if (delim != NULL && parseMsgInt(msg + 1, delim - msg - 1, &(cInfo->replyTag)) == 0)
+            cInfo->hasReplyTag = 1;
+    }
+
+    printFromClient(clientIndex, "Client is over its request rate, asking it to retry in %u ms.", waitMs);
+    sprintf(sendBuffer, "%d%s%u%s%s", SERVER_RETRY_LATER, NETWORK_MSG_DELIM, waitMs,
+        NETWORK_MSG_DELIM, "Rate limited");
+    sendReplyBuffer(cInfo, sendBuffer);
+
+    cInfo->hasReplyTag = 0;
+    __atomic_add_fetch(&throttledRequests, 1, __ATOMIC_RELAXED);
+}
+
+// Processes every complete message at the start of receiveBuffer and
+// moves any partial message to the front. Returns the bytes left.
+int processBufferedMsgs(int clientIndex, char* receiveBuffer, int bytesBuffered, char* sendBuffer)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    char* msgStart = receiveBuffer;
+    char* msgEnd;
+
+    receiveBuffer[bytesBuffered] = '\0';
+
+    while (clientConnected(cInfo) &&
+           (msgEnd = memchr(msgStart, NETWORK_MSG_END[0], bytesBuffered - (msgStart - receiveBuffer))) != NULL)
+    {
+        if (msgEnd > msgStart)
+        {
+            traceRecordEvent(&capture, cInfo->traceId, TRACE_MESSAGE, msgStart, msgEnd - msgStart);
+
+            unsigned int waitMs = requestBudgetWait(cInfo);
+            if (waitMs > 0) throttleClientMsg(clientIndex, msgStart, msgEnd - msgStart, waitMs, sendBuffer);
+            else processClientMsg(clientIndex, msgStart, msgEnd - msgStart, sendBuffer);
+        }
+        msgStart = msgEnd + 1;
+    }
+
+    // Keep any partial message for the next read
+    bytesBuffered -= msgStart - receiveBuffer;
+    memmove(receiveBuffer, msgStart, bytesBuffered);
+    return bytesBuffered;
+}
+
+// Parks a client thread while its socket is handed to a new server.
+// Hands over the partial message in receiveBuffer. Returns 1 if the
+// new server took over and the thread should exit without closing
+// the socket, or 0 if the handoff failed and serving continues.
+int parkForHandoff(int clientIndex, const char* receiveBuffer, int bytesBuffered)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+
+    profiledLock(&socketLock);
+
+    cInfo->pendingLen = bytesBuffered;
+    cInfo->pending = NULL;
+    if (bytesBuffered > 0)
+    {
+        cInfo->pending = malloc(bytesBuffered);
+        memcpy(cInfo->pending, receiveBuffer, bytesBuffered);
+    }
+
+    parkedThreads++;
+    pthread_cond_broadcast(&handoffCond);
+
+    while (handoffState == HANDOFF_STATE_RUNNING)
+        profiledCondWait(&handoffCond, &socketLock);
+
+    parkedThreads--;
+    int handedOff = (handoffState == HANDOFF_STATE_DONE);
+
+    free(cInfo->pending);
+    cInfo->pending = NULL;
+    cInfo->pendingLen = 0;
+
+    profiledUnlock(&socketLock);
+
+    return handedOff;
+}
+
+// Closes a client's socket and frees its slot right away.
+// Caller must hold socketLock.
+void _releaseClientSlot(int clientIndex)
+{
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+
+    cancelTimer(&connTimers, clientIndex);
+    pthread_mutex_lock(&(cInfo->sendLock));
+    freeOutQueue(&(cInfo->out));
+    shmClose(&(cInfo->shm));
+    pthread_mutex_unlock(&(cInfo->sendLock));
+    cInfo->subscribed = 0;
+    close(cInfo->socket);
+    traceRecordEvent(&capture, cInfo->traceId, TRACE_DISCONNECT, NULL, 0);
+    cInfo->status = CLIENT_STATUS_NONE;
+    cInfo->closeReason = CLOSE_REASON_NONE;
+
+    releaseConnSlot(&connSlots, clientIndex);
+    numConnections -= 1;
+    pthread_cond_broadcast(&handoffCond); // A handoff may be waiting on this client
+    signalWaitingRoom(&lobby);            // The next waiting client can have the slot
+}
+
+// Sends output that was waiting for room in a shared memory client's
+// channel, then reads its next requests. woken is set if the client
+// wrote to our eventfd. Returns the bytes read, or -1 if the client
+// corrupted the channel.
+int _shmReceive(clientInfo* cInfo, char* buffer, int maxLength, int woken)
+{
+    if (woken) shmDrainWake(cInfo->shm.wakeFd);
+
+    pthread_mutex_lock(&(cInfo->sendLock));
+    int failed = (cInfo->out.length > 0) && _flushClientOutput(cInfo);
+    pthread_mutex_unlock(&(cInfo->sendLock));
+    if (failed) return -1;
+
+    return shmRingRead(&(cInfo->shm.channel->requests), buffer, maxLength, cInfo->shm.peerWakeFd);
+}
+
+// Runs the client network request loop, executed in it's own thread
+void* serveClient(void* _cIndex)
+{
+    int clientIndex = (int)(intptr_t)_cIndex;
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    pthread_t threadId = cInfo->thread;
+
+    // Before the buffers below are touched, so they land on this CPU's
+    // node. Unpinned threads drop the policy inherited from the I/O thread.
+    if (cInfo->cpu >= 0 || settings.ioCpus.numCpus > 0)
+        preferNode((cInfo->cpu >= 0) ? cpuNode(cInfo->cpu) : -1);
+
+    char receiveBuffer[MSG_BUFFER_SIZE] = {0};
+    char sendBuffer[MSG_BUFFER_SIZE] = {0};
+    int bytesRead = 0;
+    int bytesBuffered = 0; // Bytes of a partial message kept from the last read
+
+    printFromThread(threadId, "Begin handling requests for Client #%d", clientIndex);
+
+    // Pick up bytes the previous server received but did not process
+    if (cInfo->pending != NULL)
+    {
+        memcpy(receiveBuffer, cInfo->pending, cInfo->pendingLen);
+        bytesBuffered = cInfo->pendingLen;
+        free(cInfo->pending);
+        cInfo->pending = NULL;
+        cInfo->pendingLen = 0;
+
+        bytesBuffered = processBufferedMsgs(clientIndex, receiveBuffer, bytesBuffered, sendBuffer);
+    }
+
+    setClientState(clientIndex, bytesBuffered > 0 ? CLIENT_STATUS_READING : CLIENT_STATUS_ACTIVE);
+
+    // Run while client is connected and server is running
+    while (serverRunning && clientConnected(cInfo))
+    {
+        // Block until the client sends data or a handoff starts.
+        // Shared memory clients write to our eventfd instead, and
+        // only if we said we are going to sleep.
+        struct pollfd pfds[3] = {
+            { cInfo->socket, POLLIN, 0 },
+            { quiescePipe[0], POLLIN, 0 },
+            { -1, POLLIN, 0 }
+        };
+        int waitMs = -1;
+
+        if (cInfo->shm.channel != NULL)
+        {
+            shmRing* requests = &(cInfo->shm.channel->requests);
+            pfds[2].fd = cInfo->shm.wakeFd;
+            if (shmRingSpin(requests, settings.shmSpinUs) || shmRingPrepareWait(requests))
+                waitMs = 0;
+        }
+
+        if (poll(pfds, 3, waitMs) < 0)
+        {
+            if (errno == EINTR) continue;
+
+            profiledLock(&socketLock);
+            _beginDisconnect(cInfo, CLOSE_REASON_ERROR);
+            profiledUnlock(&socketLock);
+            break;
+        }
+
+        if (pfds[1].revents && handoffState == HANDOFF_STATE_RUNNING)
+        {
+            if (parkForHandoff(clientIndex, receiveBuffer, bytesBuffered))
+            {
+                printFromThread(threadId, "Client #%d handed off to new server. Thread exiting ...", clientIndex);
+                return 0;
+            }
+
+            setClientState(clientIndex, bytesBuffered > 0 ? CLIENT_STATUS_READING : CLIENT_STATUS_ACTIVE);
+            continue;
+        }
+
+        if (cInfo->shm.channel != NULL && pfds[0].revents == 0)
+        {
+            bytesRead = _shmReceive(cInfo, receiveBuffer + bytesBuffered,
+                MSG_BUFFER_SIZE - 1 - bytesBuffered, pfds[2].revents != 0);
+            if (bytesRead == 0) continue;
+
+            if (bytesRead < 0)
+            {
+                printFromClient(clientIndex, "Shared memory channel is corrupt.");
+                profiledLock(&socketLock);
+                _beginDisconnect(cInfo, CLOSE_REASON_PROTOCOL);
+                profiledUnlock(&socketLock);
+                break;
+            }
+        }
+        else
+        {
+            if (pfds[0].revents == 0) continue;
+
+            // Leave room for a null terminator after the buffered data.
+            bytesRead = read(cInfo->socket, receiveBuffer + bytesBuffered,
+                MSG_BUFFER_SIZE - 1 - bytesBuffered);
+        }
+
+        if (bytesRead == 0 || (bytesRead < 0 && errno != EINTR))
+        {
+            // Peer closed the connection, or we shut it down
+            profiledLock(&socketLock);
+            _beginDisconnect(cInfo, (bytesRead == 0) ? CLOSE_REASON_EOF : CLOSE_REASON_ERROR);
+            profiledUnlock(&socketLock);
+            break;
+        }
+
+        if (bytesRead < 0) continue;
+
+        printFromThread(threadId, "%d bytes received from Client #%d", bytesRead, clientIndex);
+        bytesBuffered = processBufferedMsgs(clientIndex, receiveBuffer, bytesBuffered + bytesRead, sendBuffer);
+
+        if (bytesBuffered >= MSG_BUFFER_SIZE - 1)
+        {
+            printFromClient(clientIndex, "Message exceeds %d bytes.", MSG_BUFFER_SIZE - 1);
+            sendReply(cInfo, SERVER_MSG_INVALID, "Message too long", sendBuffer);
+
+            profiledLock(&socketLock);
+            _beginDisconnect(cInfo, CLOSE_REASON_PROTOCOL);
+            profiledUnlock(&socketLock);
+            break;
+        }
+
+        setClientState(clientIndex, bytesBuffered > 0 ? CLIENT_STATUS_READING : CLIENT_STATUS_ACTIVE);
+    }
+
+    profiledLock(&socketLock);
+
+    if (clientConnected(cInfo))
+        _beginDisconnect(cInfo, CLOSE_REASON_SHUTDOWN);
+
+    printFromThread(threadId, "Closing connection for Client #%d (%s)",
+        clientIndex, closeReasonStr(cInfo->closeReason));
+    _releaseClientSlot(clientIndex);
+
+    profiledUnlock(&socketLock);
+
+    printFromThread(threadId, "Thread exiting ...");
+    return 0;
+}
+
+// Returns the IPv4 address of a socket's peer in host order, or 0
+// for unix sockets and anything else without one
+uint32_t socketPeerAddr(int socket)
+{
+    struct sockaddr_in peer;
+    socklen_t peerLen = sizeof(peer);
+
+    if (getpeername(socket, (struct sockaddr*)&peer, &peerLen) != 0 || peer.sin_family != AF_INET)
+        return 0;
+    return ntohl(peer.sin_addr.s_addr);
+}
+
+// Takes the next free slot in the client pool and assigns socket to
+// it. handedOff holds the state of a client received from a previous
+// server, or NULL for a new connection. The slot takes ownership of
+// its buffers. Returns the slot index, or -1 if the pool is full.
+// Caller must hold socketLock.
+int _claimClientSlot(int socket, takeoverClient* handedOff)
+{
+    int i = claimConnSlot(&connSlots);
+    if (i < 0) return -1;
+
+    printFromHost("Assigning Client #%d to incoming connection.", i);
+    clientPool[i].status = CLIENT_STATUS_ACTIVE;
+    clientPool[i].socket = socket;
+    clientPool[i].closeReason = CLOSE_REASON_NONE;
+    clientPool[i].pending = NULL;
+    clientPool[i].pendingLen = 0;
+    clientPool[i].subscribed = 0;
+    clientPool[i].peerAddr = socketPeerAddr(socket);
+    clientPool[i].requestBudget.lastNs = 0;
+    clientPool[i].traceId = ++nextTraceId;
+    traceRecordEvent(&capture, clientPool[i].traceId, TRACE_CONNECT, NULL, 0);
+    if (handedOff != NULL)
+    {
+        clientPool[i].pending = handedOff->pending;
+        clientPool[i].pendingLen = handedOff->pendingLen;
+        clientPool[i].subscribed = handedOff->subscribed;
+        clientPool[i].out = handedOff->out;
+        clientPool[i].out.pool = &connBuffers;
+
+        int* shmFds = handedOff->shmFds;
+        if (shmFds[0] >= 0 && (shmFds[1] < 0 || shmFds[2] < 0 ||
+            shmAttach(&(clientPool[i].shm), shmFds[0], shmFds[1], shmFds[2])))
+        {
+            printWarning("Unable to map Client #%d's shared memory channel.", i);
+            for (int which = 0; which < SHM_NUM_FDS; which++)
+                if (shmFds[which] >= 0) close(shmFds[which]);
+        }
+    }
+    numConnections += 1;
+    return i;
+}
+
+// Assigns the connection to a free client slot and spins up a new
+// thread to handle all communications. See _claimClientSlot() for
+// handedOff. If the client pool is full returns 1.
+int startClientThread(int socket, takeoverClient* handedOff)
+{
+    profiledLock(&socketLock);
+
+    int i = _claimClientSlot(socket, handedOff);
+    if (i < 0)
+    {
+        profiledUnlock(&socketLock);
+        return 1;
+    }
+
+    // Fall back to the default stack if the configured size is rejected
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (settings.threadStackKb > 0 &&
+        pthread_attr_setstacksize(&attr, (size_t)settings.threadStackKb * 1024) != 0)
+        printWarning("Thread stack of %u KB is not allowed, using the default.", settings.threadStackKb);
+    clientPool[i].cpu = pinThreadAttr(&attr, &(settings.workerCpus), i);
+
+    int err = pthread_create( &(clientPool[i].thread), &attr, serveClient, (void*)(intptr_t)i);
+    pthread_attr_destroy(&attr);
+    if (err)
+        exitOnError(err, "Unable to create thread");
+    else
+    {
+        err = pthread_detach(clientPool[i].thread);
+        if (err)
+            exitOnError(err, "Unable to detach thread");
+        else
+            printFromHost("Thread spawned for Client #%d with handle 0x%lx", i, clientPool[i].thread);
+    }
+
+    profiledUnlock(&socketLock);
+    return 0;
+}
+
+// Serves a new connection with the configured engine, other than
+// io_uring which starts its own. If the client pool is full returns 1.
+int startClientConn(int socket)
+{
+    if (settings.ioEngine == IO_ENGINE_TASKS) return startTaskConn(socket);
+    return startClientThread(socket, NULL);
+}
+
+// Queues a message that is already formatted in sendBuffer, terminator
+// included, for every connected client, or only for subscribers.
+// Caller must hold socketLock.
+void _queueForClients(const char* sendBuffer, int subscribersOnly)
+{
+    int length = strlen(sendBuffer);
+
+    for (int i = 0; i < settings.maxConnections; i++)
+    {
+        clientInfo* cInfo = &(clientPool[i]);
+        if (!clientConnected(cInfo) || (subscribersOnly && !cInfo->subscribed)) continue;
+
+        if (_queueClientOutput(cInfo, sendBuffer, length) < 0)
+        {
+            printFromClient(i, "Client is not reading its messages, disconnecting.");
+            _beginDisconnect(cInfo, CLOSE_REASON_SLOW_CLIENT);
+        }
+    }
+
+    if (settings.ioEngine == IO_ENGINE_URING) uringWake();
+}
+
+// Sends every seat change recorded since the last tick to the
+// subscribers, as few SERVER_SEATS_CHANGED messages as fit. A seat
+// is listed as sold or returned by its state now, so one that was
+// sold and returned within a tick is only sent once. States and the
+// seats left come from one snapshot, so each message is consistent.
+// Without a snapshot the changes wait for the next tick.
+// Caller must hold socketLock.
+void _pushSeatChanges(char* sendBuffer)
+{
+    int seats[BROADCAST_SEATS_PER_MSG];
+    int returned[BROADCAST_SEATS_PER_MSG];
+    int cols = seatChanges.cols;
+    int count;
+
+    while ((count = takeSeatChanges(&seatChanges, seats, BROADCAST_SEATS_PER_MSG)) > 0)
+    {
+        int token;
+        const seatSnapshot* snapshot = acquireSeatSnapshot(seatsMap, &token);
+        if (snapshot == NULL)
+        {
+            // Out of memory, put the seats back for the next tick
+            for (int i = 0; i < count; i++)
+                recordSeatChange(&seatChanges, seats[i] / cols, seats[i] % cols);
+            break;
+        }
+
+        // Seats a resize cut off count as sold, they cannot be bought
+        int numSold = 0;
+        int numReturned = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (snapshotSeatSold(snapshot, seats[i] / cols, seats[i] % cols))
+                seats[numSold++] = seats[i];
+            else
+                returned[numReturned++] = seats[i];
+        }
+
+        unsigned int available = snapshot->rows * snapshot->cols - snapshot->numSold;
+        releaseSeatSnapshot(seatsMap, token);
+
+        int len = sprintf(sendBuffer, "%d%s%u%s", SERVER_SEATS_CHANGED,
+            NETWORK_MSG_DELIM, available, NETWORK_MSG_DELIM);
+
+        for (int i = 0; i < numSold; i++)
+            len += sprintf(sendBuffer + len, "%s%d:%d", i ? "," : "", seats[i] / cols, seats[i] % cols);
+
+        // Left off when nothing was returned, as before refunds existed
+        if (numReturned > 0) len += sprintf(sendBuffer + len, "%s", NETWORK_MSG_DELIM);
+        for (int i = 0; i < numReturned; i++)
+            len += sprintf(sendBuffer + len, "%s%d:%d", i ? "," : "", returned[i] / cols, returned[i] % cols);
+        strcpy(sendBuffer + len, NETWORK_MSG_END);
+
+        _queueForClients(sendBuffer, 1);
+    }
+}
+
+// Tells every client when sales close or open again, if that changed
+// since they were last told. Caller must hold socketLock.
+void _pushSalesChange(char* sendBuffer)
+{
+    int open = getNumSeatsAvailable(seatsMap) > 0;
+    if (open == salesOpen) return;
+
+    salesOpen = open;
+    printFromHost(open ? "Seats were returned, sales are open again." : "Sold out, telling clients.");
+    sprintf(sendBuffer, "%d%s%d%s", SERVER_SALES_CHANGED, NETWORK_MSG_DELIM, open, NETWORK_MSG_END);
+    _queueForClients(sendBuffer, 0);
+}
+
+// Pushes coalesced seat changes once per tick, sends the sold out
+// notice and flushes client output queues as their sockets drain.
+// With the io_uring engine the ring does the flushing instead.
+// Purchases only record changes, all broadcast I/O happens here.
+// Executed in it's own thread.
+void* runBroadcaster(void* unused)
+{
+    pinCurrentThread(&(settings.backgroundCpus));
+
+    char sendBuffer[MSG_BUFFER_SIZE];
+    char drain[64];
+    struct pollfd* pfds = malloc(sizeof(struct pollfd) * (settings.maxConnections + 1));
+    long long nextTick = timerNowMs() + settings.broadcastTickMs;
+    int stopping = 0;
+
+    if (pfds == NULL) exitOnError(1, "Unable to allocate broadcaster");
+
+    while (!stopping)
+    {
+        // Sleep until the next tick, a wake up, or a backed up client drains
+        int numPfds = 1;
+        pfds[0].fd = broadcastPipe[0];
+        pfds[0].events = POLLIN;
+
+        profiledLock(&socketLock);
+        for (int i = 0; i < settings.maxConnections && settings.ioEngine != IO_ENGINE_URING; i++)
+        {
+            clientInfo* cInfo = &(clientPool[i]);
+            if (!clientConnected(cInfo)) continue;
+
+            // Shared memory clients wake their own thread once they make room
+            pthread_mutex_lock(&(cInfo->sendLock));
+            if (cInfo->out.length > 0 && cInfo->shm.channel == NULL)
+            {
+                pfds[numPfds].fd = cInfo->socket;
+                pfds[numPfds++].events = POLLOUT;
+            }
+            pthread_mutex_unlock(&(cInfo->sendLock));
+        }
+        profiledUnlock(&socketLock);
+
+        long long waitMs = nextTick - timerNowMs();
+        if (waitMs > 0 && poll(pfds, numPfds, (int)waitMs) < 0 && errno != EINTR)
+            perror("Broadcaster poll failed");
+
+        while (read(broadcastPipe[0], drain, sizeof(drain)) > 0) { }
+
+        pthread_mutex_lock(&broadcastLock);
+        profiledLock(&socketLock);
+        stopping = !broadcasterRunning;
+
+        if (stopping || soldOutPending || salesChangePending || timerNowMs() >= nextTick)
+        {
+            _pushSeatChanges(sendBuffer);
+            nextTick = timerNowMs() + settings.broadcastTickMs;
+        }
+
+        if (salesChangePending)
+        {
+            salesChangePending = 0;
+            _pushSalesChange(sendBuffer);
+        }
+
+        if (soldOutPending)
+        {
+            soldOutPending = 0;
+            sprintf(sendBuffer, "%d%s%s%s", SERVER_DISCONNECT,
+                NETWORK_MSG_DELIM, "No more seats available.", NETWORK_MSG_END);
+            _queueForClients(sendBuffer, 0);
+
+            serverRunning = 0; // Before the shutdowns, so the accept loop sees it when accept() fails
+            shutdown(server_fd, SHUT_RDWR); // Forces server to stop accepting/blocking for new connections
+            if (unix_fd >= 0) shutdown(unix_fd, SHUT_RDWR);
+        }
+
+        // Write whatever the client sockets take now
+        for (int i = 0; i < settings.maxConnections && settings.ioEngine != IO_ENGINE_URING; i++)
+        {
+            clientInfo* cInfo = &(clientPool[i]);
+            if (!clientConnected(cInfo)) continue;
+
+            pthread_mutex_lock(&(cInfo->sendLock));
+            int failed = (cInfo->out.length > 0) && _flushClientOutput(cInfo);
+            pthread_mutex_unlock(&(cInfo->sendLock));
+
+            if (failed) _beginDisconnect(cInfo, CLOSE_REASON_ERROR);
+        }
+
+        profiledUnlock(&socketLock);
+        pthread_mutex_unlock(&broadcastLock);
+    }
+
+    free(pfds);
+    return NULL;
+}
+
+// Starts the broadcaster thread for a seat map of the given size
+void startBroadcaster(int rows, int cols)
+{
+    if (pipe2(broadcastPipe, O_NONBLOCK | O_CLOEXEC) < 0)
+        exitOnError(1, "Unable to create broadcaster pipe");
+    exitOnError(initSeatChangeLog(&seatChanges, rows, cols), "Unable to allocate seat change log");
+
+    broadcasterRunning = 1;
+    exitOnError(pthread_create(&broadcasterThread, NULL, runBroadcaster, NULL),
+        "Unable to create broadcaster thread");
+}
+
+// Pushes any remaining changes, then stops the broadcaster thread.
+// Does nothing if it is already stopped.
+void stopBroadcaster()
+{
+    pthread_mutex_lock(&broadcastLock);
+    int wasRunning = broadcasterRunning;
+    broadcasterRunning = 0;
+    pthread_mutex_unlock(&broadcastLock);
+
+    if (!wasRunning) return;
+
+    wakeBroadcaster();
+    pthread_join(broadcasterThread, NULL);
+    freeSeatChangeLog(&seatChanges);
+}
+
+// Sends a waiting client its place in line and an estimated wait in
+// milliseconds, or -1 before any client has been admitted. Never
+// blocks. Returns non-zero if the client has hung up.
+int sendWaitingUpdate(int socket, int position)
+{
+    char msg[64];
+    char peek;
+
+    // Requests sent while waiting stay in the socket until admitted
+    int peeked = recv(socket, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (peeked == 0 || (peeked < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) return 1;
+
+    long long etaMs = (admitRateEstimate > 0) ? (long long)(position * 1000 / admitRateEstimate) : -1;
+    int length = snprintf(msg, sizeof(msg), "%d%s%d%s%lld%s", SERVER_WAITING,
+        NETWORK_MSG_DELIM, position, NETWORK_MSG_DELIM, etaMs, NETWORK_MSG_END);
+
+    // A client too slow to read its updates just misses one
+    if (send(socket, msg, length, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        return 1;
+    return 0;
+}
+
+// Puts a connection the server has no free slot for at the back of
+// the waiting room, or turns it away if the room is full or disabled
+void waitOrShedConnection(int socket)
+{
+    int position = joinWaitingRoom(&lobby, socket, timerNowMs());
+    if (position == 0)
+    {
+        printFromHost("Server full, asking client to retry in %u ms.", settings.retryAfterMs);
+        shedConnection(socket, settings.retryAfterMs, "Server full");
+        return;
+    }
+
+    // A hang up is noticed on the next update
+    printFromHost("Server full, client is number %d in the waiting room.", position);
+    sendWaitingUpdate(socket, position);
+}
+
+// Keeps a waiting client in line if it is still connected
+int _updateWaitingClient(waitingClient* client, int position, void* unused)
+{
+    if (sendWaitingUpdate(client->socket, position) == 0) return 1;
+
+    printFromHost("A client left the waiting room after %lld ms.", timerNowMs() - client->joinedMs);
+    close(client->socket);
+    return 0;
+}
+
+// Admits clients from the front of the waiting room while slots are
+// free and admit_rate allows. startConn serves the socket and returns
+// non-zero if the slot was taken after all. Only called by one thread.
+void admitWaitingClients(int (*startConn)(int socket))
+{
+    waitingClient client;
+
+    while (waitingRoomLength(&lobby) > 0)
+    {
+        profiledLock(&socketLock);
+        int canAdmit = serverRunning && handoffState == HANDOFF_STATE_NONE &&
+                       connSlots.numUsed < connSlots.capacity;
+        profiledUnlock(&socketLock);
+        if (!canAdmit) return;
+
+        // Allows a tick's worth at once, which the next tick makes up for
+        double burst = settings.admitRate * WAITING_ROOM_TICK_MS / 1000.0;
+        if (takeToken(&admitBudget, settings.admitRate, burst, timerNowMs() * 1000000LL) > 0) return;
+
+        if (!leaveWaitingRoom(&lobby, &client)) return;
+        if (startConn(client.socket))
+        {
+            if (!rejoinWaitingRoom(&lobby, &client))
+                shedConnection(client.socket, settings.retryAfterMs, "Server full");
+            return;
+        }
+
+        printFromHost("Admitted a client from the waiting room after %lld ms.", timerNowMs() - client.joinedMs);
+    }
+}
+
+// Starts serving a client admitted from the waiting room
+int _startWaitingClient(int socket)
+{
+    return startClientConn(socket);
+}
+
+// Admits waiting clients as slots free up and tells the rest their
+// place in line every waiting_update_ms
+void* runWaitingRoom(void* unused)
+{
+    pinCurrentThread(&(settings.backgroundCpus));
+
+    long long lastUpdateMs = timerNowMs();
+    unsigned long lastAdmitted = 0;
+
+    for (;;)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WAITING_ROOM_TICK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        // Wakes early when a client slot is released
+        pthread_mutex_lock(&(lobby.mutex));
+        if (doormanRunning) pthread_cond_timedwait(&(lobby.cond), &(lobby.mutex), &deadline);
+        int running = doormanRunning;
+        unsigned long admitted = lobby.admitted;
+        pthread_mutex_unlock(&(lobby.mutex));
+        if (!running) break;
+
+        // The io_uring loop admits its own clients when woken
+        if (settings.ioEngine == IO_ENGINE_URING)
+        {
+            profiledLock(&socketLock);
+            int hasRoom = connSlots.numUsed < connSlots.capacity;
+            profiledUnlock(&socketLock);
+            if (waitingRoomLength(&lobby) > 0 && hasRoom) uringWake();
+        }
+        else admitWaitingClients(_startWaitingClient);
+
+        long long nowMs = timerNowMs();
+        if (nowMs - lastUpdateMs >= settings.waitingUpdateMs)
+        {
+            double rate = (admitted - lastAdmitted) * 1000.0 / (nowMs - lastUpdateMs);
+            admitRateEstimate = (admitRateEstimate > 0) ? admitRateEstimate * 0.7 + rate * 0.3 : rate;
+            lastAdmitted = admitted;
+            lastUpdateMs = nowMs;
+
+            visitWaitingRoom(&lobby, _updateWaitingClient, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+// Starts the waiting room thread if the waiting room is enabled
+void startWaitingRoom()
+{
+    if (initWaitingRoom(&lobby, settings.waitingRoomSize))
+        exitOnError(1, "Unable to allocate waiting room");
+    if (settings.waitingRoomSize == 0) return;
+
+    admitRateEstimate = settings.admitRate;
+    doormanRunning = 1;
+    exitOnError(pthread_create(&doormanThread, NULL, runWaitingRoom, NULL),
+        "Unable to create waiting room thread");
+    printFromHost("Up to %u connections can wait for a free slot.", settings.waitingRoomSize);
+}
+
+// Sends every waiting client away with reason and closes them
+int _dismissWaitingClient(waitingClient* client, int position, void* reason)
+{
+    char msg[128];
+    int length = snprintf(msg, sizeof(msg), "%d%s%s%s", SERVER_DISCONNECT,
+        NETWORK_MSG_DELIM, (const char*)reason, NETWORK_MSG_END);
+    send(client->socket, msg, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(client->socket);
+    return 0;
+}
+
+// Sends every waiting client a retry hint, for a server being replaced
+int _redirectWaitingClient(waitingClient* client, int position, void* unused)
+{
+    shedConnection(client->socket, settings.retryAfterMs, "Server restarting");
+    return 0;
+}
+
+// Stops the waiting room thread and empties the line. Clients are
+// told to retry if the server is being replaced, or why it closed.
+// Does nothing if the waiting room is not running.
+void stopWaitingRoom(int replaced)
+{
+    pthread_mutex_lock(&(lobby.mutex));
+    int wasRunning = doormanRunning;
+    doormanRunning = 0;
+    pthread_cond_signal(&(lobby.cond));
+    pthread_mutex_unlock(&(lobby.mutex));
+
+    if (!wasRunning) return;
+    pthread_join(doormanThread, NULL);
+
+    if (replaced)
+        visitWaitingRoom(&lobby, _redirectWaitingClient, NULL);
+    else
+        visitWaitingRoom(&lobby, _dismissWaitingClient,
+            (getNumSeatsAvailable(seatsMap) <= 0) ? "No more seats available." : "Server shutting down.");
+
+    printFromHost("%lu clients were admitted from the waiting room.", lobby.admitted);
+}
+
+// Stops the accept loop and all client threads, then sends the seat map,
+// the listening socket and every client socket to the new server on
+// conn. Returns 0 once the new server confirms it is serving, in which
+// case this process must exit without closing any handed off socket.
+// On failure everything resumes as before.
+int handOffToNewServer(int conn)
+{
+    unsigned char* payload = malloc(HANDOFF_MAX_PAYLOAD);
+    int failed = (payload == NULL);
+
+    printFromHost("Replacement server connected, pausing to hand off connections ...");
+    long long startMs = timerNowMs();
+
+    // Keep the broadcaster out until the handoff is over, its
+    // queued output goes to the new server with each client
+    pthread_mutex_lock(&broadcastLock);
+
+    // Wake the accept loop and every client thread so they park
+    profiledLock(&socketLock);
+    handoffState = HANDOFF_STATE_RUNNING;
+    profiledUnlock(&socketLock);
+    if (write(quiescePipe[1], "x", 1) != 1) failed = 1;
+
+    profiledLock(&socketLock);
+
+    for (;;)
+    {
+        int connected = 0;
+        for (int i = 0; i < settings.maxConnections; i++)
+            if (clientConnected(&(clientPool[i]))) connected++;
+
+        if (failed || (acceptLoopParked && parkedThreads >= connected)) break;
+        profiledCondWait(&handoffCond, &socketLock);
+    }
+
+    // Changes not pushed yet travel in the output queues
+    if (!failed)
+        _pushSeatChanges((char*)payload);
+
+    // Seat map: rows, cols, one byte per seat, then the receipt of each
+    if (!failed)
+    {
+        int* dims = (int*)payload;
+        unsigned char* states = payload + sizeof(int) * 2;
+        unsigned long long receipts[MAX_SEATS_ROWS * MAX_SEATS_COLS];
+        int numSeats = getSeatStates(seatsMap, states, receipts,
+            MAX_SEATS_ROWS * MAX_SEATS_COLS, &(dims[1]));
+        dims[0] = (dims[1] > 0) ? numSeats / dims[1] : 0;
+        memcpy(states + numSeats, receipts, sizeof(unsigned long long) * numSeats);
+        failed = sendHandoffMsg(conn, HANDOFF_SEATMAP, payload,
+            sizeof(int) * 2 + numSeats * (1 + sizeof(unsigned long long)), -1);
+    }
+
+    if (!failed)
+        failed = sendHandoffMsg(conn, HANDOFF_LISTENER, NULL, 0, server_fd);
+
+    if (!failed && unix_fd >= 0)
+    {
+        int kind = LISTENER_KIND_UNIX;
+        failed = sendHandoffMsg(conn, HANDOFF_LISTENER, &kind, sizeof(kind), unix_fd);
+    }
+
+    for (int i = 0; i < settings.maxConnections && !failed; i++)
+    {
+        clientInfo* cInfo = &(clientPool[i]);
+        if (!clientConnected(cInfo)) continue;
+
+        handoffClientState* state = (handoffClientState*)payload;
+        state->subscribed = cInfo->subscribed;
+        state->pendingLen = cInfo->pendingLen;
+        state->outLen = cInfo->out.length;
+
+        unsigned char* data = payload + sizeof(handoffClientState);
+        memcpy(data, cInfo->pending, cInfo->pendingLen);
+        memcpy(data + cInfo->pendingLen, cInfo->out.data, cInfo->out.length);
+
+        failed = sendHandoffMsg(conn, HANDOFF_CLIENT, payload, sizeof(handoffClientState) +
+            cInfo->pendingLen + cInfo->out.length, cInfo->socket);
+
+        // A shared memory client's channel follows, one fd per message.
+        // Requests still in the ring stay there for the new server.
+        int shmFds[SHM_NUM_FDS] = { cInfo->shm.memFd, cInfo->shm.wakeFd, cInfo->shm.peerWakeFd };
+        for (int which = 0; which < SHM_NUM_FDS && !failed && cInfo->shm.channel != NULL; which++)
+            failed = sendHandoffMsg(conn, HANDOFF_CLIENT_SHM, &which, sizeof(which), shmFds[which]);
+    }
+
+    if (!failed)
+        failed = sendHandoffMsg(conn, HANDOFF_DONE, NULL, 0, -1);
+
+    profiledUnlock(&socketLock);
+
+    // Wait for the new server to start serving
+    if (!failed)
+    {
+        struct timeval ackTimeout = { HANDOFF_ACK_TIMEOUT_SECS, 0 };
+        int type = 0, length = 0, fd = -1;
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &ackTimeout, sizeof(ackTimeout));
+        failed = recvHandoffMsg(conn, &type, payload, HANDOFF_MAX_PAYLOAD, &length, &fd) ||
+                 type != HANDOFF_ACK;
+    }
+
+    free(payload);
+
+    profiledLock(&socketLock);
+
+    if (failed)
+    {
+        // Drain the wake up byte and resume serving
+        char drain;
+        if (read(quiescePipe[0], &drain, 1) < 0) { }
+        handoffState = HANDOFF_STATE_NONE;
+        printFromHost("Handoff failed, resuming service.");
+    }
+    else
+    {
+        handoffState = HANDOFF_STATE_DONE;
+        printFromHost("Handoff complete after %lld ms.", timerNowMs() - startMs);
+    }
+
+    pthread_cond_broadcast(&handoffCond);
+    profiledUnlock(&socketLock);
+    pthread_mutex_unlock(&broadcastLock);
+
+    return failed;
+}
+
+// Waits for replacement servers on the upgrade socket.
+// Executed in it's own thread.
+void* runUpgradeListener(void* _listenFd)
+{
+    int listenFd = (int)(intptr_t)_listenFd;
+    pinCurrentThread(&(settings.backgroundCpus));
+
+    while (serverRunning)
+    {
+        int conn = accept(listenFd, NULL, NULL);
+        if (conn < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        int failed = handOffToNewServer(conn);
+        close(conn);
+        if (!failed) break;
+    }
+
+    return NULL;
+}
+
+// Starts listening for a replacement server on upgradePath
+void startUpgradeListener()
+{
+    pthread_t thread;
+
+    int listenFd = listenForHandoff(upgradePath);
+    if (listenFd < 0)
+    {
+        perror("Unable to create upgrade socket");
+        return;
+    }
+
+    if (pthread_create(&thread, NULL, runUpgradeListener, (void*)(intptr_t)listenFd) == 0)
+    {
+        pthread_detach(thread);
+        printFromHost("Listening for replacement servers on %s", upgradePath);
+    }
+}
+
+// Connects to a running server at path and receives its seat map,
+// listening sockets and client sockets. Sets seatsMap, server_fd
+// and unix_fd if the running server has a unix socket listener.
+// Returns the number of clients stored in *clients, or -1 on error.
+int receiveHandoff(const char* path, int* conn, takeoverClient** clients)
+{
+    int type, length, fd;
+    int numClients = 0;
+    unsigned char* payload = malloc(HANDOFF_MAX_PAYLOAD);
+
+    *clients = NULL;
+    *conn = connectForHandoff(path);
+    if (*conn < 0 || payload == NULL)
+    {
+        free(payload);
+        return -1;
+    }
+
+    printFromHost("Taking over from the server at %s ...", path);
+
+    while (recvHandoffMsg(*conn, &type, payload, HANDOFF_MAX_PAYLOAD, &length, &fd) == 0)
+    {
+        if (type == HANDOFF_SEATMAP && length >= sizeof(int) * 2)
+        {
+            // Receipts follow the states, unless the old server had none
+            int* dims = (int*)payload;
+            unsigned int numSeats = dims[0] * dims[1];
+            unsigned char* states = payload + sizeof(int) * 2;
+            unsigned long long receipts[MAX_SEATS_ROWS * MAX_SEATS_COLS];
+            int hasReceipts = (length - sizeof(int) * 2 == numSeats * (1 + sizeof(unsigned long long)));
+            if (numSeats > MAX_SEATS_ROWS * MAX_SEATS_COLS) break;
+            if (numSeats != length - sizeof(int) * 2 && !hasReceipts) break;
+            if (hasReceipts)
+                memcpy(receipts, states + numSeats, sizeof(unsigned long long) * numSeats);
+
+            seatsMap = createSeatMap(dims[0], dims[1]);
+            setSeatStates(seatsMap, states, hasReceipts ? receipts : NULL);
+
+            // The map keeps the old server's size until a reload
+            // changes rows or cols, see runConfigReloader()
+            settings.seatRows = dims[0];
+            settings.seatCols = dims[1];
+            salesOpen = getNumSeatsAvailable(seatsMap) > 0; // What the clients were last told
+        }
+        else if (type == HANDOFF_LISTENER && fd >= 0)
+        {
+            if (length >= sizeof(int) && *(int*)payload == LISTENER_KIND_UNIX)
+                unix_fd = fd;
+            else
+                server_fd = fd;
+        }
+        else if (type == HANDOFF_CLIENT && fd >= 0 && length >= sizeof(handoffClientState))
+        {
+            handoffClientState* state = (handoffClientState*)payload;
+            const char* data = (const char*)payload + sizeof(handoffClientState);
+            if (state->pendingLen < 0 || state->outLen < 0 ||
+                sizeof(handoffClientState) + state->pendingLen + state->outLen != length)
+            {
+                close(fd);
+                break;
+            }
+
+            *clients = realloc(*clients, sizeof(takeoverClient) * (numClients + 1));
+            takeoverClient* client = &((*clients)[numClients++]);
+            client->socket = fd;
+            client->subscribed = state->subscribed;
+            client->pendingLen = state->pendingLen;
+            client->pending = NULL;
+            if (state->pendingLen > 0)
+            {
+                client->pending = malloc(state->pendingLen);
+                memcpy(client->pending, data, state->pendingLen);
+            }
+            memset(&(client->out), 0, sizeof(outQueue));
+            appendOutQueue(&(client->out), data + state->pendingLen, state->outLen, MAX_OUT_QUEUE_LIMIT);
+            for (int which = 0; which < SHM_NUM_FDS; which++)
+                client->shmFds[which] = -1;
+        }
+        else if (type == HANDOFF_CLIENT_SHM && fd >= 0 && numClients > 0 && length == sizeof(int) &&
+                 *(int*)payload >= 0 && *(int*)payload < SHM_NUM_FDS)
+        {
+            (*clients)[numClients - 1].shmFds[*(int*)payload] = fd;
+        }
+        else if (type == HANDOFF_DONE)
+        {
+            free(payload);
+            return (seatsMap != NULL && server_fd > 0) ? numClients : -1;
+        }
+        else
+        {
+            if (fd >= 0) close(fd);
+            break;
+        }
+    }
+
+    free(payload);
+    return -1;
+}
+
+// Returns 1 if a new connection fits in this second's accept budget.
+// Otherwise returns 0 and sets retryAfterMs to the time left in the
+// current second. Only called from the accept loop.
+int withinAcceptBudget(unsigned int* retryAfterMs)
+{
+    static time_t windowStart = 0;
+    static unsigned int acceptedInWindow = 0;
+
+    if (settings.acceptRate == 0) return 1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (now.tv_sec != windowStart)
+    {
+        windowStart = now.tv_sec;
+        acceptedInWindow = 0;
+    }
+
+    if (acceptedInWindow < settings.acceptRate)
+    {
+        acceptedInWindow++;
+        return 1;
+    }
+
+    *retryAfterMs = 1000 - (now.tv_nsec / 1000000);
+    return 0;
+}
+
+// Keeps maxConnections within the process file descriptor limit
+void applyFdBudget()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) return;
+
+    if (limit.rlim_cur <= RESERVED_FDS)
+        exitOnError(1, "File descriptor limit is too low");
+
+    rlim_t budget = limit.rlim_cur - RESERVED_FDS;
+    if (settings.maxConnections > budget)
+    {
+        printFromHost("Lowering max connections from %u to %u to fit the open file limit.",
+            settings.maxConnections, (unsigned int)budget);
+        settings.maxConnections = budget;
+    }
+
+    // Waiting clients hold a descriptor each too
+    budget -= settings.maxConnections;
+    if (settings.waitingRoomSize > budget)
+    {
+        printFromHost("Lowering the waiting room from %u to %u to fit the open file limit.",
+            settings.waitingRoomSize, (unsigned int)budget);
+        settings.waitingRoomSize = budget;
+    }
+}
+
+// Returns the engine for a name such as "uring", or -1 if it is
+// unknown or not built in
+int parseIoEngine(const char* name)
+{
+    if (strcmp(name, "threads") == 0) return IO_ENGINE_THREADS;
+    if (strcmp(name, "tasks") == 0) return IO_ENGINE_TASKS;
+#ifdef USE_IO_URING
+    if (strcmp(name, "uring") == 0) return IO_ENGINE_URING;
+#endif
+    return -1;
+}
+
+// Applies a CPU list setting such as worker_cpus. At startup an invalid
+// list, or one naming a CPU this process cannot use, is fatal.
+// CPU lists only change on restart.
+void applyCpuListSetting(const iniFile* file, const char* key, cpuList* list, int reload)
+{
+    const char* text = getIniString(&configOverrides, key);
+    if (text == NULL) text = getIniString(file, key);
+    if (text == NULL) text = "";
+
+    cpuList parsed;
+    int invalid = parseCpuList(text, &parsed);
+    int unavailable = invalid ? -1 : unavailableCpu(&parsed);
+
+    if (!reload && (invalid || unavailable >= 0))
+    {
+        if (invalid)
+            fprintf(stderr, "Invalid value for %s, must be a CPU list such as 0-3,8\n", key);
+        else
+            fprintf(stderr, "Invalid value for %s, CPU %d is not available\n", key, unavailable);
+        exit(EXIT_FAILURE);
+    }
+    else if (!reload)
+        *list = parsed;
+    else if (invalid || !cpuListsEqual(&parsed, list))
+        printWarning("%s cannot change while running, restart to apply.", key);
+}
+
+// Parses a comma separated list of up to maxValues non-negative
+// integers. Returns the number of values, or -1 if the text is not
+// such a list.
+int parseUIntList(const char* text, unsigned int* values, int maxValues)
+{
+    int count = 0;
+
+    while (*text != '\0')
+    {
+        char* end;
+        if (!isdigit((unsigned char)*text) || count == maxValues) return -1;
+
+        errno = 0;
+        unsigned long value = strtoul(text, &end, 10);
+        if (errno != 0 || value > UINT_MAX) return -1;
+        values[count++] = (unsigned int)value;
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        text = end;
+    }
+
+    return count;
+}
+
+// Applies tier_prices and tier_rows. At startup invalid lists are
+// fatal, tiers only change on restart.
+void applyTierSettings(const iniFile* file, int reload)
+{
+    const char* pricesText = getIniString(&configOverrides, "tier_prices");
+    if (pricesText == NULL) pricesText = getIniString(file, "tier_prices");
+    if (pricesText == NULL || *pricesText == '\0') pricesText = "0";
+
+    const char* rowsText = getIniString(&configOverrides, "tier_rows");
+    if (rowsText == NULL) rowsText = getIniString(file, "tier_rows");
+    if (rowsText == NULL) rowsText = "";
+
+    unsigned int prices[MAX_SEAT_TIERS];
+    unsigned int rows[MAX_SEAT_TIERS] = { 0 };
+    int numTiers = parseUIntList(pricesText, prices, MAX_SEAT_TIERS);
+    int numRows = parseUIntList(rowsText, rows, MAX_SEAT_TIERS);
+    int invalid = (numTiers < 1 || numRows != numTiers - 1);
+
+    if (!reload && invalid)
+    {
+        fprintf(stderr, "Invalid value for tier_prices or tier_rows, give 1 to %d prices "
+            "and the row count of every tier but the last\n", MAX_SEAT_TIERS);
+        exit(EXIT_FAILURE);
+    }
+    else if (!reload)
+    {
+        settings.numTiers = numTiers;
+        memcpy(settings.tierPrices, prices, sizeof(prices));
+        memcpy(settings.tierRows, rows, sizeof(rows));
+    }
+    else if (invalid || numTiers != settings.numTiers ||
+             memcmp(prices, settings.tierPrices, sizeof(unsigned int) * numTiers) != 0 ||
+             memcmp(rows, settings.tierRows, sizeof(unsigned int) * numRows) != 0)
+        printWarning("tier_prices and tier_rows cannot change while running, restart to apply.");
+}
+
+// Prints how much of the client traffic the capture recorded and
+// closes its file. Does nothing if traffic is not being captured.
+void stopCapture()
+{
+    if (!traceActive(&capture)) return;
+
+    stopTrace(&capture);
+    printFromHost("Captured %lu events (%llu KB) to %s, %lu dropped because the disk fell behind.",
+        capture.records, capture.bytesWritten / 1024, settings.capturePath, capture.dropped);
+}
+
+// Applies capture_path. Unlike most string settings it can change
+// while running: a reload stops the current capture, if any, and
+// starts one at the new path. At startup a path that cannot be
+// created is fatal. Returns 1 if the capture changed.
+int applyCaptureSetting(const iniFile* file, int reload)
+{
+    const char* path = getIniString(&configOverrides, "capture_path");
+    if (path == NULL) path = getIniString(file, "capture_path");
+    if (path == NULL) path = "";
+
+    if (strcmp(path, settings.capturePath) == 0) return 0;
+
+    if (strlen(path) >= MAX_CAPTURE_PATH)
+    {
+        if (!reload)
+        {
+            fprintf(stderr, "Invalid value for capture_path, must be shorter than %d characters\n", MAX_CAPTURE_PATH);
+            exit(EXIT_FAILURE);
+        }
+        printWarning("Invalid value for capture_path, must be shorter than %d characters.", MAX_CAPTURE_PATH);
+        return 0;
+    }
+
+    stopCapture();
+    strcpy(settings.capturePath, path);
+    if (path[0] == '\0') return 1;
+
+    if (startTrace(&capture, path))
+    {
+        if (!reload)
+        {
+            fprintf(stderr, "Unable to create capture file %s: %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        printWarning("Unable to create capture file %s: %s", path, strerror(errno));
+        settings.capturePath[0] = '\0';
+        return 1;
+    }
+
+    printFromHost("Capturing client traffic to %s", path);
+    return 1;
+}
+
+// Applies the config file and the command line overrides to settings.
+// At startup an invalid value is fatal. On reload, invalid values and
+// settings that need a restart keep their current value.
+// Returns the number of settings that changed.
+int applyConfig(const iniFile* file, int reload)
+{
+    int changed = 0;
+
+    for (int i = 0; i < NUM_SETTINGS; i++)
+    {
+        const settingInfo* info = &(settingInfos[i]);
+        const iniFile* source = (getIniString(&configOverrides, info->key) != NULL) ? &configOverrides :
+                                (getIniString(file, info->key) != NULL) ? file : NULL;
+        unsigned int value = info->defaultValue;
+
+        if (source != NULL && (getIniUInt(source, info->key, &value) != 0 ||
+            value < info->minValue || value > info->maxValue))
+        {
+            if (!reload)
+            {
+                fprintf(stderr, "Invalid value for %s, must be %u to %u\n",
+                    info->key, info->minValue, info->maxValue);
+                exit(EXIT_FAILURE);
+            }
+
+            printWarning("Invalid value for %s, keeping %u.", info->key, *(info->value));
+            continue;
+        }
+
+        if (reload && value != *(info->value))
+        {
+            if (!info->live)
+            {
+                printWarning("%s cannot change while running, restart to use %u.", info->key, value);
+                continue;
+            }
+
+            printFromHost("%s changed from %u to %u.", info->key, *(info->value), value);
+            changed++;
+        }
+
+        *(info->value) = value;
+    }
+
+    const char* engineName = getIniString(&configOverrides, "io_engine");
+    if (engineName == NULL) engineName = getIniString(file, "io_engine");
+
+    int engine = (engineName != NULL) ? parseIoEngine(engineName) : DEFAULT_IO_ENGINE;
+    if (engine < 0 && !reload)
+    {
+        fprintf(stderr, "Invalid value for io_engine, must be threads, uring or tasks "
+            "(uring needs a build with -DUSE_IO_URING)\n");
+        exit(EXIT_FAILURE);
+    }
+    else if (!reload)
+        settings.ioEngine = engine;
+    else if (engine != settings.ioEngine)
+        printWarning("io_engine cannot change while running, restart to apply.");
+
+    const char* unixPath = getIniString(&configOverrides, "unix_path");
+    if (unixPath == NULL) unixPath = getIniString(file, "unix_path");
+    if (unixPath == NULL) unixPath = "";
+
+    if (strlen(unixPath) >= MAX_UNIX_PATH && !reload)
+    {
+        fprintf(stderr, "Invalid value for unix_path, must be shorter than %d characters\n", MAX_UNIX_PATH);
+        exit(EXIT_FAILURE);
+    }
+    else if (!reload)
+        strcpy(settings.unixPath, unixPath);
+    else if (strcmp(unixPath, settings.unixPath) != 0)
+        printWarning("unix_path cannot change while running, restart to apply.");
+
+    applyCpuListSetting(file, "io_cpus", &(settings.ioCpus), reload);
+    applyCpuListSetting(file, "worker_cpus", &(settings.workerCpus), reload);
+    applyCpuListSetting(file, "background_cpus", &(settings.backgroundCpus), reload);
+    applyTierSettings(file, reload);
+    changed += applyCaptureSetting(file, reload);
+
+    const char* levelName = getIniString(&configOverrides, "log_level");
+    if (levelName == NULL) levelName = getIniString(file, "log_level");
+
+    int level = (levelName != NULL) ? parseLogLevel(levelName) : DEFAULT_LOG_LEVEL;
+    if (level < 0)
+    {
+        if (!reload)
+        {
+            fprintf(stderr, "Invalid value for log_level, must be error, warn, info or debug\n");
+            exit(EXIT_FAILURE);
+        }
+
+        printWarning("Invalid value for log_level, keeping the current level.");
+    }
+    else if (level != settings.logLevel || !reload)
+    {
+        if (reload) changed++;
+        settings.logLevel = level;
+        setLogLevel(level);
+    }
+
+    return changed;
+}
+
+// Reads the config file at path into file. Exits if it cannot be read
+// at startup, returns non-zero if it cannot be read on reload.
+int readConfigFile(const char* path, iniFile* file, int reload)
+{
+    initIniFile(file);
+    if (path == NULL) return 0;
+
+    if (loadIniFile(path, file))
+    {
+        freeIniFile(file);
+        if (!reload)
+        {
+            fprintf(stderr, "Unable to read config file %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+
+        printWarning("Unable to read %s, keeping the current settings.", path);
+        return 1;
+    }
+
+    if (file->badLine)
+        printWarning("%s line %d is not a key=value pair, ignoring it.", path, file->badLine);
+    return 0;
+}
+
+// Resizes the seat map to newRows by newCols after a reload changed
+// rows or cols. Sales go on while the new layout is built, see
+// resizeSeatMap(). The rows and cols settings follow the map's size
+// and are only written under socketLock, like the rest of settings.
+void applySeatMapSize(unsigned int newRows, unsigned int newCols)
+{
+    int rows = getSeatRows(seatsMap);
+    int cols = getSeatCols(seatsMap);
+    if (rows == newRows && cols == newCols) return;
+
+    int replayed = resizeSeatMap(seatsMap, newRows, newCols);
+    if (replayed < 0)
+    {
+        if (replayed == SEAT_RESIZE_SEATS_SOLD)
+            printWarning("Keeping the seat map at %dx%d, sold seats lie outside %ux%u.",
+                rows, cols, newRows, newCols);
+        else
+            printWarning("Unable to resize the seat map, out of memory.");
+
+        // So a reload of the same size tries again
+        configRows = rows;
+        configCols = cols;
+        return;
+    }
+
+    profiledLock(&socketLock);
+    settings.seatRows = newRows;
+    settings.seatCols = newCols;
+    profiledUnlock(&socketLock);
+
+    printFromHost("Seat map resized from %dx%d to %ux%u, %d seats changed while it was built.",
+        rows, cols, newRows, newCols, replayed);
+    printSeatMap(seatsMap);
+
+    // Added seats can reopen sales, and removed unsold ones can end them
+    checkSeatsFull();
+    checkSalesReopened();
+}
+
+// Rereads the config file and applies the settings that are safe to
+// change while serving. Executed in it's own thread, once per SIGHUP.
+void* runConfigReloader(void* unused)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    pinCurrentThread(&(settings.backgroundCpus));
+
+    int sig;
+    while (sigwait(&signals, &sig) == 0)
+    {
+        iniFile file;
+        printFromHost("SIGHUP received, reloading %s ...", configPath);
+        if (readConfigFile(configPath, &file, 1)) continue;
+
+        profiledLock(&socketLock);
+        unsigned int oldBacklog = settings.listenBacklog;
+
+        // Compare against the size the config asked for last time, as
+        // a takeover or a refused resize can leave the map at another
+        settings.seatRows = configRows;
+        settings.seatCols = configCols;
+        int changed = applyConfig(&file, 1);
+        unsigned int newRows = settings.seatRows;
+        unsigned int newCols = settings.seatCols;
+        int resize = (newRows != configRows || newCols != configCols);
+        configRows = newRows;
+        configCols = newCols;
+
+        // Until applySeatMapSize() has resized it, the map keeps its size
+        settings.seatRows = getSeatRows(seatsMap);
+        settings.seatCols = getSeatCols(seatsMap);
+        profiledUnlock(&socketLock);
+
+        // Linux applies a new backlog when listen() is called again
+        if (settings.listenBacklog != oldBacklog && (listen(server_fd, settings.listenBacklog) < 0 ||
+            (unix_fd >= 0 && listen(unix_fd, settings.listenBacklog) < 0)))
+            printWarning("Unable to change the listen backlog.");
+
+        wakeBroadcaster(); // Picks up a new tick length
+        if (resize) applySeatMapSize(newRows, newCols);
+        freeIniFile(&file);
+
+        printFromHost("Config reloaded, %d settings changed.", changed);
+    }
+
+    return NULL;
+}
+
+#ifdef LOCK_PROFILE
+// Prints how long threads waited for and held each profiled lock
+void printLockReport()
+{
+    lockPrintMutex();
+    printLockProfile(stdout);
+    unlockPrintMutex();
+}
+
+// Prints the lock report each time SIGUSR1 arrives. Executed in it's
+// own thread.
+void* runLockReporter(void* unused)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pinCurrentThread(&(settings.backgroundCpus));
+
+    int sig;
+    while (sigwait(&signals, &sig) == 0)
+        printLockReport();
+
+    return NULL;
+}
+#endif
+
+// Creates the unix socket listener at path that clients on this
+// machine can use instead of TCP. Removes a stale socket file first.
+// Returns the fd or -1.
+int createUnixListener(const char* path)
+{
+    struct sockaddr_un addr;
+    if (_handoffAddr(path, &addr)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, settings.listenBacklog) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Returns the path unix_fd is bound to, stored in addr, or NULL.
+// Also works for a listener received in a handoff.
+const char* unixListenerPath(struct sockaddr_un* addr)
+{
+    socklen_t addrLen = sizeof(*addr);
+    if (unix_fd < 0 || getsockname(unix_fd, (struct sockaddr*)addr, &addrLen) < 0) return NULL;
+    return (addr->sun_path[0] != '\0') ? addr->sun_path : NULL;
+}
+
+// Closes the unix socket listener and removes its socket file.
+// Not called after a handoff, the new server still listens on it.
+void closeUnixListener()
+{
+    struct sockaddr_un addr;
+    const char* path = unixListenerPath(&addr);
+
+    if (unix_fd < 0) return;
+    if (path != NULL) unlink(path);
+
+    close(unix_fd);
+    unix_fd = -1;
+}
+
+// Sets the size of a client socket's kernel buffers if configured
+void applySocketBuffers(int socket)
+{
+    int size;
+
+    if (settings.socketSendBuffer > 0)
+    {
+        size = settings.socketSendBuffer;
+        setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+
+    if (settings.socketRecvBuffer > 0)
+    {
+        size = settings.socketRecvBuffer;
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+}
+
+#define TASK_POLL_EVENTS 64      // Ready clients taken from epoll per poll
+#define TASK_WAKE_ID 0xffffffffu // epoll data of the wake eventfd
+
+// Task side state of one client slot. Only the worker running the
+// client's task touches it, epoll hands a client to one worker at a time.
+typedef struct taskConn_ {
+    char* recvBuffer;  // Partial message, borrowed from connBuffers while one is waiting
+    int bytesBuffered;
+} taskConn;
+
+taskPool taskWorkers;
+taskConn* taskConns = NULL;
+pthread_t* taskThreads = NULL;
+int* taskThreadCpus = NULL; // CPU each worker is pinned to, -1 if not pinned
+int taskEpollFd = -1;
+int taskWakeFd = -1;        // eventfd, makes the polling worker return at exit
+
+// Closes a client the task engine serves and frees its slot
+void _taskClose(int clientIndex, int reason)
+{
+    taskConn* conn = &(taskConns[clientIndex]);
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+
+    // Before the slot can be claimed again
+    if (conn->recvBuffer != NULL) bufPoolPut(&connBuffers, conn->recvBuffer);
+    conn->recvBuffer = NULL;
+    conn->bytesBuffered = 0;
+
+    profiledLock(&socketLock);
+    _beginDisconnect(cInfo, reason);
+    printFromClient(clientIndex, "Closing connection (%s)", closeReasonStr(cInfo->closeReason));
+    _releaseClientSlot(clientIndex);
+    profiledUnlock(&socketLock);
+}
+
+// Waits for the client's next data. Each wait is one shot, so the
+// client is never ready on two workers at once.
+void _taskArm(int clientIndex)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.u32 = clientIndex;
+
+    if (epoll_ctl(taskEpollFd, EPOLL_CTL_MOD, clientPool[clientIndex].socket, &event) < 0)
+        _taskClose(clientIndex, CLOSE_REASON_ERROR);
+}
+
+// Reads from a ready client and processes its messages the same way
+// serveClient() does. Returns 1 if it may have more to read, 0 if it
+// should wait for data, or -1 once it was closed.
+int _runClientTask(int clientIndex, char* receiveBuffer, char* sendBuffer)
+{
+    taskConn* conn = &(taskConns[clientIndex]);
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+
+    // The timer or broadcaster may have disconnected it
+    if (!clientConnected(cInfo))
+    {
+        _taskClose(clientIndex, CLOSE_REASON_SHUTDOWN);
+        return -1;
+    }
+
+    int bytesBuffered = conn->bytesBuffered;
+    if (conn->recvBuffer != NULL)
+    {
+        memcpy(receiveBuffer, conn->recvBuffer, bytesBuffered);
+        bufPoolPut(&connBuffers, conn->recvBuffer);
+        conn->recvBuffer = NULL;
+    }
+    conn->bytesBuffered = 0;
+
+    // Leave room for a null terminator after the buffered data
+    int space = MSG_BUFFER_SIZE - 1 - bytesBuffered;
+    int bytesRead = recv(cInfo->socket, receiveBuffer + bytesBuffered, space, MSG_DONTWAIT);
+
+    if (bytesRead == 0 || (bytesRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+        _taskClose(clientIndex, (bytesRead == 0) ? CLOSE_REASON_EOF : CLOSE_REASON_ERROR);
+        return -1;
+    }
+
+    if (bytesRead > 0)
+    {
+        printFromClient(clientIndex, "%d bytes received", bytesRead);
+        bytesBuffered = processBufferedMsgs(clientIndex, receiveBuffer, bytesBuffered + bytesRead, sendBuffer);
+
+        if (bytesBuffered >= MSG_BUFFER_SIZE - 1)
+        {
+            printFromClient(clientIndex, "Message exceeds %d bytes.", MSG_BUFFER_SIZE - 1);
+            sendReply(cInfo, SERVER_MSG_INVALID, "Message too long", sendBuffer);
+            _taskClose(clientIndex, CLOSE_REASON_PROTOCOL);
+            return -1;
+        }
+
+        if (!clientConnected(cInfo))
+        {
+            _taskClose(clientIndex, CLOSE_REASON_SHUTDOWN);
+            return -1;
+        }
+
+        setClientState(clientIndex, bytesBuffered > 0 ? CLIENT_STATUS_READING : CLIENT_STATUS_ACTIVE);
+    }
+
+    // Only a partial message needs to keep a buffer between turns
+    if (bytesBuffered > 0)
+    {
+        if ((conn->recvBuffer = bufPoolGet(&connBuffers)) == NULL)
+        {
+            printWarning("Out of buffer memory, disconnecting Client #%d.", clientIndex);
+            _taskClose(clientIndex, CLOSE_REASON_ERROR);
+            return -1;
+        }
+        memcpy(conn->recvBuffer, receiveBuffer, bytesBuffered);
+        conn->bytesBuffered = bytesBuffered;
+    }
+
+    return (bytesRead == space) ? 1 : 0;
+}
+
+// Runs client tasks until the task pool stops. A worker runs its own
+// tasks newest first, steals from other workers when it has none,
+// and otherwise takes its turn waiting on epoll for ready clients.
+void* runTaskWorker(void* _worker)
+{
+    int worker = (int)(intptr_t)_worker;
+    int cpu = taskThreadCpus[worker];
+
+    // Before the buffers below are touched, so they land on this CPU's node
+    if (cpu >= 0 || settings.ioCpus.numCpus > 0)
+        preferNode((cpu >= 0) ? cpuNode(cpu) : -1);
+
+    char receiveBuffer[MSG_BUFFER_SIZE];
+    char sendBuffer[MSG_BUFFER_SIZE];
+    struct epoll_event events[TASK_POLL_EVENTS];
+
+    for (;;)
+    {
+        int clientIndex;
+        if (takeTask(&taskWorkers, worker, &clientIndex))
+        {
+            // A client that filled the buffer gives up its turn, behind
+            // this worker's other tasks and first in line to be stolen
+            int result = _runClientTask(clientIndex, receiveBuffer, sendBuffer);
+            if (result > 0 && yieldTask(&taskWorkers, worker, clientIndex))
+                wakeIdleWorker(&taskWorkers);
+            else if (result >= 0)
+                _taskArm(clientIndex);
+            continue;
+        }
+
+        int waiting = waitForTasks(&taskWorkers);
+        if (waiting < 0) break;
+        if (waiting == 0) continue;
+
+        int numEvents = epoll_wait(taskEpollFd, events, TASK_POLL_EVENTS, -1);
+        int numFound = 0;
+        for (int i = 0; i < numEvents; i++)
+        {
+            if (events[i].data.u32 == TASK_WAKE_ID) continue;
+
+            // Never full, a client is queued at most once
+            pushTask(&taskWorkers, worker, events[i].data.u32);
+            numFound++;
+        }
+        endTaskPoll(&taskWorkers, numFound);
+    }
+
+    return NULL;
+}
+
+// Gives a connection a client slot and waits for its first data.
+// Returns 1 if every slot is taken.
+int startTaskConn(int socket)
+{
+    profiledLock(&socketLock);
+    int i = _claimClientSlot(socket, NULL);
+    profiledUnlock(&socketLock);
+    if (i < 0) return 1;
+
+    taskConns[i].bytesBuffered = 0;
+    setClientState(i, CLIENT_STATUS_ACTIVE);
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.u32 = i;
+    if (epoll_ctl(taskEpollFd, EPOLL_CTL_ADD, socket, &event) < 0)
+    {
+        perror("Unable to watch client socket");
+        _taskClose(i, CLOSE_REASON_ERROR);
+    }
+    return 0;
+}
+
+// Starts the task engine's workers, by default one for each worker
+// CPU, or each online CPU if they are not set
+void startTaskWorkers()
+{
+    int numWorkers = settings.workerThreads;
+    if (numWorkers == 0) numWorkers = settings.workerCpus.numCpus;
+    if (numWorkers == 0) numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numWorkers < 1) numWorkers = 1;
+
+    struct epoll_event wake;
+    wake.events = EPOLLIN;
+    wake.data.u32 = TASK_WAKE_ID;
+
+    taskEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    taskWakeFd = eventfd(0, EFD_CLOEXEC);
+    taskConns = calloc(settings.maxConnections, sizeof(taskConn));
+    taskThreads = malloc(sizeof(pthread_t) * numWorkers);
+    taskThreadCpus = malloc(sizeof(int) * numWorkers);
+    if (taskEpollFd < 0 || taskWakeFd < 0 || taskConns == NULL || taskThreads == NULL ||
+        taskThreadCpus == NULL || epoll_ctl(taskEpollFd, EPOLL_CTL_ADD, taskWakeFd, &wake) < 0 ||
+        initTaskPool(&taskWorkers, numWorkers, settings.maxConnections))
+        exitOnError(1, "Unable to allocate the task engine");
+
+    for (int w = 0; w < numWorkers; w++)
+    {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        taskThreadCpus[w] = pinThreadAttr(&attr, &(settings.workerCpus), w);
+
+        int err = pthread_create(&(taskThreads[w]), &attr, runTaskWorker, (void*)(intptr_t)w);
+        pthread_attr_destroy(&attr);
+        if (err)
+            exitOnError(err, "Unable to create task worker");
+    }
+
+    printFromHost("Serving clients with %d task workers ...", numWorkers);
+}
+
+// Stops the task workers. Clients still connected are left to the exit.
+void stopTaskWorkers()
+{
+    stopTaskPool(&taskWorkers);
+    if (eventfd_write(taskWakeFd, 1) < 0) { }
+
+    for (int w = 0; w < taskWorkers.numWorkers; w++)
+        pthread_join(taskThreads[w], NULL);
+
+    unsigned long stolen;
+    unsigned long ran = taskPoolRan(&taskWorkers, &stolen);
+    printFromHost("Task workers ran %lu client turns, %lu of them stolen from another worker.", ran, stolen);
+
+    for (int i = 0; i < settings.maxConnections; i++)
+        if (taskConns[i].recvBuffer != NULL) bufPoolPut(&connBuffers, taskConns[i].recvBuffer);
+
+    freeTaskPool(&taskWorkers);
+    close(taskEpollFd);
+    close(taskWakeFd);
+    free(taskConns);
+    free(taskThreads);
+    free(taskThreadCpus);
+}
+
+#ifdef USE_IO_URING
+
+#define URING_ENTRIES 256    // Submission queue size
+#define URING_BUF_GROUP 0
+#define URING_NUM_BUFS 1024  // Provided receive buffers shared by every client
+#define URING_BUF_SIZE 2048
+#define URING_DRAIN_MS 1000  // Time given to clients to read their last replies at exit
+
+// What a completion belongs to, kept in the top half of user_data
+// with the client slot index in the bottom half
+#define URING_REQ_ACCEPT 1
+#define URING_REQ_RECV 2
+#define URING_REQ_SEND 3
+#define URING_REQ_WAKE 4
+#define URING_REQ_TIMEOUT 5
+#define URING_USER_DATA(req, index) (((uint64_t)(req) << 32) | (uint32_t)(index))
+
+// Ring side state of one client slot, only used by the ring thread
+typedef struct uringConn_ {
+    char* recvBuffer;  // Partial message, borrowed from connBuffers while one is waiting
+    int bytesBuffered;
+    int recvArmed;     // A multishot recv is in flight
+    outQueue sending;  // Bytes owned by the send in flight
+    int sendOffset;
+    int sendArmed;     // A send is in flight
+    int dirty;         // On the dirty list, has output to send
+    int closing;       // Receive ended, close once the last send is done
+} uringConn;
+
+uring serverRing;
+uringBufRing serverBufs;
+uringConn* uringConns = NULL;
+int* uringDirty = NULL; // Slots with output to send after this batch
+int numUringDirty = 0;
+int uringWakeFd = -1;   // eventfd, written by other threads that queued output
+uint64_t uringWakeValue;
+pthread_t uringThread;
+
+// Wakes the ring thread so it sends output other threads queued
+void uringWake()
+{
+    if (eventfd_write(uringWakeFd, 1) < 0) { }
+}
+
+// Has the ring send the client's queued output after the current
+// batch of completions
+void uringRequestFlush(int clientIndex)
+{
+    if (!pthread_equal(pthread_self(), uringThread))
+    {
+        uringWake();
+        return;
+    }
 
-#define DEFAULT_SEATS_ROWS 5 // Default size of seat map rows
-#define DEFAULT_SEATS_COLS 5 // Default size of seat map columns
-#define MAX_SEATS_ROWS 25    // Max allowed size of seat map rows
-#define MAX_SEATS_COLS 25    // Max allowed size of seat map columns
+    if (!uringConns[clientIndex].dirty)
+    {
+        uringConns[clientIndex].dirty = 1;
+        uringDirty[numUringDirty++] = clientIndex;
+    }
+}
 
-#define PORT 5432            // Listening port for server
-#define MAX_CONNECTIONS 5    // Max number of allowed connected clients
-#define MSG_BUFFER_SIZE 1024 // Size of network messages buffer
+// Queues a new SQE, submitting earlier ones first if the queue is full
+struct io_uring_sqe* _uringSqe()
+{
+    struct io_uring_sqe* sqe = uringGetSqe(&serverRing);
+    if (sqe == NULL) exitOnError(1, "io_uring submission queue is full");
+    return sqe;
+}
 
-// Enums for different client connection status
-#define CLIENT_STATUS_NONE 0
-#define CLIENT_STATUS_ACTIVE 1
-#define CLIENT_STATUS_DISCONNECT 2
+// Starts receiving on a client, or on the listening socket
+void _uringArmRecv(int clientIndex)
+{
+    uringPrepRecvMultishot(_uringSqe(), clientPool[clientIndex].socket,
+        URING_BUF_GROUP, URING_USER_DATA(URING_REQ_RECV, clientIndex));
+    uringConns[clientIndex].recvArmed = 1;
+}
 
-// Stores information related to a single client
-typedef struct clientInfo_ {
-    pthread_t thread;
-    int status;
-    int socket;
-} clientInfo;
+// Starts accepting on a listening socket, the index is its LISTENER_KIND
+void _uringArmAccept(int listenerKind)
+{
+    int listenFd = (listenerKind == LISTENER_KIND_UNIX) ? unix_fd : server_fd;
+    uringPrepAcceptMultishot(_uringSqe(), listenFd, URING_USER_DATA(URING_REQ_ACCEPT, listenerKind));
+}
 
-// Global variables because this is just an example program.
-seatMap* seatsMap = NULL;
-clientInfo clientPool[MAX_CONNECTIONS];
-unsigned int numConnections = 0;
-unsigned int serverRunning = 0;
-int server_fd = 0;
+void _uringArmWake()
+{
+    uringPrepRead(_uringSqe(), uringWakeFd, &uringWakeValue, sizeof(uringWakeValue),
+        URING_USER_DATA(URING_REQ_WAKE, 0));
+}
 
-pthread_mutex_t socketLock;
+// Moves the client's queued output into a send, unless one is already
+// in flight. Replies queued meanwhile go out with the next send.
+void _uringStartSend(int clientIndex)
+{
+    uringConn* conn = &(uringConns[clientIndex]);
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    if (conn->sendArmed) return;
 
-// Helper function that will automatically exit the server
-// if returnVal is non-zero
-int exitOnError(int returnVal, char* errMsg) {
-    if (returnVal != 0) 
-    { 
-        serverRunning = 0;
-        perror(errMsg); 
-        exit(1);
-    }
+    pthread_mutex_lock(&(cInfo->sendLock));
+    outQueue swap = conn->sending;
+    conn->sending = cInfo->out;
+    cInfo->out = swap;
+    cInfo->out.length = 0;
+    pthread_mutex_unlock(&(cInfo->sendLock));
 
-    return returnVal; 
+    if (conn->sending.length == 0) return;
+
+    conn->sendOffset = 0;
+    conn->sendArmed = 1;
+    uringPrepSend(_uringSqe(), cInfo->socket, conn->sending.data, conn->sending.length,
+        URING_USER_DATA(URING_REQ_SEND, clientIndex));
 }
 
-// Initializes the client connection pool
-void initclientPool()
+// Frees the slot once its receive has ended and no send is in flight
+void _uringTryClose(int clientIndex)
 {
-    for (int i = 0; i < MAX_CONNECTIONS; i++)
-    {
-        clientPool[i].thread = 0;
-        clientPool[i].status = CLIENT_STATUS_NONE;
-        clientPool[i].socket = 0;
-    }
+    uringConn* conn = &(uringConns[clientIndex]);
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+    if (!conn->closing || conn->recvArmed || conn->sendArmed) return;
+
+    profiledLock(&socketLock);
+
+    // Last chance for replies queued after the final send, such as
+    // a disconnect notice
+    pthread_mutex_lock(&(cInfo->sendLock));
+    flushOutQueue(&(cInfo->out), cInfo->socket);
+    pthread_mutex_unlock(&(cInfo->sendLock));
+    shutdown(cInfo->socket, SHUT_RDWR);
+
+    printFromClient(clientIndex, "Closing connection (%s)", closeReasonStr(cInfo->closeReason));
+    _releaseClientSlot(clientIndex);
+
+    profiledUnlock(&socketLock);
+
+    freeOutQueue(&(conn->sending));
+    conn->closing = 0;
+    conn->bytesBuffered = 0;
+    if (conn->recvBuffer != NULL) bufPoolPut(&connBuffers, conn->recvBuffer);
+    conn->recvBuffer = NULL;
 }
 
-// Helper function that sends a response id and resonse message to a client
-void sendMsgResponse(int socket, int msgId, char* msgBody, char* sendBuffer)
+// Starts closing a client whose receive ended
+void _uringBeginClose(int clientIndex, int reason)
 {
-    sprintf(sendBuffer, "%d", msgId);
-    strcat(sendBuffer, NETWORK_MSG_DELIM);
-    strcat(sendBuffer, msgBody);
-    send(socket, sendBuffer, strlen(sendBuffer), 0);
+    profiledLock(&socketLock);
+    _beginDisconnect(&(clientPool[clientIndex]), reason);
+    profiledUnlock(&socketLock);
+
+    uringConns[clientIndex].closing = 1;
+    _uringTryClose(clientIndex);
 }
 
-// Checks if all seats have been sold, and disconnects all clients if so
-void checkSeatsFull(char* sendBuffer)
+// Processes received bytes the same way serveClient() does
+void _uringReceive(int clientIndex, const char* data, int length, char* sendBuffer)
 {
-    if (getNumSeatsAvailable(seatsMap) <= 0)
+    uringConn* conn = &(uringConns[clientIndex]);
+    clientInfo* cInfo = &(clientPool[clientIndex]);
+
+    if (conn->recvBuffer == NULL && (conn->recvBuffer = bufPoolGet(&connBuffers)) == NULL)
     {
-        printFromHost("All seats have been sold. Disconnecting clients ...");
+        printWarning("Out of buffer memory, disconnecting Client #%d.", clientIndex);
+        profiledLock(&socketLock);
+        _beginDisconnect(cInfo, CLOSE_REASON_ERROR);
+        profiledUnlock(&socketLock);
+        return;
+    }
+
+    while (length > 0 && clientConnected(cInfo))
+    {
+        // Leave room for a null terminator after the buffered data
+        int space = MSG_BUFFER_SIZE - 1 - conn->bytesBuffered;
+        int chunk = (length < space) ? length : space;
 
-        for (int i = 0; i < MAX_CONNECTIONS; i++)
+        memcpy(conn->recvBuffer + conn->bytesBuffered, data, chunk);
+        data += chunk;
+        length -= chunk;
+
+        conn->bytesBuffered = processBufferedMsgs(clientIndex, conn->recvBuffer,
+            conn->bytesBuffered + chunk, sendBuffer);
+
+        if (conn->bytesBuffered >= MSG_BUFFER_SIZE - 1)
         {
-            if (clientPool[i].status == 1)
-            {
-                sendMsgResponse(clientPool[i].socket, SERVER_DISCONNECT, "No more seats available.", sendBuffer);
-            }
+            printFromClient(clientIndex, "Message exceeds %d bytes.", MSG_BUFFER_SIZE - 1);
+            sendReply(cInfo, SERVER_MSG_INVALID, "Message too long", sendBuffer);
+
+            profiledLock(&socketLock);
+            _beginDisconnect(cInfo, CLOSE_REASON_PROTOCOL);
+            profiledUnlock(&socketLock);
+            return;
         }
+    }
 
-        shutdown(server_fd, SHUT_RDWR); // Forces server to stop accepting/blocking for new connections
-        serverRunning = 0;
+    // Only a partial message needs to keep the buffer
+    if (conn->bytesBuffered == 0)
+    {
+        bufPoolPut(&connBuffers, conn->recvBuffer);
+        conn->recvBuffer = NULL;
     }
+
+    setClientState(clientIndex, conn->bytesBuffered > 0 ? CLIENT_STATUS_READING : CLIENT_STATUS_ACTIVE);
 }
 
-// Processes a message recieved from a client
-int processClientMsg(int clientIndex, char* msg, int msgSize, char* sendBuffer)
+// Gives a connection a client slot and starts receiving from it.
+// Returns 1 if every slot is taken.
+int _uringStartConn(int socket)
 {
-    clientInfo* cInfo = &(clientPool[clientIndex]);
+    profiledLock(&socketLock);
+    int i = _claimClientSlot(socket, NULL);
+    profiledUnlock(&socketLock);
+    if (i < 0) return 1;
+
+    uringConns[i].bytesBuffered = 0;
+    uringConns[i].closing = 0;
+    setClientState(i, CLIENT_STATUS_ACTIVE);
+    _uringArmRecv(i);
+    return 0;
+}
 
-    printFromClient(clientIndex, "Processing message. Data = '%s'", msg);
+// Admits or sheds a connection the ring accepted
+void _uringAccept(int socket, int listenerKind)
+{
+    unsigned int retryAfterMs;
 
-    char intStr[20];
-    char *saveptr;
-    char* sRow;
-    char* sCol;
-    char* reqIdStr = strtok_r(msg, NETWORK_MSG_DELIM, &saveptr); // strtok_r is threadsafe
-    int row, col, taken;
-    int reqId = atoi(reqIdStr);
+    printFromHost("~~~ New connection established%s ~~~", (listenerKind == LISTENER_KIND_UNIX) ? " (unix socket)" : "");
+    applySocketBuffers(socket);
 
-    // All network messages start with a reqest id
-    switch (reqId)
+    if (!withinAcceptBudget(&retryAfterMs))
     {
-        case CLIENT_DISCONNECT:
-            printFromClient(clientIndex, "Client requested disconnection.");
-            cInfo->status = CLIENT_DISCONNECT;
-            sendMsgResponse(cInfo->socket, SERVER_DISCONNECT,"Client requested disconnection.", sendBuffer);
-            break;
-        case CLIENT_TICKET_REQUESTAVAILABILITY:
-            printFromClient(clientIndex, "Client requested ticket availability. Sending response.");
-
-            sprintf(sendBuffer, "%d", SERVER_TICKET_RANGE);
-            strcat(sendBuffer, NETWORK_MSG_DELIM);
-            
-            sprintf(intStr, "%d", getSeatRows(seatsMap));
-            strcat(sendBuffer, intStr);
-            strcat(sendBuffer, NETWORK_MSG_DELIM);
-
-            sprintf(intStr, "%d", getSeatCols(seatsMap));
-            strcat(sendBuffer, intStr);
-            strcat(sendBuffer, NETWORK_MSG_DELIM);
-
-            sprintf(intStr, "%d", getNumSeatsAvailable(seatsMap));
-            strcat(sendBuffer, intStr);
-            send(cInfo->socket, sendBuffer, strlen(sendBuffer), 0);
-            break;
-        case CLIENT_TICKET_REQUESTSTATUS:
-            printFromClient(clientIndex, "Client requested ticket status.");
+        printFromHost("Accept rate exceeded, asking client to retry in %u ms.", retryAfterMs);
+        shedConnection(socket, retryAfterMs, "Accept rate exceeded");
+        return;
+    }
+    if (shedIfSoldOut(socket)) return;
 
-            sRow = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            if (sRow == NULL)
-            {
-                printFromClient(clientIndex, "Client request is missing Row arg.");
-                sendMsgResponse(cInfo->socket, SERVER_TICKET_INVALID,"Missing row argument", sendBuffer);
-                break;
-            }
+    // Others already waiting keep their place in line
+    if (waitingRoomLength(&lobby) > 0 || _uringStartConn(socket))
+        waitOrShedConnection(socket);
+}
 
-            sCol = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            if (sCol == NULL)
-            {
-                printFromClient(clientIndex, "Client request is missing Row arg.");
-                sendMsgResponse(cInfo->socket, SERVER_TICKET_INVALID, "Missing column argument", sendBuffer);
-                break;
-            }
-            
-            row = atoi(sRow);
-            col = atoi(sCol);
-            taken = seatSold(seatsMap, row, col);
-            if (taken == -1)
-            {
-                printFromClient(clientIndex, "Ticket Row/Col is invalid. (row: %2d, col: %2d)", row, col);
-                sendMsgResponse(cInfo->socket, SERVER_TICKET_INVALID, "Invalid row or column", sendBuffer);
-            }
-            else if (taken == 0)
-            {
-                printFromClient(clientIndex, "Sending response. Is Available (row: %2d, col: %2d)", row, col);
-                sprintf(sendBuffer, "%d", SERVER_TICKET_AVAILABLE);
-                send(cInfo->socket, sendBuffer, strlen(sendBuffer), 0);
-            }
-            else
-            {
-                printFromClient(clientIndex, "Sending response. Not Available (row: %2d, col: %2d)", row, col);
-                sprintf(sendBuffer, "%d", SERVER_TICKET_NOT_AVAILABLE);
-                send(cInfo->socket, sendBuffer, strlen(sendBuffer), 0);
-            }
-            break;
-        case CLIENT_TICKET_REQUESTPURCHASE:
-            printFromClient(clientIndex, "Client requested ticket purchase.");
+// Handles one completion
+void _uringComplete(struct io_uring_cqe* cqe, char* sendBuffer)
+{
+    int req = cqe->user_data >> 32;
+    int index = (uint32_t)cqe->user_data;
+    int more = cqe->flags & IORING_CQE_F_MORE;
 
-            sRow = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            if (sRow == NULL)
-            {
-                printFromClient(clientIndex, "Client request is missing Row arg.");
-                sendMsgResponse(cInfo->socket, SERVER_TICKET_INVALID, "Missing row argument", sendBuffer);
-                break;
-            }
+    if (req == URING_REQ_ACCEPT)
+    {
+        if (cqe->res >= 0) _uringAccept(cqe->res, index);
+        if (!more && serverRunning) _uringArmAccept(index);
+    }
+    else if (req == URING_REQ_RECV)
+    {
+        uringConn* conn = &(uringConns[index]);
 
-            sCol = strtok_r(NULL, NETWORK_MSG_DELIM, &saveptr);
-            if (sCol == NULL)
-            {
-                printFromClient(clientIndex, "Client request is missing Row arg.");
-                sendMsgResponse(cInfo->socket, SERVER_TICKET_INVALID, "Missing column argument", sendBuffer);
-                break;
-            }
-            
-            row = atoi(sRow);
-            col = atoi(sCol);
-            int success = buySeat(seatsMap, row, col);
-            if (success == -1)
-            {
-                printFromClient(clientIndex, "Ticket Row/Col is invalid. (row: %2d, col: %2d)", row, col);
-                sendMsgResponse(cInfo->socket, SERVER_TICKET_INVALID, "Invalid row or column", sendBuffer);
-            }
-            else if (success == 0)
-            {
-                printFromClient(clientIndex, "Ticket Row/Col is already taken. (row: %2d, col: %2d)", row, col);
-                sendMsgResponse(cInfo->socket, SERVER_TICKET_TRANSACTION_FAILED, "Ticket already purchased", sendBuffer);
-            }
+        if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+        {
+            unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            _uringReceive(index, uringBufData(&serverBufs, bid), cqe->res, sendBuffer);
+            uringRecycleBuf(&serverBufs, bid);
+        }
+
+        if (!more)
+        {
+            conn->recvArmed = 0;
+
+            // Out of provided buffers is not the client's fault, try again
+            if ((cqe->res > 0 || cqe->res == -ENOBUFS) && clientConnected(&(clientPool[index])))
+                _uringArmRecv(index);
             else
-            {
-                printFromClient(clientIndex, "Client successfully purchased a ticket. (row: %2d, col: %2d)", row, col);
-                sendMsgResponse(cInfo->socket, SERVER_TICKET_TRANSACTION_SUCCESS, "Ticket purchased", sendBuffer);
-                printSeatMap(seatsMap);
-                checkSeatsFull(sendBuffer); // Closes server if all seats are full
-            }
-            break;
-        default:
-            printFromClient(clientIndex, "Message contains an invalid request id: %d", reqId);
-            sendMsgResponse(cInfo->socket, SERVER_MSG_INVALID,"Unknown request id", sendBuffer);
-            return 1;
+                _uringBeginClose(index, (cqe->res == 0) ? CLOSE_REASON_EOF : CLOSE_REASON_ERROR);
+        }
     }
+    else if (req == URING_REQ_SEND)
+    {
+        uringConn* conn = &(uringConns[index]);
+        conn->sendArmed = 0;
 
-    return 0;
+        if (cqe->res < 0)
+        {
+            freeOutQueue(&(conn->sending));
+            profiledLock(&socketLock);
+            _beginDisconnect(&(clientPool[index]), CLOSE_REASON_ERROR);
+            profiledUnlock(&socketLock);
+        }
+        else if (conn->sendOffset + cqe->res < conn->sending.length)
+        {
+            // Short send, the rest goes before anything queued later
+            conn->sendOffset += cqe->res;
+            conn->sendArmed = 1;
+            uringPrepSend(_uringSqe(), clientPool[index].socket,
+                conn->sending.data + conn->sendOffset, conn->sending.length - conn->sendOffset,
+                URING_USER_DATA(URING_REQ_SEND, index));
+        }
+        else
+        {
+            freeOutQueue(&(conn->sending));
+            uringRequestFlush(index); // Anything queued while this send was in flight
+        }
+
+        _uringTryClose(index);
+    }
+    else if (req == URING_REQ_WAKE)
+    {
+        // Another thread queued output, send it for every client,
+        // or the waiting room has clients for free slots
+        for (int i = 0; i < settings.maxConnections; i++)
+            if (clientConnected(&(clientPool[i])) && !uringConns[i].closing)
+                uringRequestFlush(i);
+        admitWaitingClients(_uringStartConn);
+        _uringArmWake();
+    }
 }
 
-// Runs the client network request loop, executed in it's own thread
-void* serveClient(void* _cIndex)
+// Serves every client from one io_uring event loop until the server
+// stops. Runs on the main thread in place of the accept loop.
+// Returns non-zero if io_uring is not available, without serving.
+int runUringServer()
 {
-    int clientIndex = (int)_cIndex;
-    clientInfo* cInfo = &(clientPool[clientIndex]);
-    pthread_t threadId = cInfo->thread;
-
-    char receiveBuffer[MSG_BUFFER_SIZE] = {0};
-    char sendBuffer[MSG_BUFFER_SIZE] = {0};
-    int bytesRead = 0;
+    char sendBuffer[MSG_BUFFER_SIZE];
+    struct __kernel_timespec drainTimeout = { 0, 100 * 1000000LL };
+    long long drainDeadline = 0;
 
-    printFromThread(threadId, "Begin handling requests for Client #%d", clientIndex);
+    uringThread = pthread_self();
 
-    // Run while client is connected and server is running
-    while (serverRunning && cInfo->status == CLIENT_STATUS_ACTIVE)
+    if (uringInit(&serverRing, URING_ENTRIES)) return 1;
+    if (uringSetupBufRing(&serverRing, &serverBufs, URING_BUF_GROUP, URING_NUM_BUFS, URING_BUF_SIZE))
     {
-        // Block until next network message is received from the client
-        bytesRead = read(cInfo->socket, receiveBuffer, MSG_BUFFER_SIZE);
+        uringFree(&serverRing);
+        return 1;
+    }
 
-        if (bytesRead > 0)
+    uringWakeFd = eventfd(0, EFD_CLOEXEC);
+    uringConns = calloc(settings.maxConnections, sizeof(uringConn));
+    uringDirty = malloc(sizeof(int) * settings.maxConnections);
+    if (uringWakeFd < 0 || uringConns == NULL || uringDirty == NULL)
+        exitOnError(1, "Unable to allocate the io_uring engine");
+
+    for (int i = 0; i < settings.maxConnections; i++)
+        uringConns[i].sending.pool = &connBuffers;
+
+    printFromHost("Serving clients with io_uring ...");
+    _uringArmAccept(LISTENER_KIND_TCP);
+    if (unix_fd >= 0) _uringArmAccept(LISTENER_KIND_UNIX);
+    _uringArmWake();
+
+    for (;;)
+    {
+        // Once sold out, push the last changes and give clients a
+        // moment to read their final replies
+        if (!serverRunning && drainDeadline == 0)
         {
-            // Make sure message is null terminated
-            receiveBuffer[bytesRead] = '\0';
+            stopBroadcaster();
+            stopWaitingRoom(0);
 
-            printFromThread(threadId, "%d bytes received from Client #%d", bytesRead, clientIndex);
-            processClientMsg(clientIndex, receiveBuffer, bytesRead, sendBuffer);
+            profiledLock(&socketLock);
+            for (int i = 0; i < settings.maxConnections; i++)
+                _beginDisconnect(&(clientPool[i]), CLOSE_REASON_SHUTDOWN);
+            profiledUnlock(&socketLock);
+
+            drainDeadline = timerNowMs() + URING_DRAIN_MS;
         }
-    }
 
-    printFromThread(threadId, "Closing connection for Client #%d", clientIndex);
+        if (drainDeadline > 0)
+        {
+            if (numConnections == 0 || timerNowMs() > drainDeadline) break;
+            uringPrepTimeout(_uringSqe(), &drainTimeout, URING_USER_DATA(URING_REQ_TIMEOUT, 0));
+        }
 
-    pthread_mutex_lock(&socketLock);
+        // Send everything the last batch produced in the same system
+        // call that waits for the next completions
+        for (int i = 0; i < numUringDirty; i++)
+        {
+            uringConns[uringDirty[i]].dirty = 0;
+            _uringStartSend(uringDirty[i]);
+        }
+        numUringDirty = 0;
 
-    // Close client socket
-    cInfo->status = CLIENT_STATUS_NONE;
-    shutdown(cInfo->socket, SHUT_RDWR);
-    close(cInfo->socket);
+        if (uringSubmit(&serverRing, 1) < 0 && errno != EBUSY)
+        {
+            perror("io_uring_enter failed");
+            break;
+        }
 
-    numConnections -= 1;
+        struct io_uring_cqe* cqe;
+        while ((cqe = uringPeekCqe(&serverRing)) != NULL)
+        {
+            _uringComplete(cqe, sendBuffer);
+            uringCqeSeen(&serverRing);
+        }
+    }
 
-    pthread_mutex_unlock(&socketLock);
+    // Closing the ring cancels every request still in flight
+    uringFree(&serverRing);
+    uringFreeBufRing(&serverBufs);
+    close(uringWakeFd);
 
-    printFromThread(threadId, "Thread exiting ...");
+    for (int i = 0; i < settings.maxConnections; i++)
+    {
+        if (uringConns[i].recvBuffer != NULL) bufPoolPut(&connBuffers, uringConns[i].recvBuffer);
+        freeOutQueue(&(uringConns[i].sending));
+    }
+    free(uringConns);
+    free(uringDirty);
     return 0;
 }
 
-// Finds the next available client in the client pool and
-// spins up a new thread to handle all communications.
-// If the client pool is full returns 1.
-int startClientThread(int socket)
-{
-    if (numConnections >= MAX_CONNECTIONS) return 1;
+#else
 
-    printFromHost("Finding next available socket in pool ...");
+// Built without io_uring, applyConfig() never selects it
+int runUringServer() { return 1; }
+void uringWake() { }
+void uringRequestFlush(int clientIndex) { }
 
-    pthread_mutex_lock(&socketLock);
+#endif
 
-    for (int i = 0; i < MAX_CONNECTIONS; i++)
-    {
-        if (clientPool[i].status == CLIENT_STATUS_NONE)
-        {
-            printFromHost("Assigning Client #%d to incoming connection.", i);
-            clientPool[i].status = CLIENT_STATUS_ACTIVE;
-            clientPool[i].socket = socket;
-            numConnections += 1;
+// Logs what each connection slot costs, to help size max_connections
+void printConnectionFootprint()
+{
+    // Client state, free list link and generation, timer heap entry
+    // and position, and the broadcaster's pollfd
+    size_t slotBytes = sizeof(clientInfo) + sizeof(int) + sizeof(unsigned int) +
+                       sizeof(timerEntry) + sizeof(int) + sizeof(struct pollfd);
+#ifdef USE_IO_URING
+    if (settings.ioEngine == IO_ENGINE_URING) slotBytes += sizeof(uringConn) + sizeof(int);
+#endif
+    if (settings.ioEngine == IO_ENGINE_TASKS) slotBytes += sizeof(taskConn);
 
-            int err = pthread_create( &(clientPool[i].thread), NULL, serveClient, (void*)i);
-            if (err)
-                exitOnError(err, "Unable to create thread");
-            else
-            {
-                err = pthread_detach(clientPool[i].thread);
-                if (err)
-                    exitOnError(err, "Unable to detach thread");
-                else
-                    printFromHost("Thread spawned for Client #%d with handle 0x%lx", i, clientPool[i].thread);
-            }
+    printFromHost("Connection table: %u slots of %zu bytes, %zu KB in total.", settings.maxConnections,
+        slotBytes, slotBytes * settings.maxConnections / 1024);
 
-            pthread_mutex_unlock(&socketLock); 
-            return 0;
+    if (settings.ioEngine == IO_ENGINE_THREADS)
+    {
+        size_t stackBytes = (size_t)settings.threadStackKb * 1024;
+        pthread_attr_t attr;
+        if (stackBytes == 0 && pthread_attr_init(&attr) == 0)
+        {
+            pthread_attr_getstacksize(&attr, &stackBytes);
+            pthread_attr_destroy(&attr);
         }
+
+        printFromHost("Each connection also has a thread with a %zu KB stack, %d KB of it message buffers.",
+            stackBytes / 1024, 2 * MSG_BUFFER_SIZE / 1024);
     }
 
-    pthread_mutex_unlock(&socketLock); 
-    return 2;
+    printFromHost("%d byte buffers are lent to connections only while they have %s waiting.", MSG_BUFFER_SIZE,
+        (settings.ioEngine != IO_ENGINE_THREADS) ? "output or a partial message" : "output");
 }
 
 // Program entry point
 int main(int argc, char const *argv[]) 
 {
-    unsigned int seatMapRows = DEFAULT_SEATS_ROWS;
-    unsigned int seatMapCols = DEFAULT_SEATS_COLS;
+    int positionalArg = 0;
+    const char* takeoverPath = NULL;
+    char clamped[16];
+
+    initIniFile(&configOverrides);
 
-    // Get seat map rows from command line args
-    if (argc > 1)
+    // Process command line arguments. Setting values are kept as
+    // overrides so they also win over a reloaded config file.
+    for (int curArg = 1; curArg < argc; curArg++)
     {
-        seatMapRows = atoi(argv[1]);
-        if (seatMapRows == 0)
-            seatMapRows = DEFAULT_SEATS_ROWS;
-        else if (seatMapRows > MAX_SEATS_ROWS)
-            seatMapRows = MAX_SEATS_ROWS;
+        const char* value = (curArg + 1 < argc) ? argv[curArg + 1] : NULL;
+        const settingInfo* flagInfo = NULL;
+
+        for (int i = 0; i < NUM_SETTINGS; i++)
+            if (settingInfos[i].flag != NULL && strcmp(argv[curArg], settingInfos[i].flag) == 0)
+                flagInfo = &(settingInfos[i]);
+
+        const char* stringKey = (strcmp(argv[curArg], "-loglevel") == 0) ? "log_level" :
+                                (strcmp(argv[curArg], "-engine") == 0) ? "io_engine" :
+                                (strcmp(argv[curArg], "-unixsock") == 0) ? "unix_path" :
+                                (strcmp(argv[curArg], "-capture") == 0) ? "capture_path" :
+                                (strcmp(argv[curArg], "-iocpus") == 0) ? "io_cpus" :
+                                (strcmp(argv[curArg], "-workercpus") == 0) ? "worker_cpus" :
+                                (strcmp(argv[curArg], "-backgroundcpus") == 0) ? "background_cpus" : NULL;
+
+        if (flagInfo != NULL || stringKey != NULL)
+        {
+            if (value == NULL)
+            {
+                fprintf(stderr, "Missing value for %s\n", argv[curArg]);
+                exit(EXIT_FAILURE);
+            }
+
+            setIniValue(&configOverrides, flagInfo ? flagInfo->key : stringKey, value);
+            curArg++;
+        }
+        else if (strcmp(argv[curArg], "-config") == 0 && value != NULL)
+            configPath = argv[++curArg];
+        else if (strcmp(argv[curArg], "-upgradesock") == 0 && value != NULL)
+            upgradePath = argv[++curArg];
+        else if (strcmp(argv[curArg], "-takeover") == 0 && value != NULL)
+            takeoverPath = argv[++curArg];
+        else if (positionalArg < 2)
+        {
+            // Get seat map rows, then cols, from command line args.
+            // Out of range sizes are clamped, 0 keeps the configured size.
+            unsigned int size = atoi(argv[curArg]);
+            unsigned int maxSize = (positionalArg == 0) ? MAX_SEATS_ROWS : MAX_SEATS_COLS;
+            if (size > maxSize) size = maxSize;
+
+            if (size > 0)
+            {
+                snprintf(clamped, sizeof(clamped), "%u", size);
+                setIniValue(&configOverrides, (positionalArg == 0) ? "rows" : "cols", clamped);
+            }
+            positionalArg++;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown command line argument: %s\n", argv[curArg]);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    // Get seat map cols from command line args
-    if (argc > 2)
+    initTraceWriter(&capture);
+    initSeatScan(); // Before any seat map is created or received
+
+    iniFile configFile;
+    readConfigFile(configPath, &configFile, 0);
+    applyConfig(&configFile, 0);
+    configRows = settings.seatRows;
+    configCols = settings.seatCols;
+    freeIniFile(&configFile);
+
+    if (settings.ioEngine != IO_ENGINE_THREADS && (upgradePath != NULL || takeoverPath != NULL))
     {
-        seatMapCols = atoi(argv[2]);
-        if (seatMapCols == 0)
-            seatMapCols = DEFAULT_SEATS_COLS;
-        else if (seatMapCols > MAX_SEATS_COLS)
-            seatMapCols = MAX_SEATS_COLS;
+        fprintf(stderr, "-upgradesock and -takeover need -engine threads\n");
+        exit(EXIT_FAILURE);
     }
 
-    int new_socket, valread; 
+    // Only the reload thread handles SIGHUP, and the lock reporter
+    // SIGUSR1. Every thread created from here on inherits the mask.
+    sigset_t signals;
+    sigemptyset(&signals);
+    if (configPath != NULL) sigaddset(&signals, SIGHUP);
+#ifdef LOCK_PROFILE
+    sigaddset(&signals, SIGUSR1);
+#endif
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    applyFdBudget();
+
+    // The main thread runs the accept loop or the io_uring engine and
+    // allocates the seat map and client pool, pin it before any of that
+    rememberProcessCpus();
+    if (pinCurrentThread(&(settings.ioCpus)))
+        printWarning("Unable to pin the I/O thread, it can run on any CPU.");
+    if (settings.workerCpus.numCpus > 0)
+        printFromHost("Client threads pinned to %d CPUs on %d NUMA nodes.",
+            settings.workerCpus.numCpus, cpuListNodes(&(settings.workerCpus)));
+
+    int new_socket; 
+    unsigned int retryAfterMs;
     struct sockaddr_in address; 
     int opt = 1; 
     int addrlen = sizeof(address); 
-    char buffer[1024] = {0}; 
+    int takeoverConn = -1;
+    int numTakeoverClients = 0;
+    takeoverClient* takeoverClients = NULL;
+
+    if (pipe2(quiescePipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        perror("Unable to create pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    if (takeoverPath != NULL)
+    {
+        // Receive the listening socket, clients and seat map
+        // from the running server instead of starting fresh
+        numTakeoverClients = receiveHandoff(takeoverPath, &takeoverConn, &takeoverClients);
+        if (numTakeoverClients < 0)
+        {
+            fprintf(stderr, "Unable to take over from the server at %s\n", takeoverPath);
+            exit(EXIT_FAILURE);
+        }
+
+        if (numTakeoverClients > settings.maxConnections)
+            settings.maxConnections = numTakeoverClients;
+        if (upgradePath == NULL)
+            upgradePath = takeoverPath;
+
+        goto serverSocketReady;
+    }
 
     printFromHost("Creating socket file descriptor ...");
 
@@ -401,7 +3931,7 @@ int main(int argc, char const *argv[])
     // Set up server address properties
     address.sin_family = AF_INET; 
     address.sin_addr.s_addr = INADDR_ANY; 
-    address.sin_port = htons( PORT ); 
+    address.sin_port = htons( settings.port ); 
     
     printFromHost("Binding socket to port ...");
 
@@ -414,55 +3944,209 @@ int main(int argc, char const *argv[])
 
     printFromHost("Starting to listen for new connections ...");
 
-    if (listen(server_fd, 3) < 0) 
+    if (listen(server_fd, settings.listenBacklog) < 0) 
     { 
         perror("Server listen failed"); 
         exit(EXIT_FAILURE); 
     } 
 
     // Allocate new seat map with the given rows and cols
-    seatsMap = createSeatMap(seatMapRows, seatMapCols);
+    seatsMap = createSeatMap(settings.seatRows, settings.seatCols);
+
+serverSocketReady:
+    // A listener received in a handoff is kept, even if this
+    // server was configured with another path
+    if (unix_fd < 0 && settings.unixPath[0] != '\0')
+    {
+        if ((unix_fd = createUnixListener(settings.unixPath)) < 0)
+        {
+            perror("Unable to create unix socket listener");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct sockaddr_un unixAddr;
+    if (unixListenerPath(&unixAddr) != NULL)
+        printFromHost("Also listening on unix socket %s", unixAddr.sun_path);
+
+    // Tiers come from this server's config, also after a takeover
+    setSeatTiers(seatsMap, settings.numTiers, settings.tierRows, settings.tierPrices);
+    setSeatSections(seatsMap, settings.sectionSize);
+    if (settings.numTiers > 1)
+        printFromHost("Selling seats in %u price tiers.", settings.numTiers);
+    printFromHost("Seat scans use the %s kernels.", seatScan.name);
+
     printSeatMap(seatsMap);
     initclientPool();
+    printConnectionFootprint();
+
+    // Connections are closed through the timer thread and
+    // shutdown(), a send to a dead peer must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    exitOnError(startTimerService(&connTimers, settings.maxConnections, onClientTimeout),
+        "Unable to start timer thread");
+    pinThread(connTimers.thread, &(settings.backgroundCpus));
+    startBroadcaster(MAX_SEATS_ROWS, MAX_SEATS_COLS); // Seat numbers stay valid across resizes
+
     serverRunning = 1;
+    startWaitingRoom();
+
+    if (takeoverPath != NULL)
+    {
+        // Tell the old server we are ready, then serve its clients
+        if (sendHandoffMsg(takeoverConn, HANDOFF_ACK, NULL, 0, -1))
+            exitOnError(1, "Unable to confirm takeover");
+        close(takeoverConn);
+
+        for (int i = 0; i < numTakeoverClients; i++)
+            startClientThread(takeoverClients[i].socket, &(takeoverClients[i]));
+        free(takeoverClients);
+        wakeBroadcaster(); // Flush output the old server had queued
+
+        printFromHost("Took over %d client connections.", numTakeoverClients);
+    }
+
+    if (upgradePath != NULL)
+        startUpgradeListener();
+
+    pthread_t reloaderThread;
+    if (configPath != NULL && pthread_create(&reloaderThread, NULL, runConfigReloader, NULL) == 0)
+    {
+        pthread_detach(reloaderThread);
+        printFromHost("Send SIGHUP to reload %s", configPath);
+    }
+
+#ifdef LOCK_PROFILE
+    pthread_t lockReporterThread;
+    if (pthread_create(&lockReporterThread, NULL, runLockReporter, NULL) == 0)
+    {
+        pthread_detach(lockReporterThread);
+        printFromHost("Profiling locks, send SIGUSR1 for a report");
+    }
+#endif
+
+    if (settings.ioEngine == IO_ENGINE_URING && runUringServer())
+    {
+        printWarning("io_uring is not available, serving with threads instead.");
+        settings.ioEngine = IO_ENGINE_THREADS;
+    }
 
     // While server is running, keep listening for new connections
-    while (serverRunning)
+    if (settings.ioEngine == IO_ENGINE_TASKS)
+        startTaskWorkers();
+
+    while (serverRunning && settings.ioEngine != IO_ENGINE_URING)
     {
         printFromHost("Waiting for a new connection ...");
-        if ((new_socket = accept(server_fd, (struct sockaddr *)&address,  
+
+        // poll() skips unix_fd when it is -1
+        struct pollfd pfds[3] = {
+            { server_fd, POLLIN, 0 },
+            { quiescePipe[0], POLLIN, 0 },
+            { unix_fd, POLLIN, 0 }
+        };
+
+        if (poll(pfds, 3, -1) < 0 && errno != EINTR)
+        {
+            perror("Error waiting for connections");
+            break;
+        }
+
+        if (pfds[1].revents && handoffState == HANDOFF_STATE_RUNNING)
+        {
+            // Stop accepting while the listening socket is handed off
+            profiledLock(&socketLock);
+            acceptLoopParked = 1;
+            pthread_cond_broadcast(&handoffCond);
+            while (handoffState == HANDOFF_STATE_RUNNING)
+                profiledCondWait(&handoffCond, &socketLock);
+            acceptLoopParked = 0;
+            int handedOff = (handoffState == HANDOFF_STATE_DONE);
+            profiledUnlock(&socketLock);
+
+            if (handedOff)
+            {
+                // The new server owns every socket now, exit without
+                // shutting any of them down
+                stopWaitingRoom(1);
+                stopCapture();
+                printFromHost("Server exiting after handoff ...");
+#ifdef LOCK_PROFILE
+                printLockReport();
+#endif
+                exit(0);
+            }
+            continue;
+        }
+
+        if (pfds[0].revents == 0 && pfds[2].revents == 0) continue;
+
+        // One connection per pass, the other listener is
+        // still readable on the next poll() if both are
+        int listenFd = pfds[0].revents ? server_fd : unix_fd;
+        addrlen = sizeof(address);
+        if ((new_socket = accept(listenFd, (struct sockaddr *)&address,  
                        (socklen_t*)&addrlen))<0) 
         { 
+            // The connection may have been reset before we got to it
+            if (serverRunning && (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN)) continue;
+
             if (serverRunning) perror("Error accepting connection");
             break;
         }
 
-        printFromHost("~~~ New connection established ~~~");
+        printFromHost("~~~ New connection established%s ~~~", (listenFd == unix_fd) ? " (unix socket)" : "");
+        applySocketBuffers(new_socket);
 
-        // Attempt to accept new client
-        if (startClientThread(new_socket))
+        // Shed load without touching the client pool if we are
+        // admitting connections faster than the configured rate
+        if (!withinAcceptBudget(&retryAfterMs))
         {
-            safePrintLine("Server full, unable to accept more connections. Disconnecting client.");
-            sendMsgResponse(new_socket, SERVER_DISCONNECT, "Server full", buffer);
+            printFromHost("Accept rate exceeded, asking client to retry in %u ms.", retryAfterMs);
+            shedConnection(new_socket, retryAfterMs, "Accept rate exceeded");
+            continue;
         }
+        if (shedIfSoldOut(new_socket)) continue;
+
+        // Attempt to accept new client, unless others are already waiting
+        if (waitingRoomLength(&lobby) > 0 || startClientConn(new_socket))
+            waitOrShedConnection(new_socket);
     }
 
     serverRunning = 0;
+    stopBroadcaster();
+    stopWaitingRoom(0);
+    closeUnixListener();
 
     // Close all open client sockets
-    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    profiledLock(&socketLock);
+    for (int i = 0; i < settings.maxConnections; i++)
     {
-        if (clientPool[i].status == 1)
-        {
-            // Shutdown all open sockets, which will force the client
-            // threads to terminate
-            clientPool[i].status = CLIENT_STATUS_DISCONNECT;
-            shutdown(clientPool[i].socket, SHUT_RDWR);
-        }
+        // Shutdown all open sockets, which will force the client
+        // threads to terminate
+        _beginDisconnect(&(clientPool[i]), CLOSE_REASON_SHUTDOWN);
     }
+    profiledUnlock(&socketLock);
 
     printFromHost("Server exiting ...");
+    stopCapture();
+    printFromHost("At most %d buffers (%zu KB) were lent to connections at once.",
+        connBuffers.peakInUse, (size_t)connBuffers.peakInUse * MSG_BUFFER_SIZE / 1024);
+    printFromHost("%lu purchase retries were answered with their original reply.", dedupHits(&purchaseReplies));
+    printFromHost("%lu requests were turned away by the rate limits.", throttledRequests);
+#ifdef LOCK_PROFILE
+    printLockReport();
+#endif
     sleep(1);
+    if (settings.ioEngine == IO_ENGINE_TASKS) stopTaskWorkers();
+    stopTimerService(&connTimers);
     deleteSeatMap(&seatsMap);
+    free(clientPool);
+    freeConnTable(&connSlots);
+    freeBufPool(&connBuffers);
+    freeDedupCache(&purchaseReplies);
+    freeIpRateLimiter(&ipLimits);
+    freeWaitingRoom(&lobby);
+    freeIniFile(&configOverrides);
     return 0; 
 } 
\ No newline at end of file
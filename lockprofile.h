@@ -0,0 +1,258 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Optional lock contention profiler. Locks taken
+// with profiledLock() are plain pthread mutex calls
+// unless built with -DLOCK_PROFILE. Then every call
+// site keeps its own counts and log2 histograms of
+// how long threads waited for the lock and how long
+// they held it, and printLockProfile() reports them
+// ordered by total wait. Hold times are tracked on a
+// small per thread stack of held locks, so a lock
+// must be released by the thread that took it.
+// ==============================
+
+#ifndef LOCKPROFILE_H
+#define LOCKPROFILE_H
+
+#include <pthread.h>
+
+#ifndef LOCK_PROFILE
+
+#define profiledLock(mutex) pthread_mutex_lock(mutex)
+#define profiledUnlock(mutex) pthread_mutex_unlock(mutex)
+#define profiledCondWait(cond, mutex) pthread_cond_wait(cond, mutex)
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOCK_HIST_BUCKETS 40 // Bucket i counts times from 2^i up to 2^(i+1) ns
+#define LOCK_HELD_DEPTH 8    // Locks a thread can hold at once and still be timed
+
+// Statistics of one place in the code that takes a lock
+typedef struct lockSite_ {
+    const char* lock; // The expression naming the mutex
+    const char* file;
+    const char* func;
+    int line;
+    int registered;
+    struct lockSite_* next;
+    unsigned long acquired;
+    unsigned long contended; // Acquisitions that had to wait
+    unsigned long long waitNs;
+    unsigned long long holdNs;
+    unsigned long long maxWaitNs;
+    unsigned long long maxHoldNs;
+    unsigned long waitHist[LOCK_HIST_BUCKETS];
+    unsigned long holdHist[LOCK_HIST_BUCKETS];
+} lockSite;
+
+// A lock the current thread holds
+typedef struct heldLock_ {
+    pthread_mutex_t* mutex;
+    lockSite* site;
+    long long acquiredNs;
+} heldLock;
+
+lockSite* _lockSites = NULL; // Every site used so far, newest first
+long long _lockProfileStartNs = 0;
+__thread heldLock _heldLocks[LOCK_HELD_DEPTH];
+__thread int _numHeldLocks = 0;
+
+// Each use gets a site of its own, found without any lookup
+#define profiledLock(mutex) do { \
+        static lockSite _site = { #mutex, __FILE__, __func__, __LINE__ }; \
+        _profiledLock(mutex, &_site); \
+    } while (0)
+#define profiledUnlock(mutex) _profiledUnlock(mutex)
+#define profiledCondWait(cond, mutex) _profiledCondWait(cond, mutex)
+
+// Returns the monotonic clock in nanoseconds
+long long _lockNowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Returns the histogram bucket for a time
+int _lockHistBucket(unsigned long long ns)
+{
+    int bucket = (ns > 1) ? 63 - __builtin_clzll(ns) : 0;
+    return (bucket < LOCK_HIST_BUCKETS) ? bucket : LOCK_HIST_BUCKETS - 1;
+}
+
+// Raises *max to value unless it is already larger
+void _lockRaiseMax(unsigned long long* max, unsigned long long value)
+{
+    unsigned long long current = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > current &&
+           !__atomic_compare_exchange_n(max, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Adds a site to the report the first time it is used
+void _registerLockSite(lockSite* site)
+{
+    if (__atomic_exchange_n(&(site->registered), 1, __ATOMIC_ACQ_REL)) return;
+
+    long long unset = 0;
+    __atomic_compare_exchange_n(&_lockProfileStartNs, &unset, _lockNowNs(), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    site->next = __atomic_load_n(&_lockSites, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&_lockSites, &(site->next), site, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Ends the current thread's hold of mutex and records its length.
+// Returns the held lock's entry, or NULL if it was not being timed.
+heldLock* _endLockHold(pthread_mutex_t* mutex, long long nowNs)
+{
+    for (int i = _numHeldLocks - 1; i >= 0; i--)
+    {
+        heldLock* held = &(_heldLocks[i]);
+        if (held->mutex != mutex) continue;
+
+        unsigned long long holdNs = nowNs - held->acquiredNs;
+        __atomic_add_fetch(&(held->site->holdNs), holdNs, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&(held->site->holdHist[_lockHistBucket(holdNs)]), 1, __ATOMIC_RELAXED);
+        _lockRaiseMax(&(held->site->maxHoldNs), holdNs);
+        return held;
+    }
+    return NULL;
+}
+
+void _profiledLock(pthread_mutex_t* mutex, lockSite* site)
+{
+    if (!site->registered) _registerLockSite(site);
+
+    unsigned long long waitNs = 0;
+    if (pthread_mutex_trylock(mutex) != 0)
+    {
+        long long start = _lockNowNs();
+        pthread_mutex_lock(mutex);
+        waitNs = _lockNowNs() - start;
+        __atomic_add_fetch(&(site->contended), 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&(site->waitNs), waitNs, __ATOMIC_RELAXED);
+        _lockRaiseMax(&(site->maxWaitNs), waitNs);
+    }
+
+    __atomic_add_fetch(&(site->acquired), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(site->waitHist[_lockHistBucket(waitNs)]), 1, __ATOMIC_RELAXED);
+
+    if (_numHeldLocks < LOCK_HELD_DEPTH)
+    {
+        heldLock* held = &(_heldLocks[_numHeldLocks++]);
+        held->mutex = mutex;
+        held->site = site;
+        held->acquiredNs = _lockNowNs();
+    }
+}
+
+void _profiledUnlock(pthread_mutex_t* mutex)
+{
+    heldLock* held = _endLockHold(mutex, _lockNowNs());
+    if (held != NULL)
+    {
+        // Locks are not always released in the reverse order
+        *held = _heldLocks[--_numHeldLocks];
+    }
+    pthread_mutex_unlock(mutex);
+}
+
+// Waiting on a condition releases the mutex, so that time is not
+// counted as held
+int _profiledCondWait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+    heldLock* held = _endLockHold(mutex, _lockNowNs());
+    int result = pthread_cond_wait(cond, mutex);
+    if (held != NULL) held->acquiredNs = _lockNowNs();
+    return result;
+}
+
+// Returns about the time under which fraction of the times in hist
+// fall, the top of the bucket that holds it
+double _lockHistPercentileUs(const unsigned long* hist, unsigned long count, double fraction)
+{
+    unsigned long target = (unsigned long)(count * fraction);
+    unsigned long seen = 0;
+    for (int bucket = 0; bucket < LOCK_HIST_BUCKETS; bucket++)
+    {
+        seen += hist[bucket];
+        if (seen > target) return bucket ? (2ULL << bucket) / 1000.0 : 0;
+    }
+    return (2ULL << (LOCK_HIST_BUCKETS - 1)) / 1000.0;
+}
+
+int _compareLockSites(const void* a, const void* b)
+{
+    unsigned long long waitA = (*(lockSite* const*)a)->waitNs;
+    unsigned long long waitB = (*(lockSite* const*)b)->waitNs;
+    return (waitA < waitB) - (waitA > waitB);
+}
+
+// Prints every site's statistics, most time spent waiting first.
+// Percentiles are the top of their histogram bucket, so within 2x.
+void printLockProfile(FILE* out)
+{
+    // Sites added while printing are left for the next report
+    lockSite* first = __atomic_load_n(&_lockSites, __ATOMIC_ACQUIRE);
+    int count = 0;
+    for (lockSite* site = first; site != NULL; site = site->next)
+        count++;
+
+    lockSite** sites = malloc(sizeof(lockSite*) * (count + 1));
+    if (sites == NULL) return;
+
+    count = 0;
+    for (lockSite* site = first; site != NULL; site = site->next)
+        sites[count++] = site;
+    qsort(sites, count, sizeof(lockSite*), _compareLockSites);
+
+    double elapsedS = _lockProfileStartNs ? (_lockNowNs() - _lockProfileStartNs) / 1e9 : 0;
+    fprintf(out, "Lock profile over %.1f s, times in us, p99 within 2x\n", elapsedS);
+    fprintf(out, "%-22s %-30s %10s %6s %10s %9s %9s %9s %9s %9s\n", "lock", "site", "acquired",
+        "cont%", "wait ms", "wait p99", "wait max", "hold avg", "hold p99", "hold max");
+
+    for (int i = 0; i < count; i++)
+    {
+        lockSite* site = sites[i];
+        unsigned long acquired = __atomic_load_n(&(site->acquired), __ATOMIC_RELAXED);
+        if (acquired == 0) continue;
+
+        // Leave out the &( ) around the mutex name
+        const char* lock = site->lock;
+        int lockLen = strlen(lock);
+        if (lockLen > 3 && strncmp(lock, "&(", 2) == 0) { lock += 2; lockLen -= 3; }
+        else if (lock[0] == '&') { lock++; lockLen--; }
+
+        char where[64];
+        const char* file = strrchr(site->file, '/');
+        snprintf(where, sizeof(where), "%s:%d %s", file ? file + 1 : site->file, site->line, site->func);
+
+        // A bucket's top can be past the longest time seen
+        double maxWaitUs = site->maxWaitNs / 1000.0;
+        double maxHoldUs = site->maxHoldNs / 1000.0;
+        double waitP99 = _lockHistPercentileUs(site->waitHist, acquired, 0.99);
+        double holdP99 = _lockHistPercentileUs(site->holdHist, acquired, 0.99);
+
+        fprintf(out, "%-22.*s %-30.30s %10lu %6.2f %10.2f %9.1f %9.1f %9.2f %9.1f %9.1f\n",
+            lockLen, lock, where, acquired, site->contended * 100.0 / acquired, site->waitNs / 1e6,
+            (waitP99 < maxWaitUs) ? waitP99 : maxWaitUs, maxWaitUs, site->holdNs / 1000.0 / acquired,
+            (holdP99 < maxHoldUs) ? holdP99 : maxHoldUs, maxHoldUs);
+    }
+
+    free(sites);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,172 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Single pass network message parser. Splits a
+// message around NETWORK_MSG_DELIM and converts the
+// arguments to integers with range checking.
+// Does not allocate memory or modify the input buffer.
+// ==============================
+
+#ifndef MSGPARSER_H
+#define MSGPARSER_H
+
+#include <limits.h>
+#include "networkmsg.h"
+
+#define MSG_MAX_ARGS 8 // Max number of arguments following the message id
+
+// Parser result codes
+#define MSG_PARSE_OK 0
+#define MSG_PARSE_EMPTY 1     // Message has no request id
+#define MSG_PARSE_BADINT 2    // A field is not a valid integer
+#define MSG_PARSE_RANGE 3     // A field does not fit in an int
+#define MSG_PARSE_TOOMANY 4   // More than MSG_MAX_ARGS arguments
+
+// Stores a parsed network message. Arguments point back into
+// the original buffer, so the buffer must outlive this struct.
+typedef struct netMsg_
+{
+    int hasTag;  // 1 if the message started with a request tag
+    int tag;
+    int id;
+    int numArgs;
+    int args[MSG_MAX_ARGS];        // Integer value of each argument
+    const char* argStr[MSG_MAX_ARGS]; // Start of each argument's text
+    int argLen[MSG_MAX_ARGS];      // Length of each argument's text
+    int argIsInt[MSG_MAX_ARGS];    // 1 if the argument parsed as an int
+} netMsg;
+
+// Converts exactly len characters of str to an int.
+// Accepts an optional leading '-' or '+'. Returns MSG_PARSE_OK,
+// MSG_PARSE_BADINT or MSG_PARSE_RANGE.
+int parseMsgInt(const char* str, int len, int* result)
+{
+    int i = 0;
+    int negative = 0;
+
+    if (len <= 0) return MSG_PARSE_BADINT;
+
+    if (str[0] == '-' || str[0] == '+')
+    {
+        negative = (str[0] == '-');
+        i = 1;
+        if (len == 1) return MSG_PARSE_BADINT;
+    }
+
+    // Accumulate as a negative number so INT_MIN can be represented.
+    // Keep scanning after an overflow so bad characters are still reported.
+    int value = 0;
+    int overflow = 0;
+    for (; i < len; i++)
+    {
+        int digit = str[i] - '0';
+        if (digit < 0 || digit > 9) return MSG_PARSE_BADINT;
+
+        if (overflow || value < (INT_MIN + digit) / 10)
+            overflow = 1;
+        else
+            value = value * 10 - digit;
+    }
+
+    if (overflow) return MSG_PARSE_RANGE;
+
+    if (!negative)
+    {
+        if (value == INT_MIN) return MSG_PARSE_RANGE;
+        value = -value;
+    }
+
+    *result = value;
+    return MSG_PARSE_OK;
+}
+
+// Parses the first msgLen bytes of buffer into msg. Parsing also stops
+// at a null or new line character. An optional "@<tag>" field may come
+// before the request id. The request id must be an integer, arguments
+// that are not integers are kept as text with argIsInt = 0.
+// Returns MSG_PARSE_OK on success, or one of the error codes above.
+int parseNetMsg(const char* buffer, int msgLen, netMsg* msg)
+{
+    const char delim = NETWORK_MSG_DELIM[0];
+    int field = -1; // -2 is the tag, -1 is the request id, 0+ are arguments
+    int start = 0;
+    int err;
+
+    msg->hasTag = 0;
+    msg->tag = 0;
+    msg->id = 0;
+    msg->numArgs = 0;
+
+    if (msgLen > 0 && buffer[0] == NETWORK_MSG_TAG)
+    {
+        field = -2;
+        start = 1;
+    }
+
+    for (int i = 0; ; i++)
+    {
+        int atEnd = (i >= msgLen || buffer[i] == '\0' || buffer[i] == '\n');
+        if (!atEnd && buffer[i] != delim) continue;
+
+        // Ignore a trailing carriage return from line based clients
+        int end = i;
+        if (atEnd && end > start && buffer[end - 1] == '\r') end--;
+
+        if (field == -2)
+        {
+            err = parseMsgInt(buffer + start, end - start, &(msg->tag));
+            if (err) return err;
+            msg->hasTag = 1;
+
+            // A tag must be followed by a request id
+            if (atEnd) return MSG_PARSE_EMPTY;
+        }
+        else if (field == -1)
+        {
+            if (end == start) return MSG_PARSE_EMPTY;
+            err = parseMsgInt(buffer + start, end - start, &(msg->id));
+            if (err) return err;
+        }
+        else
+        {
+            if (field >= MSG_MAX_ARGS) return MSG_PARSE_TOOMANY;
+
+            msg->argStr[field] = buffer + start;
+            msg->argLen[field] = end - start;
+            msg->args[field] = 0;
+            err = parseMsgInt(buffer + start, end - start, &(msg->args[field]));
+            if (err == MSG_PARSE_RANGE) return err;
+            msg->argIsInt[field] = (err == MSG_PARSE_OK);
+            msg->numArgs++;
+        }
+
+        if (atEnd) break;
+
+        field++;
+        start = i + 1;
+    }
+
+    return MSG_PARSE_OK;
+}
+
+// Returns a short description of a parser result code
+const char* msgParseErrorStr(int err)
+{
+    switch (err)
+    {
+        case MSG_PARSE_OK: return "No error";
+        case MSG_PARSE_EMPTY: return "Missing request id";
+        case MSG_PARSE_BADINT: return "Malformed integer";
+        case MSG_PARSE_RANGE: return "Integer out of range";
+        case MSG_PARSE_TOOMANY: return "Too many arguments";
+        default: return "Unknown error";
+    }
+}
+
+#endif
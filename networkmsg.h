@@ -15,6 +15,8 @@
 #define NETWORKMSG_H
 
 #define NETWORK_MSG_DELIM "|"
+#define NETWORK_MSG_END "\n" // Terminates every message in both directions
+#define NETWORK_MSG_TAG '@'  // Optional "@<request tag>|" prefix, echoed in the reply
 
 #define SERVER_DISCONNECT 1
 #define SERVER_MSG_INVALID 2
@@ -23,11 +25,33 @@
 #define SERVER_TICKET_AVAILABLE 5
 #define SERVER_TICKET_NOT_AVAILABLE 6
 #define SERVER_TICKET_TRANSACTION_FAILED 7
-#define SERVER_TICKET_TRANSACTION_SUCCESS 8
+#define SERVER_TICKET_TRANSACTION_SUCCESS 8 // Args: text, receipt of the sale
+#define SERVER_RETRY_LATER 9 // Args: retry after milliseconds, reason
 
 #define CLIENT_DISCONNECT 10
 #define CLIENT_TICKET_REQUESTAVAILABILITY 11
 #define CLIENT_TICKET_REQUESTSTATUS 12
-#define CLIENT_TICKET_REQUESTPURCHASE 13
+#define CLIENT_TICKET_REQUESTPURCHASE 13 // Args: row, col, request id that makes retries safe (optional)
+#define CLIENT_TICKET_REQUESTMAP 14 // Args: first row (optional)
+#define CLIENT_SUBSCRIBE 15 // Args: 1 to receive seat change pushes, 0 to stop (optional, default 1)
+#define CLIENT_SHM_ATTACH 16 // Move this connection onto shared memory, unix sockets only
+#define CLIENT_TICKET_REQUESTTIERS 17 // Price tiers and how many seats each has left
+#define CLIENT_TICKET_REQUESTTIERPURCHASE 18 // Args: tier, or -1 for the cheapest tier with seats left, request id (optional)
+#define CLIENT_TICKET_REQUESTREGION 19 // Args: first row, first col, # rows and # cols (optional, default to the end of the map)
+#define CLIENT_TICKET_REQUESTSUMMARY 20 // Available seats of every row and section
+#define CLIENT_TICKET_REQUESTREFUND 21 // Args: row, col, receipt the seat was bought with
+
+// Server messages added after the original protocol
+#define SERVER_TICKET_MAP 30 // Args: first row, # rows, # cols, hex bitmap of sold seats
+#define SERVER_SUBSCRIBED 31 // Args: 1 if subscribed, push interval in milliseconds
+#define SERVER_SEATS_CHANGED 32 // Pushed, args: # seats available, comma separated "row:col" list, then of returned seats (optional)
+#define SERVER_SHM_READY 33 // Args: ring size in bytes, carries the channel's file descriptors
+#define SERVER_TICKET_TIERS 34 // Args: cheapest tier with seats left or -1, comma separated "price:available:total" per tier
+#define SERVER_TICKET_SEAT_ASSIGNED 35 // Args: row, col, tier, price, receipt of the seat bought by tier
+#define SERVER_WAITING 36 // Pushed, args: place in the waiting room from 1, estimated wait in milliseconds or -1
+#define SERVER_TICKET_REGION 37 // Args: # seats available in the region, row and col of the first one or -1, -1
+#define SERVER_TICKET_SUMMARY 38 // Args: # rows, # cols, section size, comma separated available seats per row, then per section row by row
+#define SERVER_TICKET_REFUNDED 39 // Args: row, col of the seat returned
+#define SERVER_SALES_CHANGED 40 // Pushed, args: 1 if seats are for sale again, 0 once every seat is sold
 
 #endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Token buckets that limit how fast requests are
+// served. A bucket holds up to burst tokens and
+// gains rate tokens per second, each request takes
+// one. Per connection buckets belong to whichever
+// thread serves the connection and need no lock.
+// Per address buckets live in a fixed size table
+// split into stripes, each with its own mutex and
+// cache line, so clients rarely wait on each other.
+// ==============================
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define IP_LIMIT_STRIPES 64 // Must be a power of 2
+#define IP_LIMIT_PROBES 8   // Slots searched for an address before one is reused
+
+typedef struct tokenBucket_
+{
+    double tokens;
+    long long lastNs; // 0 = never used, starts full
+} tokenBucket;
+
+typedef struct ipBucket_
+{
+    uint32_t addr;
+    int used;
+    tokenBucket bucket;
+} ipBucket;
+
+typedef struct ipLimitStripe_
+{
+    pthread_mutex_t mutex;
+    ipBucket* slots;
+    int numSlots;
+} __attribute__((aligned(64))) ipLimitStripe;
+
+typedef struct ipRateLimiter_
+{
+    ipLimitStripe stripes[IP_LIMIT_STRIPES];
+} ipRateLimiter;
+
+// Refills bucket for the time since it was last used and takes one
+// token. A rate of 0 means no limit. Returns 0 if a token was taken,
+// otherwise the milliseconds until the next one.
+unsigned int takeToken(tokenBucket* bucket, double rate, double burst, long long nowNs)
+{
+    if (rate <= 0) return 0;
+    if (burst < 1) burst = 1;
+
+    double tokens = (bucket->lastNs == 0) ? burst :
+        bucket->tokens + (nowNs - bucket->lastNs) * rate / 1e9;
+    if (tokens > burst) tokens = burst;
+    bucket->lastNs = nowNs;
+
+    if (tokens >= 1)
+    {
+        bucket->tokens = tokens - 1;
+        return 0;
+    }
+
+    bucket->tokens = tokens;
+    return (unsigned int)((1 - tokens) * 1000 / rate) + 1;
+}
+
+// Sets up a table with room for about capacity addresses.
+// Returns 0 on success.
+int initIpRateLimiter(ipRateLimiter* limiter, int capacity)
+{
+    int perStripe = (capacity + IP_LIMIT_STRIPES - 1) / IP_LIMIT_STRIPES;
+    if (perStripe < IP_LIMIT_PROBES) perStripe = IP_LIMIT_PROBES;
+
+    for (int s = 0; s < IP_LIMIT_STRIPES; s++)
+    {
+        ipLimitStripe* stripe = &(limiter->stripes[s]);
+        pthread_mutex_init(&(stripe->mutex), NULL);
+        stripe->numSlots = perStripe;
+        stripe->slots = calloc(perStripe, sizeof(ipBucket));
+        if (stripe->slots == NULL) return 1;
+    }
+
+    return 0;
+}
+
+// Takes a token from addr's bucket. When none of the slots searched
+// holds addr, an empty slot is used, else the one idle the longest,
+// which gives that address a full bucket the next time it is seen.
+// Returns 0 if a token was taken, otherwise the milliseconds until
+// the next one.
+unsigned int takeIpToken(ipRateLimiter* limiter, uint32_t addr, double rate, double burst, long long nowNs)
+{
+    if (rate <= 0) return 0;
+
+    // Multiplicative hash, the high bits pick the stripe
+    uint32_t hash = addr * 2654435761u;
+    ipLimitStripe* stripe = &(limiter->stripes[hash >> 26 & (IP_LIMIT_STRIPES - 1)]);
+
+    pthread_mutex_lock(&(stripe->mutex));
+
+    ipBucket* found = NULL;
+    ipBucket* oldest = NULL;
+    for (int probe = 0; probe < IP_LIMIT_PROBES && found == NULL; probe++)
+    {
+        ipBucket* slot = &(stripe->slots[((hash ^ hash >> 16) + probe) % stripe->numSlots]);
+        if (slot->used && slot->addr == addr) found = slot;
+        else if (!slot->used && (oldest == NULL || oldest->used)) oldest = slot;
+        else if (oldest == NULL || (oldest->used && slot->bucket.lastNs < oldest->bucket.lastNs)) oldest = slot;
+    }
+
+    if (found == NULL)
+    {
+        found = oldest;
+        found->used = 1;
+        found->addr = addr;
+        found->bucket.lastNs = 0;
+    }
+
+    unsigned int waitMs = takeToken(&(found->bucket), rate, burst, nowNs);
+
+    pthread_mutex_unlock(&(stripe->mutex));
+    return waitMs;
+}
+
+// Frees every stripe's slots
+void freeIpRateLimiter(ipRateLimiter* limiter)
+{
+    for (int s = 0; s < IP_LIMIT_STRIPES; s++)
+    {
+        free(limiter->stripes[s].slots);
+        limiter->stripes[s].slots = NULL;
+        pthread_mutex_destroy(&(limiter->stripes[s].mutex));
+    }
+}
+
+#endif
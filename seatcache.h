@@ -0,0 +1,177 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the client side
+// ==============================
+// Client side cache of which seats are known to be
+// sold. Seats that are not known to be sold are kept
+// in a candidate list so a random one can be picked,
+// removed, or added back once refunded in O(1).
+// ==============================
+
+#ifndef SEATCACHE_H
+#define SEATCACHE_H
+
+#include <stdlib.h>
+
+typedef struct seatCache_
+{
+    int rows;
+    int cols;
+    int* candidates; // Seat indexes (row * cols + col) not known to be sold
+    int* position;   // Index of each seat in candidates, or -1 if sold
+    int numCandidates;
+} seatCache;
+
+// Allocates a cache where every seat may still be available.
+// Returns 0 on success.
+int initSeatCache(seatCache* cache, int rows, int cols)
+{
+    int total = rows * cols;
+
+    cache->rows = rows;
+    cache->cols = cols;
+    cache->candidates = malloc(sizeof(int) * total);
+    cache->position = malloc(sizeof(int) * total);
+    cache->numCandidates = total;
+
+    if (cache->candidates == NULL || cache->position == NULL)
+    {
+        free(cache->candidates);
+        free(cache->position);
+        cache->candidates = NULL;
+        cache->position = NULL;
+        cache->numCandidates = 0;
+        return 1;
+    }
+
+    for (int i = 0; i < total; i++)
+    {
+        cache->candidates[i] = i;
+        cache->position[i] = i;
+    }
+
+    return 0;
+}
+
+// Frees the cache's arrays
+void freeSeatCache(seatCache* cache)
+{
+    free(cache->candidates);
+    free(cache->position);
+    cache->candidates = NULL;
+    cache->position = NULL;
+    cache->numCandidates = 0;
+}
+
+// Records that a seat is sold, or does not exist
+void markSeatSold(seatCache* cache, int row, int col)
+{
+    if (row < 0 || row >= cache->rows || col < 0 || col >= cache->cols) return;
+
+    int seat = row * cache->cols + col;
+    int pos = cache->position[seat];
+    if (pos < 0) return;
+
+    // Swap the last candidate into the removed seat's place
+    int last = cache->candidates[--cache->numCandidates];
+    cache->candidates[pos] = last;
+    cache->position[last] = pos;
+    cache->position[seat] = -1;
+}
+
+// Records that a seat is free again, such as after a refund
+void markSeatFree(seatCache* cache, int row, int col)
+{
+    if (row < 0 || row >= cache->rows || col < 0 || col >= cache->cols) return;
+
+    int seat = row * cache->cols + col;
+    if (cache->position[seat] >= 0) return;
+
+    cache->candidates[cache->numCandidates] = seat;
+    cache->position[seat] = cache->numCandidates++;
+}
+
+// Picks a random seat that is not known to be sold.
+// Returns 0 if every seat is known to be sold.
+int pickCachedSeat(seatCache* cache, int* row, int* col)
+{
+    if (cache->numCandidates == 0) return 0;
+
+    int seat = cache->candidates[rand() % cache->numCandidates];
+    *row = seat / cache->cols;
+    *col = seat % cache->cols;
+    return 1;
+}
+
+// Applies a hex encoded bitmap of sold seats, as sent in SERVER_TICKET_MAP,
+// covering numRows rows starting at firstRow. Each hex digit holds 4 seats,
+// most significant bit first. Returns 0 if the bitmap was valid.
+int applySeatBitmap(seatCache* cache, int firstRow, int numRows, const char* hex, int hexLen)
+{
+    int numSeats = numRows * cache->cols;
+
+    if (firstRow < 0 || numRows < 0 || firstRow + numRows > cache->rows) return 1;
+    if (hexLen < (numSeats + 3) / 4) return 1;
+
+    for (int i = 0; i < numSeats; i++)
+    {
+        char digit = hex[i / 4];
+        int value;
+
+        if (digit >= '0' && digit <= '9') value = digit - '0';
+        else if (digit >= 'a' && digit <= 'f') value = digit - 'a' + 10;
+        else return 1;
+
+        // Seats can be refunded, so a free seat may have been sold before
+        if (value & (8 >> (i % 4)))
+            markSeatSold(cache, firstRow + i / cache->cols, i % cache->cols);
+        else
+            markSeatFree(cache, firstRow + i / cache->cols, i % cache->cols);
+    }
+
+    return 0;
+}
+
+// Applies a comma separated "row:col" list of sold seats, or of
+// returned seats if sold is 0, as sent in SERVER_SEATS_CHANGED.
+// Returns the number of seats in the list, or -1 if the list is
+// malformed.
+int applySeatList(seatCache* cache, const char* list, int listLen, int sold)
+{
+    int count = 0;
+    int pos = 0;
+
+    while (pos < listLen)
+    {
+        int values[2] = { 0, 0 };
+
+        for (int v = 0; v < 2; v++)
+        {
+            int digits = 0;
+            while (pos < listLen && list[pos] >= '0' && list[pos] <= '9' && digits < 6)
+            {
+                values[v] = values[v] * 10 + (list[pos++] - '0');
+                digits++;
+            }
+
+            char expected = (v == 0) ? ':' : ',';
+            if (digits == 0) return -1;
+            if (pos < listLen && list[pos] != expected) return -1;
+            if (v == 0 && pos >= listLen) return -1;
+            pos++;
+        }
+
+        if (sold) markSeatSold(cache, values[0], values[1]);
+        else markSeatFree(cache, values[0], values[1]);
+        count++;
+    }
+
+    return count;
+}
+
+#endif
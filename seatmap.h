@@ -8,7 +8,41 @@
 // multi theading and sockets from the client side
 // ==============================
 // Creates, manages, and syncs the seat map between
-// different threads
+// different threads. Seats are split into price
+// tiers by row, front rows first. Each tier keeps
+// a count and a list of its unsold seats that
+// buySeat() updates, so tier queries and buying by
+// tier never scan the map. Every seat's sold flag is
+// also kept in one flat byte array, so counting and
+// searching seats runs the vector kernels in
+// seatscan.h over contiguous memory.
+//
+// Each row and each section, a square block of
+// seats, keeps a count of its unsold seats that a
+// sale updates in O(1), so a venue wide summary of
+// where seats are left never scans the map.
+//
+// refundSeat() returns a sold seat. It undoes every
+// count a sale changed, also in O(1), and puts the
+// seat back at the end of its tier's free list.
+//
+// All of this lives in a seatLayout that the map
+// points to. resizeSeatMap() builds the resized
+// layout without the lock while sales go on in the
+// old one, then replays the seats sold or returned
+// meanwhile and swaps the pointer, so buyers only
+// wait for that last step. A resize that would cut
+// off a sold seat is refused.
+//
+// Readers that want the whole map, like printing
+// it, use a seatSnapshot: a read only copy of the
+// sold flags. The map counts its changes, and a
+// reader that finds the newest snapshot out of date
+// copies a new one under the lock, one memcpy, and
+// publishes it for the next readers. Old snapshots
+// are freed through epochreclaim.h once no reader
+// holds them, so readers never lock the map while
+// they go over one.
 // ==============================
 
 #ifndef SEATMAP_H
@@ -17,24 +51,94 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include "threadsafeprint.h"
+#include "seatscan.h"
+#include "epochreclaim.h"
 
 // Created a struct in case I wanted to add more fields later,
 // like the buyer's name
 typedef struct seatInfo_
 {
     int taken;
+    unsigned long long receipt; // Receipt of the sale that sold it, 0 while unsold
 } seatInfo;
 
-// Stores the seat map array, size, number sold, and a mutex
-// for thread sync
-typedef struct seatMap_
+#define MAX_SEAT_TIERS 8
+#define DEFAULT_SECTION_SIZE 5 // Rows and columns of seats in a section
+
+// Errors returned by resizeSeatMap()
+#define SEAT_RESIZE_NO_MEMORY -1
+#define SEAT_RESIZE_SEATS_SOLD -2 // The new size would cut off sold seats
+
+// One price tier. Its unsold seats are freeSeats[start] up to
+// freeSeats[start + numFree - 1] of the seat map.
+typedef struct seatTier_
+{
+    unsigned int price;
+    unsigned int numSeats;
+    unsigned int numFree;
+    int start;
+} seatTier;
+
+// One version of the seat map: the seat array, its size, number
+// sold, and every index kept over it. A resize builds a new layout
+// next to the current one and swaps the pointer, see resizeSeatMap().
+typedef struct seatLayout_
 {
     seatInfo** seatArr;
     unsigned int rows;
     unsigned int cols;
     unsigned int numSold;
 
+    // Side arrays indexed by seat number, row * cols + col
+    unsigned char* seatTier; // Tier of each seat
+    unsigned char* seatSold; // 1 if sold, mirrors seatArr for the scan kernels
+    int* freePos;            // Index in freeSeats, -1 once sold
+    int* freeSeats;          // Unsold seat numbers, grouped by tier
+
+    seatTier tiers[MAX_SEAT_TIERS];
+    unsigned int numTiers;
+    unsigned int tierRows[MAX_SEAT_TIERS]; // Rows in each tier, the last one takes the rest
+
+    // Unsold seats of each row, and of each section row by row.
+    // Sections on the last row or column of sections may be smaller.
+    unsigned int* rowFree;
+    unsigned int* sectionFree;
+    unsigned int sectionSize;
+    unsigned int sectionRows;
+    unsigned int sectionCols;
+} seatLayout;
+
+// A read only copy of every seat's sold flag, see acquireSeatSnapshot()
+typedef struct seatSnapshot_
+{
+    epochNode node; // Must stay first
+    unsigned long version;
+    unsigned int rows;
+    unsigned int cols;
+    unsigned int numSold;
+    unsigned char seatSold[]; // rows * cols flags, row by row
+} seatSnapshot;
+
+// Stores the current seat layout and a mutex for thread sync
+typedef struct seatMap_
+{
+    seatLayout* layout; // Only replaced while holding both mutexes
     pthread_mutex_t mutex;
+
+    // Held for a whole resize, so resizes run one at a time and the
+    // tiers and sections cannot change while one is building
+    pthread_mutex_t resizeMutex;
+
+    // Seats changed while a resize builds its new layout, replayed
+    // onto it before it is swapped in. NULL when no resize is running.
+    unsigned char* resizeDirty; // 1 if the seat is already in resizeChanged
+    int* resizeChanged;
+    int numResizeChanged;
+
+    // Bumped under the mutex whenever a seat or the size changes
+    unsigned long version;
+    seatSnapshot* snapshot; // Newest snapshot, replaced under the mutex
+    epochDomain snapshotEpochs;
 } seatMap;
 
 // Allocates and returns a new 2d seatInfo array
@@ -49,49 +153,271 @@ seatInfo** _allocSeatsArr(int rows, int cols)
         {
             // All seats are initially available to purchase
             _newSeatArr[y][x].taken = 0;
+            _newSeatArr[y][x].receipt = 0;
         }
     }
 
     return _newSeatArr;
 }
 
-// Frees memory created for the 2d seatInfo array
-// Not thread safe, use freeSeatsData() instead
-void _freeSeatsData(seatMap* seats)
+// Frees the tier, flag and count side arrays. Not thread safe.
+void _freeSeatTiers(seatLayout* layout)
+{
+    free(layout->seatTier);
+    free(layout->seatSold);
+    free(layout->freePos);
+    free(layout->freeSeats);
+    free(layout->rowFree);
+    free(layout->sectionFree);
+    layout->seatTier = NULL;
+    layout->seatSold = NULL;
+    layout->rowFree = NULL;
+    layout->sectionFree = NULL;
+    layout->freePos = NULL;
+    layout->freeSeats = NULL;
+}
+
+// Assigns every seat to its tier and lists the unsold seats of each
+// tier, lowest seat number last so buying by tier starts at the
+// front. Also refills the sold flags and the row and section counts.
+// Called whenever the map is resized or reloaded. Returns 0, or -1 if
+// out of memory, which leaves the side arrays NULL. Not thread safe.
+int _rebuildSeatTiers(seatLayout* layout)
+{
+    int numSeats = layout->rows * layout->cols;
+
+    _freeSeatTiers(layout);
+    if (layout->seatArr == NULL || numSeats == 0) return 0;
+
+    layout->seatTier = malloc(numSeats);
+    layout->seatSold = malloc(numSeats);
+    layout->freePos = malloc(sizeof(int) * numSeats);
+    layout->freeSeats = malloc(sizeof(int) * numSeats);
+    layout->sectionRows = (layout->rows + layout->sectionSize - 1) / layout->sectionSize;
+    layout->sectionCols = (layout->cols + layout->sectionSize - 1) / layout->sectionSize;
+    layout->rowFree = calloc(layout->rows, sizeof(unsigned int));
+    layout->sectionFree = calloc(layout->sectionRows * layout->sectionCols, sizeof(unsigned int));
+    if (layout->seatTier == NULL || layout->seatSold == NULL ||
+        layout->freePos == NULL || layout->freeSeats == NULL ||
+        layout->rowFree == NULL || layout->sectionFree == NULL)
+    {
+        _freeSeatTiers(layout);
+        return -1;
+    }
+
+    for (int y = 0; y < layout->rows; y++)
+        for (int x = 0; x < layout->cols; x++)
+            layout->seatSold[y * layout->cols + x] = (layout->seatArr[y][x].taken != 0);
+
+    // Each row of a section is a run of the row's flags
+    for (int y = 0; y < layout->rows; y++)
+    {
+        const unsigned char* rowFlags = layout->seatSold + y * layout->cols;
+        layout->rowFree[y] = layout->cols - seatScan.countSold(rowFlags, layout->cols);
+
+        unsigned int* sections = layout->sectionFree + (y / layout->sectionSize) * layout->sectionCols;
+        for (int x = 0; x < layout->cols; x += layout->sectionSize)
+        {
+            int width = (layout->cols - x < layout->sectionSize) ? layout->cols - x : layout->sectionSize;
+            sections[x / layout->sectionSize] += width - seatScan.countSold(rowFlags + x, width);
+        }
+    }
+
+    int tier = 0;
+    int rowsLeft = layout->tierRows[0];
+    for (int y = 0; y < layout->rows; y++)
+    {
+        // The last tier takes every remaining row
+        while (rowsLeft == 0 && tier + 1 < layout->numTiers)
+            rowsLeft = layout->tierRows[++tier];
+        rowsLeft--;
+
+        for (int x = 0; x < layout->cols; x++)
+            layout->seatTier[y * layout->cols + x] = tier;
+    }
+
+    int start = 0;
+    for (int t = 0; t < layout->numTiers; t++)
+    {
+        seatTier* info = &(layout->tiers[t]);
+        info->start = start;
+        info->numSeats = 0;
+        info->numFree = 0;
+
+        for (int seat = numSeats - 1; seat >= 0; seat--)
+        {
+            if (layout->seatTier[seat] != t) continue;
+            info->numSeats++;
+
+            seatInfo* selectedSeat = &(layout->seatArr[seat / layout->cols][seat % layout->cols]);
+            layout->freePos[seat] = -1;
+            if (selectedSeat->taken) continue;
+
+            layout->freePos[seat] = start + info->numFree;
+            layout->freeSeats[start + info->numFree] = seat;
+            info->numFree++;
+        }
+
+        start += info->numSeats;
+    }
+    return 0;
+}
+
+// Records a seat that was just sold in its flag, and takes it off its
+// tier's free list by moving the tier's last free seat into its place.
+// Not thread safe.
+void _removeFreeSeat(seatLayout* layout, int seat)
 {
-    if (seats->seatArr == NULL) return;
+    if (layout->seatSold != NULL)
+    {
+        int row = seat / layout->cols;
+        int col = seat % layout->cols;
+        layout->seatSold[seat] = 1;
+        layout->rowFree[row]--;
+        layout->sectionFree[(row / layout->sectionSize) * layout->sectionCols + col / layout->sectionSize]--;
+    }
+    if (layout->freePos == NULL || layout->freePos[seat] < 0) return;
+
+    seatTier* info = &(layout->tiers[layout->seatTier[seat]]);
+    int pos = layout->freePos[seat];
+    int last = info->start + --info->numFree;
 
-    for (int y = 0; y < seats->rows; y++)
+    layout->freeSeats[pos] = layout->freeSeats[last];
+    layout->freePos[layout->freeSeats[pos]] = pos;
+    layout->freePos[seat] = -1;
+}
+
+// Undoes _removeFreeSeat() for a seat that was just returned, adding it
+// to the end of its tier's free list. Not thread safe.
+void _addFreeSeat(seatLayout* layout, int seat)
+{
+    if (layout->seatSold != NULL)
     {
-        free(seats->seatArr[y]);
+        int row = seat / layout->cols;
+        int col = seat % layout->cols;
+        layout->seatSold[seat] = 0;
+        layout->rowFree[row]++;
+        layout->sectionFree[(row / layout->sectionSize) * layout->sectionCols + col / layout->sectionSize]++;
     }
+    if (layout->freePos == NULL || layout->freePos[seat] >= 0) return;
+
+    seatTier* info = &(layout->tiers[layout->seatTier[seat]]);
+    int pos = info->start + info->numFree++;
 
-    free(seats->seatArr);
-    seats->seatArr = NULL;
+    layout->freeSeats[pos] = seat;
+    layout->freePos[seat] = pos;
+}
+
+// Frees memory created for the 2d seatInfo array and the side
+// arrays. Not thread safe.
+void _freeSeatsData(seatLayout* layout)
+{
+    _freeSeatTiers(layout);
+    if (layout->seatArr == NULL) return;
+
+    for (int y = 0; y < layout->rows; y++)
+    {
+        free(layout->seatArr[y]);
+    }
+
+    free(layout->seatArr);
+    layout->seatArr = NULL;
+}
+
+// Allocates a rows by cols layout of unsold seats with the tiers and
+// sections of config, or one free tier if config is NULL. The caller
+// marks any sold seats and then calls _rebuildSeatTiers(). Returns
+// NULL if out of memory.
+seatLayout* _createSeatLayout(int rows, int cols, const seatLayout* config)
+{
+    seatLayout* layout = calloc(1, sizeof(seatLayout));
+    if (layout == NULL) return NULL;
+
+    layout->seatArr = _allocSeatsArr(rows, cols);
+    layout->rows = rows;
+    layout->cols = cols;
+    layout->numTiers = 1;
+    layout->sectionSize = DEFAULT_SECTION_SIZE;
+
+    if (config != NULL)
+    {
+        layout->numTiers = config->numTiers;
+        layout->sectionSize = config->sectionSize;
+        for (int t = 0; t < config->numTiers; t++)
+        {
+            layout->tierRows[t] = config->tierRows[t];
+            layout->tiers[t].price = config->tiers[t].price;
+        }
+    }
+
+    return layout;
+}
+
+// Frees a layout that is no longer the current one
+void _deleteSeatLayout(seatLayout* layout)
+{
+    if (layout == NULL) return;
+
+    _freeSeatsData(layout);
+    free(layout);
+}
+
+// Records that a seat of the current layout changed, if a resize is
+// building a new layout from an older copy. Caller must hold the
+// map's mutex.
+void _logResizeChange(seatMap* seats, int seat)
+{
+    if (seats->resizeDirty == NULL || seats->resizeDirty[seat]) return;
+
+    seats->resizeDirty[seat] = 1;
+    seats->resizeChanged[seats->numResizeChanged++] = seat;
+}
+
+// Marks every snapshot taken so far as out of date. Caller must hold
+// the map's mutex.
+void _bumpSeatVersion(seatMap* seats)
+{
+    __atomic_store_n(&(seats->version), seats->version + 1, __ATOMIC_RELEASE);
+}
+
+void _freeSeatSnapshot(epochNode* node)
+{
+    free(node);
 }
 
 // Helper function that ensures thread safety
 void freeSeatsData(seatMap* seats)
 {
-    pthread_mutex_lock(&(seats->mutex));
-    _freeSeatsData(seats);
-    pthread_mutex_unlock(&(seats->mutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+    _freeSeatsData(layout);
+    profiledUnlock(&(seats->mutex));
 }
 
-// Initializes a given seatMap with the specified rows and cols.
-// Is thead safe.
+// Initializes a given seatMap with the specified rows and cols,
+// every seat unsold. Keeps the tiers and sections. Is thead safe.
 void initSeatsData(seatMap* seats, int rows, int cols)
 {
-    pthread_mutex_lock(&(seats->mutex));
+    profiledLock(&(seats->resizeMutex));
 
-    _freeSeatsData(seats);
-    seats->seatArr = _allocSeatsArr(rows, cols);
+    seatLayout* next = _createSeatLayout(rows, cols, seats->layout);
+    if (next != NULL && _rebuildSeatTiers(next) != 0)
+    {
+        _deleteSeatLayout(next);
+        next = NULL;
+    }
 
-    seats->rows = rows;
-    seats->cols = cols;
-    seats->numSold = 0;
+    profiledLock(&(seats->mutex));
+    seatLayout* old = seats->layout;
+    if (next != NULL)
+    {
+        seats->layout = next;
+        _bumpSeatVersion(seats);
+    }
+    profiledUnlock(&(seats->mutex));
 
-    pthread_mutex_unlock(&(seats->mutex));
+    if (next != NULL) _deleteSeatLayout(old);
+    profiledUnlock(&(seats->resizeMutex));
 }
 
 // Deletes a given seatMap from memory
@@ -99,7 +425,11 @@ void deleteSeatMap(seatMap** seats)
 {
     if (*seats == NULL) return;
 
-    freeSeatsData(*seats);
+    _deleteSeatLayout((*seats)->layout);
+    free((*seats)->snapshot);
+    freeEpochDomain(&((*seats)->snapshotEpochs));
+    pthread_mutex_destroy(&((*seats)->mutex));
+    pthread_mutex_destroy(&((*seats)->resizeMutex));
     free(*seats);
 
     *seats = NULL;
@@ -109,8 +439,16 @@ void deleteSeatMap(seatMap** seats)
 seatMap* createSeatMap(int rows, int cols)
 {
     seatMap* newSeats = malloc(sizeof(seatMap));
-    newSeats->seatArr = NULL;
-    initSeatsData(newSeats, rows, cols);
+    pthread_mutex_init(&(newSeats->mutex), NULL);
+    pthread_mutex_init(&(newSeats->resizeMutex), NULL);
+    newSeats->resizeDirty = NULL;
+    newSeats->resizeChanged = NULL;
+    newSeats->numResizeChanged = 0;
+    newSeats->version = 0;
+    newSeats->snapshot = NULL;
+    initEpochDomain(&(newSeats->snapshotEpochs), _freeSeatSnapshot);
+    newSeats->layout = _createSeatLayout(rows, cols, NULL);
+    _rebuildSeatTiers(newSeats->layout);
 
     return newSeats;
 }
@@ -119,51 +457,142 @@ seatMap* createSeatMap(int rows, int cols)
 // while being thread safe
 unsigned int getSeatRows(seatMap* seats)
 {
-    pthread_mutex_lock(&(seats->mutex));
-    unsigned int retVal = seats->rows;
-    pthread_mutex_unlock(&(seats->mutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+    unsigned int retVal = layout->rows;
+    profiledUnlock(&(seats->mutex));
 
     return retVal;
 }
 
-// Sets the number of rows in the given seat map
-// while being thread safe. resizes the seat map
-// array automatically.
-void setSeatRows(seatMap* seats, int newRows)
+// Returns the number of columns in the given seat map
+// while being thread safe
+unsigned int getSeatCols(seatMap* seats)
 {
-    if (seats->rows == newRows) return;
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+    unsigned int retVal = layout->cols;
+    profiledUnlock(&(seats->mutex));
+
+    return retVal;
+}
 
-    pthread_mutex_lock(&(seats->mutex));
+// Resizes the map to newRows by newCols while it keeps selling. Seats
+// inside both sizes keep their state and added seats are unsold. A
+// size that would cut off a sold seat is refused, so a sale is never
+// lost. The new layout is built from a copy of the kept
+// seats without holding the mutex, while buyers keep using the current
+// layout and every seat they change is logged. The mutex is then only
+// held to replay the logged seats onto the new layout and swap the
+// pointer. Returns the number of seats replayed, SEAT_RESIZE_NO_MEMORY,
+// or SEAT_RESIZE_SEATS_SOLD if a seat that would be cut off was sold
+// before or during the build. Is thread safe.
+int resizeSeatMap(seatMap* seats, int newRows, int newCols)
+{
+    profiledLock(&(seats->resizeMutex));
 
-    // Reallocate seat array if necessary
-    if (seats->seatArr != NULL)
+    // Only resizes replace the layout, so it can be read here unlocked
+    seatLayout* old = seats->layout;
+    int oldRows = old->rows;
+    int oldCols = old->cols;
+    if (oldRows == newRows && oldCols == newCols)
     {
-        seatInfo** _newSeatArr = _allocSeatsArr(newRows, seats->cols);
-        
-        for (int y = 0; y < seats->rows && y < newRows; y++) {
-            for (int x = 0; x < seats->cols; x++) {
-                _newSeatArr[y][x] = seats->seatArr[y][x];
-            }
-        }
+        profiledUnlock(&(seats->resizeMutex));
+        return 0;
+    }
 
-        _freeSeatsData(seats);
-        seats->seatArr = _newSeatArr;
+    unsigned char* dirty = calloc(oldRows * oldCols, 1);
+    int* changed = malloc(sizeof(int) * oldRows * oldCols);
+    seatLayout* next = _createSeatLayout(newRows, newCols, old);
+    int keptRows = (oldRows < newRows) ? oldRows : newRows;
+    int keptCols = (oldCols < newCols) ? oldCols : newCols;
+    if (dirty == NULL || changed == NULL || next == NULL)
+    {
+        free(dirty);
+        free(changed);
+        _deleteSeatLayout(next);
+        profiledUnlock(&(seats->resizeMutex));
+        return SEAT_RESIZE_NO_MEMORY;
     }
 
-    seats->rows = newRows;
+    // Copy the seats that stay, with the receipt of each sale, and
+    // start logging changes in one step
+    profiledLock(&(seats->mutex));
+    for (int y = 0; y < keptRows; y++)
+        memcpy(next->seatArr[y], old->seatArr[y], sizeof(seatInfo) * keptCols);
+    unsigned int soldAtCopy = old->numSold;
+    seats->resizeDirty = dirty;
+    seats->resizeChanged = changed;
+    seats->numResizeChanged = 0;
+    profiledUnlock(&(seats->mutex));
+
+    for (int y = 0; y < keptRows; y++)
+        for (int x = 0; x < keptCols; x++)
+            next->numSold += (next->seatArr[y][x].taken != 0);
+
+    // Sold seats outside the copy would be cut off. Without its tiers
+    // and free lists the new layout cannot sell, so it is not used.
+    int cutOff = (next->numSold < soldAtCopy);
+    int noMemory = (!cutOff && _rebuildSeatTiers(next) != 0);
+
+    // Replay what changed since the copy, then publish the new layout
+    profiledLock(&(seats->mutex));
+    for (int i = 0; i < seats->numResizeChanged && !cutOff && !noMemory; i++)
+    {
+        int y = seats->resizeChanged[i] / oldCols;
+        int x = seats->resizeChanged[i] % oldCols;
+        if (y >= newRows || x >= newCols)
+        {
+            cutOff = old->seatArr[y][x].taken;
+            continue;
+        }
+
+        seatInfo* selectedSeat = &(next->seatArr[y][x]);
+        int taken = old->seatArr[y][x].taken;
+        selectedSeat->receipt = old->seatArr[y][x].receipt; // May be resold meanwhile
+        if (selectedSeat->taken == taken) continue;
 
-    pthread_mutex_unlock(&(seats->mutex));
+        selectedSeat->taken = taken;
+        if (taken)
+        {
+            next->numSold++;
+            _removeFreeSeat(next, y * newCols + x);
+        }
+        else
+        {
+            next->numSold--;
+            _addFreeSeat(next, y * newCols + x);
+        }
+    }
+    int replayed = seats->numResizeChanged;
+    int kept = !cutOff && !noMemory;
+    if (kept)
+    {
+        seats->layout = next;
+        _bumpSeatVersion(seats);
+    }
+    seats->resizeDirty = NULL;
+    seats->resizeChanged = NULL;
+    seats->numResizeChanged = 0;
+    profiledUnlock(&(seats->mutex));
+
+    // No thread reads a layout without the mutex, so nothing can still
+    // be using the one that was not kept
+    _deleteSeatLayout(kept ? old : next);
+    free(dirty);
+    free(changed);
+
+    profiledUnlock(&(seats->resizeMutex));
+    if (noMemory) return SEAT_RESIZE_NO_MEMORY;
+    return cutOff ? SEAT_RESIZE_SEATS_SOLD : replayed;
 }
 
-// Returns the number of columns in the given seat map
-// while being thread safe
-unsigned int getSeatCols(seatMap* seats)
+// Sets the number of rows in the given seat map
+// while being thread safe. resizes the seat map
+// array automatically.
+void setSeatRows(seatMap* seats, int newRows)
 {
-    pthread_mutex_lock(&(seats->mutex));
-    unsigned int retVal = seats->cols;
-    pthread_mutex_unlock(&(seats->mutex));
-
-    return retVal;
+    resizeSeatMap(seats, newRows, getSeatCols(seats));
 }
 
 // Sets the number of cols in the given seat map
@@ -171,37 +600,17 @@ unsigned int getSeatCols(seatMap* seats)
 // array automatically.
 void setSeatCols(seatMap* seats, int newCols)
 {
-    if (seats->cols == newCols) return;
-
-    pthread_mutex_lock(&(seats->mutex));
-
-    // Reallocate seat array if necessary
-    if (seats->seatArr != NULL)
-    {
-        seatInfo** _newSeatArr = _allocSeatsArr(seats->rows, newCols);
-        
-        for (int y = 0; y < seats->rows; y++) {
-            for (int x = 0; x < seats->cols && x < newCols; x++) {
-                _newSeatArr[y][x] = seats->seatArr[y][x];
-            }
-        }
-
-        _freeSeatsData(seats);
-        seats->seatArr = _newSeatArr;
-    }
-
-    seats->cols = newCols;
-
-    pthread_mutex_unlock(&(seats->mutex));
+    resizeSeatMap(seats, getSeatRows(seats), newCols);
 }
 
 // Returns the total number of sold and unsold seats
 // in the given seat map while being thread safe
 unsigned int getNumSeatsTotal(seatMap* seats)
 {
-    pthread_mutex_lock(&(seats->mutex));
-    unsigned int retVal = seats->rows * seats->cols;
-    pthread_mutex_unlock(&(seats->mutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+    unsigned int retVal = layout->rows * layout->cols;
+    profiledUnlock(&(seats->mutex));
 
     return retVal;
 }
@@ -210,9 +619,10 @@ unsigned int getNumSeatsTotal(seatMap* seats)
 // in the given seat map while being thread safe
 unsigned int getNumSeatsAvailable(seatMap* seats)
 {
-    pthread_mutex_lock(&(seats->mutex));
-    unsigned int retVal = (seats->rows * seats->cols) - seats->numSold;
-    pthread_mutex_unlock(&(seats->mutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+    unsigned int retVal = (layout->rows * layout->cols) - layout->numSold;
+    profiledUnlock(&(seats->mutex));
 
     return retVal;
 }
@@ -221,32 +631,36 @@ unsigned int getNumSeatsAvailable(seatMap* seats)
 // in the given seat map while being thread safe
 unsigned int getNumSeatsSold(seatMap* seats)
 {
-    pthread_mutex_lock(&(seats->mutex));
-    unsigned int retVal = seats->numSold;
-    pthread_mutex_unlock(&(seats->mutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+    unsigned int retVal = layout->numSold;
+    profiledUnlock(&(seats->mutex));
 
     return retVal;
 }
 
-// Returns a pointer to the seatInfo struct for the given seat
-// in the seat map while being thread safe
-const seatInfo* getSeatInfo(seatMap* seats, int row, int col)
+// Copies the seatInfo struct for the given seat into info.
+// A copy, as a resize can free the seat once the lock is
+// dropped. Returns 1, or -1 if row or col is invalid.
+// Is thread safe.
+int getSeatInfo(seatMap* seats, int row, int col, seatInfo* info)
 {
-    pthread_mutex_lock(&(seats->mutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
 
-    if (row < 0 || row >= seats->rows ||
-        col < 0 || col >= seats->cols ||
-        seats->seatArr == NULL) 
+    if (row < 0 || row >= layout->rows ||
+        col < 0 || col >= layout->cols ||
+        layout->seatArr == NULL) 
         {
-            pthread_mutex_unlock(&(seats->mutex));
-            return NULL;
+            profiledUnlock(&(seats->mutex));
+            return -1;
         }
     
-    seatInfo* retVal = &(seats->seatArr[row][col]);
+    *info = layout->seatArr[row][col];
 
-    pthread_mutex_unlock(&(seats->mutex));
+    profiledUnlock(&(seats->mutex));
     
-    return retVal;
+    return 1;
 }
 
 // Returns 1 if the specified seat has been sold
@@ -254,103 +668,484 @@ const seatInfo* getSeatInfo(seatMap* seats, int row, int col)
 // If the row or col is invalid, returns -1. Is thread safe.
 int seatSold(seatMap* seats, int row, int col)
 {
-    pthread_mutex_lock(&(seats->mutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
 
-    if (row < 0 || row >= seats->rows ||
-        col < 0 || col >= seats->cols ||
-        seats->seatArr == NULL) 
+    if (row < 0 || row >= layout->rows ||
+        col < 0 || col >= layout->cols ||
+        layout->seatArr == NULL) 
     {
-        pthread_mutex_unlock(&(seats->mutex));
+        profiledUnlock(&(seats->mutex));
         return -1;
     }
 
-    seatInfo* selectedSeat = &(seats->seatArr[row][col]);
+    seatInfo* selectedSeat = &(layout->seatArr[row][col]);
     int retVal = selectedSeat->taken;
 
-    pthread_mutex_unlock(&(seats->mutex));
+    profiledUnlock(&(seats->mutex));
 
     return retVal;
 }
 
 // Attempts to purchase the given row and col seat in
-// the seat map, returns -1 if row or col is invalid.
+// the seat map and keeps receipt with it, which a refund
+// must show. Returns -1 if row or col is invalid.
 // Returns 0 if the specified seat is already sold.
 // Returns 1 if the transaction was successful.
 // Is thread safe.
-int buySeat(seatMap* seats, int row, int col)
+int buySeat(seatMap* seats, int row, int col, unsigned long long receipt)
 {
-    pthread_mutex_lock(&(seats->mutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
 
-    if (row < 0 || row >= seats->rows ||
-        col < 0 || col >= seats->cols ||
-        seats->seatArr == NULL) 
+    if (row < 0 || row >= layout->rows ||
+        col < 0 || col >= layout->cols ||
+        layout->seatArr == NULL) 
     {
-        pthread_mutex_unlock(&(seats->mutex));
+        profiledUnlock(&(seats->mutex));
         return -1;
     }
     
-    seatInfo* selectedSeat = &(seats->seatArr[row][col]);
+    seatInfo* selectedSeat = &(layout->seatArr[row][col]);
     if (selectedSeat->taken) 
     {
-        pthread_mutex_unlock(&(seats->mutex));
+        profiledUnlock(&(seats->mutex));
         return 0;
     }
 
     selectedSeat->taken = 1;
-    seats->numSold++;
+    selectedSeat->receipt = receipt;
+    layout->numSold++;
+    _removeFreeSeat(layout, row * layout->cols + col);
+    _logResizeChange(seats, row * layout->cols + col);
+    _bumpSeatVersion(seats);
 
-    pthread_mutex_unlock(&(seats->mutex));
+    profiledUnlock(&(seats->mutex));
 
     return 1;
 }
 
-// Prints the grid of seats to the terminal.
+// Returns the given row and col seat so it can be sold again, if it
+// was sold with receipt. Returns -1 if row or col is invalid, 0 if the
+// seat is not sold or was sold with another receipt, or 1 if it was
+// returned. Is thread safe.
+int refundSeat(seatMap* seats, int row, int col, unsigned long long receipt)
+{
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+
+    if (row < 0 || row >= layout->rows ||
+        col < 0 || col >= layout->cols ||
+        layout->seatArr == NULL)
+    {
+        profiledUnlock(&(seats->mutex));
+        return -1;
+    }
+
+    seatInfo* selectedSeat = &(layout->seatArr[row][col]);
+    if (!selectedSeat->taken || selectedSeat->receipt != receipt)
+    {
+        profiledUnlock(&(seats->mutex));
+        return 0;
+    }
+
+    selectedSeat->taken = 0;
+    selectedSeat->receipt = 0;
+    layout->numSold--;
+    _addFreeSeat(layout, row * layout->cols + col);
+    _logResizeChange(seats, row * layout->cols + col);
+    _bumpSeatVersion(seats);
+
+    profiledUnlock(&(seats->mutex));
+
+    return 1;
+}
+
+// Sets up numTiers price tiers, front rows first. rowsPerTier gives
+// the rows in every tier but the last, which takes the remaining rows.
+// Tiers past the last row have no seats. Waits for a running resize.
 // Is thread safe.
-void printSeatMap(seatMap* seats)
+void setSeatTiers(seatMap* seats, int numTiers, const unsigned int* rowsPerTier, const unsigned int* prices)
+{
+    profiledLock(&(seats->resizeMutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+
+    if (numTiers < 1) numTiers = 1;
+    if (numTiers > MAX_SEAT_TIERS) numTiers = MAX_SEAT_TIERS;
+
+    layout->numTiers = numTiers;
+    for (int t = 0; t < numTiers; t++)
+    {
+        layout->tierRows[t] = (t + 1 < numTiers) ? rowsPerTier[t] : 0;
+        layout->tiers[t].price = prices[t];
+    }
+    _rebuildSeatTiers(layout);
+
+    profiledUnlock(&(seats->mutex));
+    profiledUnlock(&(seats->resizeMutex));
+}
+
+// Splits the map into sections of size by size seats, counted from
+// the front left seat. Is thread safe.
+void setSeatSections(seatMap* seats, int size)
+{
+    profiledLock(&(seats->resizeMutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+
+    layout->sectionSize = (size > 0) ? size : DEFAULT_SECTION_SIZE;
+    _rebuildSeatTiers(layout);
+
+    profiledUnlock(&(seats->mutex));
+    profiledUnlock(&(seats->resizeMutex));
+}
+
+// Copies the unsold seat count of every row into rowFree, and of every
+// section, row by row, into sectionFree. They must hold maxRows and
+// maxSections counts. Stores the number of columns, the section size
+// and the number of sections down and across, all of the same layout.
+// Returns the number of rows, or 0 if a buffer is too small.
+// Is thread safe.
+int getSeatSummaries(seatMap* seats, unsigned int* rowFree, int maxRows, unsigned int* sectionFree,
+    int maxSections, int* cols, int* sectionSize, int* sectionRows, int* sectionCols)
+{
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+
+    int numRows = layout->rows;
+    int numSections = layout->sectionRows * layout->sectionCols;
+    if (layout->rowFree == NULL || numRows > maxRows || numSections > maxSections)
+    {
+        profiledUnlock(&(seats->mutex));
+        return 0;
+    }
+
+    memcpy(rowFree, layout->rowFree, sizeof(unsigned int) * numRows);
+    memcpy(sectionFree, layout->sectionFree, sizeof(unsigned int) * numSections);
+    *cols = layout->cols;
+    *sectionSize = layout->sectionSize;
+    *sectionRows = layout->sectionRows;
+    *sectionCols = layout->sectionCols;
+
+    profiledUnlock(&(seats->mutex));
+    return numRows;
+}
+
+// Returns the unsold tier with the lowest price, or -1 if every seat
+// is sold. Ties go to the tier nearer the front. Not thread safe.
+int _cheapestSeatTier(seatLayout* layout)
 {
-    pthread_mutex_lock(&(seats->mutex));
+    int cheapest = -1;
+    for (int t = 0; t < layout->numTiers; t++)
+    {
+        if (layout->tiers[t].numFree > 0 &&
+            (cheapest < 0 || layout->tiers[t].price < layout->tiers[cheapest].price))
+            cheapest = t;
+    }
 
-    if (seats->seatArr == NULL) 
+    return cheapest;
+}
+
+// Copies every tier into tiers, which must hold MAX_SEAT_TIERS, and
+// sets *cheapest to the cheapest tier with seats left, or -1.
+// Returns the number of tiers. Is thread safe.
+int getSeatTiers(seatMap* seats, seatTier* tiers, int* cheapest)
+{
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+
+    int numTiers = layout->numTiers;
+    for (int t = 0; t < numTiers; t++)
+        tiers[t] = layout->tiers[t];
+    *cheapest = _cheapestSeatTier(layout);
+
+    profiledUnlock(&(seats->mutex));
+    return numTiers;
+}
+
+// Returns the price of a tier, or 0 if there is no such tier.
+// Is thread safe.
+unsigned int getSeatTierPrice(seatMap* seats, int tier)
+{
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+    unsigned int retVal = (tier >= 0 && tier < layout->numTiers) ? layout->tiers[tier].price : 0;
+    profiledUnlock(&(seats->mutex));
+
+    return retVal;
+}
+
+// Buys an unsold seat in the given tier, or in the cheapest tier with
+// seats left if tier is -1. Stores the seat in row and col, and the
+// tier bought from in tier, and keeps receipt with it like buySeat().
+// Returns -1 if the tier is invalid, 0 if it is sold out, or 1 if the
+// transaction was successful.
+// Is thread safe.
+int buyTierSeat(seatMap* seats, int* tier, int* row, int* col, unsigned long long receipt)
+{
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+
+    if (*tier < -1 || *tier >= (int)layout->numTiers || layout->freeSeats == NULL)
+    {
+        profiledUnlock(&(seats->mutex));
+        return -1;
+    }
+
+    if (*tier == -1) *tier = _cheapestSeatTier(layout);
+    if (*tier < 0 || layout->tiers[*tier].numFree == 0)
     {
-        pthread_mutex_unlock(&(seats->mutex));
-        return;
+        profiledUnlock(&(seats->mutex));
+        return 0;
     }
 
+    seatTier* info = &(layout->tiers[*tier]);
+    int seat = layout->freeSeats[info->start + info->numFree - 1];
+    *row = seat / layout->cols;
+    *col = seat % layout->cols;
+
+    layout->seatArr[*row][*col].taken = 1;
+    layout->seatArr[*row][*col].receipt = receipt;
+    layout->numSold++;
+    _removeFreeSeat(layout, seat);
+    _logResizeChange(seats, seat);
+    _bumpSeatVersion(seats);
+
+    profiledUnlock(&(seats->mutex));
+    return 1;
+}
+
+// Copies the taken flag of every seat, row by row, into states and
+// the receipt it was sold with into receipts, and stores the number
+// of columns they are for in cols. Both must hold maxSeats entries.
+// Returns the number of seats written, or 0 if maxSeats is too small.
+// Is thread safe.
+int getSeatStates(seatMap* seats, unsigned char* states, unsigned long long* receipts,
+    int maxSeats, int* cols)
+{
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+
+    int total = layout->rows * layout->cols;
+    if (layout->seatSold == NULL || total > maxSeats)
+    {
+        profiledUnlock(&(seats->mutex));
+        return 0;
+    }
+
+    memcpy(states, layout->seatSold, total);
+    for (int y = 0; y < layout->rows; y++)
+        for (int x = 0; x < layout->cols; x++)
+            receipts[y * layout->cols + x] = layout->seatArr[y][x].receipt;
+    *cols = layout->cols;
+
+    profiledUnlock(&(seats->mutex));
+    return total;
+}
+
+// Marks seats as taken from the states and receipts written by
+// getSeatStates() and recounts numSold. receipts may be NULL, then
+// the seats cannot be refunded. Is thread safe.
+void setSeatStates(seatMap* seats, const unsigned char* states,
+    const unsigned long long* receipts)
+{
+    profiledLock(&(seats->resizeMutex));
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+
+    for (int y = 0; y < layout->rows; y++)
+    {
+        for (int x = 0; x < layout->cols; x++)
+        {
+            layout->seatArr[y][x].taken = (states[y * layout->cols + x] != 0);
+            layout->seatArr[y][x].receipt = (receipts != NULL && states[y * layout->cols + x]) ?
+                receipts[y * layout->cols + x] : 0;
+        }
+    }
+
+    _rebuildSeatTiers(layout);
+    layout->numSold = (layout->seatSold != NULL) ?
+        seatScan.countSold(layout->seatSold, layout->rows * layout->cols) : 0;
+    _bumpSeatVersion(seats);
+
+    profiledUnlock(&(seats->mutex));
+    profiledUnlock(&(seats->resizeMutex));
+}
+
+// Counts the unsold seats in the rectangle of numRows by numCols seats
+// whose top left seat is row, col, and stores the first one found,
+// row by row, in firstRow and firstCol, or -1 if there is none. A
+// numRows or numCols of -1 reaches the last row or column of the map.
+// Returns the count, or -1 if the rectangle is not inside the map.
+// Is thread safe.
+int countSeatsAvailableIn(seatMap* seats, int row, int col, int numRows, int numCols,
+    int* firstRow, int* firstCol)
+{
+    profiledLock(&(seats->mutex));
+    seatLayout* layout = seats->layout;
+
+    // Read under the lock, so the rest is of the layout counted
+    if (numRows == -1) numRows = (int)layout->rows - row;
+    if (numCols == -1) numCols = (int)layout->cols - col;
+
+    if (row < 0 || col < 0 || numRows < 1 || numCols < 1 ||
+        numRows > (int)layout->rows - row || numCols > (int)layout->cols - col ||
+        layout->seatSold == NULL)
+    {
+        profiledUnlock(&(seats->mutex));
+        return -1;
+    }
+
+    // Whole rows are contiguous, scan them in one pass
+    int cols = layout->cols;
+    int lineLength = numCols;
+    int numLines = numRows;
+    if (numCols == cols)
+    {
+        lineLength = numRows * cols;
+        numLines = 1;
+    }
+
+    int available = 0;
+    int first = -1;
+    for (int line = 0; line < numLines; line++)
+    {
+        const unsigned char* flags = layout->seatSold + (row + line) * cols + col;
+        int sold = seatScan.countSold(flags, lineLength);
+        if (sold == lineLength) continue;
+
+        available += lineLength - sold;
+        if (first < 0) first = (row + line) * cols + col + seatScan.findFree(flags, lineLength);
+    }
+
+    *firstRow = (first < 0) ? -1 : first / cols;
+    *firstCol = (first < 0) ? -1 : first % cols;
+
+    profiledUnlock(&(seats->mutex));
+    return available;
+}
+
+// Returns a snapshot of the sold flags no older than the last change
+// seen by this thread, and enters an epoch that keeps it valid until
+// releaseSeatSnapshot() is called with token. A snapshot that is out
+// of date is replaced with a copy made under the lock. Returns NULL,
+// with nothing to release, if out of memory before any snapshot
+// exists. Is thread safe.
+const seatSnapshot* acquireSeatSnapshot(seatMap* seats, int* token)
+{
+    *token = enterEpoch(&(seats->snapshotEpochs));
+
+    seatSnapshot* current = __atomic_load_n(&(seats->snapshot), __ATOMIC_ACQUIRE);
+    if (current != NULL && current->version == __atomic_load_n(&(seats->version), __ATOMIC_ACQUIRE))
+        return current;
+
+    // Allocated without the lock, again if a resize changes the size
+    seatSnapshot* next = NULL;
+    int capacity = 0;
+    seatSnapshot* old = NULL;
+
+    profiledLock(&(seats->mutex));
+    for (;;)
+    {
+        current = seats->snapshot;
+        if (current != NULL && current->version == seats->version) break;
+
+        seatLayout* layout = seats->layout;
+        int total = layout->rows * layout->cols;
+        if (layout->seatSold == NULL) break;
+        if (next != NULL && total <= capacity)
+        {
+            next->version = seats->version;
+            next->rows = layout->rows;
+            next->cols = layout->cols;
+            next->numSold = layout->numSold;
+            memcpy(next->seatSold, layout->seatSold, total);
+
+            old = current;
+            __atomic_store_n(&(seats->snapshot), next, __ATOMIC_RELEASE);
+            current = next;
+            next = NULL;
+            break;
+        }
+
+        profiledUnlock(&(seats->mutex));
+        free(next);
+        capacity = total;
+        next = malloc(sizeof(seatSnapshot) + capacity);
+        profiledLock(&(seats->mutex));
+
+        // Fall back on the out of date snapshot
+        if (next == NULL) break;
+    }
+    profiledUnlock(&(seats->mutex));
+
+    free(next);
+    if (old != NULL) retireEpochObject(&(seats->snapshotEpochs), &(old->node));
+
+    if (current == NULL) leaveEpoch(&(seats->snapshotEpochs), *token);
+    return current;
+}
+
+// Ends the use of a snapshot from acquireSeatSnapshot()
+void releaseSeatSnapshot(seatMap* seats, int token)
+{
+    leaveEpoch(&(seats->snapshotEpochs), token);
+}
+
+// Returns 1 if the given seat was sold when the snapshot was taken,
+// 0 if not, or -1 if the row or col is invalid
+int snapshotSeatSold(const seatSnapshot* snapshot, int row, int col)
+{
+    if (row < 0 || row >= snapshot->rows || col < 0 || col >= snapshot->cols)
+        return -1;
+
+    return snapshot->seatSold[row * snapshot->cols + col];
+}
+
+// Prints the grid of seats to the terminal from a snapshot,
+// so buyers are not held up while it prints. Is thread safe.
+void printSeatMap(seatMap* seats)
+{
+    int token;
+    const seatSnapshot* snapshot = acquireSeatSnapshot(seats, &token);
+    if (snapshot == NULL) return;
+
     lockPrintMutex();
 
     printf("\n====== Seats Sold =======\n");
     printf("-------------------------\n");
     printf("   | ");
 
-    for (int x = 0; x < seats->cols; x++)
+    for (int x = 0; x < snapshot->cols; x++)
         printf("%2d ", x);
 
     printf("\n---|--");
 
-    for (int x = 0; x < seats->cols; x++)
+    for (int x = 0; x < snapshot->cols; x++)
         printf("---");
 
     printf("\n");
 
-    for (int y = 0; y < seats->rows; y++)
+    for (int y = 0; y < snapshot->rows; y++)
     {
         printf("%2d | ", y);
-        for (int x = 0; x < seats->cols; x++)
+        for (int x = 0; x < snapshot->cols; x++)
         {
-            printf("%2d ", seats->seatArr[y][x].taken);
+            printf("%2d ", snapshot->seatSold[y * snapshot->cols + x]);
         }
         printf("|\n");
     }
     
     printf("\n~~~~~~");
 
-    for (int x = 0; x < seats->cols; x++)
+    for (int x = 0; x < snapshot->cols; x++)
         printf("~~~");
 
     printf("\n\n");
 
     unlockPrintMutex();
-    pthread_mutex_unlock(&(seats->mutex));
+    releaseSeatSnapshot(seats, token);
 }
 
 #endif
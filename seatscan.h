@@ -0,0 +1,170 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Scan kernels over an array of seat flags, one
+// byte per seat that is 1 if sold and 0 if not.
+// Counting sold seats and finding the first free
+// one take 16 or 32 seats per instruction with
+// SSE2 or AVX2, and 8 per step with plain 64 bit
+// arithmetic elsewhere. initSeatScan() picks the
+// widest version the CPU supports at runtime, so
+// one binary runs everywhere.
+// ==============================
+
+#ifndef SEATSCAN_H
+#define SEATSCAN_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SEAT_SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define SEAT_FLAGS_ONES 0x0101010101010101ULL // A 1 in every byte of a word
+
+typedef struct seatScanKernels_
+{
+    const char* name;
+    int (*countSold)(const unsigned char* flags, int length); // Seats set to 1
+    int (*findFree)(const unsigned char* flags, int length);  // First 0, or -1
+} seatScanKernels;
+
+// Counts the 1s eight flags at a time. Multiplying by a 1 in every
+// byte sums the bytes into the top one, which cannot overflow as
+// every byte is 0 or 1.
+int _countSoldScalar(const unsigned char* flags, int length)
+{
+    int count = 0;
+    int i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, flags + i, sizeof(word));
+        count += (int)((word * SEAT_FLAGS_ONES) >> 56);
+    }
+    for (; i < length; i++)
+        count += flags[i];
+    return count;
+}
+
+// Skips eight sold flags at a time, then finds the free one
+int _findFreeScalar(const unsigned char* flags, int length)
+{
+    int i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, flags + i, sizeof(word));
+        if (word != SEAT_FLAGS_ONES) break;
+    }
+    for (; i < length; i++)
+        if (flags[i] == 0) return i;
+    return -1;
+}
+
+#ifdef SEAT_SCAN_X86
+
+// psadbw sums each group of 8 bytes into a 64 bit lane
+__attribute__((target("sse2")))
+int _countSoldSse2(const unsigned char* flags, int length)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i sums = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(flags + i));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(chunk, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, sums);
+    return (int)(lanes[0] + lanes[1]) + _countSoldScalar(flags + i, length - i);
+}
+
+__attribute__((target("sse2")))
+int _findFreeSse2(const unsigned char* flags, int length)
+{
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(flags + i));
+        int freeMask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+        if (freeMask) return i + __builtin_ctz(freeMask);
+    }
+
+    int rest = _findFreeScalar(flags + i, length - i);
+    return (rest < 0) ? -1 : i + rest;
+}
+
+__attribute__((target("avx2")))
+int _countSoldAvx2(const unsigned char* flags, int length)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i sums = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(flags + i));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(chunk, zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, sums);
+    return (int)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + _countSoldSse2(flags + i, length - i);
+}
+
+__attribute__((target("avx2")))
+int _findFreeAvx2(const unsigned char* flags, int length)
+{
+    __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(flags + i));
+        unsigned int freeMask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+        if (freeMask) return i + __builtin_ctz(freeMask);
+    }
+
+    int rest = _findFreeSse2(flags + i, length - i);
+    return (rest < 0) ? -1 : i + rest;
+}
+
+#endif
+
+// The kernels in use, the scalar ones until initSeatScan() runs
+seatScanKernels seatScan = { "scalar", _countSoldScalar, _findFreeScalar };
+
+// Picks the widest kernels this CPU supports. Call once at startup,
+// before other threads scan. Returns the name of the kernels chosen.
+const char* initSeatScan()
+{
+#ifdef SEAT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        seatScan.name = "AVX2";
+        seatScan.countSold = _countSoldAvx2;
+        seatScan.findFree = _findFreeAvx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        seatScan.name = "SSE2";
+        seatScan.countSold = _countSoldSse2;
+        seatScan.findFree = _findFreeSse2;
+    }
+#endif
+
+    return seatScan.name;
+}
+
+#endif
@@ -0,0 +1,318 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Shared memory transport for clients on the same
+// machine. A memfd holds two single producer, single
+// consumer byte rings, one per direction. Each side
+// owns an eventfd the other side writes to, but only
+// after the owner said it is going to sleep, so a
+// busy connection moves messages without system calls.
+// ==============================
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#define SHM_RING_SIZE (64 * 1024) // Bytes per direction, must be a power of 2
+#define SHM_MAGIC 0x54534852      // "TSHR", checked when attaching
+#define SHM_NUM_FDS 3             // memfd, then the client's and the server's eventfd
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+// One direction of the channel. Positions only grow and wrap
+// at 2^32, the producer and consumer fields are kept on
+// separate cache lines.
+typedef struct shmRing_
+{
+    uint32_t head;            // Consumer position
+    uint32_t consumerWaiting; // Consumer is about to sleep on its eventfd
+    char pad1[56];
+    uint32_t tail;            // Producer position
+    uint32_t producerWaiting; // Producer has bytes the ring had no room for
+    char pad2[56];
+    char data[SHM_RING_SIZE];
+} shmRing;
+
+// Layout of the shared memory segment
+typedef struct shmChannel_
+{
+    uint32_t magic;
+    uint32_t ringSize;
+    char pad[56];
+    shmRing requests;  // Client to server
+    shmRing responses; // Server to client
+} shmChannel;
+
+// One side's view of a channel
+typedef struct shmEndpoint_
+{
+    shmChannel* channel;
+    int memFd;
+    int wakeFd;     // Readable when the peer wrote to us or made room
+    int peerWakeFd; // Written to wake the peer
+} shmEndpoint;
+
+// Wakes the side that sleeps on fd
+void shmWake(int fd)
+{
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0) { } // Counter full means a wake is pending
+}
+
+// Clears a wake up so the eventfd stops being readable
+void shmDrainWake(int fd)
+{
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0) { }
+}
+
+// Copies up to length bytes into the ring and wakes the consumer
+// if it is sleeping. Only one thread may write to a ring at a time.
+// Returns the number of bytes copied, 0 if the ring is full, or -1 if
+// the peer corrupted the ring's positions.
+int shmRingWrite(shmRing* ring, const char* data, int length, int peerWakeFd)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+    if (tail - head > SHM_RING_SIZE) return -1;
+
+    uint32_t space = SHM_RING_SIZE - (tail - head);
+    int count = (length < space) ? length : (int)space;
+    if (count <= 0) return 0;
+
+    uint32_t start = tail & (SHM_RING_SIZE - 1);
+    int first = (count < SHM_RING_SIZE - start) ? count : (int)(SHM_RING_SIZE - start);
+    memcpy(ring->data + start, data, first);
+    memcpy(ring->data, data + first, count - first);
+
+    __atomic_store_n(&(ring->tail), tail + count, __ATOMIC_RELEASE);
+
+    // Pairs with the fence in shmRingPrepareWait(), either the
+    // consumer sees the new tail or we see its waiting flag
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(ring->consumerWaiting), __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&(ring->consumerWaiting), 0, __ATOMIC_ACQ_REL))
+        shmWake(peerWakeFd);
+
+    return count;
+}
+
+// Copies up to maxLength bytes out of the ring and wakes the producer
+// if it is waiting for room. Only one thread may read from a ring at a
+// time. Returns the number of bytes copied, 0 if the ring is empty, or
+// -1 if the peer corrupted the ring's positions.
+int shmRingRead(shmRing* ring, char* data, int maxLength, int peerWakeFd)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE);
+    uint32_t avail = tail - head;
+    if (avail > SHM_RING_SIZE) return -1;
+
+    int count = (maxLength < avail) ? maxLength : (int)avail;
+    if (count <= 0) return 0;
+
+    uint32_t start = head & (SHM_RING_SIZE - 1);
+    int first = (count < SHM_RING_SIZE - start) ? count : (int)(SHM_RING_SIZE - start);
+    memcpy(data, ring->data + start, first);
+    memcpy(data + first, ring->data, count - first);
+
+    __atomic_store_n(&(ring->head), head + count, __ATOMIC_RELEASE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(ring->producerWaiting), __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&(ring->producerWaiting), 0, __ATOMIC_ACQ_REL))
+        shmWake(peerWakeFd);
+
+    return count;
+}
+
+// Returns 1 if the ring holds bytes to read
+int shmRingReadable(shmRing* ring)
+{
+    return __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) != ring->head;
+}
+
+// Polls the ring for up to spinUs microseconds before the consumer goes
+// to sleep, which saves the wake up system calls when the peer answers
+// quickly. Skipped on a single CPU, where the peer cannot run while we
+// spin. Returns 1 if bytes arrived.
+int shmRingSpin(shmRing* ring, unsigned int spinUs)
+{
+    static int numCpus = 0;
+    if (numCpus == 0) numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (spinUs == 0 || numCpus < 2) return shmRingReadable(ring);
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            if (shmRingReadable(ring)) return 1;
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000LL + (now.tv_nsec - start.tv_nsec) / 1000 < spinUs);
+
+    return 0;
+}
+
+// Called by the consumer before it sleeps on its eventfd. Returns 0 if
+// it may sleep, the producer will wake it. Returns 1 if bytes arrived
+// in the meantime and it should read them instead.
+int shmRingPrepareWait(shmRing* ring)
+{
+    __atomic_store_n(&(ring->consumerWaiting), 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) != ring->head)
+    {
+        __atomic_store_n(&(ring->consumerWaiting), 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Called by the producer when the ring had no room for everything.
+// Returns 0 if the consumer will wake it once it reads, or 1 if room
+// appeared in the meantime and it should write again.
+int shmRingWaitForRoom(shmRing* ring)
+{
+    __atomic_store_n(&(ring->producerWaiting), 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint32_t head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+    if (ring->tail - head < SHM_RING_SIZE)
+    {
+        __atomic_store_n(&(ring->producerWaiting), 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Maps a channel received from the other side. Returns 0 on success,
+// the endpoint then owns the three file descriptors.
+int shmAttach(shmEndpoint* endpoint, int memFd, int wakeFd, int peerWakeFd)
+{
+    struct stat info;
+    if (fstat(memFd, &info) < 0 || info.st_size < (off_t)sizeof(shmChannel)) return 1;
+
+    shmChannel* channel = mmap(NULL, sizeof(shmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+    if (channel == MAP_FAILED) return 1;
+
+    if (channel->magic != SHM_MAGIC || channel->ringSize != SHM_RING_SIZE)
+    {
+        munmap(channel, sizeof(shmChannel));
+        return 1;
+    }
+
+    endpoint->channel = channel;
+    endpoint->memFd = memFd;
+    endpoint->wakeFd = wakeFd;
+    endpoint->peerWakeFd = peerWakeFd;
+    fcntl(wakeFd, F_SETFL, fcntl(wakeFd, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+// Creates a new channel and the server's end of it. The client's
+// eventfd is stored in *clientWakeFd. Returns 0 on success.
+int shmCreate(shmEndpoint* endpoint, int* clientWakeFd)
+{
+    int memFd = syscall(__NR_memfd_create, "ticketshm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memFd < 0) return 1;
+
+    int serverWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    *clientWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    shmChannel* channel = MAP_FAILED;
+    if (serverWakeFd >= 0 && *clientWakeFd >= 0 && ftruncate(memFd, sizeof(shmChannel)) == 0)
+        channel = mmap(NULL, sizeof(shmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+
+    if (channel == MAP_FAILED)
+    {
+        close(memFd);
+        if (serverWakeFd >= 0) close(serverWakeFd);
+        if (*clientWakeFd >= 0) close(*clientWakeFd);
+        return 1;
+    }
+
+#ifdef F_ADD_SEALS
+    // The client must not be able to shrink the segment under us
+    fcntl(memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+
+    channel->magic = SHM_MAGIC;
+    channel->ringSize = SHM_RING_SIZE;
+
+    endpoint->channel = channel;
+    endpoint->memFd = memFd;
+    endpoint->wakeFd = serverWakeFd;
+    endpoint->peerWakeFd = *clientWakeFd;
+    return 0;
+}
+
+// Unmaps the channel and closes its file descriptors
+void shmClose(shmEndpoint* endpoint)
+{
+    if (endpoint->channel == NULL) return;
+
+    munmap(endpoint->channel, sizeof(shmChannel));
+    close(endpoint->memFd);
+    close(endpoint->wakeFd);
+    close(endpoint->peerWakeFd);
+    endpoint->channel = NULL;
+}
+
+// Sends length bytes together with numFds file descriptors over a unix
+// socket without blocking. Returns 0 if everything was sent.
+int shmSendFds(int sock, const char* data, int length, const int* fds, int numFds)
+{
+    char control[CMSG_SPACE(sizeof(int) * SHM_NUM_FDS)];
+    struct iovec iov = { (void*)data, length };
+    struct msghdr msg;
+
+    if (numFds > SHM_NUM_FDS) return 1;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * numFds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * numFds);
+
+    return sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != length;
+}
+
+#endif
@@ -0,0 +1,251 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Work stealing task queues for a fixed set of
+// worker threads. A task is an int, such as a
+// client slot. Each worker has its own deque: it
+// pushes and pops at the back, so the task it ran
+// last runs next while its data is still cached,
+// and other workers steal from the front. Each
+// deque has its own mutex and cache line, so
+// workers only meet when one steals.
+//
+// Workers with nothing to run or steal take turns
+// waiting for new tasks: one of them polls while
+// the rest sleep, and a poll that finds tasks
+// wakes sleepers to steal them and to poll next.
+// ==============================
+
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct taskDeque_
+{
+    pthread_mutex_t mutex;
+    int* tasks;  // Ring of capacity tasks
+    int head;    // Front, where thieves take from
+    int count;
+    unsigned long ran;    // Tasks this deque's worker ran
+    unsigned long stolen; // Of those, taken from another deque
+} __attribute__((aligned(64))) taskDeque;
+
+typedef struct taskPool_
+{
+    taskDeque* deques;
+    int numWorkers;
+    int capacity;        // Tasks a deque can hold
+    pthread_mutex_t idleMutex;
+    pthread_cond_t idleCond;
+    int numIdle;         // Workers sleeping on idleCond
+    int polling;         // A worker is waiting for new tasks
+    int stopping;
+} taskPool;
+
+// Sets up numWorkers deques of capacity tasks each. A deque must be
+// able to hold every task that can exist at once. Returns 0 on success.
+int initTaskPool(taskPool* pool, int numWorkers, int capacity)
+{
+    pool->numWorkers = numWorkers;
+    pool->capacity = capacity;
+    pool->numIdle = 0;
+    pool->polling = 0;
+    pool->stopping = 0;
+    pthread_mutex_init(&(pool->idleMutex), NULL);
+    pthread_cond_init(&(pool->idleCond), NULL);
+
+    pool->deques = aligned_alloc(64, sizeof(taskDeque) * numWorkers);
+    if (pool->deques == NULL) return 1;
+
+    for (int w = 0; w < numWorkers; w++)
+    {
+        taskDeque* deque = &(pool->deques[w]);
+        pthread_mutex_init(&(deque->mutex), NULL);
+        deque->head = 0;
+        deque->count = 0;
+        deque->ran = 0;
+        deque->stolen = 0;
+        deque->tasks = malloc(sizeof(int) * capacity);
+        if (deque->tasks == NULL) return 1;
+    }
+
+    return 0;
+}
+
+// Adds a task at the back of worker's deque. Returns the number of
+// tasks now in it, or 0 if it is full.
+int pushTask(taskPool* pool, int worker, int task)
+{
+    taskDeque* deque = &(pool->deques[worker]);
+    pthread_mutex_lock(&(deque->mutex));
+
+    int count = 0;
+    if (deque->count < pool->capacity)
+    {
+        deque->tasks[(deque->head + deque->count) % pool->capacity] = task;
+        count = ++deque->count;
+    }
+
+    pthread_mutex_unlock(&(deque->mutex));
+    return count;
+}
+
+// Puts a task that gave up its turn at the front of worker's deque,
+// so the worker's other tasks run first and thieves take it first.
+// Returns the number of tasks now in the deque, or 0 if it is full.
+int yieldTask(taskPool* pool, int worker, int task)
+{
+    taskDeque* deque = &(pool->deques[worker]);
+    pthread_mutex_lock(&(deque->mutex));
+
+    int count = 0;
+    if (deque->count < pool->capacity)
+    {
+        deque->head = (deque->head + pool->capacity - 1) % pool->capacity;
+        deque->tasks[deque->head] = task;
+        count = ++deque->count;
+    }
+
+    pthread_mutex_unlock(&(deque->mutex));
+    return count;
+}
+
+// Takes the task at the back of worker's own deque or, failing that,
+// the front of another worker's. Returns 1 if a task was found.
+int takeTask(taskPool* pool, int worker, int* task)
+{
+    taskDeque* own = &(pool->deques[worker]);
+    pthread_mutex_lock(&(own->mutex));
+    int found = (own->count > 0);
+    if (found)
+    {
+        *task = own->tasks[(own->head + --own->count) % pool->capacity];
+        own->ran++;
+    }
+    pthread_mutex_unlock(&(own->mutex));
+    if (found) return 1;
+
+    // Start with the next worker, so thieves spread over the victims
+    for (int i = 1; i < pool->numWorkers; i++)
+    {
+        taskDeque* victim = &(pool->deques[(worker + i) % pool->numWorkers]);
+        if (__atomic_load_n(&(victim->count), __ATOMIC_RELAXED) == 0) continue;
+
+        pthread_mutex_lock(&(victim->mutex));
+        found = (victim->count > 0);
+        if (found)
+        {
+            *task = victim->tasks[victim->head];
+            victim->head = (victim->head + 1) % pool->capacity;
+            victim->count--;
+        }
+        pthread_mutex_unlock(&(victim->mutex));
+
+        if (found)
+        {
+            pthread_mutex_lock(&(own->mutex));
+            own->ran++;
+            own->stolen++;
+            pthread_mutex_unlock(&(own->mutex));
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Called by a worker that found no task. Returns 1 if the caller
+// should now poll for new tasks and then call endTaskPoll(), 0 once
+// it was woken from sleep, or -1 if the pool is stopping.
+int waitForTasks(taskPool* pool)
+{
+    pthread_mutex_lock(&(pool->idleMutex));
+
+    int result = -1;
+    if (!pool->stopping && !pool->polling)
+    {
+        pool->polling = 1;
+        result = 1;
+    }
+    else if (!pool->stopping)
+    {
+        pool->numIdle++;
+        pthread_cond_wait(&(pool->idleCond), &(pool->idleMutex));
+        pool->numIdle--;
+        result = 0;
+    }
+
+    pthread_mutex_unlock(&(pool->idleMutex));
+    return result;
+}
+
+// Ends a poll that queued numFound tasks. Wakes up to that many
+// sleeping workers to steal them, one of which polls next.
+void endTaskPoll(taskPool* pool, int numFound)
+{
+    pthread_mutex_lock(&(pool->idleMutex));
+
+    pool->polling = 0;
+    for (int i = 0; i < numFound && i < pool->numIdle; i++)
+        pthread_cond_signal(&(pool->idleCond));
+
+    pthread_mutex_unlock(&(pool->idleMutex));
+}
+
+// Wakes one sleeping worker, if any, to steal a task just pushed
+void wakeIdleWorker(taskPool* pool)
+{
+    if (__atomic_load_n(&(pool->numIdle), __ATOMIC_RELAXED) == 0) return;
+
+    pthread_mutex_lock(&(pool->idleMutex));
+    pthread_cond_signal(&(pool->idleCond));
+    pthread_mutex_unlock(&(pool->idleMutex));
+}
+
+// Makes waitForTasks() return -1 from now on and wakes every sleeping
+// worker. The poller must be woken by the caller.
+void stopTaskPool(taskPool* pool)
+{
+    pthread_mutex_lock(&(pool->idleMutex));
+    pool->stopping = 1;
+    pthread_cond_broadcast(&(pool->idleCond));
+    pthread_mutex_unlock(&(pool->idleMutex));
+}
+
+// Returns the tasks run by every worker, and how many were stolen
+unsigned long taskPoolRan(taskPool* pool, unsigned long* stolen)
+{
+    unsigned long ran = 0;
+    *stolen = 0;
+    for (int w = 0; w < pool->numWorkers; w++)
+    {
+        pthread_mutex_lock(&(pool->deques[w].mutex));
+        ran += pool->deques[w].ran;
+        *stolen += pool->deques[w].stolen;
+        pthread_mutex_unlock(&(pool->deques[w].mutex));
+    }
+    return ran;
+}
+
+// Frees every deque, the workers must have stopped
+void freeTaskPool(taskPool* pool)
+{
+    for (int w = 0; w < pool->numWorkers; w++)
+    {
+        free(pool->deques[w].tasks);
+        pthread_mutex_destroy(&(pool->deques[w].mutex));
+    }
+    free(pool->deques);
+    pool->deques = NULL;
+    pool->numWorkers = 0;
+}
+
+#endif
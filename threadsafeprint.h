@@ -10,6 +10,10 @@
 // Provides thread safe wrapper functions
 // for printf(). Ensures multiple threads
 // can print to the terminal without issues.
+// printWarning() logs at LOG_LEVEL_WARN,
+// printFromHost() and printFromClient() at
+// LOG_LEVEL_INFO, printFromThread() at
+// LOG_LEVEL_DEBUG. safePrint() always prints.
 // ==============================
 
 #ifndef THEADSAFEPRINT_H
@@ -18,12 +22,37 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <string.h>
+#include "lockprofile.h"
+
+// Log levels, messages above the current level are dropped
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
 
 pthread_mutex_t _printLock;
+volatile int _logLevel = LOG_LEVEL_DEBUG;
+
+// Changes the log level, safe to call while other threads print
+void setLogLevel(int level)
+{
+    _logLevel = level;
+}
+
+// Returns the log level for a name such as "info", or -1 if unknown
+int parseLogLevel(const char* name)
+{
+    if (strcmp(name, "error") == 0) return LOG_LEVEL_ERROR;
+    if (strcmp(name, "warn") == 0) return LOG_LEVEL_WARN;
+    if (strcmp(name, "info") == 0) return LOG_LEVEL_INFO;
+    if (strcmp(name, "debug") == 0) return LOG_LEVEL_DEBUG;
+    return -1;
+}
 
 void safePrint(char* msg, ...)
 {
-    pthread_mutex_lock(&_printLock);
+    profiledLock(&_printLock);
 
     va_list vargs;
     va_start(vargs, msg);
@@ -31,12 +60,12 @@ void safePrint(char* msg, ...)
     va_end(vargs);
     fflush(stdout);
 
-    pthread_mutex_unlock(&_printLock);
+    profiledUnlock(&_printLock);
 }
 
 void safePrintLine(char* msg, ...)
 {
-    pthread_mutex_lock(&_printLock);
+    profiledLock(&_printLock);
 
     va_list vargs;
     va_start(vargs, msg);
@@ -47,12 +76,14 @@ void safePrintLine(char* msg, ...)
     va_end(vargs);
     fflush(stdout);
 
-    pthread_mutex_unlock(&_printLock);
+    profiledUnlock(&_printLock);
 }
 
 void printFromHost(char* msg, ...)
 {
-    pthread_mutex_lock(&_printLock);
+    if (_logLevel < LOG_LEVEL_INFO) return;
+
+    profiledLock(&_printLock);
 
     printf("[ Host ] ");
 
@@ -65,12 +96,34 @@ void printFromHost(char* msg, ...)
     va_end(vargs);
     fflush(stdout);
 
-    pthread_mutex_unlock(&_printLock);
+    profiledUnlock(&_printLock);
+}
+
+void printWarning(char* msg, ...)
+{
+    if (_logLevel < LOG_LEVEL_WARN) return;
+
+    profiledLock(&_printLock);
+
+    printf("[ Warning ] ");
+
+    va_list vargs;
+    va_start(vargs, msg);
+    vprintf(msg, vargs);
+
+    printf("\n");
+
+    va_end(vargs);
+    fflush(stdout);
+
+    profiledUnlock(&_printLock);
 }
 
 void printFromThread(pthread_t id, char* msg, ...)
 {
-    pthread_mutex_lock(&_printLock);
+    if (_logLevel < LOG_LEVEL_DEBUG) return;
+
+    profiledLock(&_printLock);
 
     printf("[0x%lx] ", id);
 
@@ -83,12 +136,14 @@ void printFromThread(pthread_t id, char* msg, ...)
     va_end(vargs);
     fflush(stdout);
 
-    pthread_mutex_unlock(&_printLock);
+    profiledUnlock(&_printLock);
 }
 
 void printFromClient(int clientId, char* msg, ...)
 {
-    pthread_mutex_lock(&_printLock);
+    if (_logLevel < LOG_LEVEL_INFO) return;
+
+    profiledLock(&_printLock);
 
     printf("[ Client #%d ] ", clientId);
 
@@ -101,18 +156,18 @@ void printFromClient(int clientId, char* msg, ...)
     va_end(vargs);
     fflush(stdout);
 
-    pthread_mutex_unlock(&_printLock);
+    profiledUnlock(&_printLock);
 }
 
 void lockPrintMutex()
 {
-    pthread_mutex_lock(&_printLock);
+    profiledLock(&_printLock);
 }
 
 void unlockPrintMutex()
 {
     fflush(stdout);
-    pthread_mutex_unlock(&_printLock);
+    profiledUnlock(&_printLock);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,904 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the client side
+// ==============================
+// Asynchronous ticket server client library.
+// A ticketClient runs one network thread that
+// services any number of sessions (server
+// connections) with non-blocking sockets.
+// Every request is tagged with an id that the
+// server echoes back, so each response is handed
+// to the callback or future that is waiting for it.
+// Sessions on a unix socket can move onto a shared
+// memory channel with ticketUseSharedMemory().
+// ==============================
+
+#ifndef TICKETCLIENT_H
+#define TICKETCLIENT_H
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "networkmsg.h"
+#include "msgparser.h"
+#include "shmring.h"
+
+#define TICKET_MSG_BUFFER_SIZE 1024 // Max size of a single message
+#define TICKET_MAX_PENDING 64       // Max in flight requests per session
+#define TICKET_MAX_SESSIONS 256     // Max sessions per client
+#define TICKET_SHM_SPIN_US 20       // Time the network thread polls shared memory before sleeping
+
+// ticketFutureWait() results
+#define TICKET_WAIT_OK 0
+#define TICKET_WAIT_CLOSED 1  // Session closed before the response arrived
+#define TICKET_WAIT_TIMEOUT 2
+
+typedef struct ticketSession_ ticketSession;
+typedef struct ticketClient_ ticketClient;
+
+// A message received from the server. text is only valid
+// for the duration of the callback.
+typedef struct ticketResponse_
+{
+    netMsg msg;
+    const char* text;
+    int length;
+} ticketResponse;
+
+// Called on the network thread with the response to a request.
+// response is NULL if the session closed before it arrived.
+// For the push callback, NULL means the session has closed.
+typedef void (*ticketCallback)(ticketSession* session, const ticketResponse* response, void* userData);
+
+// A request waiting for its response
+typedef struct ticketPending_
+{
+    int inUse;
+    int tag;
+    ticketCallback callback;
+    void* userData;
+} ticketPending;
+
+struct ticketSession_
+{
+    ticketClient* client;
+    int socket;
+    int connected;
+    int released; // Freed by the network thread once closed
+
+    int nextTag;
+    ticketPending pending[TICKET_MAX_PENDING];
+
+    // Receives messages that are not a reply to a request,
+    // such as SERVER_DISCONNECT
+    ticketCallback pushCallback;
+    void* pushUserData;
+
+    // Only touched by the network thread
+    char recvBuffer[TICKET_MSG_BUFFER_SIZE];
+    int recvLen;
+
+    // Bytes waiting to be written, protected by mutex
+    char* sendBuffer;
+    int sendLen;
+    int sendCapacity;
+
+    // Shared memory channel, set by the network thread once the server
+    // moved us onto it. Requests are written under mutex.
+    shmEndpoint shm;
+    int shmRequested;            // Expecting file descriptors with a reply
+    int passedFds[SHM_NUM_FDS];  // Received with the reply, -1 if none
+    int numPassedFds;
+
+    pthread_mutex_t mutex;
+};
+
+struct ticketClient_
+{
+    ticketSession* sessions[TICKET_MAX_SESSIONS];
+    int numSessions;
+    int running;
+    int wakePipe[2];
+    pthread_t thread;
+    pthread_mutex_t mutex; // Protects the session list
+};
+
+// A response that a caller can block on
+typedef struct ticketFuture_
+{
+    ticketSession* session;
+    int tag;
+    int done;
+    int closed;
+    char text[TICKET_MSG_BUFFER_SIZE];
+    netMsg msg; // Parsed response, valid once done
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} ticketFuture;
+
+// Wakes the network thread so it notices new sessions or queued data
+void _ticketWake(ticketClient* client)
+{
+    if (write(client->wakePipe[1], "x", 1) < 0) { } // Pipe full means a wake is pending
+}
+
+// Fails every pending request on a session that has closed.
+// Called on the network thread.
+void _ticketFailPending(ticketSession* session)
+{
+    for (int i = 0; i < TICKET_MAX_PENDING; i++)
+    {
+        pthread_mutex_lock(&(session->mutex));
+        ticketPending pending = session->pending[i];
+        session->pending[i].inUse = 0;
+        pthread_mutex_unlock(&(session->mutex));
+
+        if (pending.inUse) pending.callback(session, NULL, pending.userData);
+    }
+}
+
+// Marks a session closed and notifies everyone waiting on it
+void _ticketCloseSession(ticketSession* session)
+{
+    pthread_mutex_lock(&(session->mutex));
+    int wasConnected = session->connected;
+    session->connected = 0;
+    pthread_mutex_unlock(&(session->mutex));
+
+    if (!wasConnected) return;
+
+    close(session->socket);
+    shmClose(&(session->shm));
+    for (int i = 0; i < session->numPassedFds; i++)
+        close(session->passedFds[i]);
+    session->numPassedFds = 0;
+
+    _ticketFailPending(session);
+    if (session->pushCallback) session->pushCallback(session, NULL, session->pushUserData);
+}
+
+// Hands one complete message to its request's callback,
+// or to the push callback if it is not a reply
+void _ticketDeliver(ticketSession* session, const char* text, int length)
+{
+    ticketResponse response;
+    response.text = text;
+    response.length = length;
+    if (parseNetMsg(text, length, &(response.msg)) != MSG_PARSE_OK) return;
+
+    // The server only uses the channel after this reply, so it must be
+    // in place before the next read. Without it the session is useless.
+    if (response.msg.id == SERVER_SHM_READY)
+    {
+        shmEndpoint shm;
+        int* fds = session->passedFds;
+        int attached = (session->numPassedFds == SHM_NUM_FDS && shmAttach(&shm, fds[0], fds[1], fds[2]) == 0);
+
+        pthread_mutex_lock(&(session->mutex));
+        if (attached)
+            session->shm = shm;
+        else
+            shutdown(session->socket, SHUT_RDWR);
+        pthread_mutex_unlock(&(session->mutex));
+
+        for (int i = 0; i < session->numPassedFds && !attached; i++)
+            close(fds[i]);
+        session->numPassedFds = 0;
+    }
+
+    ticketCallback callback = session->pushCallback;
+    void* userData = session->pushUserData;
+
+    if (response.msg.hasTag)
+    {
+        pthread_mutex_lock(&(session->mutex));
+
+        // A negative tag is never ours and must not index the table
+        ticketPending* pending = (response.msg.tag >= 0) ?
+            &(session->pending[response.msg.tag % TICKET_MAX_PENDING]) : NULL;
+        if (pending == NULL || !pending->inUse || pending->tag != response.msg.tag)
+        {
+            // Nobody is waiting for this reply any more
+            pthread_mutex_unlock(&(session->mutex));
+            return;
+        }
+
+        callback = pending->callback;
+        userData = pending->userData;
+        pending->inUse = 0;
+
+        pthread_mutex_unlock(&(session->mutex));
+    }
+
+    if (callback) callback(session, &response, userData);
+}
+
+// Delivers every complete message after bytesRead new bytes were added
+// to the receive buffer. Returns non-zero if the stream is broken.
+int _ticketReceived(ticketSession* session, int bytesRead)
+{
+    session->recvLen += bytesRead;
+
+    char* msgStart = session->recvBuffer;
+    char* msgEnd;
+    while ((msgEnd = memchr(msgStart, NETWORK_MSG_END[0],
+            session->recvLen - (msgStart - session->recvBuffer))) != NULL)
+    {
+        if (msgEnd > msgStart) _ticketDeliver(session, msgStart, msgEnd - msgStart);
+        msgStart = msgEnd + 1;
+    }
+
+    session->recvLen -= msgStart - session->recvBuffer;
+    memmove(session->recvBuffer, msgStart, session->recvLen);
+
+    // A message that can never fit means the stream is broken
+    return session->recvLen >= TICKET_MSG_BUFFER_SIZE;
+}
+
+// Reads from the socket, keeping any file descriptors sent along
+// while a shared memory channel has been requested
+int _ticketRecv(ticketSession* session, char* buffer, int length)
+{
+    if (!session->shmRequested) return read(session->socket, buffer, length);
+
+    char control[CMSG_SPACE(sizeof(int) * SHM_NUM_FDS)];
+    struct iovec iov = { buffer, length };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int bytesRead = recvmsg(session->socket, &msg, MSG_CMSG_CLOEXEC);
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); bytesRead > 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        int numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* fds = (int*)CMSG_DATA(cmsg);
+        for (int i = 0; i < numFds; i++)
+        {
+            if (i < SHM_NUM_FDS && session->numPassedFds == i) session->passedFds[session->numPassedFds++] = fds[i];
+            else close(fds[i]);
+        }
+    }
+
+    return bytesRead;
+}
+
+// Reads whatever the server sent and delivers complete messages
+void _ticketHandleReadable(ticketSession* session)
+{
+    for (;;)
+    {
+        int bytesRead = _ticketRecv(session, session->recvBuffer + session->recvLen,
+            TICKET_MSG_BUFFER_SIZE - session->recvLen);
+
+        if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead <= 0 || _ticketReceived(session, bytesRead))
+        {
+            _ticketCloseSession(session);
+            return;
+        }
+    }
+}
+
+// Writes queued requests into the shared memory channel. Whatever does
+// not fit waits until the server reads and wakes the network thread.
+// Caller holds the session lock. Returns non-zero if the channel broke.
+int _ticketFlushShm(ticketSession* session)
+{
+    shmRing* ring = &(session->shm.channel->requests);
+    int sent = 0;
+
+    do
+    {
+        int count = shmRingWrite(ring, session->sendBuffer + sent, session->sendLen - sent, session->shm.peerWakeFd);
+        if (count < 0) return 1;
+        sent += count;
+    } while (sent < session->sendLen && shmRingWaitForRoom(ring));
+
+    session->sendLen -= sent;
+    memmove(session->sendBuffer, session->sendBuffer + sent, session->sendLen);
+    return 0;
+}
+
+// Services a shared memory session: sends queued requests the channel
+// had no room for, then delivers every reply waiting in the channel.
+// woken is set if the server wrote to our eventfd.
+void _ticketHandleShm(ticketSession* session, int woken)
+{
+    if (woken) shmDrainWake(session->shm.wakeFd);
+
+    pthread_mutex_lock(&(session->mutex));
+    int broken = (session->sendLen > 0) && _ticketFlushShm(session);
+    pthread_mutex_unlock(&(session->mutex));
+
+    while (!broken)
+    {
+        int bytesRead = shmRingRead(&(session->shm.channel->responses), session->recvBuffer + session->recvLen,
+            TICKET_MSG_BUFFER_SIZE - session->recvLen, session->shm.peerWakeFd);
+        if (bytesRead == 0) return;
+
+        broken = (bytesRead < 0) || _ticketReceived(session, bytesRead);
+    }
+
+    _ticketCloseSession(session);
+}
+
+// Writes as much queued data as the socket accepts
+void _ticketHandleWritable(ticketSession* session)
+{
+    pthread_mutex_lock(&(session->mutex));
+
+    int sent = 0;
+    while (sent < session->sendLen)
+    {
+        ssize_t n = send(session->socket, session->sendBuffer + sent,
+            session->sendLen - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        sent += n;
+    }
+
+    session->sendLen -= sent;
+    memmove(session->sendBuffer, session->sendBuffer + sent, session->sendLen);
+
+    pthread_mutex_unlock(&(session->mutex));
+}
+
+// Frees a session's memory. Not thread safe.
+void _ticketFreeSession(ticketSession* session)
+{
+    pthread_mutex_destroy(&(session->mutex));
+    free(session->sendBuffer);
+    free(session);
+}
+
+// Network thread. Waits on every session socket at once.
+void* _runTicketClient(void* _client)
+{
+    ticketClient* client = (ticketClient*)_client;
+    struct pollfd pfds[TICKET_MAX_SESSIONS * 2 + 1];
+    ticketSession* polled[TICKET_MAX_SESSIONS];
+
+    while (client->running)
+    {
+        int numPolled = 0;
+        int waitMs = -1;
+
+        pthread_mutex_lock(&(client->mutex));
+
+        // Free released sessions that have finished closing
+        for (int i = 0; i < client->numSessions; i++)
+        {
+            ticketSession* session = client->sessions[i];
+            if (session->released && !session->connected)
+            {
+                client->sessions[i--] = client->sessions[--client->numSessions];
+                _ticketFreeSession(session);
+            }
+        }
+
+        pfds[0].fd = client->wakePipe[0];
+        pfds[0].events = POLLIN;
+        for (int i = 0; i < client->numSessions; i++)
+        {
+            ticketSession* session = client->sessions[i];
+
+            // Each session has a socket slot and, on shared memory, an
+            // eventfd slot. poll() skips the eventfd slot when it is -1.
+            pthread_mutex_lock(&(session->mutex));
+            if (session->connected)
+            {
+                int isShm = (session->shm.channel != NULL);
+                polled[numPolled] = session;
+                pfds[numPolled * 2 + 1].fd = session->socket;
+                pfds[numPolled * 2 + 1].events = POLLIN | (session->sendLen > 0 && !isShm ? POLLOUT : 0);
+                pfds[numPolled * 2 + 2].fd = isShm ? session->shm.wakeFd : -1;
+                pfds[numPolled * 2 + 2].events = POLLIN;
+                numPolled++;
+            }
+            pthread_mutex_unlock(&(session->mutex));
+        }
+
+        pthread_mutex_unlock(&(client->mutex));
+
+        // Only sleep once every shared memory session told the
+        // server it must wake us
+        for (int i = 0; i < numPolled; i++)
+        {
+            shmRing* responses = (pfds[i * 2 + 2].fd >= 0) ? &(polled[i]->shm.channel->responses) : NULL;
+            if (responses != NULL && waitMs != 0 &&
+                (shmRingSpin(responses, TICKET_SHM_SPIN_US) || shmRingPrepareWait(responses)))
+                waitMs = 0;
+        }
+
+        if (poll(pfds, numPolled * 2 + 1, waitMs) < 0) continue;
+
+        if (pfds[0].revents)
+        {
+            char drain[64];
+            while (read(client->wakePipe[0], drain, sizeof(drain)) > 0) { }
+        }
+
+        // Sessions are only freed on this thread, so the
+        // polled pointers stay valid without the client lock
+        for (int i = 0; i < numPolled; i++)
+        {
+            // Replies in the channel go before a close seen on the socket
+            if (pfds[i * 2 + 2].fd >= 0) _ticketHandleShm(polled[i], pfds[i * 2 + 2].revents != 0);
+            if (!polled[i]->connected) continue;
+
+            short revents = pfds[i * 2 + 1].revents;
+            if (revents & POLLOUT) _ticketHandleWritable(polled[i]);
+            if (revents & (POLLIN | POLLHUP | POLLERR)) _ticketHandleReadable(polled[i]);
+        }
+    }
+
+    return NULL;
+}
+
+// Creates a client and starts its network thread. Returns NULL on failure.
+ticketClient* ticketClientCreate()
+{
+    ticketClient* client = calloc(1, sizeof(ticketClient));
+    if (client == NULL) return NULL;
+
+    if (pipe(client->wakePipe) < 0)
+    {
+        free(client);
+        return NULL;
+    }
+
+    fcntl(client->wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(client->wakePipe[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&(client->mutex), NULL);
+    client->running = 1;
+
+    if (pthread_create(&(client->thread), NULL, _runTicketClient, client))
+    {
+        close(client->wakePipe[0]);
+        close(client->wakePipe[1]);
+        free(client);
+        return NULL;
+    }
+
+    return client;
+}
+
+// Closes every session, stops the network thread and frees the client
+void ticketClientDestroy(ticketClient* client)
+{
+    client->running = 0;
+    _ticketWake(client);
+    pthread_join(client->thread, NULL);
+
+    for (int i = 0; i < client->numSessions; i++)
+    {
+        _ticketCloseSession(client->sessions[i]);
+        _ticketFreeSession(client->sessions[i]);
+    }
+
+    close(client->wakePipe[0]);
+    close(client->wakePipe[1]);
+    pthread_mutex_destroy(&(client->mutex));
+    free(client);
+}
+
+// Connects a new session to the server at addr, retrying once a second
+// up to timeoutRetrys times. Shared by the TCP and unix socket versions.
+ticketSession* _ticketConnectAddr(ticketClient* client, const struct sockaddr* addr, socklen_t addrLen,
+    unsigned int timeoutRetrys, ticketCallback pushCallback, void* pushUserData)
+{
+    int sock = socket(addr->sa_family, SOCK_STREAM, 0);
+    if (sock < 0) return NULL;
+
+    int cResult = connect(sock, addr, addrLen);
+    while (timeoutRetrys > 0 && cResult < 0)
+    {
+        // Keep trying to connect until we run out of timeout retrys
+        sleep(1);
+        timeoutRetrys--;
+        cResult = connect(sock, addr, addrLen);
+    }
+
+    if (cResult < 0)
+    {
+        close(sock);
+        return NULL;
+    }
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    ticketSession* session = calloc(1, sizeof(ticketSession));
+    if (session == NULL)
+    {
+        close(sock);
+        return NULL;
+    }
+
+    session->client = client;
+    session->socket = sock;
+    session->connected = 1;
+    session->pushCallback = pushCallback;
+    session->pushUserData = pushUserData;
+    pthread_mutex_init(&(session->mutex), NULL);
+
+    pthread_mutex_lock(&(client->mutex));
+    if (client->numSessions >= TICKET_MAX_SESSIONS)
+    {
+        pthread_mutex_unlock(&(client->mutex));
+        close(sock);
+        _ticketFreeSession(session);
+        errno = EMFILE;
+        return NULL;
+    }
+    client->sessions[client->numSessions++] = session;
+    pthread_mutex_unlock(&(client->mutex));
+
+    _ticketWake(client);
+    return session;
+}
+
+// Connects a new session to the server, retrying once a second up to
+// timeoutRetrys times. pushCallback receives messages that are not
+// replies, and NULL once the session closes. Returns NULL on failure.
+ticketSession* ticketConnect(ticketClient* client, const char* ip, unsigned int port,
+    unsigned int timeoutRetrys, ticketCallback pushCallback, void* pushUserData)
+{
+    struct sockaddr_in servAddr;
+
+    memset(&servAddr, 0, sizeof(servAddr));
+    servAddr.sin_family = AF_INET;
+    servAddr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &servAddr.sin_addr) <= 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return _ticketConnectAddr(client, (struct sockaddr*)&servAddr, sizeof(servAddr),
+        timeoutRetrys, pushCallback, pushUserData);
+}
+
+// Same as ticketConnect(), but connects to a server on this machine
+// through the unix socket at path, which skips the TCP stack
+ticketSession* ticketConnectUnix(ticketClient* client, const char* path,
+    unsigned int timeoutRetrys, ticketCallback pushCallback, void* pushUserData)
+{
+    struct sockaddr_un servAddr;
+
+    memset(&servAddr, 0, sizeof(servAddr));
+    servAddr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(servAddr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(servAddr.sun_path, path);
+
+    return _ticketConnectAddr(client, (struct sockaddr*)&servAddr, sizeof(servAddr),
+        timeoutRetrys, pushCallback, pushUserData);
+}
+
+// Returns 1 while the session is connected to the server
+int ticketConnected(ticketSession* session)
+{
+    pthread_mutex_lock(&(session->mutex));
+    int connected = session->connected;
+    pthread_mutex_unlock(&(session->mutex));
+    return connected;
+}
+
+// Closes the session's connection. Pending requests fail and the
+// push callback receives NULL on the network thread.
+void ticketDisconnect(ticketSession* session)
+{
+    pthread_mutex_lock(&(session->mutex));
+    if (session->connected) shutdown(session->socket, SHUT_RDWR);
+    pthread_mutex_unlock(&(session->mutex));
+}
+
+// Disconnects the session and lets the network thread free it.
+// The session must not be used after this call.
+void ticketReleaseSession(ticketSession* session)
+{
+    pthread_mutex_lock(&(session->mutex));
+    session->released = 1;
+    if (session->connected) shutdown(session->socket, SHUT_RDWR);
+    pthread_mutex_unlock(&(session->mutex));
+
+    _ticketWake(session->client);
+}
+
+// Appends text to the session's send queue. Caller holds the session lock.
+int _ticketQueue(ticketSession* session, const char* text, int length)
+{
+    if (session->sendLen + length > session->sendCapacity)
+    {
+        int capacity = session->sendCapacity ? session->sendCapacity * 2 : TICKET_MSG_BUFFER_SIZE;
+        while (capacity < session->sendLen + length) capacity *= 2;
+
+        char* grown = realloc(session->sendBuffer, capacity);
+        if (grown == NULL) return 1;
+        session->sendBuffer = grown;
+        session->sendCapacity = capacity;
+    }
+
+    memcpy(session->sendBuffer + session->sendLen, text, length);
+    session->sendLen += length;
+    return 0;
+}
+
+// Queues a tagged request with numArgs integer arguments from args,
+// followed by requestId unless it is NULL. Returns the request tag,
+// or -1 if the session is closed or has too many requests in flight.
+int _ticketRequest(ticketSession* session, ticketCallback callback, void* userData,
+    const char* requestId, int msgId, int numArgs, const int* args)
+{
+    char text[TICKET_MSG_BUFFER_SIZE];
+
+    pthread_mutex_lock(&(session->mutex));
+
+    int tag = session->nextTag;
+    ticketPending* pending = &(session->pending[tag % TICKET_MAX_PENDING]);
+    if (!session->connected || pending->inUse)
+    {
+        pthread_mutex_unlock(&(session->mutex));
+        return -1;
+    }
+
+    int length = sprintf(text, "%c%d%s%d", NETWORK_MSG_TAG, tag, NETWORK_MSG_DELIM, msgId);
+    for (int i = 0; i < numArgs; i++)
+        length += sprintf(text + length, "%s%d", NETWORK_MSG_DELIM, args[i]);
+    if (requestId != NULL)
+        length += snprintf(text + length, sizeof(text) - length - 1, "%s%s", NETWORK_MSG_DELIM, requestId);
+    length += sprintf(text + length, "%s", NETWORK_MSG_END);
+
+    if (_ticketQueue(session, text, length))
+    {
+        pthread_mutex_unlock(&(session->mutex));
+        return -1;
+    }
+
+    pending->inUse = 1;
+    pending->tag = tag;
+    pending->callback = callback;
+    pending->userData = userData;
+    session->nextTag = (tag + 1) & 0x3fffffff;
+
+    // On shared memory the request goes straight into the channel,
+    // the network thread is only needed if it did not fit
+    int isShm = (session->shm.channel != NULL);
+    if (isShm) _ticketFlushShm(session);
+
+    pthread_mutex_unlock(&(session->mutex));
+
+    if (!isShm) _ticketWake(session->client);
+    return tag;
+}
+
+// Sends a request with numArgs integer arguments. callback runs on the
+// network thread when the tagged response arrives. Returns the request
+// tag, or -1 if the session is closed or has too many requests in flight.
+int ticketRequestAsync(ticketSession* session, ticketCallback callback, void* userData,
+    int msgId, int numArgs, ...)
+{
+    int args[MSG_MAX_ARGS];
+    va_list vargs;
+
+    if (numArgs > MSG_MAX_ARGS) return -1;
+
+    va_start(vargs, numArgs);
+    for (int i = 0; i < numArgs; i++) args[i] = va_arg(vargs, int);
+    va_end(vargs);
+
+    return _ticketRequest(session, callback, userData, NULL, msgId, numArgs, args);
+}
+
+// Sends a message that expects no reply, such as CLIENT_DISCONNECT.
+// Returns 0 if it was queued.
+int ticketSend(ticketSession* session, int msgId)
+{
+    char text[32];
+    int length = sprintf(text, "%d%s", msgId, NETWORK_MSG_END);
+
+    pthread_mutex_lock(&(session->mutex));
+    int err = !session->connected || _ticketQueue(session, text, length);
+    int isShm = (session->shm.channel != NULL);
+    if (!err && isShm) _ticketFlushShm(session);
+    pthread_mutex_unlock(&(session->mutex));
+
+    if (!err && !isShm) _ticketWake(session->client);
+    return err;
+}
+
+// Stops waiting for the request with the given tag. Returns 1 if it was
+// still pending, or 0 if its callback has already been taken.
+int ticketCancel(ticketSession* session, int tag)
+{
+    pthread_mutex_lock(&(session->mutex));
+
+    ticketPending* pending = &(session->pending[tag % TICKET_MAX_PENDING]);
+    int cancelled = pending->inUse && pending->tag == tag;
+    if (cancelled) pending->inUse = 0;
+
+    pthread_mutex_unlock(&(session->mutex));
+    return cancelled;
+}
+
+// Completes a future, called on the network thread
+void _ticketFutureCallback(ticketSession* session, const ticketResponse* response, void* _future)
+{
+    ticketFuture* future = (ticketFuture*)_future;
+
+    pthread_mutex_lock(&(future->mutex));
+
+    if (response == NULL)
+    {
+        future->closed = 1;
+    }
+    else
+    {
+        memcpy(future->text, response->text, response->length);
+        future->text[response->length] = '\0';
+        parseNetMsg(future->text, response->length, &(future->msg));
+    }
+
+    future->done = 1;
+    pthread_cond_signal(&(future->cond));
+    pthread_mutex_unlock(&(future->mutex));
+}
+
+// Sets up future and sends its request. Returns 0 if it was sent.
+int _ticketRequestFuture(ticketSession* session, ticketFuture* future,
+    const char* requestId, int msgId, int numArgs, const int* args)
+{
+    future->session = session;
+    future->done = 0;
+    future->closed = 0;
+    pthread_mutex_init(&(future->mutex), NULL);
+    pthread_cond_init(&(future->cond), NULL);
+
+    future->tag = _ticketRequest(session, _ticketFutureCallback, future,
+        requestId, msgId, numArgs, args);
+    if (future->tag < 0)
+    {
+        pthread_mutex_destroy(&(future->mutex));
+        pthread_cond_destroy(&(future->cond));
+        return 1;
+    }
+
+    return 0;
+}
+
+// Sends a request whose response is collected by ticketFutureWait().
+// Returns 0 if the request was sent.
+int ticketRequest(ticketSession* session, ticketFuture* future, int msgId, int numArgs, ...)
+{
+    int args[MSG_MAX_ARGS];
+    va_list vargs;
+
+    if (numArgs > MSG_MAX_ARGS) return 1;
+
+    va_start(vargs, numArgs);
+    for (int i = 0; i < numArgs; i++) args[i] = va_arg(vargs, int);
+    va_end(vargs);
+
+    return _ticketRequestFuture(session, future, NULL, msgId, numArgs, args);
+}
+
+// Like ticketRequest(), with requestId sent after the integer
+// arguments. The server answers a purchase sent again with the same
+// id with its first reply, so it can be retried after a timeout or a
+// reconnect without buying twice. Returns 0 if the request was sent.
+int ticketRequestWithId(ticketSession* session, ticketFuture* future, const char* requestId,
+    int msgId, int numArgs, ...)
+{
+    int args[MSG_MAX_ARGS];
+    va_list vargs;
+
+    if (numArgs > MSG_MAX_ARGS - 1) return 1;
+
+    va_start(vargs, numArgs);
+    for (int i = 0; i < numArgs; i++) args[i] = va_arg(vargs, int);
+    va_end(vargs);
+
+    return _ticketRequestFuture(session, future, requestId, msgId, numArgs, args);
+}
+
+// Blocks until the future's response arrives, the session closes, or
+// timeoutMs passes (0 waits forever). Returns TICKET_WAIT_OK with
+// future->msg set, TICKET_WAIT_CLOSED or TICKET_WAIT_TIMEOUT.
+// The future may be reused once this returns.
+int ticketFutureWait(ticketFuture* future, unsigned int timeoutMs)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&(future->mutex));
+
+    while (!future->done)
+    {
+        if (timeoutMs == 0)
+        {
+            pthread_cond_wait(&(future->cond), &(future->mutex));
+        }
+        else if (pthread_cond_timedwait(&(future->cond), &(future->mutex), &deadline) == ETIMEDOUT &&
+                 !future->done)
+        {
+            // If the callback is already running, wait for it to finish
+            // so it never touches the future after we return
+            if (!ticketCancel(future->session, future->tag))
+            {
+                timeoutMs = 0;
+                continue;
+            }
+
+            pthread_mutex_unlock(&(future->mutex));
+            pthread_mutex_destroy(&(future->mutex));
+            pthread_cond_destroy(&(future->cond));
+            return TICKET_WAIT_TIMEOUT;
+        }
+    }
+
+    int result = future->closed ? TICKET_WAIT_CLOSED : TICKET_WAIT_OK;
+
+    pthread_mutex_unlock(&(future->mutex));
+    pthread_mutex_destroy(&(future->mutex));
+    pthread_cond_destroy(&(future->cond));
+    return result;
+}
+
+// Moves a session connected with ticketConnectUnix() onto a shared
+// memory channel, so requests and replies no longer need system calls
+// while both sides are busy. Waits up to timeoutMs for the server.
+// Returns 0 on success, the session keeps using its socket otherwise.
+int ticketUseSharedMemory(ticketSession* session, unsigned int timeoutMs)
+{
+    ticketFuture future;
+
+    pthread_mutex_lock(&(session->mutex));
+    session->shmRequested = 1;
+    pthread_mutex_unlock(&(session->mutex));
+
+    int failed = ticketRequest(session, &future, CLIENT_SHM_ATTACH, 0) ||
+                 ticketFutureWait(&future, timeoutMs) != TICKET_WAIT_OK;
+
+    pthread_mutex_lock(&(session->mutex));
+    int attached = (session->shm.channel != NULL);
+    session->shmRequested = 0;
+    pthread_mutex_unlock(&(session->mutex));
+
+    return failed || !attached;
+}
+
+#endif
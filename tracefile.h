@@ -0,0 +1,361 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Binary traces of client traffic. A trace starts
+// with TRACE_MAGIC and the capture's start time,
+// followed by one record per event: the
+// microseconds since the previous record, the
+// connection id, the kind and length packed
+// together, each as a varint, then the message
+// bytes without their terminator. Most records
+// only add 3 or 4 bytes to the message.
+//
+// traceWriter buffers records in memory and a
+// thread of its own writes them out, so recording
+// never waits on the disk. When the disk falls too
+// far behind, records are dropped and counted.
+// ==============================
+
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define TRACE_MAGIC "TKTRACE1"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_HEADER_SIZE 16       // Magic, then the start time in ns since the epoch
+#define TRACE_BUFFER_SIZE (1 << 20) // Each of the two in memory buffers
+#define TRACE_MAX_MESSAGE 4096      // Longer messages are cut short
+#define TRACE_RECORD_OVERHEAD 15    // Most bytes the three varints take
+
+// Record kinds
+#define TRACE_CONNECT 0
+#define TRACE_MESSAGE 1
+#define TRACE_DISCONNECT 2
+
+typedef struct traceRecord_
+{
+    long long timeUs; // Since the capture started
+    unsigned int connId;
+    int kind;
+    int length;
+} traceRecord;
+
+typedef struct traceWriter_
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;  // Signaled when a buffer is worth writing, or to stop
+    pthread_t thread;
+    int active;           // Read without the mutex to skip recording quickly
+    int stopping;
+    int fd;
+    char* buffers[2];
+    int current;          // Buffer being filled, the other may be being written
+    int fill;
+    long long startNs;    // Monotonic clock when the capture started
+    long long lastUs;
+    unsigned long records;
+    unsigned long dropped;
+    unsigned long long bytesWritten;
+} traceWriter;
+
+typedef struct traceReader_
+{
+    FILE* file;
+    long long timeUs;
+    long long startEpochNs;
+} traceReader;
+
+// Returns the monotonic clock in nanoseconds
+long long _traceNowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Appends value as a varint, 7 bits per byte, low bits first.
+// Returns the bytes written.
+int _tracePutVarint(char* out, unsigned long long value)
+{
+    int length = 0;
+    while (value >= 0x80)
+    {
+        out[length++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (char)value;
+    return length;
+}
+
+// Writes all of buffer, retrying short writes. Returns 0 on success.
+int _traceWriteAll(int fd, const char* buffer, int length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, buffer, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 1;
+        buffer += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// Writes filled buffers out until the writer is stopped
+void* _runTraceWriter(void* _writer)
+{
+    traceWriter* writer = (traceWriter*)_writer;
+    int failed = 0;
+
+    pthread_mutex_lock(&(writer->mutex));
+
+    for (;;)
+    {
+        // Also write out a partly filled buffer every so often, so a
+        // quiet capture still reaches the disk
+        if (writer->fill == 0 && !writer->stopping)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            pthread_cond_timedwait(&(writer->cond), &(writer->mutex), &deadline);
+        }
+
+        if (writer->fill == 0 && writer->stopping) break;
+        if (writer->fill == 0) continue;
+
+        char* full = writer->buffers[writer->current];
+        int length = writer->fill;
+        writer->current ^= 1;
+        writer->fill = 0;
+
+        pthread_mutex_unlock(&(writer->mutex));
+        if (!failed && _traceWriteAll(writer->fd, full, length))
+        {
+            perror("Unable to write capture file");
+            failed = 1;
+        }
+        pthread_mutex_lock(&(writer->mutex));
+
+        if (!failed) writer->bytesWritten += length;
+    }
+
+    pthread_mutex_unlock(&(writer->mutex));
+    return NULL;
+}
+
+// Sets up a writer that is not recording yet
+void initTraceWriter(traceWriter* writer)
+{
+    pthread_mutex_init(&(writer->mutex), NULL);
+    pthread_cond_init(&(writer->cond), NULL);
+    writer->active = 0;
+    writer->buffers[0] = NULL;
+    writer->buffers[1] = NULL;
+    writer->records = 0;
+    writer->dropped = 0;
+    writer->bytesWritten = 0;
+}
+
+// Creates a trace at path and starts recording to it. The writer
+// must not be recording already. Returns 0 on success.
+int startTrace(traceWriter* writer, const char* path)
+{
+    char header[TRACE_HEADER_SIZE];
+    struct timespec now;
+
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer->fd < 0) return 1;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t startEpochNs = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    memcpy(header, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    memcpy(header + TRACE_MAGIC_SIZE, &startEpochNs, sizeof(startEpochNs));
+
+    writer->buffers[0] = malloc(TRACE_BUFFER_SIZE);
+    writer->buffers[1] = malloc(TRACE_BUFFER_SIZE);
+    if (writer->buffers[0] == NULL || writer->buffers[1] == NULL ||
+        _traceWriteAll(writer->fd, header, sizeof(header)))
+    {
+        free(writer->buffers[0]);
+        free(writer->buffers[1]);
+        writer->buffers[0] = NULL;
+        writer->buffers[1] = NULL;
+        close(writer->fd);
+        return 1;
+    }
+
+    pthread_mutex_lock(&(writer->mutex));
+    writer->current = 0;
+    writer->fill = 0;
+    writer->stopping = 0;
+    writer->startNs = _traceNowNs();
+    writer->lastUs = 0;
+    writer->records = 0;
+    writer->dropped = 0;
+    writer->bytesWritten = sizeof(header);
+    pthread_mutex_unlock(&(writer->mutex));
+
+    if (pthread_create(&(writer->thread), NULL, _runTraceWriter, writer))
+    {
+        free(writer->buffers[0]);
+        free(writer->buffers[1]);
+        writer->buffers[0] = NULL;
+        writer->buffers[1] = NULL;
+        close(writer->fd);
+        return 1;
+    }
+
+    __atomic_store_n(&(writer->active), 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Records one event for connection connId. Never blocks on the disk,
+// the record is dropped if the buffer is full. Is thread safe.
+void traceRecordEvent(traceWriter* writer, unsigned int connId, int kind, const char* data, int length)
+{
+    if (!__atomic_load_n(&(writer->active), __ATOMIC_ACQUIRE)) return;
+    if (length > TRACE_MAX_MESSAGE) length = TRACE_MAX_MESSAGE;
+
+    pthread_mutex_lock(&(writer->mutex));
+
+    if (!writer->active)
+    {
+        pthread_mutex_unlock(&(writer->mutex));
+        return;
+    }
+
+    if (writer->fill + TRACE_RECORD_OVERHEAD + length > TRACE_BUFFER_SIZE)
+    {
+        writer->dropped++;
+        pthread_cond_signal(&(writer->cond));
+        pthread_mutex_unlock(&(writer->mutex));
+        return;
+    }
+
+    // Taken under the mutex, so times never go backwards in the file
+    long long nowUs = (_traceNowNs() - writer->startNs) / 1000;
+    char* out = writer->buffers[writer->current] + writer->fill;
+    int used = _tracePutVarint(out, nowUs - writer->lastUs);
+    used += _tracePutVarint(out + used, connId);
+    used += _tracePutVarint(out + used, ((unsigned long long)length << 2) | kind);
+    if (length > 0) memcpy(out + used, data, length);
+
+    writer->fill += used + length;
+    writer->lastUs = nowUs;
+    writer->records++;
+
+    if (writer->fill >= TRACE_BUFFER_SIZE / 2) pthread_cond_signal(&(writer->cond));
+    pthread_mutex_unlock(&(writer->mutex));
+}
+
+// Writes out everything recorded so far and closes the trace. Does
+// nothing if the writer is not recording. Records and drops are kept
+// for the caller to report.
+void stopTrace(traceWriter* writer)
+{
+    if (!__atomic_load_n(&(writer->active), __ATOMIC_ACQUIRE)) return;
+
+    pthread_mutex_lock(&(writer->mutex));
+    writer->active = 0;
+    writer->stopping = 1;
+    pthread_cond_signal(&(writer->cond));
+    pthread_mutex_unlock(&(writer->mutex));
+
+    pthread_join(writer->thread, NULL);
+    close(writer->fd);
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    writer->buffers[0] = NULL;
+    writer->buffers[1] = NULL;
+}
+
+// Returns 1 if the writer is recording
+int traceActive(traceWriter* writer)
+{
+    return __atomic_load_n(&(writer->active), __ATOMIC_ACQUIRE);
+}
+
+// Reads a varint. Returns 0 on success, 1 at the end of the file.
+int _traceGetVarint(FILE* file, unsigned long long* value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = fgetc(file);
+        if (byte == EOF) return 1;
+        *value |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return 1;
+}
+
+// Opens a trace for reading. Returns 0 on success.
+int openTrace(traceReader* reader, const char* path)
+{
+    char header[TRACE_HEADER_SIZE];
+    uint64_t startEpochNs;
+
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) return 1;
+
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header) ||
+        memcmp(header, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0)
+    {
+        fclose(reader->file);
+        errno = EINVAL;
+        return 1;
+    }
+
+    memcpy(&startEpochNs, header + TRACE_MAGIC_SIZE, sizeof(startEpochNs));
+    reader->startEpochNs = startEpochNs;
+    reader->timeUs = 0;
+    return 0;
+}
+
+// Reads the next record and its message into data, which must hold
+// TRACE_MAX_MESSAGE bytes. Returns 1 on success, 0 at the end of the
+// trace, or -1 if the trace is damaged or cut short.
+int readTraceRecord(traceReader* reader, traceRecord* record, char* data)
+{
+    unsigned long long deltaUs, connId, kindLength;
+
+    if (_traceGetVarint(reader->file, &deltaUs)) return feof(reader->file) ? 0 : -1;
+    if (_traceGetVarint(reader->file, &connId) || _traceGetVarint(reader->file, &kindLength)) return -1;
+
+    // Checked before narrowing, a huge length would wrap negative
+    if ((kindLength >> 2) > TRACE_MAX_MESSAGE) return -1;
+    record->length = (int)(kindLength >> 2);
+    record->kind = (int)(kindLength & 3);
+    if (record->kind > TRACE_DISCONNECT) return -1;
+    if (record->length > 0 && fread(data, 1, record->length, reader->file) != (size_t)record->length) return -1;
+
+    reader->timeUs += deltaUs;
+    record->timeUs = reader->timeUs;
+    record->connId = (unsigned int)connId;
+    return 1;
+}
+
+// Closes a trace opened with openTrace()
+void closeTrace(traceReader* reader)
+{
+    fclose(reader->file);
+    reader->file = NULL;
+}
+
+#endif
@@ -0,0 +1,312 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// Minimal io_uring wrapper built on the raw system
+// calls, so liburing is not needed. Covers what the
+// server's io_uring engine uses: multishot accept and
+// recv, provided buffer rings and batched sends.
+// Requires Linux 6.0 or newer.
+// ==============================
+
+#ifndef URINGENGINE_H
+#define URINGENGINE_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+
+// Submission and completion queues of one ring
+typedef struct uring_
+{
+    int fd;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned sqEntries;
+    unsigned sqLocalTail; // SQEs handed out but not submitted yet
+    struct io_uring_sqe* sqes;
+
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+} uring;
+
+// Provided buffer ring. The kernel picks a free buffer for
+// each completed recv and reports its id in the CQE flags.
+typedef struct uringBufRing_
+{
+    struct io_uring_buf_ring* ring;
+    char* buffers;
+    unsigned numBufs; // Power of 2
+    unsigned bufSize;
+    unsigned short group;
+    size_t ringSize;
+} uringBufRing;
+
+// Creates a ring with room for entries SQEs. Returns 0 on success.
+int uringInit(uring* ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(uring));
+
+    // Only one thread submits, and completions are reaped when it
+    // enters the kernel, which saves interrupts and wakeups
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    params.flags |= IORING_SETUP_CQSIZE;
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return 1;
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+    {
+        close(ring->fd);
+        return 1;
+    }
+
+    // One mapping holds both the SQ and CQ rings
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        if (ring->sqRing != MAP_FAILED) munmap(ring->sqRing, ring->sqRingSize);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqesSize);
+        close(ring->fd);
+        return 1;
+    }
+
+    ring->cqRing = ring->sqRing;
+    ring->cqRingSize = 0; // Shares the SQ mapping
+
+    char* sq = ring->sqRing;
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->sqEntries = params.sq_entries;
+    ring->sqLocalTail = *(ring->sqTail);
+
+    char* cq = ring->cqRing;
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+// Unmaps and closes the ring
+void uringFree(uring* ring)
+{
+    munmap(ring->sqes, ring->sqesSize);
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+// Submits every prepared SQE and waits for at least waitFor
+// completions. Returns the number submitted, or -1 on error.
+int uringSubmit(uring* ring, unsigned waitFor)
+{
+    unsigned toSubmit = ring->sqLocalTail - *(ring->sqTail);
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+
+    unsigned flags = waitFor ? IORING_ENTER_GETEVENTS : 0;
+    if (toSubmit == 0 && waitFor == 0) return 0;
+
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, toSubmit, waitFor, flags, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+// Returns a zeroed SQE to fill in, submitting queued ones first
+// if the submission queue is full
+struct io_uring_sqe* uringGetSqe(uring* ring)
+{
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (ring->sqLocalTail - head >= ring->sqEntries)
+    {
+        uringSubmit(ring, 0);
+        head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if (ring->sqLocalTail - head >= ring->sqEntries) return NULL;
+    }
+
+    unsigned index = ring->sqLocalTail & *(ring->sqMask);
+    ring->sqArray[index] = index;
+    ring->sqLocalTail++;
+
+    struct io_uring_sqe* sqe = &(ring->sqes[index]);
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Returns the next completion, or NULL if there is none
+struct io_uring_cqe* uringPeekCqe(uring* ring)
+{
+    unsigned head = *(ring->cqHead);
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) return NULL;
+    return &(ring->cqes[head & *(ring->cqMask)]);
+}
+
+// Releases the completion returned by uringPeekCqe()
+void uringCqeSeen(uring* ring)
+{
+    __atomic_store_n(ring->cqHead, *(ring->cqHead) + 1, __ATOMIC_RELEASE);
+}
+
+// Accepts connections on listenFd until cancelled or an error occurs
+void uringPrepAcceptMultishot(struct io_uring_sqe* sqe, int listenFd, uint64_t userData)
+{
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = userData;
+}
+
+// Receives into buffers from the given buffer group until the
+// socket closes, an error occurs or the group runs out of buffers
+void uringPrepRecvMultishot(struct io_uring_sqe* sqe, int socket, unsigned short group, uint64_t userData)
+{
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = userData;
+}
+
+// Sends length bytes from data, which must stay valid until completion
+void uringPrepSend(struct io_uring_sqe* sqe, int socket, const void* data, unsigned length, uint64_t userData)
+{
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = socket;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = length;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData;
+}
+
+// Reads length bytes from fd into data, used to wait on an eventfd
+void uringPrepRead(struct io_uring_sqe* sqe, int fd, void* data, unsigned length, uint64_t userData)
+{
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = length;
+    sqe->off = (uint64_t)-1; // Current position, eventfds are not seekable
+    sqe->user_data = userData;
+}
+
+// Completes once the relative time in ts passes, used to bound a wait.
+// ts must stay valid until the SQE is submitted.
+void uringPrepTimeout(struct io_uring_sqe* sqe, struct __kernel_timespec* ts, uint64_t userData)
+{
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)ts;
+    sqe->len = 1;
+    sqe->user_data = userData;
+}
+
+// Hands buffer bid back to the kernel
+void uringRecycleBuf(uringBufRing* bufRing, unsigned short bid)
+{
+    unsigned short tail = bufRing->ring->tail;
+    struct io_uring_buf* buf = &(bufRing->ring->bufs[tail & (bufRing->numBufs - 1)]);
+
+    buf->addr = (uint64_t)(uintptr_t)(bufRing->buffers + (size_t)bid * bufRing->bufSize);
+    buf->len = bufRing->bufSize;
+    buf->bid = bid;
+
+    __atomic_store_n(&(bufRing->ring->tail), tail + 1, __ATOMIC_RELEASE);
+}
+
+// Returns the data of buffer bid
+char* uringBufData(uringBufRing* bufRing, unsigned short bid)
+{
+    return bufRing->buffers + (size_t)bid * bufRing->bufSize;
+}
+
+// Allocates numBufs buffers of bufSize bytes and registers them as
+// buffer group group. numBufs must be a power of 2 no larger than
+// 32768. Returns 0 on success.
+int uringSetupBufRing(uring* ring, uringBufRing* bufRing, unsigned short group, unsigned numBufs, unsigned bufSize)
+{
+    bufRing->numBufs = numBufs;
+    bufRing->bufSize = bufSize;
+    bufRing->group = group;
+    bufRing->ringSize = numBufs * sizeof(struct io_uring_buf);
+
+    // The ring must be page aligned
+    bufRing->ring = mmap(NULL, bufRing->ringSize, PROT_READ | PROT_WRITE,
+        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (bufRing->ring == MAP_FAILED) return 1;
+
+    bufRing->buffers = malloc((size_t)numBufs * bufSize);
+    if (bufRing->buffers == NULL)
+    {
+        munmap(bufRing->ring, bufRing->ringSize);
+        return 1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)bufRing->ring;
+    reg.ring_entries = numBufs;
+    reg.bgid = group;
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        free(bufRing->buffers);
+        munmap(bufRing->ring, bufRing->ringSize);
+        return 1;
+    }
+
+    bufRing->ring->tail = 0;
+    for (unsigned i = 0; i < numBufs; i++)
+        uringRecycleBuf(bufRing, i);
+
+    return 0;
+}
+
+// Frees the buffers. The ring they were registered with must be freed first.
+void uringFreeBufRing(uringBufRing* bufRing)
+{
+    free(bufRing->buffers);
+    munmap(bufRing->ring, bufRing->ringSize);
+}
+
+#endif
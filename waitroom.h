@@ -0,0 +1,162 @@
+// ==============================
+// School: Central Washington University
+// Course: CS470 Operating Systems
+// Instructor: Dr. Szilárd VAJDA
+// Student: Andrew Dunn
+// Assignment: Lab 3
+// Description: Example program demonstrating
+// multi theading and sockets from the server side
+// ==============================
+// First in first out line of connections waiting
+// for a client slot. A waiting connection is only
+// its socket and the time it joined, kept in a
+// fixed size ring, so thousands of them cost no
+// threads or buffers. Thread safe.
+// ==============================
+
+#ifndef WAITROOM_H
+#define WAITROOM_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct waitingClient_
+{
+    int socket;
+    long long joinedMs;
+} waitingClient;
+
+// Decides whether a waiting client stays in line, given its position
+// counting from 1. Returns 0 to take it out of the line.
+typedef int (*waitingVisitFunc)(waitingClient* client, int position, void* userData);
+
+typedef struct waitingRoom_
+{
+    waitingClient* line;
+    int capacity; // 0 = no waiting room
+    int head;
+    int length;
+    unsigned long admitted; // Clients that left the line for a slot
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;    // Signaled when a slot may have opened
+} waitingRoom;
+
+// Sets up a room for up to capacity clients. Returns 0 on success.
+int initWaitingRoom(waitingRoom* room, int capacity)
+{
+    room->line = NULL;
+    room->capacity = capacity;
+    room->head = 0;
+    room->length = 0;
+    room->admitted = 0;
+    pthread_mutex_init(&(room->mutex), NULL);
+    pthread_cond_init(&(room->cond), NULL);
+
+    if (capacity == 0) return 0;
+    room->line = malloc(sizeof(waitingClient) * capacity);
+    return room->line == NULL;
+}
+
+// Adds a client to the back of the line. Returns its position,
+// or 0 if the room is full or disabled.
+int joinWaitingRoom(waitingRoom* room, int socket, long long nowMs)
+{
+    pthread_mutex_lock(&(room->mutex));
+
+    int position = 0;
+    if (room->length < room->capacity)
+    {
+        waitingClient* client = &(room->line[(room->head + room->length) % room->capacity]);
+        client->socket = socket;
+        client->joinedMs = nowMs;
+        position = ++room->length;
+    }
+
+    pthread_mutex_unlock(&(room->mutex));
+    return position;
+}
+
+// Takes the client at the front of the line. Returns 1 if there was one.
+int leaveWaitingRoom(waitingRoom* room, waitingClient* client)
+{
+    pthread_mutex_lock(&(room->mutex));
+
+    int found = (room->length > 0);
+    if (found)
+    {
+        *client = room->line[room->head];
+        room->head = (room->head + 1) % room->capacity;
+        room->length--;
+        room->admitted++;
+    }
+
+    pthread_mutex_unlock(&(room->mutex));
+    return found;
+}
+
+// Puts a client from leaveWaitingRoom() back at the front, for when
+// its slot was taken after all. Returns 0 if the room filled up
+// meanwhile and the client was not put back.
+int rejoinWaitingRoom(waitingRoom* room, const waitingClient* client)
+{
+    pthread_mutex_lock(&(room->mutex));
+
+    int rejoined = (room->length < room->capacity);
+    if (rejoined)
+    {
+        room->head = (room->head + room->capacity - 1) % room->capacity;
+        room->line[room->head] = *client;
+        room->length++;
+        room->admitted--;
+    }
+
+    pthread_mutex_unlock(&(room->mutex));
+    return rejoined;
+}
+
+// Returns the number of clients in line
+int waitingRoomLength(waitingRoom* room)
+{
+    if (room->capacity == 0) return 0;
+
+    pthread_mutex_lock(&(room->mutex));
+    int length = room->length;
+    pthread_mutex_unlock(&(room->mutex));
+    return length;
+}
+
+// Calls visit for every client from the front of the line and
+// closes the gaps left by the ones it removes. visit runs with the
+// room locked and must not block.
+void visitWaitingRoom(waitingRoom* room, waitingVisitFunc visit, void* userData)
+{
+    pthread_mutex_lock(&(room->mutex));
+
+    int kept = 0;
+    for (int i = 0; i < room->length; i++)
+    {
+        waitingClient client = room->line[(room->head + i) % room->capacity];
+        if (visit(&client, kept + 1, userData))
+            room->line[(room->head + kept++) % room->capacity] = client;
+    }
+    room->length = kept;
+
+    pthread_mutex_unlock(&(room->mutex));
+}
+
+// Wakes whoever waits on the room's condition
+void signalWaitingRoom(waitingRoom* room)
+{
+    pthread_cond_signal(&(room->cond));
+}
+
+// Frees the line, any sockets still in it must be closed first
+void freeWaitingRoom(waitingRoom* room)
+{
+    free(room->line);
+    room->line = NULL;
+    room->capacity = 0;
+    room->length = 0;
+}
+
+#endif